@@ -30,6 +30,7 @@
 #include <linux/syscore_ops.h>
 #include <linux/reboot.h>
 #include <linux/security.h>
+#include <linux/initrd.h>
 
 #include <generated/utsrelease.h>
 
@@ -333,6 +334,7 @@ fw_get_filesystem_firmware(struct device *device, struct firmware_buf *buf)
 		msize = buf->allocated_size;
 	}
 
+	wait_for_initramfs();
 	path = __getname();
 	if (!path)
 		return -ENOMEM;
@@ -18,6 +18,7 @@
 #include <linux/cputime.h>
 #include <linux/hashtable.h>
 #include <linux/init.h>
+#include <linux/percpu.h>
 #include <linux/proc_fs.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
@@ -27,6 +28,7 @@
 #include <linux/uaccess.h>
 
 #define UID_HASH_BITS 10
+#define UID_DELTA_SLOTS 8
 
 static DECLARE_HASHTABLE(uid_hash_table, UID_HASH_BITS);
 
@@ -47,6 +49,7 @@ struct concurrent_times {
 struct uid_entry {
 	uid_t uid;
 	unsigned int max_state;
+	u64 gen;
 	struct hlist_node hash;
 	struct rcu_head rcu;
 	struct concurrent_times *concurrent_times;
@@ -69,6 +72,32 @@ struct cpu_freqs {
 
 static struct cpu_freqs *all_freqs[NR_CPUS];
 
+/*
+ * Time accounted on a cpu to a uid/frequency pair which has not been
+ * added to the uid_entry yet. The tick only takes the lock of its own
+ * cpu's cache; the caches are folded into uid_hash_table when one fills
+ * up and before the uid stats are read.
+ */
+struct uid_delta {
+	uid_t uid;
+	unsigned int state;
+	cputime_t time;
+};
+
+struct uid_delta_cache {
+	spinlock_t lock;
+	unsigned int nr;
+	struct uid_delta deltas[UID_DELTA_SLOTS];
+};
+
+static DEFINE_PER_CPU(struct uid_delta_cache, uid_delta_cache);
+
+/*
+ * Bumped, under uid_lock, every time the caches are folded. A uid_entry's
+ * gen is the generation in which its times last changed.
+ */
+static u64 uid_gen = 1;
+
 static unsigned int next_offset;
 
 /* uid_cpupower_enable is used to enable/disable concurrent_*_time. This
@@ -166,6 +195,79 @@ static struct uid_entry *find_or_register_uid_locked(uid_t uid)
 	return uid_entry;
 }
 
+/* Caller must hold cache->lock and uid_lock */
+static void uid_delta_flush_locked(struct uid_delta_cache *cache)
+{
+	struct uid_entry *uid_entry;
+	struct uid_delta *delta;
+	unsigned int i;
+
+	for (i = 0; i < cache->nr; i++) {
+		delta = &cache->deltas[i];
+		uid_entry = find_or_register_uid_locked(delta->uid);
+		if (uid_entry && delta->state < uid_entry->max_state) {
+			uid_entry->time_in_state[delta->state] += delta->time;
+			uid_entry->gen = uid_gen;
+		}
+	}
+	cache->nr = 0;
+}
+
+/*
+ * Fold the pending times of all cpus into uid_hash_table and start a new
+ * generation. Returns the generation that was just completed: every
+ * uid_entry changed so far has a gen no larger than it.
+ */
+static u64 uid_delta_flush_all(void)
+{
+	struct uid_delta_cache *cache;
+	unsigned long flags;
+	u64 gen;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(&uid_delta_cache, cpu);
+		spin_lock_irqsave(&cache->lock, flags);
+		if (cache->nr) {
+			spin_lock(&uid_lock);
+			uid_delta_flush_locked(cache);
+			spin_unlock(&uid_lock);
+		}
+		spin_unlock_irqrestore(&cache->lock, flags);
+	}
+
+	spin_lock_irqsave(&uid_lock, flags);
+	gen = uid_gen++;
+	spin_unlock_irqrestore(&uid_lock, flags);
+
+	return gen;
+}
+
+/* Caller must hold cache->lock. Returns false when the cache is full. */
+static bool uid_delta_add_locked(struct uid_delta_cache *cache, uid_t uid,
+				 unsigned int state, cputime_t time)
+{
+	struct uid_delta *delta;
+	unsigned int i;
+
+	for (i = 0; i < cache->nr; i++) {
+		delta = &cache->deltas[i];
+		if (delta->uid == uid && delta->state == state) {
+			delta->time += time;
+			return true;
+		}
+	}
+
+	if (cache->nr == UID_DELTA_SLOTS)
+		return false;
+
+	delta = &cache->deltas[cache->nr++];
+	delta->uid = uid;
+	delta->state = state;
+	delta->time = time;
+	return true;
+}
+
 static int single_uid_time_in_state_show(struct seq_file *m, void *ptr)
 {
 	struct uid_entry *uid_entry;
@@ -175,6 +277,8 @@ static int single_uid_time_in_state_show(struct seq_file *m, void *ptr)
 	if (uid == overflowuid)
 		return -EINVAL;
 
+	uid_delta_flush_all();
+
 	rcu_read_lock();
 
 	uid_entry = find_uid_entry_rcu(uid);
@@ -198,6 +302,9 @@ static void *uid_seq_start(struct seq_file *seq, loff_t *pos)
 	if (*pos >= HASH_SIZE(uid_hash_table))
 		return NULL;
 
+	if (!*pos)
+		uid_delta_flush_all();
+
 	return &uid_hash_table[*pos];
 }
 
@@ -306,6 +413,93 @@ static int time_in_state_seq_show(struct seq_file *m, void *v)
 	return 0;
 }
 
+/*
+ * time_in_state_bulk is a header followed by fixed size records, all in
+ * native byte order:
+ * struct { u64 cookie; u32 nr_freqs; u32 record_size; }
+ * struct { u32 uid; u32 reserved; u64 time[nr_freqs]; } for every uid
+ * where times are in clock_t and nr_freqs is the total number of
+ * frequencies. Writing the u64 cookie of an earlier read to the file
+ * before reading it again from the start limits the records to the uids
+ * whose times changed since that read. The cookie only applies to the open
+ * file it was written to, so the file is writable by every reader.
+ */
+struct uid_bulk_iter {
+	u64 since;
+	u64 gen;
+	u32 nr_freqs;
+};
+
+static void *uid_bulk_seq_start(struct seq_file *m, loff_t *pos)
+{
+	struct uid_bulk_iter *iter = m->private;
+
+	if (*pos >= HASH_SIZE(uid_hash_table))
+		return NULL;
+
+	if (!*pos) {
+		iter->gen = uid_delta_flush_all();
+		iter->nr_freqs = READ_ONCE(next_offset);
+	}
+
+	return &uid_hash_table[*pos];
+}
+
+static int uid_bulk_seq_show(struct seq_file *m, void *v)
+{
+	struct uid_bulk_iter *iter = m->private;
+	struct uid_entry *uid_entry;
+	u32 rec[2] = { 0, 0 };
+	u64 time;
+	int i;
+
+	if (v == uid_hash_table) {
+		u32 hdr[2] = { iter->nr_freqs,
+			       sizeof(rec) + iter->nr_freqs * sizeof(time) };
+
+		seq_write(m, &iter->gen, sizeof(iter->gen));
+		seq_write(m, hdr, sizeof(hdr));
+	}
+
+	rcu_read_lock();
+
+	hlist_for_each_entry_rcu(uid_entry, (struct hlist_head *)v, hash) {
+		if (READ_ONCE(uid_entry->gen) <= iter->since)
+			continue;
+
+		rec[0] = (u32)uid_entry->uid;
+		seq_write(m, rec, sizeof(rec));
+
+		for (i = 0; i < iter->nr_freqs; ++i) {
+			time = 0;
+			if (i < uid_entry->max_state)
+				time = cputime_to_clock_t(
+					uid_entry->time_in_state[i]);
+			seq_write(m, &time, sizeof(time));
+		}
+	}
+
+	rcu_read_unlock();
+	return 0;
+}
+
+static ssize_t uid_bulk_write(struct file *file, const char __user *buffer,
+			      size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct uid_bulk_iter *iter = m->private;
+	u64 since;
+
+	if (count != sizeof(since))
+		return -EINVAL;
+
+	if (copy_from_user(&since, buffer, sizeof(since)))
+		return -EFAULT;
+
+	iter->since = since;
+	return count;
+}
+
 /*
  * concurrent_active_time is an array of u32's in the following format:
  * [n, uid0, time0a, time0b, ..., time0n,
@@ -700,8 +894,10 @@ void cpufreq_acct_update_power(struct task_struct *p, cputime_t cputime)
 	unsigned int policy_cpu_cnt = 0;
 	unsigned int policy_first_cpu;
 	struct uid_entry *uid_entry;
+	struct uid_delta_cache *cache;
 	struct cpu_freqs *freqs = all_freqs[task_cpu(p)];
 	struct cpufreq_policy *policy;
+	bool cached;
 	uid_t uid = from_kuid_munged(current_user_ns(), task_uid(p));
 	int cpu = 0;
 
@@ -716,11 +912,38 @@ void cpufreq_acct_update_power(struct task_struct *p, cputime_t cputime)
 		p->time_in_state[state] += cputime;
 	spin_unlock_irqrestore(&task_time_in_state_lock, flags);
 
-	spin_lock_irqsave(&uid_lock, flags);
-	uid_entry = find_or_register_uid_locked(uid);
-	if (uid_entry && state < uid_entry->max_state)
-		uid_entry->time_in_state[state] += cputime;
-	spin_unlock_irqrestore(&uid_lock, flags);
+	/*
+	 * A uid which is seen for the first time, or whose uid_entry is too
+	 * small for a new policy, is registered right away so that the
+	 * concurrent times below find it. Anything else goes to this cpu's
+	 * cache.
+	 */
+	rcu_read_lock();
+	uid_entry = find_uid_entry_rcu(uid);
+	cached = uid_entry && state < uid_entry->max_state;
+	rcu_read_unlock();
+
+	if (cached) {
+		local_irq_save(flags);
+		cache = this_cpu_ptr(&uid_delta_cache);
+		spin_lock(&cache->lock);
+		if (!uid_delta_add_locked(cache, uid, state, cputime)) {
+			spin_lock(&uid_lock);
+			uid_delta_flush_locked(cache);
+			spin_unlock(&uid_lock);
+			uid_delta_add_locked(cache, uid, state, cputime);
+		}
+		spin_unlock(&cache->lock);
+		local_irq_restore(flags);
+	} else {
+		spin_lock_irqsave(&uid_lock, flags);
+		uid_entry = find_or_register_uid_locked(uid);
+		if (uid_entry && state < uid_entry->max_state) {
+			uid_entry->time_in_state[state] += cputime;
+			uid_entry->gen = uid_gen;
+		}
+		spin_unlock_irqrestore(&uid_lock, flags);
+	}
 
 	if (!uid_cpupower_enable)
 		return;
@@ -838,6 +1061,9 @@ void cpufreq_task_times_remove_uids(uid_t uid_start, uid_t uid_end)
 	struct hlist_node *tmp;
 	unsigned long flags;
 
+	/* Pending times would register the uids again */
+	uid_delta_flush_all();
+
 	spin_lock_irqsave(&uid_lock, flags);
 
 	for (; uid_start <= uid_end; uid_start++) {
@@ -910,6 +1136,27 @@ const struct file_operations time_in_state_fops = {
 	.release	= seq_release,
 };
 
+static const struct seq_operations uid_bulk_seq_ops = {
+	.start = uid_bulk_seq_start,
+	.next = uid_seq_next,
+	.stop = uid_seq_stop,
+	.show = uid_bulk_seq_show,
+};
+
+static int uid_bulk_open(struct inode *inode, struct file *file)
+{
+	return seq_open_private(file, &uid_bulk_seq_ops,
+				sizeof(struct uid_bulk_iter));
+}
+
+static const struct file_operations uid_bulk_fops = {
+	.open		= uid_bulk_open,
+	.read		= seq_read,
+	.write		= uid_bulk_write,
+	.llseek		= seq_lseek,
+	.release	= seq_release_private,
+};
+
 static const struct seq_operations concurrent_active_time_seq_ops = {
 	.start = uid_seq_start,
 	.next = uid_seq_next,
@@ -1003,6 +1250,10 @@ static const struct file_operations uid_cpupower_enable_fops = {
 static int __init cpufreq_times_init(void)
 {
 	struct proc_dir_entry *uid_cpupower;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu(uid_delta_cache, cpu).lock);
 
 	proc_create_data("uid_time_in_state", 0444, NULL,
 			 &uid_time_in_state_fops, NULL);
@@ -1024,6 +1275,9 @@ static int __init cpufreq_times_init(void)
 		proc_create_data("time_in_state", 0444, uid_cpupower,
 				 &time_in_state_fops, NULL);
 
+		proc_create_data("time_in_state_bulk", 0666, uid_cpupower,
+				 &uid_bulk_fops, NULL);
+
 		proc_create_data("concurrent_active_time", 0444, uid_cpupower,
 				 &concurrent_active_time_fops, NULL);
 
@@ -236,12 +236,41 @@ int cpuidle_enter_state(struct cpuidle_device *dev, struct cpuidle_driver *drv,
 	dev->last_residency = (int) diff;
 
 	if (entered_state >= 0) {
+		s64 delay = drv->states[entered_state].exit_latency;
+		int i;
+
 		/* Update cpuidle counters */
 		/* This can be moved to within driver enter routine
 		 * but that results in multiple copies of same code.
 		 */
 		dev->states_usage[entered_state].time += dev->last_residency;
 		dev->states_usage[entered_state].usage++;
+
+		/*
+		 * The state was too deep if the CPU did not stay in it for
+		 * its target residency while a shallower one was enabled,
+		 * and too shallow if an enabled deeper one would have fit.
+		 */
+		if (diff < drv->states[entered_state].target_residency) {
+			for (i = entered_state - 1; i >= 0; i--) {
+				if (drv->states[i].disabled ||
+				    dev->states_usage[i].disable)
+					continue;
+
+				dev->states_usage[entered_state].above++;
+				break;
+			}
+		} else if (diff > delay) {
+			for (i = entered_state + 1; i < drv->state_count; i++) {
+				if (drv->states[i].disabled ||
+				    dev->states_usage[i].disable)
+					continue;
+
+				if (diff - delay >= drv->states[i].target_residency)
+					dev->states_usage[entered_state].below++;
+				break;
+			}
+		}
 	} else {
 		dev->last_residency = 0;
 	}
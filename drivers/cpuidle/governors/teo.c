@@ -0,0 +1,403 @@
+/*
+ * teo.c - the timer events oriented idle governor
+ *
+ * This code is licenced under the GPL version 2 as described
+ * in the COPYING file that acompanies the Linux Kernel.
+ */
+
+#include <linux/kernel.h>
+#include <linux/cpuidle.h>
+#include <linux/jiffies.h>
+#include <linux/pm_qos.h>
+#include <linux/ktime.h>
+#include <linux/tick.h>
+#include <linux/sched.h>
+#include <linux/math64.h>
+
+/*
+ * Concepts and ideas behind the TEO governor
+ *
+ * Most wakeups of an idle CPU on a phone are timer events, and for those
+ * the time till the next timer, the "sleep length", is exact. The menu
+ * governor scales the sleep length by a running correction factor, which
+ * on a mix of timer wakeups and early interrupt wakeups ends up
+ * predicting idle periods that are too short for either, and then picks
+ * a shallow state.
+ *
+ * TEO instead keeps the sleep length as is and only asks how often the
+ * CPU did not make it that far. For every idle state it keeps three
+ * decaying metrics:
+ *
+ * hits		The sleep length fell into the state's range (its target
+ *		residency up to the next state's) and the CPU was indeed
+ *		idle long enough for the state.
+ * misses	The sleep length fell into the state's range, but the CPU
+ *		woke up too early for the state.
+ * early_hits	The CPU woke up early, and the measured idle duration
+ *		fell into the state's range.
+ *
+ * The state matching the sleep length is selected if its hits outweigh
+ * its misses. Otherwise the shallower state with the most early hits,
+ * which is where the early wakeups usually end up, is selected instead.
+ *
+ * On top of that the durations of the most recent early wakeups are
+ * kept; if most of them are shorter than the selected state's target
+ * residency, a state matching their average is used.
+ */
+
+#define PULSE		1024
+#define DECAY_SHIFT	3
+
+/* Number of the most recent idle duration values to take into account */
+#define INTERVALS	8
+
+/* Length of a tick period */
+#define TEO_TICK_USEC	(USEC_PER_SEC / HZ)
+
+/**
+ * struct teo_idle_state - idle state data used by the TEO governor
+ * @early_hits: "early" CPU wakeups "matching" this state
+ * @hits: "on time" CPU wakeups "matching" this state
+ * @misses: CPU wakeups "missing" this state
+ */
+struct teo_idle_state {
+	unsigned int early_hits;
+	unsigned int hits;
+	unsigned int misses;
+};
+
+/**
+ * struct teo_cpu - CPU data used by the TEO governor
+ * @sleep_length_us: time till the closest timer event at selection time
+ * @last_state: idle state entered last time, or -1 after an update
+ * @interval_idx: index of the most recent saved idle interval
+ * @states: idle states data corresponding to this CPU
+ * @intervals: saved idle duration values
+ */
+struct teo_cpu {
+	unsigned int sleep_length_us;
+	int last_state;
+	int interval_idx;
+	struct teo_idle_state states[CPUIDLE_STATE_MAX];
+	unsigned int intervals[INTERVALS];
+};
+
+static DEFINE_PER_CPU(struct teo_cpu, teo_cpus);
+
+/**
+ * teo_update - update CPU data after wakeup
+ * @drv: cpuidle driver containing state data
+ * @dev: target CPU
+ */
+static void teo_update(struct cpuidle_driver *drv, struct cpuidle_device *dev)
+{
+	struct teo_cpu *cpu_data = this_cpu_ptr(&teo_cpus);
+	unsigned int sleep_length_us = cpu_data->sleep_length_us;
+	unsigned int lat, measured_us;
+	int i, idx_hit = -1, idx_timer = -1;
+
+	/*
+	 * The measured residency includes the exit latency, but the wakeup
+	 * event happened before that. If the measurement is shorter than
+	 * the latency, assume the state was not really reached.
+	 */
+	measured_us = cpuidle_get_last_residency(dev);
+	lat = drv->states[cpu_data->last_state].exit_latency;
+	if (measured_us > 2 * lat)
+		measured_us -= lat;
+	else
+		measured_us /= 2;
+
+	/*
+	 * A wakeup at or past the sleep length was the timer: the CPU was
+	 * idle as long as it could have been.
+	 */
+	if (measured_us >= sleep_length_us)
+		measured_us = UINT_MAX;
+
+	/*
+	 * Decay the "early hits" metric for all of the states and find the
+	 * states matching the sleep length and the measured idle duration.
+	 */
+	for (i = 0; i < drv->state_count; i++) {
+		unsigned int early_hits = cpu_data->states[i].early_hits;
+
+		cpu_data->states[i].early_hits -= early_hits >> DECAY_SHIFT;
+
+		if (drv->states[i].target_residency <= sleep_length_us) {
+			idx_timer = i;
+			if (drv->states[i].target_residency <= measured_us)
+				idx_hit = i;
+		}
+	}
+
+	/*
+	 * Update the "hits" and "misses" data for the state matching the
+	 * sleep length. If the measured idle duration matches it too, this
+	 * is a hit, otherwise it is a miss and the state matching the
+	 * measured idle duration gets an early hit.
+	 */
+	if (idx_timer >= 0) {
+		unsigned int hits = cpu_data->states[idx_timer].hits;
+		unsigned int misses = cpu_data->states[idx_timer].misses;
+
+		hits -= hits >> DECAY_SHIFT;
+		misses -= misses >> DECAY_SHIFT;
+
+		if (idx_timer > idx_hit) {
+			misses += PULSE;
+			if (idx_hit >= 0)
+				cpu_data->states[idx_hit].early_hits += PULSE;
+		} else {
+			hits += PULSE;
+		}
+
+		cpu_data->states[idx_timer].misses = misses;
+		cpu_data->states[idx_timer].hits = hits;
+	}
+
+	/* Save idle durations of non-timer wakeups for pattern detection */
+	cpu_data->intervals[cpu_data->interval_idx++] = measured_us;
+	if (cpu_data->interval_idx >= INTERVALS)
+		cpu_data->interval_idx = 0;
+}
+
+/**
+ * teo_find_shallower_state - find shallower idle state matching given duration
+ * @drv: cpuidle driver containing state data
+ * @dev: target CPU
+ * @state_idx: index of the capping idle state
+ * @duration_us: idle duration value to match
+ */
+static int teo_find_shallower_state(struct cpuidle_driver *drv,
+				    struct cpuidle_device *dev, int state_idx,
+				    unsigned int duration_us)
+{
+	int i;
+
+	for (i = state_idx - 1; i >= 0; i--) {
+		if (drv->states[i].disabled || dev->states_usage[i].disable)
+			continue;
+
+		state_idx = i;
+		if (drv->states[i].target_residency <= duration_us)
+			break;
+	}
+	return state_idx;
+}
+
+/*
+ * With the tick stopped, a state shallower than a tick period is not
+ * worth picking for early wakeups: if they do not come, the CPU stays
+ * in it for the whole sleep length.
+ */
+static bool teo_too_shallow(struct cpuidle_state *s)
+{
+	return tick_nohz_tick_stopped() && s->target_residency < TEO_TICK_USEC;
+}
+
+/**
+ * teo_select - selects the next idle state to enter
+ * @drv: cpuidle driver containing state data
+ * @dev: target CPU
+ */
+static int teo_select(struct cpuidle_driver *drv, struct cpuidle_device *dev)
+{
+	struct teo_cpu *cpu_data = this_cpu_ptr(&teo_cpus);
+	int latency_req = pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
+	unsigned int duration_us, hits, misses, early_hits;
+	int max_early_idx, prev_max_early_idx, constraint_idx, idx, i;
+
+	if (cpu_data->last_state >= 0) {
+		teo_update(drv, dev);
+		cpu_data->last_state = -1;
+	}
+
+	cpu_data->sleep_length_us = ktime_to_us(tick_nohz_get_sleep_length());
+	duration_us = cpu_data->sleep_length_us;
+
+	hits = 0;
+	misses = 0;
+	early_hits = 0;
+	max_early_idx = -1;
+	prev_max_early_idx = -1;
+	constraint_idx = drv->state_count;
+	idx = -1;
+
+	for (i = 0; i < drv->state_count; i++) {
+		struct cpuidle_state *s = &drv->states[i];
+		struct cpuidle_state_usage *su = &dev->states_usage[i];
+
+		if (s->disabled || su->disable) {
+			/*
+			 * Ignore disabled states with target residencies
+			 * beyond the anticipated idle duration.
+			 */
+			if (s->target_residency > duration_us)
+				continue;
+
+			/*
+			 * The range of idle durations of this state is
+			 * covered by the current candidate state, but its
+			 * metrics still decide whether the candidate is good
+			 * enough.
+			 */
+			hits = cpu_data->states[i].hits;
+			misses = cpu_data->states[i].misses;
+
+			if (early_hits >= cpu_data->states[i].early_hits ||
+			    idx < 0)
+				continue;
+
+			/*
+			 * If the candidate has the most early hits so far,
+			 * take over the disabled state's early hits so that
+			 * a deeper state with fewer of them is not selected.
+			 */
+			if (max_early_idx == idx) {
+				early_hits = cpu_data->states[i].early_hits;
+				continue;
+			}
+
+			/*
+			 * Otherwise the candidate is closer to the disabled
+			 * state than the one with the most early hits, so
+			 * let it replace that one.
+			 */
+			if (!teo_too_shallow(&drv->states[idx])) {
+				prev_max_early_idx = max_early_idx;
+				early_hits = cpu_data->states[i].early_hits;
+				max_early_idx = idx;
+			}
+
+			continue;
+		}
+
+		if (idx < 0) {
+			idx = i; /* first enabled state */
+			hits = cpu_data->states[i].hits;
+			misses = cpu_data->states[i].misses;
+		}
+
+		if (s->target_residency > duration_us)
+			break;
+
+		if (s->exit_latency > latency_req && constraint_idx > i)
+			constraint_idx = i;
+
+		idx = i;
+		hits = cpu_data->states[i].hits;
+		misses = cpu_data->states[i].misses;
+
+		if (early_hits < cpu_data->states[i].early_hits &&
+		    !teo_too_shallow(s)) {
+			prev_max_early_idx = max_early_idx;
+			early_hits = cpu_data->states[i].early_hits;
+			max_early_idx = i;
+		}
+	}
+
+	/*
+	 * If the hits of the state matching the sleep length do not
+	 * outweigh its misses, one of the shallower states is likely to
+	 * match the idle duration, so take the one with the most early
+	 * hits, if there is one.
+	 */
+	if (hits <= misses) {
+		if (idx == max_early_idx)
+			max_early_idx = prev_max_early_idx;
+
+		if (max_early_idx >= 0) {
+			idx = max_early_idx;
+			duration_us = drv->states[idx].target_residency;
+		}
+	}
+
+	/* A latency constraint may require a shallower state */
+	if (constraint_idx < idx)
+		idx = constraint_idx;
+
+	if (idx < 0) {
+		idx = 0; /* No states enabled, must use 0 */
+	} else if (idx > 0) {
+		unsigned int count = 0;
+		u64 sum = 0;
+
+		/*
+		 * Count and sum the most recent idle durations shorter than
+		 * the currently expected one.
+		 */
+		for (i = 0; i < INTERVALS; i++) {
+			unsigned int val = cpu_data->intervals[i];
+
+			if (val >= duration_us)
+				continue;
+
+			count++;
+			sum += val;
+		}
+
+		/*
+		 * Use their average only if they are the majority, and do
+		 * not go below a tick period with the tick stopped.
+		 */
+		if (count > INTERVALS / 2) {
+			unsigned int avg_us = div64_u64(sum, count);
+
+			if (!(tick_nohz_tick_stopped() &&
+			      avg_us < TEO_TICK_USEC) &&
+			    drv->states[idx].target_residency > avg_us)
+				idx = teo_find_shallower_state(drv, dev,
+							       idx, avg_us);
+		}
+	}
+
+	return idx;
+}
+
+/**
+ * teo_reflect - note that governor data for the CPU need to be updated
+ * @dev: target CPU
+ * @state: index of the idle state entered
+ */
+static void teo_reflect(struct cpuidle_device *dev, int state)
+{
+	struct teo_cpu *cpu_data = this_cpu_ptr(&teo_cpus);
+
+	cpu_data->last_state = state;
+}
+
+/**
+ * teo_enable_device - initialize the governor's data for the target CPU
+ * @drv: cpuidle driver (not used)
+ * @dev: target CPU
+ */
+static int teo_enable_device(struct cpuidle_driver *drv,
+			     struct cpuidle_device *dev)
+{
+	struct teo_cpu *cpu_data = &per_cpu(teo_cpus, dev->cpu);
+	int i;
+
+	memset(cpu_data, 0, sizeof(*cpu_data));
+	cpu_data->last_state = -1;
+
+	for (i = 0; i < INTERVALS; i++)
+		cpu_data->intervals[i] = UINT_MAX;
+
+	return 0;
+}
+
+static struct cpuidle_governor teo_governor = {
+	.name =		"teo",
+	.rating =	19,
+	.enable =	teo_enable_device,
+	.select =	teo_select,
+	.reflect =	teo_reflect,
+};
+
+static int __init teo_governor_init(void)
+{
+	return cpuidle_register_governor(&teo_governor);
+}
+
+postcore_initcall(teo_governor_init);
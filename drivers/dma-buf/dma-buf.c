@@ -35,11 +35,17 @@
 #include <linux/reservation.h>
 #include <linux/mm.h>
 #include <linux/mount.h>
+#include <linux/fdtable.h>
+#include <linux/proc_fs.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
 
 #include <uapi/linux/dma-buf.h>
 
-static inline int is_dma_buf_file(struct file *);
-
+/*
+ * The list is modified under the mutex; lookups that only need the buffer
+ * sizes and exporter names walk it under RCU, see dma_buf_info_show().
+ */
 struct dma_buf_list {
 	struct list_head head;
 	struct mutex lock;
@@ -47,6 +53,10 @@ struct dma_buf_list {
 
 static struct dma_buf_list db_list;
 
+/* totals of all exported buffers, kept up to date on export and release */
+static atomic_long_t db_total_size = ATOMIC_LONG_INIT(0);
+static atomic_t db_count = ATOMIC_INIT(0);
+
 static const struct dentry_operations dma_buf_dentry_ops = {
 	.d_dname = simple_dname,
 };
@@ -66,6 +76,14 @@ static struct file_system_type dma_buf_fs_type = {
 	.kill_sb = kill_anon_super,
 };
 
+static void dma_buf_free_rcu(struct rcu_head *rcu)
+{
+	struct dma_buf *dmabuf = container_of(rcu, struct dma_buf, rcu);
+
+	module_put(dmabuf->owner);
+	kfree(dmabuf);
+}
+
 static int dma_buf_release(struct inode *inode, struct file *file)
 {
 	struct dma_buf *dmabuf;
@@ -90,14 +108,16 @@ static int dma_buf_release(struct inode *inode, struct file *file)
 	dmabuf->ops->release(dmabuf);
 
 	mutex_lock(&db_list.lock);
-	list_del(&dmabuf->list_node);
+	list_del_rcu(&dmabuf->list_node);
 	mutex_unlock(&db_list.lock);
+	atomic_long_sub(dmabuf->size, &db_total_size);
+	atomic_dec(&db_count);
 
 	if (dmabuf->resv == (struct reservation_object *)&dmabuf[1])
 		reservation_object_fini(dmabuf->resv);
 
-	module_put(dmabuf->owner);
-	kfree(dmabuf);
+	/* RCU walkers of db_list may still look at the buffer and exp_name */
+	call_rcu(&dmabuf->rcu, dma_buf_free_rcu);
 	return 0;
 }
 
@@ -380,13 +400,15 @@ static const struct file_operations dma_buf_fops = {
 	.show_fdinfo	= dma_buf_show_fdinfo,
 };
 
-/*
+/**
  * is_dma_buf_file - Check if struct file* is associated with dma_buf
+ * @file:	[in]	file to check
  */
-static inline int is_dma_buf_file(struct file *file)
+int is_dma_buf_file(struct file *file)
 {
 	return file->f_op == &dma_buf_fops;
 }
+EXPORT_SYMBOL_GPL(is_dma_buf_file);
 
 static struct file *dma_buf_getfile(struct dma_buf *dmabuf, int flags)
 {
@@ -505,8 +527,10 @@ struct dma_buf *dma_buf_export(const struct dma_buf_export_info *exp_info)
 	INIT_LIST_HEAD(&dmabuf->attachments);
 
 	mutex_lock(&db_list.lock);
-	list_add(&dmabuf->list_node, &db_list.head);
+	list_add_rcu(&dmabuf->list_node, &db_list.head);
 	mutex_unlock(&db_list.lock);
+	atomic_long_add(dmabuf->size, &db_total_size);
+	atomic_inc(&db_count);
 
 	return dmabuf;
 
@@ -967,6 +991,155 @@ void dma_buf_vunmap(struct dma_buf *dmabuf, void *vaddr)
 }
 EXPORT_SYMBOL_GPL(dma_buf_vunmap);
 
+struct dma_buf_fd_ref {
+	const struct dma_buf *dmabuf;
+	size_t size;
+};
+
+struct dma_buf_fd_walk {
+	struct dma_buf_fd_ref *refs;
+	unsigned int nr;
+	unsigned int max;
+};
+
+/* Called under the files_struct's file_lock, must not sleep */
+static int dma_buf_collect_fd(const void *data, struct file *file,
+			      unsigned int fd)
+{
+	struct dma_buf_fd_walk *walk = (struct dma_buf_fd_walk *)data;
+	struct dma_buf *dmabuf;
+
+	if (!is_dma_buf_file(file))
+		return 0;
+
+	dmabuf = file->private_data;
+	if (walk->nr < walk->max) {
+		walk->refs[walk->nr].dmabuf = dmabuf;
+		walk->refs[walk->nr].size = dmabuf->size;
+	}
+	walk->nr++;
+	return 0;
+}
+
+static int dma_buf_fd_ref_cmp(const void *a, const void *b)
+{
+	const struct dma_buf_fd_ref *ra = a, *rb = b;
+
+	if (ra->dmabuf < rb->dmabuf)
+		return -1;
+	return ra->dmabuf > rb->dmabuf;
+}
+
+/**
+ * dma_buf_task_stats - count the dma-bufs a task holds file descriptors to
+ * @task:	[in]	task whose file table is looked at
+ * @stats:	[out]	number of fds, distinct buffers and their total size
+ *
+ * Only the task's own file table is walked; a buffer referenced by several
+ * of its fds is counted once. The buffer pointers collected are only
+ * compared, never dereferenced, once the file table is unlocked.
+ *
+ * Returns 0 on success, or a negative error code.
+ */
+int dma_buf_task_stats(struct task_struct *task, struct dma_buf_task_stats *stats)
+{
+	struct dma_buf_fd_walk walk = { };
+	struct files_struct *files;
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	files = get_files_struct(task);
+	if (!files)
+		return 0;
+
+	/* the first pass only counts, then retry until the array is big enough */
+	for (;;) {
+		walk.nr = 0;
+		iterate_fd(files, 0, dma_buf_collect_fd, &walk);
+		if (walk.nr <= walk.max)
+			break;
+
+		vfree(walk.refs);
+		walk.max = walk.nr + 16;
+		walk.refs = vmalloc(walk.max * sizeof(*walk.refs));
+		if (!walk.refs) {
+			put_files_struct(files);
+			return -ENOMEM;
+		}
+	}
+	put_files_struct(files);
+
+	stats->fds = walk.nr;
+	sort(walk.refs, walk.nr, sizeof(*walk.refs), dma_buf_fd_ref_cmp, NULL);
+	for (i = 0; i < walk.nr; i++) {
+		if (i && walk.refs[i].dmabuf == walk.refs[i - 1].dmabuf)
+			continue;
+		stats->buffers++;
+		stats->size += walk.refs[i].size;
+	}
+	vfree(walk.refs);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(dma_buf_task_stats);
+
+#ifdef CONFIG_PROC_FS
+/*
+ * /proc/dma_buf_info: a struct dma_buf_info_header followed by one struct
+ * dma_buf_info per exported buffer. The list is walked under RCU only, so
+ * reading it never holds up exporting or releasing buffers; the header
+ * totals are sampled before the walk and may not match the records
+ * exactly.
+ */
+static int dma_buf_info_show(struct seq_file *s, void *unused)
+{
+	struct dma_buf_info_header hdr = { };
+	struct dma_buf_info rec;
+	struct dma_buf *dmabuf;
+
+	hdr.total_size = atomic_long_read(&db_total_size);
+	hdr.nr_buffers = atomic_read(&db_count);
+	hdr.record_size = sizeof(rec);
+	seq_write(s, &hdr, sizeof(hdr));
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(dmabuf, &db_list.head, list_node) {
+		memset(&rec, 0, sizeof(rec));
+		rec.inode = file_inode(dmabuf->file)->i_ino;
+		rec.size = dmabuf->size;
+		rec.file_count = file_count(dmabuf->file);
+		strlcpy(rec.exp_name, dmabuf->exp_name, sizeof(rec.exp_name));
+		if (seq_write(s, &rec, sizeof(rec)))
+			break;
+	}
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static int dma_buf_info_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dma_buf_info_show, NULL);
+}
+
+static const struct file_operations dma_buf_info_fops = {
+	.open           = dma_buf_info_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release        = single_release,
+};
+
+static void dma_buf_init_procfs(void)
+{
+	proc_create("dma_buf_info", S_IRUSR, NULL, &dma_buf_info_fops);
+}
+#else
+static inline void dma_buf_init_procfs(void)
+{
+}
+#endif
+
 #ifdef CONFIG_DEBUG_FS
 static int dma_buf_debug_show(struct seq_file *s, void *unused)
 {
@@ -1088,6 +1261,7 @@ static int __init dma_buf_init(void)
 	mutex_init(&db_list.lock);
 	INIT_LIST_HEAD(&db_list.head);
 	dma_buf_init_debugfs();
+	dma_buf_init_procfs();
 	return 0;
 }
 subsys_initcall(dma_buf_init);
@@ -73,7 +73,6 @@ static int z_erofs_lz4_prepare_destpages(struct z_erofs_decompress_req *rq,
 					   BITS_PER_LONG)] = { 0 };
 	unsigned int lz4_max_distance_pages =
 				EROFS_SB(rq->sb)->lz4.max_distance_pages;
-	void *kaddr = NULL;
 	unsigned int i, j, top;
 
 	top = 0;
@@ -93,17 +92,8 @@ static int z_erofs_lz4_prepare_destpages(struct z_erofs_decompress_req *rq,
 
 		if (page) {
 			__clear_bit(j, bounced);
-			if (kaddr) {
-				if (kaddr + PAGE_SIZE == page_address(page))
-					kaddr += PAGE_SIZE;
-				else
-					kaddr = NULL;
-			} else if (!i) {
-				kaddr = page_address(page);
-			}
 			continue;
 		}
-		kaddr = NULL;
 		__set_bit(j, bounced);
 
 		if (top) {
@@ -116,13 +106,15 @@ static int z_erofs_lz4_prepare_destpages(struct z_erofs_decompress_req *rq,
 		}
 		rq->out[i] = victim;
 	}
-	return kaddr ? 1 : 0;
+	/* check if destpages indicate continuous physical memory */
+	return erofs_page_address_contig(rq->out, nr) ? 1 : 0;
 }
 
 static void *z_erofs_handle_inplace_io(struct z_erofs_decompress_req *rq,
 			void *inpage, unsigned int *inputmargin, int *maptype,
 			bool support_0padding)
 {
+	struct erofs_sb_info *const sbi = EROFS_SB(rq->sb);
 	unsigned int nrpages_in, nrpages_out;
 	unsigned int ofull, oend, inputsize, total, i, j;
 	struct page **in;
@@ -145,6 +137,7 @@ static void *z_erofs_handle_inplace_io(struct z_erofs_decompress_req *rq,
 				if (rq->out[j] == rq->in[i])
 					goto docopy;
 		}
+		z_erofs_stat_inc(sbi, inplace);
 	}
 
 	if (nrpages_in <= 1) {
@@ -152,10 +145,20 @@ static void *z_erofs_handle_inplace_io(struct z_erofs_decompress_req *rq,
 		return inpage;
 	}
 	kunmap_atomic(inpage);
+
+	/* compressed pages could be allocated in one go, see zdata.c */
+	src = erofs_page_address_contig(rq->in, nrpages_in);
+	if (src) {
+		z_erofs_stat_inc(sbi, direct_in);
+		*maptype = 3;
+		return src;
+	}
+
 	might_sleep();
 	src = erofs_vm_map_ram(rq->in, nrpages_in);
 	if (!src)
 		return ERR_PTR(-ENOMEM);
+	z_erofs_stat_inc(sbi, vmap_in);
 	*maptype = 1;
 	return src;
 
@@ -185,6 +188,7 @@ static void *z_erofs_handle_inplace_io(struct z_erofs_decompress_req *rq,
 		++in;
 		*inputmargin = 0;
 	}
+	z_erofs_stat_inc(sbi, copy_in);
 	*maptype = 2;
 	return src;
 }
@@ -250,7 +254,7 @@ static int z_erofs_lz4_decompress(struct z_erofs_decompress_req *rq, u8 *out)
 		vm_unmap_ram(src, PAGE_ALIGN(rq->inputsize) >> PAGE_SHIFT);
 	} else if (maptype == 2) {
 		erofs_put_pcpubuf(src);
-	} else {
+	} else if (maptype != 3) {
 		DBG_BUGON(1);
 		return -EFAULT;
 	}
@@ -326,9 +330,11 @@ static int z_erofs_decompress_generic(struct z_erofs_decompress_req *rq,
 
 			rq->inplace_io = false;
 			ret = alg->decompress(rq, dst);
-			if (!ret)
+			if (!ret) {
 				copy_from_pcpubuf(rq->out, dst, rq->pageofs_out,
 						  rq->outputsize);
+				z_erofs_stat_inc(EROFS_SB(rq->sb), copy_out);
+			}
 
 			erofs_put_pcpubuf(dst);
 			return ret;
@@ -342,12 +348,15 @@ static int z_erofs_decompress_generic(struct z_erofs_decompress_req *rq,
 	if (ret) {
 		dst = page_address(*rq->out);
 		dst_maptype = 1;
+		if (nrpages_out > 1)
+			z_erofs_stat_inc(EROFS_SB(rq->sb), direct_out);
 		goto dstmap_out;
 	}
 
 	dst = erofs_vm_map_ram(rq->out, nrpages_out);
 	if (!dst)
 		return -ENOMEM;
+	z_erofs_stat_inc(EROFS_SB(rq->sb), vmap_out);
 	dst_maptype = 2;
 
 dstmap_out:
@@ -53,6 +53,20 @@ struct erofs_sb_lz4_info {
 	u16 max_pclusterblks;
 };
 
+/* how compressed and decompressed data got mapped, see decompressor.c */
+struct erofs_decompress_stats {
+	atomic_long_t inplace;		/* decoded in place, no copy-in */
+	atomic_long_t copy_in;		/* compressed data copied to pcpubuf */
+	atomic_long_t copy_out;		/* decompressed data copied from pcpubuf */
+	atomic_long_t direct_in;	/* contiguous input, vmap avoided */
+	atomic_long_t direct_out;	/* contiguous output, vmap avoided */
+	atomic_long_t vmap_in;
+	atomic_long_t vmap_out;
+	atomic_long_t contig_pclusters;	/* read into a contiguous allocation */
+};
+
+#define z_erofs_stat_inc(sbi, field)	atomic_long_inc(&(sbi)->dstats.field)
+
 struct erofs_sb_info {
 #ifdef CONFIG_EROFS_FS_ZIP
 	/* list for all registered superblocks, mainly for shrinker */
@@ -76,6 +90,8 @@ struct erofs_sb_info {
 	struct inode *managed_cache;
 
 	struct erofs_sb_lz4_info lz4;
+	struct erofs_decompress_stats dstats;
+	struct proc_dir_entry *proc;
 #endif	/* CONFIG_EROFS_FS_ZIP */
 	u32 blocks;
 	u32 meta_blkaddr;
@@ -409,6 +425,27 @@ static inline void *erofs_vm_map_ram(struct page **pages, unsigned int count)
 	return NULL;
 }
 
+/*
+ * lowmem pages which happen to be physically consecutive can be accessed
+ * through the linear mapping directly, so no vmap is needed for them.
+ */
+static inline void *erofs_page_address_contig(struct page **pages,
+					      unsigned int count)
+{
+	void *kaddr;
+	unsigned int i;
+
+	if (!pages[0] || PageHighMem(pages[0]))
+		return NULL;
+
+	kaddr = page_address(pages[0]);
+	for (i = 1; i < count; ++i)
+		if (!pages[i] || PageHighMem(pages[i]) ||
+		    page_address(pages[i]) != kaddr + i * PAGE_SIZE)
+			return NULL;
+	return kaddr;
+}
+
 /* pcpubuf.c */
 void *erofs_get_pcpubuf(unsigned int requiredpages);
 void erofs_put_pcpubuf(void *ptr);
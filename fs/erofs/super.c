@@ -8,6 +8,7 @@
 #include <linux/statfs.h>
 #include <linux/parser.h>
 #include <linux/seq_file.h>
+#include <linux/proc_fs.h>
 #include <linux/crc32c.h>
 #include "xattr.h"
 
@@ -528,6 +529,79 @@ static int erofs_init_managed_cache(struct super_block *sb)
 static int erofs_init_managed_cache(struct super_block *sb) { return 0; }
 #endif
 
+#ifdef CONFIG_EROFS_FS_ZIP
+static struct proc_dir_entry *erofs_proc_root;
+
+static int erofs_decompress_stats_show(struct seq_file *seq, void *v)
+{
+	struct erofs_sb_info *sbi = EROFS_SB((struct super_block *)seq->private);
+	struct erofs_decompress_stats *st = &sbi->dstats;
+
+	seq_printf(seq, "inplace: %ld\n", atomic_long_read(&st->inplace));
+	seq_printf(seq, "copy_in: %ld\n", atomic_long_read(&st->copy_in));
+	seq_printf(seq, "copy_out: %ld\n", atomic_long_read(&st->copy_out));
+	seq_printf(seq, "direct_in: %ld\n", atomic_long_read(&st->direct_in));
+	seq_printf(seq, "direct_out: %ld\n", atomic_long_read(&st->direct_out));
+	seq_printf(seq, "vmap_in: %ld\n", atomic_long_read(&st->vmap_in));
+	seq_printf(seq, "vmap_out: %ld\n", atomic_long_read(&st->vmap_out));
+	seq_printf(seq, "contig_pclusters: %ld\n",
+		   atomic_long_read(&st->contig_pclusters));
+	return 0;
+}
+
+static int erofs_decompress_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, erofs_decompress_stats_show, PDE_DATA(inode));
+}
+
+static const struct file_operations erofs_decompress_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= erofs_decompress_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void erofs_register_proc(struct super_block *sb)
+{
+	struct erofs_sb_info *sbi = EROFS_SB(sb);
+
+	if (!erofs_proc_root)
+		return;
+	sbi->proc = proc_mkdir(sb->s_id, erofs_proc_root);
+	if (sbi->proc)
+		proc_create_data("decompress_stats", S_IRUGO, sbi->proc,
+				 &erofs_decompress_stats_fops, sb);
+}
+
+static void erofs_unregister_proc(struct super_block *sb)
+{
+	struct erofs_sb_info *sbi = EROFS_SB(sb);
+
+	if (!sbi->proc)
+		return;
+	remove_proc_entry("decompress_stats", sbi->proc);
+	remove_proc_entry(sb->s_id, erofs_proc_root);
+	sbi->proc = NULL;
+}
+
+static void erofs_init_proc(void)
+{
+	erofs_proc_root = proc_mkdir("fs/erofs", NULL);
+}
+
+static void erofs_exit_proc(void)
+{
+	if (erofs_proc_root)
+		remove_proc_entry("fs/erofs", NULL);
+}
+#else
+static void erofs_register_proc(struct super_block *sb) {}
+static void erofs_unregister_proc(struct super_block *sb) {}
+static void erofs_init_proc(void) {}
+static void erofs_exit_proc(void) {}
+#endif
+
 static int erofs_fill_super(struct super_block *sb, void *data, int silent)
 {
 	struct inode *inode;
@@ -595,6 +669,7 @@ static int erofs_fill_super(struct super_block *sb, void *data, int silent)
 	err = erofs_init_managed_cache(sb);
 	if (err)
 		return err;
+	erofs_register_proc(sb);
 
 	erofs_info(sb, "mounted with opts: %s, root inode @ nid %llu.",
 		   (char *)data, ROOT_NID(sbi));
@@ -633,6 +708,7 @@ static void erofs_put_super(struct super_block *sb)
 
 	DBG_BUGON(!sbi);
 
+	erofs_unregister_proc(sb);
 	erofs_shrinker_unregister(sb);
 #ifdef CONFIG_EROFS_FS_ZIP
 	iput(sbi->managed_cache);
@@ -677,6 +753,7 @@ static int __init erofs_module_init(void)
 	if (err)
 		goto fs_err;
 
+	erofs_init_proc();
 	return 0;
 
 fs_err:
@@ -692,6 +769,7 @@ static int __init erofs_module_init(void)
 static void __exit erofs_module_exit(void)
 {
 	unregister_filesystem(&erofs_fs_type);
+	erofs_exit_proc();
 	z_erofs_exit_zip_subsystem();
 	erofs_exit_shrinker();
 
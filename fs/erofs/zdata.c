@@ -1179,6 +1179,44 @@ static struct page *pickup_page_for_submission(struct z_erofs_pcluster *pcl,
 	return page;
 }
 
+/*
+ * For big pclusters which have neither cached nor inplace pages, try to
+ * allocate all compressed pages in one go and queue them at the tail of
+ * @pagepool in order, so that the decompressor can access them through the
+ * linear mapping rather than vmap. It's only a hint, since order-0 pages
+ * are used instead if such allocation fails or races.
+ */
+static void z_erofs_prealloc_contig(struct erofs_sb_info *sbi,
+				    struct z_erofs_pcluster *pcl,
+				    struct list_head *pagepool, gfp_t gfp)
+{
+	const unsigned int nr = pcl->pclusterpages;
+	const unsigned int order = get_order(nr << PAGE_SHIFT);
+	struct page *page;
+	unsigned int i;
+
+	if (nr <= 1 || order > PAGE_ALLOC_COSTLY_ORDER)
+		return;
+
+	for (i = 0; i < nr; ++i)
+		if (READ_ONCE(pcl->compressed_pages[i]))
+			return;
+
+	/* don't bother reclaim or compaction for this */
+	gfp = (gfp | __GFP_NORETRY | __GFP_NOWARN) & ~__GFP_DIRECT_RECLAIM;
+	page = alloc_pages(gfp, order);
+	if (!page)
+		return;
+	split_page(page, order);
+
+	/* erofs_allocpage() takes pages from the tail of the pool */
+	for (i = nr; i < 1 << order; ++i)
+		list_add(&page[i].lru, pagepool);
+	for (i = nr; i; --i)
+		list_add_tail(&page[i - 1].lru, pagepool);
+	z_erofs_stat_inc(sbi, contig_pclusters);
+}
+
 static struct z_erofs_decompressqueue *
 jobqueue_init(struct super_block *sb,
 	      struct z_erofs_decompressqueue *fgq, bool *fg)
@@ -1285,6 +1323,8 @@ static void z_erofs_submit_queue(struct super_block *sb,
 		owned_head = cmpxchg(&pcl->next, Z_EROFS_PCLUSTER_TAIL,
 				     Z_EROFS_PCLUSTER_TAIL_CLOSED);
 
+		z_erofs_prealloc_contig(sbi, pcl, pagepool, GFP_NOFS);
+
 		do {
 			struct page *page;
 
@@ -0,0 +1,1385 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ *  fs/ext4/fast_commit.c
+ *
+ * Ext4 fast commits: on fsync, log the changes the running transaction
+ * made to a handful of inodes instead of committing the whole transaction.
+ * See fast_commit.h for the on-disk format.
+ *
+ * Tracking. Every handle that dirties a regular file queues it on s_fc_q
+ * and widens the range of logical blocks whose mapping changed; links and
+ * unlinks of existing inodes are queued on s_fc_dentry_q. Operations that
+ * cannot be described by these records mark the transaction ineligible.
+ *
+ * Commit. With the journal updates locked the queues are a consistent
+ * snapshot of the running transaction. The current mapping of each
+ * tracked range is logged as ADD_RANGE/DEL_RANGE records, followed by the
+ * inode's attributes, and the queues are emptied. A full commit of the
+ * transaction makes all its fast commits obsolete.
+ *
+ * Replay. Journal recovery hands us the fast commit area; ext4_fc_replay()
+ * applies the valid fast commits through the regular file system paths
+ * once the block allocator is up, then commits the result.
+ *
+ * Fast commits are only enabled in data=ordered mode with delayed
+ * allocation: ordered mode guarantees that blocks freed by a transaction
+ * are not reused before it commits, which keeps the logged ranges of
+ * different inodes from overlapping.
+ */
+
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/crc32.h>
+#include <linux/pagemap.h>
+#include <linux/quotaops.h>
+#include <linux/seq_file.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "ext4_extents.h"
+
+static const char * const fc_ineligible_reasons[] = {
+	[EXT4_FC_REASON_XATTR]			= "Extended attributes changed",
+	[EXT4_FC_REASON_RENAME]			= "Rename",
+	[EXT4_FC_REASON_DIR_OP]			= "Directory removed",
+	[EXT4_FC_REASON_JOURNAL_FLAG_CHANGE]	= "Journal flag changed",
+	[EXT4_FC_REASON_NOMEM]			= "Insufficient memory",
+	[EXT4_FC_REASON_SWAP_BOOT]		= "Swap boot",
+	[EXT4_FC_REASON_RESIZE]			= "Resize",
+	[EXT4_FC_REASON_FALLOC_RANGE]		= "Falloc range op",
+	[EXT4_FC_REASON_EXTENT_SWAP]		= "Extent swap",
+	[EXT4_FC_REASON_INODE_JOURNAL_DATA]	= "Data journalling",
+	[EXT4_FC_REASON_UNSUPPORTED_INODE]	= "Unsupported inode",
+	[EXT4_FC_REASON_ENCRYPTED_FILENAME]	= "Encrypted filename",
+	[EXT4_FC_REASON_COMMIT_FAILED]		= "Commit failed",
+	[EXT4_FC_REASON_NEW_INODE]		= "New inode",
+	[EXT4_FC_REASON_INODE_EVICTED]		= "Inode evicted",
+};
+
+/* Fast commit block being filled and submitted by ext4_fc_commit() */
+struct ext4_fc_writer {
+	struct super_block *sb;
+	journal_t *journal;
+	struct buffer_head *bh;		/* Block being filled, if any */
+	int off;			/* Write offset in @bh */
+	int nblks;			/* Blocks taken from the journal */
+	u32 crc;			/* crc32 of the submitted blocks */
+};
+
+/*
+ * Tracking
+ */
+
+static bool ext4_fc_should_track(handle_t *handle, struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT) || !ext4_handle_valid(handle))
+		return false;
+	if (EXT4_SB(sb)->s_mount_state & EXT4_FC_REPLAY)
+		return false;
+	/* ext4_fc_del() has already dropped it, don't queue it again */
+	if (inode->i_state & I_FREEING)
+		return false;
+	return !IS_NOQUOTA(inode);
+}
+
+/* Must be called with s_fc_lock held */
+static void __ext4_fc_mark_ineligible(struct ext4_sb_info *sbi, int reason,
+				      tid_t tid)
+{
+	if (!sbi->s_fc_ineligible || tid_gt(tid, sbi->s_fc_ineligible_tid))
+		sbi->s_fc_ineligible_tid = tid;
+	sbi->s_fc_ineligible = true;
+	sbi->s_fc_stats.fc_ineligible_reason_count[reason]++;
+}
+
+/* Must be called with s_fc_lock held */
+static bool ext4_fc_is_ineligible(struct ext4_sb_info *sbi, tid_t tid)
+{
+	return sbi->s_fc_ineligible && tid_geq(sbi->s_fc_ineligible_tid, tid);
+}
+
+/*
+ * Make fsyncs of the transaction of @handle, or of the running transaction
+ * if @handle is NULL, fall back to a full commit.
+ */
+void ext4_fc_mark_ineligible(struct super_block *sb, int reason,
+			     handle_t *handle)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	journal_t *journal = sbi->s_journal;
+	tid_t tid;
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT) ||
+	    (sbi->s_mount_state & EXT4_FC_REPLAY))
+		return;
+
+	if (handle && ext4_handle_valid(handle)) {
+		tid = handle->h_transaction->t_tid;
+	} else {
+		read_lock(&journal->j_state_lock);
+		tid = journal->j_running_transaction ?
+			journal->j_running_transaction->t_tid :
+			journal->j_transaction_sequence;
+		read_unlock(&journal->j_state_lock);
+	}
+
+	spin_lock(&sbi->s_fc_lock);
+	__ext4_fc_mark_ineligible(sbi, reason, tid);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/* Must be called with s_fc_lock held */
+static void ext4_fc_queue_inode(handle_t *handle, struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+
+	ei->i_fc_tid = handle->h_transaction->t_tid;
+	if (list_empty(&ei->i_fc_list))
+		list_add_tail(&ei->i_fc_list, &EXT4_SB(inode->i_sb)->s_fc_q);
+}
+
+/*
+ * Note that @inode was changed by @handle. Called whenever the inode is
+ * marked dirty.
+ */
+void ext4_fc_track_inode(handle_t *handle, struct inode *inode)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+
+	if (!ext4_fc_should_track(handle, inode))
+		return;
+	/*
+	 * Directory contents are logged as LINK/UNLINK records, and other
+	 * inodes only change in ways that make the transaction ineligible.
+	 */
+	if (!S_ISREG(inode->i_mode))
+		return;
+	if (ext4_should_journal_data(inode)) {
+		ext4_fc_mark_ineligible(inode->i_sb,
+					EXT4_FC_REASON_INODE_JOURNAL_DATA,
+					handle);
+		return;
+	}
+	if (ext4_has_inline_data(inode)) {
+		ext4_fc_mark_ineligible(inode->i_sb,
+					EXT4_FC_REASON_UNSUPPORTED_INODE,
+					handle);
+		return;
+	}
+
+	spin_lock(&sbi->s_fc_lock);
+	ext4_fc_queue_inode(handle, inode);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/*
+ * Note that @handle changed the mapping of logical blocks @start to @end
+ * (inclusive) of @inode.
+ */
+void ext4_fc_track_range(handle_t *handle, struct inode *inode,
+			 ext4_lblk_t start, ext4_lblk_t end)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	ext4_lblk_t cur_end;
+
+	if (!ext4_fc_should_track(handle, inode))
+		return;
+	/* Directory blocks are journalled metadata */
+	if (S_ISDIR(inode->i_mode))
+		return;
+	if (!S_ISREG(inode->i_mode) ||
+	    !ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS) ||
+	    ext4_should_journal_data(inode)) {
+		ext4_fc_mark_ineligible(inode->i_sb,
+					EXT4_FC_REASON_UNSUPPORTED_INODE,
+					handle);
+		return;
+	}
+
+	/* Keep the length representable */
+	if (end > EXT_MAX_BLOCKS - 2)
+		end = EXT_MAX_BLOCKS - 2;
+	if (start > end)
+		return;
+
+	spin_lock(&sbi->s_fc_lock);
+	if (!ei->i_fc_lblk_len) {
+		ei->i_fc_lblk_start = start;
+		ei->i_fc_lblk_len = end - start + 1;
+	} else {
+		cur_end = ei->i_fc_lblk_start + ei->i_fc_lblk_len - 1;
+		ei->i_fc_lblk_start = min(ei->i_fc_lblk_start, start);
+		ei->i_fc_lblk_len = max(cur_end, end) - ei->i_fc_lblk_start + 1;
+	}
+	ext4_fc_queue_inode(handle, inode);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+static void ext4_fc_track_dentry(handle_t *handle, struct inode *dir,
+				 struct inode *inode,
+				 const struct qstr *d_name, int op)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(dir->i_sb);
+	struct ext4_fc_dentry_update *fcd;
+
+	if (!ext4_fc_should_track(handle, dir))
+		return;
+	if (IS_ENCRYPTED(dir)) {
+		ext4_fc_mark_ineligible(dir->i_sb,
+					EXT4_FC_REASON_ENCRYPTED_FILENAME,
+					handle);
+		return;
+	}
+
+	fcd = kmalloc(sizeof(*fcd) + d_name->len, GFP_NOFS);
+	if (!fcd) {
+		ext4_fc_mark_ineligible(dir->i_sb, EXT4_FC_REASON_NOMEM,
+					handle);
+		return;
+	}
+	fcd->fcd_op = op;
+	fcd->fcd_tid = handle->h_transaction->t_tid;
+	fcd->fcd_parent = dir->i_ino;
+	fcd->fcd_ino = inode->i_ino;
+	fcd->fcd_name_len = d_name->len;
+	memcpy(fcd->fcd_name, d_name->name, d_name->len);
+
+	spin_lock(&sbi->s_fc_lock);
+	list_add_tail(&fcd->fcd_list, &sbi->s_fc_dentry_q);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+void ext4_fc_track_link(handle_t *handle, struct inode *dir,
+			struct inode *inode, const struct qstr *d_name)
+{
+	ext4_fc_track_dentry(handle, dir, inode, d_name, EXT4_FC_TAG_LINK);
+}
+
+void ext4_fc_track_unlink(handle_t *handle, struct inode *dir,
+			  struct inode *inode, const struct qstr *d_name)
+{
+	ext4_fc_track_dentry(handle, dir, inode, d_name, EXT4_FC_TAG_UNLINK);
+}
+
+/*
+ * Drop @inode from the fast commit queue before it is evicted. Unless the
+ * inode is being deleted, its pending changes can no longer be logged, so
+ * their transaction has to be committed in full.
+ */
+void ext4_fc_del(struct inode *inode)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	struct ext4_inode_info *ei = EXT4_I(inode);
+
+	if (!test_opt2(inode->i_sb, JOURNAL_FAST_COMMIT))
+		return;
+
+	spin_lock(&sbi->s_fc_lock);
+	/* A fast commit may be logging this inode right now */
+	while (sbi->s_fc_committing && !list_empty(&ei->i_fc_list)) {
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait(&sbi->s_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		spin_unlock(&sbi->s_fc_lock);
+		schedule();
+		finish_wait(&sbi->s_fc_wait, &wait);
+		spin_lock(&sbi->s_fc_lock);
+	}
+	if (!list_empty(&ei->i_fc_list)) {
+		list_del_init(&ei->i_fc_list);
+		ei->i_fc_lblk_len = 0;
+		if (inode->i_nlink &&
+		    !(sbi->s_mount_state & EXT4_FC_REPLAY))
+			__ext4_fc_mark_ineligible(sbi,
+					EXT4_FC_REASON_INODE_EVICTED,
+					ei->i_fc_tid);
+	}
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/*
+ * Called by jbd2 once transaction @tid is fully committed: everything
+ * queued on behalf of @tid or earlier is on disk now.
+ */
+static void ext4_fc_cleanup(journal_t *journal, tid_t tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_inode_info *ei, *ei_n;
+	struct ext4_fc_dentry_update *fcd, *fcd_n;
+
+	spin_lock(&sbi->s_fc_lock);
+	list_for_each_entry_safe(ei, ei_n, &sbi->s_fc_q, i_fc_list) {
+		if (tid_gt(ei->i_fc_tid, tid))
+			continue;
+		list_del_init(&ei->i_fc_list);
+		ei->i_fc_lblk_len = 0;
+	}
+	list_for_each_entry_safe(fcd, fcd_n, &sbi->s_fc_dentry_q, fcd_list) {
+		if (tid_gt(fcd->fcd_tid, tid))
+			continue;
+		list_del(&fcd->fcd_list);
+		kfree(fcd);
+	}
+	if (sbi->s_fc_ineligible && !tid_gt(sbi->s_fc_ineligible_tid, tid))
+		sbi->s_fc_ineligible = false;
+	sbi->s_fc_stats.fc_full_commits++;
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/*
+ * Commit
+ */
+
+static void ext4_fc_submit_bh(struct ext4_fc_writer *w, bool is_tail)
+{
+	struct buffer_head *bh = w->bh;
+	int op_flags = WRITE_SYNC;
+
+	/*
+	 * The tail makes the fast commit valid, so it has to reach the disk
+	 * after the data. Earlier blocks may be reordered around it: the
+	 * tail's crc rejects the fast commit if one of them is missing.
+	 */
+	if (is_tail && (w->journal->j_flags & JBD2_BARRIER))
+		op_flags = WRITE_FLUSH_FUA;
+	else
+		w->crc = crc32_le(w->crc, bh->b_data, bh->b_size);
+
+	lock_buffer(bh);
+	set_buffer_uptodate(bh);
+	clear_buffer_dirty(bh);
+	get_bh(bh);
+	bh->b_end_io = end_buffer_write_sync;
+	submit_bh(REQ_OP_WRITE, op_flags, bh);
+	w->bh = NULL;
+}
+
+/*
+ * Reserve @len bytes for a record. Records do not straddle blocks: the
+ * rest of a block that is too small is padded and the block submitted.
+ */
+static int ext4_fc_reserve_space(struct ext4_fc_writer *w, int len, u8 **dst)
+{
+	int bsize = w->sb->s_blocksize;
+	struct ext4_fc_tl tl;
+	int ret;
+
+	if (w->bh && w->off + len > bsize) {
+		if (bsize - w->off >= sizeof(tl)) {
+			tl.fc_tag = cpu_to_le16(EXT4_FC_TAG_PAD);
+			tl.fc_len = cpu_to_le16(bsize - w->off - sizeof(tl));
+			memcpy(w->bh->b_data + w->off, &tl, sizeof(tl));
+		}
+		ext4_fc_submit_bh(w, false);
+	}
+	if (!w->bh) {
+		ret = jbd2_fc_get_buf(w->journal, &w->bh);
+		if (ret)
+			return ret;
+		w->nblks++;
+		memset(w->bh->b_data, 0, bsize);
+		w->off = 0;
+	}
+	*dst = w->bh->b_data + w->off;
+	w->off += len;
+	return 0;
+}
+
+static int ext4_fc_add_tlv(struct ext4_fc_writer *w, u16 tag, u16 len,
+			   const void *val)
+{
+	struct ext4_fc_tl tl;
+	u8 *dst;
+	int ret;
+
+	ret = ext4_fc_reserve_space(w, sizeof(tl) + len, &dst);
+	if (ret)
+		return ret;
+	tl.fc_tag = cpu_to_le16(tag);
+	tl.fc_len = cpu_to_le16(len);
+	memcpy(dst, &tl, sizeof(tl));
+	memcpy(dst + sizeof(tl), val, len);
+	return 0;
+}
+
+static int ext4_fc_write_dentry(struct ext4_fc_writer *w,
+				struct ext4_fc_dentry_update *fcd)
+{
+	struct ext4_fc_dentry_info info;
+	struct ext4_fc_tl tl;
+	int len = sizeof(info) + fcd->fcd_name_len;
+	u8 *dst;
+	int ret;
+
+	ret = ext4_fc_reserve_space(w, sizeof(tl) + len, &dst);
+	if (ret)
+		return ret;
+	tl.fc_tag = cpu_to_le16(fcd->fcd_op);
+	tl.fc_len = cpu_to_le16(len);
+	info.fc_parent_ino = cpu_to_le32(fcd->fcd_parent);
+	info.fc_ino = cpu_to_le32(fcd->fcd_ino);
+	memcpy(dst, &tl, sizeof(tl));
+	memcpy(dst + sizeof(tl), &info, sizeof(info));
+	memcpy(dst + sizeof(tl) + sizeof(info), fcd->fcd_name,
+	       fcd->fcd_name_len);
+	return 0;
+}
+
+/* Log the current mapping of the tracked range of @inode */
+static int ext4_fc_write_inode_data(struct ext4_fc_writer *w,
+				    struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	ext4_lblk_t cur = ei->i_fc_lblk_start;
+	ext4_lblk_t end = cur + ei->i_fc_lblk_len - 1;
+	struct ext4_fc_add_range add;
+	struct ext4_fc_del_range del;
+	struct ext4_map_blocks map;
+	unsigned int max;
+	int ret;
+
+	if (!ei->i_fc_lblk_len)
+		return 0;
+
+	while (cur <= end) {
+		map.m_lblk = cur;
+		map.m_len = end - cur + 1;
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			return ret;
+		if (!map.m_len)
+			return -EFSCORRUPTED;
+
+		if (ret == 0) {
+			del.fc_ino = cpu_to_le32(inode->i_ino);
+			del.fc_lblk = cpu_to_le32(map.m_lblk);
+			del.fc_len = cpu_to_le32(map.m_len);
+			ret = ext4_fc_add_tlv(w, EXT4_FC_TAG_DEL_RANGE,
+					      sizeof(del), &del);
+		} else {
+			/* Replay inserts each range as a single extent */
+			max = map.m_flags & EXT4_MAP_UNWRITTEN ?
+				EXT_UNWRITTEN_MAX_LEN : EXT_INIT_MAX_LEN;
+			map.m_len = min(map.m_len, max);
+			add.fc_ino = cpu_to_le32(inode->i_ino);
+			add.fc_lblk = cpu_to_le32(map.m_lblk);
+			add.fc_len = cpu_to_le32(map.m_len);
+			add.fc_flags = cpu_to_le32(map.m_flags &
+						   EXT4_MAP_UNWRITTEN ?
+						   EXT4_FC_RANGE_UNWRITTEN : 0);
+			add.fc_pblk = cpu_to_le64(map.m_pblk);
+			ret = ext4_fc_add_tlv(w, EXT4_FC_TAG_ADD_RANGE,
+					      sizeof(add), &add);
+		}
+		if (ret)
+			return ret;
+		if (cur + map.m_len - 1 >= end)
+			break;
+		cur += map.m_len;
+	}
+	return 0;
+}
+
+static int ext4_fc_write_inode(struct ext4_fc_writer *w, struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_fc_inode raw;
+
+	memset(&raw, 0, sizeof(raw));
+	raw.fc_ino = cpu_to_le32(inode->i_ino);
+	raw.fc_mode = cpu_to_le16(inode->i_mode);
+	raw.fc_uid = cpu_to_le32(i_uid_read(inode));
+	raw.fc_gid = cpu_to_le32(i_gid_read(inode));
+	raw.fc_size = cpu_to_le64(ei->i_disksize);
+	raw.fc_atime = cpu_to_le32(inode->i_atime.tv_sec);
+	raw.fc_atime_nsec = cpu_to_le32(inode->i_atime.tv_nsec);
+	raw.fc_mtime = cpu_to_le32(inode->i_mtime.tv_sec);
+	raw.fc_mtime_nsec = cpu_to_le32(inode->i_mtime.tv_nsec);
+	raw.fc_ctime = cpu_to_le32(inode->i_ctime.tv_sec);
+	raw.fc_ctime_nsec = cpu_to_le32(inode->i_ctime.tv_nsec);
+	raw.fc_generation = cpu_to_le32(inode->i_generation);
+	raw.fc_flags = cpu_to_le32(ei->i_flags);
+
+	return ext4_fc_add_tlv(w, EXT4_FC_TAG_INODE, sizeof(raw), &raw);
+}
+
+static int ext4_fc_write_tail(struct ext4_fc_writer *w, tid_t tid)
+{
+	int bsize = w->sb->s_blocksize;
+	struct ext4_fc_tail tail;
+	struct ext4_fc_tl tl;
+	u8 *dst;
+	int ret;
+
+	ret = ext4_fc_reserve_space(w, sizeof(tl) + sizeof(tail), &dst);
+	if (ret)
+		return ret;
+
+	/* The tail owns the rest of the block */
+	tl.fc_tag = cpu_to_le16(EXT4_FC_TAG_TAIL);
+	tl.fc_len = cpu_to_le16(bsize - (dst - (u8 *)w->bh->b_data) -
+				sizeof(tl));
+	tail.fc_tid = cpu_to_le32(tid);
+	memcpy(dst, &tl, sizeof(tl));
+	memcpy(dst + sizeof(tl), &tail.fc_tid, sizeof(tail.fc_tid));
+	tail.fc_crc = cpu_to_le32(crc32_le(w->crc, w->bh->b_data,
+			dst + sizeof(tl) + offsetof(struct ext4_fc_tail, fc_crc) -
+			(u8 *)w->bh->b_data));
+	memcpy(dst + sizeof(tl) + offsetof(struct ext4_fc_tail, fc_crc),
+	       &tail.fc_crc, sizeof(tail.fc_crc));
+	w->off = bsize;
+
+	ext4_fc_submit_bh(w, true);
+	return 0;
+}
+
+/*
+ * Write out and wait for the data of the queued inodes before claiming
+ * the fast commit area: writeback starts handles, and a handle waiting
+ * for the running transaction to be locked never gets there while the
+ * commit thread waits for the fast commit to end. Nothing holds entries
+ * on the queue yet, so work on references to the inodes taken under
+ * s_fc_lock.
+ */
+static void ext4_fc_flush_data(struct ext4_sb_info *sbi)
+{
+	struct ext4_inode_info *ei;
+	struct inode **inodes, *inode;
+	unsigned int nr = 0, max = 0, i;
+
+	spin_lock(&sbi->s_fc_lock);
+	list_for_each_entry(ei, &sbi->s_fc_q, i_fc_list)
+		max++;
+	spin_unlock(&sbi->s_fc_lock);
+	if (!max)
+		return;
+
+	/* ext4_fc_wait_data() still catches what we miss here */
+	inodes = kmalloc_array(max, sizeof(*inodes), GFP_NOFS);
+	if (!inodes)
+		return;
+
+	spin_lock(&sbi->s_fc_lock);
+	list_for_each_entry(ei, &sbi->s_fc_q, i_fc_list) {
+		if (nr == max)
+			break;
+		inode = igrab(&ei->vfs_inode);
+		if (inode)
+			inodes[nr++] = inode;
+	}
+	spin_unlock(&sbi->s_fc_lock);
+
+	for (i = 0; i < nr; i++) {
+		filemap_fdatawrite(inodes[i]->i_mapping);
+		filemap_fdatawait_keep_errors(inodes[i]->i_mapping);
+		iput(inodes[i]);
+	}
+	kfree(inodes);
+}
+
+/*
+ * Wait for data writeback of the queued inodes: the logged ranges must not
+ * expose blocks whose contents never made it to disk. Blocks are only
+ * allocated by handles in delalloc mode, and writeback sets the pages
+ * under writeback before the handle stops, so once the updates are locked
+ * waiting is enough. After ext4_fc_flush_data() this only catches
+ * writeback started in the meantime. Write errors were already reported
+ * to the fsync caller and are left in place for the other users of the
+ * mappings.
+ */
+static void ext4_fc_wait_data(struct ext4_sb_info *sbi)
+{
+	struct ext4_inode_info *ei;
+
+	list_for_each_entry(ei, &sbi->s_fc_q, i_fc_list)
+		filemap_fdatawait_keep_errors(ei->vfs_inode.i_mapping);
+}
+
+/*
+ * Write one fast commit of transaction @tid. Called with the fast commit
+ * area claimed and s_fc_committing set, which keeps entries from being
+ * removed from the queues behind our back.
+ *
+ * Returns the number of blocks written, -EAGAIN if the transaction turned
+ * ineligible, or an error.
+ */
+static int ext4_fc_perform_commit(journal_t *journal, tid_t tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_writer w = { .sb = sb, .journal = journal };
+	struct ext4_fc_dentry_update *fcd, *fcd_n;
+	struct ext4_inode_info *ei, *ei_n;
+	struct ext4_fc_head head;
+	int ret, err;
+
+	/* With no handle running, the queues cannot change any more */
+	jbd2_journal_lock_updates(journal);
+
+	spin_lock(&sbi->s_fc_lock);
+	if (ext4_fc_is_ineligible(sbi, tid))
+		ret = -EAGAIN;
+	else if (list_empty(&sbi->s_fc_q) && list_empty(&sbi->s_fc_dentry_q))
+		ret = 0;
+	else
+		ret = 1;
+	spin_unlock(&sbi->s_fc_lock);
+	if (ret <= 0)
+		goto out_unlock;
+
+	ext4_fc_wait_data(sbi);
+	if (journal->j_fs_dev != journal->j_dev &&
+	    (journal->j_flags & JBD2_BARRIER))
+		blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
+
+	head.fc_features = 0;
+	head.fc_tid = cpu_to_le32(tid);
+	ret = ext4_fc_add_tlv(&w, EXT4_FC_TAG_HEAD, sizeof(head), &head);
+	if (ret)
+		goto out;
+
+	list_for_each_entry(fcd, &sbi->s_fc_dentry_q, fcd_list) {
+		ret = ext4_fc_write_dentry(&w, fcd);
+		if (ret)
+			goto out;
+	}
+	list_for_each_entry(ei, &sbi->s_fc_q, i_fc_list) {
+		ret = ext4_fc_write_inode_data(&w, &ei->vfs_inode);
+		if (!ret)
+			ret = ext4_fc_write_inode(&w, &ei->vfs_inode);
+		if (ret)
+			goto out;
+	}
+	ret = ext4_fc_write_tail(&w, tid);
+
+out:
+	/* Also drops a block we took but could not fill and submit */
+	err = jbd2_fc_wait_bufs(journal, w.nblks);
+	if (!ret)
+		ret = err;
+	if (!ret) {
+		spin_lock(&sbi->s_fc_lock);
+		list_for_each_entry_safe(ei, ei_n, &sbi->s_fc_q, i_fc_list) {
+			list_del_init(&ei->i_fc_list);
+			ei->i_fc_lblk_len = 0;
+		}
+		list_for_each_entry_safe(fcd, fcd_n, &sbi->s_fc_dentry_q,
+					 fcd_list) {
+			list_del(&fcd->fcd_list);
+			kfree(fcd);
+		}
+		spin_unlock(&sbi->s_fc_lock);
+		ret = w.nblks;
+	}
+out_unlock:
+	jbd2_journal_unlock_updates(journal);
+	return ret;
+}
+
+/*
+ * Make the changes of transaction @commit_tid durable, with a fast commit
+ * where possible and by waiting for a full commit otherwise.
+ */
+int ext4_fc_commit(journal_t *journal, tid_t commit_tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ktime_t start_time = ktime_get();
+	u64 commit_time;
+	int ret;
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT))
+		return jbd2_complete_transaction(journal, commit_tid);
+
+	ext4_fc_flush_data(sbi);
+
+	ret = jbd2_fc_begin_commit(journal, commit_tid);
+	if (ret == -EALREADY) {
+		/* A full commit got there first */
+		spin_lock(&sbi->s_fc_lock);
+		sbi->s_fc_stats.fc_skipped_commits++;
+		spin_unlock(&sbi->s_fc_lock);
+		return 0;
+	}
+	if (ret)
+		return jbd2_complete_transaction(journal, commit_tid);
+
+	spin_lock(&sbi->s_fc_lock);
+	if (ext4_fc_is_ineligible(sbi, commit_tid)) {
+		sbi->s_fc_stats.fc_ineligible_commits++;
+		spin_unlock(&sbi->s_fc_lock);
+		jbd2_fc_end_commit(journal);
+		return jbd2_complete_transaction(journal, commit_tid);
+	}
+	sbi->s_fc_committing = true;
+	spin_unlock(&sbi->s_fc_lock);
+
+	ret = ext4_fc_perform_commit(journal, commit_tid);
+
+	spin_lock(&sbi->s_fc_lock);
+	sbi->s_fc_committing = false;
+	if (ret > 0) {
+		commit_time = ktime_to_ns(ktime_sub(ktime_get(), start_time));
+		sbi->s_fc_stats.fc_num_commits++;
+		sbi->s_fc_stats.fc_numblks += ret;
+		if (likely(sbi->s_fc_stats.fc_avg_commit_time))
+			sbi->s_fc_stats.fc_avg_commit_time =
+				(commit_time +
+				 sbi->s_fc_stats.fc_avg_commit_time * 3) / 4;
+		else
+			sbi->s_fc_stats.fc_avg_commit_time = commit_time;
+	} else if (ret == 0) {
+		sbi->s_fc_stats.fc_skipped_commits++;
+	} else if (ret == -EAGAIN) {
+		sbi->s_fc_stats.fc_ineligible_commits++;
+	} else {
+		/*
+		 * The fast commit area may now hold a partial fast commit;
+		 * recovery stops there, so later fast commits of this
+		 * transaction would be lost.
+		 */
+		__ext4_fc_mark_ineligible(sbi, EXT4_FC_REASON_COMMIT_FAILED,
+					  commit_tid);
+		sbi->s_fc_stats.fc_failed_commits++;
+	}
+	spin_unlock(&sbi->s_fc_lock);
+	wake_up_all(&sbi->s_fc_wait);
+	jbd2_fc_end_commit(journal);
+
+	if (ret < 0)
+		return jbd2_complete_transaction(journal, commit_tid);
+	/*
+	 * Nothing left to log: the metadata is safe already, but the data
+	 * written by the caller may still sit in the disk cache.
+	 */
+	if (ret == 0 && (journal->j_flags & JBD2_BARRIER))
+		return blkdev_issue_flush(sb->s_bdev, GFP_KERNEL, NULL);
+	return 0;
+}
+
+/*
+ * Replay
+ */
+
+/*
+ * Recovery callback, called for each block of the fast commit area in
+ * order. Copies the blocks that hold complete fast commits of
+ * @expected_tid into the replay state.
+ */
+int ext4_fc_replay_scan(journal_t *journal, struct buffer_head *bh, int off,
+			tid_t expected_tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_fc_replay_state *state = &EXT4_SB(sb)->s_fc_replay_state;
+	int bsize = journal->j_blocksize;
+	struct ext4_fc_head head;
+	struct ext4_fc_tail tail;
+	struct ext4_fc_tl tl;
+	u8 *start, *cur, *end;
+	int len;
+	u32 crc;
+
+	if (off == 0) {
+		if (!state->fc_buf) {
+			state->fc_buf = ext4_kvzalloc((journal->j_fc_last -
+						       journal->j_fc_first) *
+						      bsize, GFP_KERNEL);
+			if (!state->fc_buf)
+				return -ENOMEM;
+		}
+		state->fc_valid_len = 0;
+		state->fc_crc = 0;
+		state->fc_in_commit = false;
+	}
+
+	start = state->fc_buf + off * bsize;
+	end = start + bsize;
+	memcpy(start, bh->b_data, bsize);
+
+	for (cur = start; cur + sizeof(tl) <= end;
+	     cur += sizeof(tl) + len) {
+		memcpy(&tl, cur, sizeof(tl));
+		len = le16_to_cpu(tl.fc_len);
+		if (cur + sizeof(tl) + len > end)
+			return 0;
+		/* A fast commit starts with a head at the start of a block */
+		if (!state->fc_in_commit &&
+		    (le16_to_cpu(tl.fc_tag) != EXT4_FC_TAG_HEAD || cur != start))
+			return 0;
+
+		switch (le16_to_cpu(tl.fc_tag)) {
+		case EXT4_FC_TAG_HEAD:
+			if (state->fc_in_commit || len != sizeof(head))
+				return 0;
+			memcpy(&head, cur + sizeof(tl), sizeof(head));
+			if (le32_to_cpu(head.fc_tid) != expected_tid ||
+			    head.fc_features)
+				return 0;
+			state->fc_in_commit = true;
+			state->fc_crc = 0;
+			break;
+		case EXT4_FC_TAG_TAIL:
+			if (len < sizeof(tail))
+				return 0;
+			memcpy(&tail, cur + sizeof(tl), sizeof(tail));
+			if (le32_to_cpu(tail.fc_tid) != expected_tid)
+				return 0;
+			crc = crc32_le(state->fc_crc, start,
+				       cur + sizeof(tl) +
+				       offsetof(struct ext4_fc_tail, fc_crc) -
+				       start);
+			if (crc != le32_to_cpu(tail.fc_crc))
+				return 0;
+			state->fc_in_commit = false;
+			state->fc_valid_len = (off + 1) * bsize;
+			journal->j_fc_replay_pending = true;
+			return 1;
+		case EXT4_FC_TAG_ADD_RANGE:
+			if (len != sizeof(struct ext4_fc_add_range))
+				return 0;
+			break;
+		case EXT4_FC_TAG_DEL_RANGE:
+			if (len != sizeof(struct ext4_fc_del_range))
+				return 0;
+			break;
+		case EXT4_FC_TAG_INODE:
+			if (len != sizeof(struct ext4_fc_inode))
+				return 0;
+			break;
+		case EXT4_FC_TAG_LINK:
+		case EXT4_FC_TAG_UNLINK:
+			if (len <= sizeof(struct ext4_fc_dentry_info) ||
+			    len > sizeof(struct ext4_fc_dentry_info) +
+				  EXT4_NAME_LEN)
+				return 0;
+			break;
+		case EXT4_FC_TAG_PAD:
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	state->fc_crc = crc32_le(state->fc_crc, start, bsize);
+	return 1;
+}
+
+/*
+ * Look up inode @ino for replay. Inodes that no longer exist are not an
+ * error: the record is skipped.
+ */
+static int ext4_fc_replay_iget(struct super_block *sb, unsigned long ino,
+			       struct inode **inodep)
+{
+	struct inode *inode;
+	int ret;
+
+	*inodep = NULL;
+	inode = ext4_iget(sb, ino, EXT4_IGET_NORMAL);
+	if (IS_ERR(inode)) {
+		ret = PTR_ERR(inode);
+		if (ret == -ESTALE || ret == -ENOENT || ret == -EFSCORRUPTED)
+			return 0;
+		return ret;
+	}
+	ret = dquot_initialize(inode);
+	if (ret) {
+		iput(inode);
+		return ret;
+	}
+	*inodep = inode;
+	return 0;
+}
+
+static bool ext4_fc_replay_inode_ok(struct inode *inode)
+{
+	return S_ISREG(inode->i_mode) &&
+		ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS);
+}
+
+/* Pass 1: claim the blocks of an ADD_RANGE before any extent is touched */
+static int ext4_fc_replay_mark_range(struct super_block *sb, u8 *val)
+{
+	struct ext4_fc_add_range range;
+	struct inode *inode;
+	ext4_fsblk_t pblk;
+	ext4_grpblk_t offset;
+	ext4_group_t group;
+	unsigned long len, count;
+	handle_t *handle;
+	int ret;
+
+	memcpy(&range, val, sizeof(range));
+	ret = ext4_fc_replay_iget(sb, le32_to_cpu(range.fc_ino), &inode);
+	if (ret || !inode)
+		return ret;
+
+	pblk = le64_to_cpu(range.fc_pblk);
+	len = le32_to_cpu(range.fc_len);
+	if (!ext4_fc_replay_inode_ok(inode) || !len ||
+	    !ext4_inode_block_valid(inode, pblk, len))
+		goto out;
+
+	while (len) {
+		ext4_get_group_no_and_offset(sb, pblk, &group, &offset);
+		count = min_t(unsigned long, len,
+			      EXT4_BLOCKS_PER_GROUP(sb) - offset);
+		handle = ext4_journal_start_sb(sb, EXT4_HT_MISC, 2);
+		if (IS_ERR(handle)) {
+			ret = PTR_ERR(handle);
+			break;
+		}
+		ret = ext4_mb_mark_bb(handle, sb, pblk, count);
+		ext4_journal_stop(handle);
+		if (ret)
+			break;
+		pblk += count;
+		len -= count;
+	}
+out:
+	iput(inode);
+	return ret;
+}
+
+static int ext4_fc_replay_punch(struct inode *inode, ext4_lblk_t lblk,
+				ext4_lblk_t len)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	handle_t *handle;
+	int ret;
+
+	handle = ext4_journal_start(inode, EXT4_HT_TRUNCATE,
+				    ext4_writepage_trans_blocks(inode));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	down_write(&ei->i_data_sem);
+	ext4_discard_preallocations(inode);
+	ret = ext4_es_remove_extent(inode, lblk, len);
+	if (!ret)
+		ret = ext4_ext_remove_space(inode, lblk, lblk + len - 1);
+	up_write(&ei->i_data_sem);
+	if (!ret)
+		ret = ext4_mark_inode_dirty(handle, inode);
+	ext4_journal_stop(handle);
+	return ret;
+}
+
+/* Map the hole at @lblk to @pblk with a single extent */
+static int ext4_fc_replay_insert(struct inode *inode, ext4_lblk_t lblk,
+				 ext4_fsblk_t pblk, ext4_lblk_t len,
+				 bool unwritten)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_ext_path *path;
+	struct ext4_extent newex;
+	handle_t *handle;
+	int ret;
+
+	handle = ext4_journal_start(inode, EXT4_HT_MAP_BLOCKS,
+				    ext4_chunk_trans_blocks(inode, len) +
+				    EXT4_QUOTA_TRANS_BLOCKS(inode->i_sb));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	newex.ee_block = cpu_to_le32(lblk);
+	newex.ee_len = cpu_to_le16(len);
+	ext4_ext_store_pblock(&newex, pblk);
+	if (unwritten)
+		ext4_ext_mark_unwritten(&newex);
+
+	down_write(&ei->i_data_sem);
+	ret = ext4_es_remove_extent(inode, lblk, len);
+	if (ret)
+		goto out_sem;
+	path = ext4_find_extent(inode, lblk, NULL, 0);
+	if (IS_ERR(path)) {
+		ret = PTR_ERR(path);
+		goto out_sem;
+	}
+	ret = ext4_ext_insert_extent(handle, inode, &path, &newex, 0);
+	ext4_ext_drop_refs(path);
+	kfree(path);
+out_sem:
+	up_write(&ei->i_data_sem);
+	if (!ret) {
+		/* The blocks were claimed in pass 1, charge them now */
+		dquot_alloc_block_nofail(inode, len);
+		ret = ext4_mark_inode_dirty(handle, inode);
+	}
+	ext4_journal_stop(handle);
+	return ret;
+}
+
+static int ext4_fc_replay_add_range(struct super_block *sb, u8 *val)
+{
+	struct ext4_fc_add_range range;
+	struct ext4_map_blocks map;
+	struct inode *inode;
+	ext4_lblk_t lblk, len, done, n;
+	ext4_fsblk_t pblk;
+	bool unwritten;
+	int ret;
+
+	memcpy(&range, val, sizeof(range));
+	ret = ext4_fc_replay_iget(sb, le32_to_cpu(range.fc_ino), &inode);
+	if (ret || !inode)
+		return ret;
+
+	lblk = le32_to_cpu(range.fc_lblk);
+	len = le32_to_cpu(range.fc_len);
+	pblk = le64_to_cpu(range.fc_pblk);
+	unwritten = le32_to_cpu(range.fc_flags) & EXT4_FC_RANGE_UNWRITTEN;
+	if (!ext4_fc_replay_inode_ok(inode) || !len ||
+	    len > (unwritten ? EXT_UNWRITTEN_MAX_LEN : EXT_INIT_MAX_LEN) ||
+	    lblk + len - 1 < lblk ||
+	    !ext4_inode_block_valid(inode, pblk, len))
+		goto out;
+
+	for (done = 0; done < len; done += n) {
+		map.m_lblk = lblk + done;
+		map.m_len = len - done;
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			break;
+		if (ret == 0) {
+			n = map.m_len ? min(map.m_len, len - done) : len - done;
+			ret = ext4_fc_replay_insert(inode, map.m_lblk,
+						    pblk + done, n, unwritten);
+		} else if (map.m_pblk == pblk + done) {
+			n = ret;
+			ret = 0;
+			if ((map.m_flags & EXT4_MAP_UNWRITTEN) && !unwritten)
+				ret = ext4_convert_unwritten_extents(NULL,
+					inode,
+					(loff_t)map.m_lblk << inode->i_blkbits,
+					(ssize_t)n << inode->i_blkbits);
+		} else {
+			/* Mapped elsewhere before the transaction */
+			n = ret;
+			ret = ext4_fc_replay_punch(inode, map.m_lblk, n);
+			if (!ret)
+				ret = ext4_fc_replay_insert(inode, map.m_lblk,
+							    pblk + done, n,
+							    unwritten);
+		}
+		if (ret)
+			break;
+	}
+out:
+	iput(inode);
+	return ret;
+}
+
+static int ext4_fc_replay_del_range(struct super_block *sb, u8 *val)
+{
+	struct ext4_fc_del_range range;
+	struct inode *inode;
+	ext4_lblk_t lblk, len;
+	int ret;
+
+	memcpy(&range, val, sizeof(range));
+	ret = ext4_fc_replay_iget(sb, le32_to_cpu(range.fc_ino), &inode);
+	if (ret || !inode)
+		return ret;
+
+	lblk = le32_to_cpu(range.fc_lblk);
+	len = le32_to_cpu(range.fc_len);
+	if (lblk >= EXT_MAX_BLOCKS - 1)
+		goto out;
+	len = min(len, EXT_MAX_BLOCKS - 1 - lblk);
+	if (ext4_fc_replay_inode_ok(inode) && len)
+		ret = ext4_fc_replay_punch(inode, lblk, len);
+out:
+	iput(inode);
+	return ret;
+}
+
+static int ext4_fc_replay_dentry(struct super_block *sb, int tag, u8 *val,
+				 int len)
+{
+	struct ext4_fc_dentry_info info;
+	struct inode *dir = NULL, *inode = NULL;
+	struct qstr d_name;
+	handle_t *handle;
+	int ret;
+
+	memcpy(&info, val, sizeof(info));
+	d_name.name = val + sizeof(info);
+	d_name.len = len - sizeof(info);
+
+	ret = ext4_fc_replay_iget(sb, le32_to_cpu(info.fc_parent_ino), &dir);
+	if (ret || !dir)
+		return ret;
+	ret = ext4_fc_replay_iget(sb, le32_to_cpu(info.fc_ino), &inode);
+	if (ret || !inode)
+		goto out;
+	if (!S_ISDIR(dir->i_mode) || S_ISDIR(inode->i_mode))
+		goto out;
+
+	handle = ext4_journal_start(dir, EXT4_HT_DIR,
+			(EXT4_DATA_TRANS_BLOCKS(sb) +
+			 EXT4_INDEX_EXTRA_TRANS_BLOCKS) + 1);
+	if (IS_ERR(handle)) {
+		ret = PTR_ERR(handle);
+		goto out;
+	}
+	if (tag == EXT4_FC_TAG_LINK) {
+		ret = __ext4_link(handle, dir, &d_name, inode);
+		if (ret == -EEXIST)
+			ret = 0;
+	} else {
+		ret = __ext4_unlink(handle, dir, &d_name, inode);
+		if (ret == -ENOENT)
+			ret = 0;
+	}
+	ext4_journal_stop(handle);
+out:
+	/* An inode whose last link went away is deleted here */
+	iput(inode);
+	iput(dir);
+	return ret;
+}
+
+static int ext4_fc_replay_inode(struct super_block *sb, u8 *val)
+{
+	struct ext4_fc_inode raw;
+	struct ext4_inode_info *ei;
+	struct inode *inode;
+	handle_t *handle;
+	u32 mask;
+	int ret;
+
+	memcpy(&raw, val, sizeof(raw));
+	ret = ext4_fc_replay_iget(sb, le32_to_cpu(raw.fc_ino), &inode);
+	if (ret || !inode)
+		return ret;
+	ei = EXT4_I(inode);
+	if (!ext4_fc_replay_inode_ok(inode))
+		goto out;
+
+	handle = ext4_journal_start(inode, EXT4_HT_INODE, 1);
+	if (IS_ERR(handle)) {
+		ret = PTR_ERR(handle);
+		goto out;
+	}
+	inode->i_mode = (inode->i_mode & S_IFMT) |
+			(le16_to_cpu(raw.fc_mode) & ~S_IFMT);
+	i_uid_write(inode, le32_to_cpu(raw.fc_uid));
+	i_gid_write(inode, le32_to_cpu(raw.fc_gid));
+	i_size_write(inode, le64_to_cpu(raw.fc_size));
+	ei->i_disksize = le64_to_cpu(raw.fc_size);
+	inode->i_atime.tv_sec = (signed)le32_to_cpu(raw.fc_atime);
+	inode->i_atime.tv_nsec = le32_to_cpu(raw.fc_atime_nsec);
+	inode->i_mtime.tv_sec = (signed)le32_to_cpu(raw.fc_mtime);
+	inode->i_mtime.tv_nsec = le32_to_cpu(raw.fc_mtime_nsec);
+	inode->i_ctime.tv_sec = (signed)le32_to_cpu(raw.fc_ctime);
+	inode->i_ctime.tv_nsec = le32_to_cpu(raw.fc_ctime_nsec);
+	inode->i_generation = le32_to_cpu(raw.fc_generation);
+	/* The mapping format is not the fast commit's to change */
+	mask = EXT4_FL_USER_MODIFIABLE & ~EXT4_EXTENTS_FL;
+	ei->i_flags = (ei->i_flags & ~mask) |
+		      (le32_to_cpu(raw.fc_flags) & mask);
+	ext4_set_inode_flags(inode);
+	ret = ext4_mark_inode_dirty(handle, inode);
+	ext4_journal_stop(handle);
+out:
+	iput(inode);
+	return ret;
+}
+
+/*
+ * Walk the valid fast commits in log order. Pass 1 only claims the blocks
+ * of all logged ranges, so that extent tree blocks allocated by pass 2
+ * cannot land on them.
+ */
+static int ext4_fc_replay_pass(struct super_block *sb, bool mark_blocks)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_replay_state *state = &sbi->s_fc_replay_state;
+	int bsize = sbi->s_journal->j_blocksize;
+	u8 *blk, *cur, *val;
+	struct ext4_fc_tl tl;
+	int tag, len, ret;
+
+	for (blk = state->fc_buf; blk < state->fc_buf + state->fc_valid_len;
+	     blk += bsize) {
+		for (cur = blk; cur + sizeof(tl) <= blk + bsize;
+		     cur += sizeof(tl) + len) {
+			memcpy(&tl, cur, sizeof(tl));
+			tag = le16_to_cpu(tl.fc_tag);
+			len = le16_to_cpu(tl.fc_len);
+			val = cur + sizeof(tl);
+
+			if (mark_blocks) {
+				ret = tag == EXT4_FC_TAG_ADD_RANGE ?
+					ext4_fc_replay_mark_range(sb, val) : 0;
+			} else {
+				switch (tag) {
+				case EXT4_FC_TAG_ADD_RANGE:
+					ret = ext4_fc_replay_add_range(sb, val);
+					break;
+				case EXT4_FC_TAG_DEL_RANGE:
+					ret = ext4_fc_replay_del_range(sb, val);
+					break;
+				case EXT4_FC_TAG_LINK:
+				case EXT4_FC_TAG_UNLINK:
+					ret = ext4_fc_replay_dentry(sb, tag,
+								    val, len);
+					break;
+				case EXT4_FC_TAG_INODE:
+					ret = ext4_fc_replay_inode(sb, val);
+					break;
+				default:
+					ret = 0;
+					continue;
+				}
+				sbi->s_fc_stats.fc_replayed_tags++;
+			}
+			if (ret)
+				return ret;
+			if (tag == EXT4_FC_TAG_TAIL)
+				break;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Apply the fast commits found by journal recovery. Needs the block
+ * allocator, so it runs late in the mount. A failed replay leaves the file
+ * system to fsck: applying the same records over later changes on the next
+ * mount would be worse.
+ */
+int ext4_fc_replay(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_replay_state *state = &sbi->s_fc_replay_state;
+	journal_t *journal = sbi->s_journal;
+	unsigned long s_flags = sb->s_flags;
+	int ret = 0;
+
+	if (!journal || !journal->j_fc_replay_pending || !state->fc_buf)
+		goto out;
+	if (bdev_read_only(sb->s_bdev)) {
+		ext4_msg(sb, KERN_WARNING, "write access unavailable, "
+			 "skipping fast commit replay");
+		goto out;
+	}
+	if (ext4_has_feature_bigalloc(sb)) {
+		ext4_msg(sb, KERN_ERR, "fast commit replay is not supported "
+			 "with bigalloc");
+		ret = -EOPNOTSUPP;
+		goto done;
+	}
+
+	sb->s_flags &= ~MS_RDONLY;
+	sbi->s_mount_state |= EXT4_FC_REPLAY;
+	ret = ext4_fc_replay_pass(sb, true);
+	if (!ret)
+		ret = ext4_fc_replay_pass(sb, false);
+	if (!ret)
+		ret = jbd2_journal_force_commit(journal);
+	sbi->s_mount_state &= ~EXT4_FC_REPLAY;
+	sb->s_flags = s_flags;
+
+done:
+	if (ret)
+		ext4_error(sb, "fast commit replay failed: %d", ret);
+	else
+		ext4_msg(sb, KERN_INFO, "replayed %lu fast commit records",
+			 sbi->s_fc_stats.fc_replayed_tags);
+	jbd2_fc_replay_done(journal);
+out:
+	kvfree(state->fc_buf);
+	state->fc_buf = NULL;
+	return ret;
+}
+
+/*
+ * Setup and statistics
+ */
+
+void ext4_fc_init(struct super_block *sb, journal_t *journal)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	INIT_LIST_HEAD(&sbi->s_fc_q);
+	INIT_LIST_HEAD(&sbi->s_fc_dentry_q);
+	spin_lock_init(&sbi->s_fc_lock);
+	init_waitqueue_head(&sbi->s_fc_wait);
+	sbi->s_fc_committing = false;
+	sbi->s_fc_ineligible = false;
+
+	if (!journal || !ext4_has_feature_fast_commit(sb))
+		return;
+	if (test_opt(sb, DATA_FLAGS) != EXT4_MOUNT_ORDERED_DATA ||
+	    !test_opt(sb, DELALLOC) || ext4_has_feature_bigalloc(sb)) {
+		ext4_msg(sb, KERN_INFO, "fast commits need data=ordered, "
+			 "delalloc and no bigalloc, disabled");
+		return;
+	}
+	if (!jbd2_has_feature_fast_commit(journal) &&
+	    ((sb->s_flags & MS_RDONLY) ||
+	     !jbd2_journal_set_features(journal, 0, 0,
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT))) {
+		ext4_msg(sb, KERN_INFO, "journal fast commit area unavailable, "
+			 "fast commits disabled");
+		return;
+	}
+
+	journal->j_fc_cleanup_callback = ext4_fc_cleanup;
+	set_opt2(sb, JOURNAL_FAST_COMMIT);
+}
+
+void ext4_fc_destroy(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_dentry_update *fcd, *fcd_n;
+
+	kvfree(sbi->s_fc_replay_state.fc_buf);
+	sbi->s_fc_replay_state.fc_buf = NULL;
+
+	if (!test_opt2(sb, JOURNAL_FAST_COMMIT))
+		return;
+	list_for_each_entry_safe(fcd, fcd_n, &sbi->s_fc_dentry_q, fcd_list) {
+		list_del(&fcd->fcd_list);
+		kfree(fcd);
+	}
+}
+
+int ext4_seq_fc_info_show(struct seq_file *seq, void *v)
+{
+	struct super_block *sb = seq->private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_stats stats;
+	int i;
+
+	if (v != SEQ_START_TOKEN)
+		return 0;
+
+	spin_lock(&sbi->s_fc_lock);
+	stats = sbi->s_fc_stats;
+	spin_unlock(&sbi->s_fc_lock);
+
+	seq_printf(seq, "fast commit: %s\n",
+		   test_opt2(sb, JOURNAL_FAST_COMMIT) ? "enabled" : "disabled");
+	seq_printf(seq, "stats:\n  %lu fast commits\n  %lu blocks\n"
+		   "  %llu us average fast commit time\n",
+		   stats.fc_num_commits, stats.fc_numblks,
+		   div_u64(stats.fc_avg_commit_time, 1000));
+	seq_printf(seq, "  %lu full commits\n  %lu ineligible fsyncs\n"
+		   "  %lu failed fast commits\n  %lu skipped fast commits\n",
+		   stats.fc_full_commits, stats.fc_ineligible_commits,
+		   stats.fc_failed_commits, stats.fc_skipped_commits);
+	seq_printf(seq, "  %lu records replayed\n", stats.fc_replayed_tags);
+	seq_puts(seq, "ineligible reasons:\n");
+	for (i = 0; i < EXT4_FC_REASON_MAX; i++)
+		seq_printf(seq, "  %u %s\n", stats.fc_ineligible_reason_count[i],
+			   fc_ineligible_reasons[i]);
+	return 0;
+}
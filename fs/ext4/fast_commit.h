@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ *  fs/ext4/fast_commit.h
+ *
+ * Definitions for the ext4 fast commit log.
+ */
+
+#ifndef __FAST_COMMIT_H__
+#define __FAST_COMMIT_H__
+
+/*
+ * A fast commit is a compact logical record of the changes made by the
+ * running transaction to a few inodes, written to the fast commit area at
+ * the end of the journal on fsync instead of committing the whole
+ * transaction. The on-disk format is a stream of tag-length-value records:
+ *
+ *	HEAD, { LINK | UNLINK }, { { ADD_RANGE | DEL_RANGE }, INODE }, TAIL
+ *
+ * Records never straddle a block boundary; the unused end of a block is
+ * filled with a PAD record, or skipped when it is smaller than a tag.
+ * Every fast commit starts on a fresh block and its TAIL covers the rest of
+ * its last block. The TAIL carries a crc32 of all records of the fast
+ * commit up to and including the TAIL's tid.
+ *
+ * Only inodes that already exist in the last full commit can be described
+ * this way. Creating inodes, renames, xattr updates and the like mark the
+ * running transaction ineligible, and fsync then waits for a full commit.
+ *
+ * The tags and records are not those of the upstream fast commit format,
+ * which is why the feature uses private ext4 and jbd2 feature bits.
+ */
+
+/* Fast commit tags */
+#define EXT4_FC_TAG_ADD_RANGE		0x0001
+#define EXT4_FC_TAG_DEL_RANGE		0x0002
+#define EXT4_FC_TAG_LINK		0x0003
+#define EXT4_FC_TAG_UNLINK		0x0004
+#define EXT4_FC_TAG_INODE		0x0005
+#define EXT4_FC_TAG_PAD			0x0006
+#define EXT4_FC_TAG_TAIL		0x0007
+#define EXT4_FC_TAG_HEAD		0x0008
+
+/* Fast commit on-disk tag-length structure */
+struct ext4_fc_tl {
+	__le16 fc_tag;
+	__le16 fc_len;
+};
+
+/* Value structure for tag EXT4_FC_TAG_HEAD */
+struct ext4_fc_head {
+	__le32 fc_features;
+	__le32 fc_tid;
+};
+
+/* Flags for struct ext4_fc_add_range */
+#define EXT4_FC_RANGE_UNWRITTEN		0x0001
+
+/* Value structure for tag EXT4_FC_TAG_ADD_RANGE */
+struct ext4_fc_add_range {
+	__le32 fc_ino;
+	__le32 fc_lblk;
+	__le32 fc_len;
+	__le32 fc_flags;
+	__le64 fc_pblk;
+};
+
+/* Value structure for tag EXT4_FC_TAG_DEL_RANGE */
+struct ext4_fc_del_range {
+	__le32 fc_ino;
+	__le32 fc_lblk;
+	__le32 fc_len;
+};
+
+/* Value structure for tags EXT4_FC_TAG_LINK and EXT4_FC_TAG_UNLINK */
+struct ext4_fc_dentry_info {
+	__le32 fc_parent_ino;
+	__le32 fc_ino;
+	__u8 fc_dname[0];
+};
+
+/* Value structure for tag EXT4_FC_TAG_INODE */
+struct ext4_fc_inode {
+	__le32 fc_ino;
+	__le16 fc_mode;
+	__le16 fc_pad;
+	__le32 fc_uid;
+	__le32 fc_gid;
+	__le64 fc_size;
+	__le32 fc_atime;
+	__le32 fc_atime_nsec;
+	__le32 fc_mtime;
+	__le32 fc_mtime_nsec;
+	__le32 fc_ctime;
+	__le32 fc_ctime_nsec;
+	__le32 fc_generation;
+	__le32 fc_flags;
+};
+
+/* Value structure for tag EXT4_FC_TAG_TAIL */
+struct ext4_fc_tail {
+	__le32 fc_tid;
+	__le32 fc_crc;
+};
+
+/*
+ * Reasons a transaction could not be committed with a fast commit. The
+ * fsync then falls back to a full jbd2 commit.
+ */
+enum {
+	EXT4_FC_REASON_XATTR = 0,
+	EXT4_FC_REASON_RENAME,
+	EXT4_FC_REASON_DIR_OP,
+	EXT4_FC_REASON_JOURNAL_FLAG_CHANGE,
+	EXT4_FC_REASON_NOMEM,
+	EXT4_FC_REASON_SWAP_BOOT,
+	EXT4_FC_REASON_RESIZE,
+	EXT4_FC_REASON_FALLOC_RANGE,
+	EXT4_FC_REASON_EXTENT_SWAP,
+	EXT4_FC_REASON_INODE_JOURNAL_DATA,
+	EXT4_FC_REASON_UNSUPPORTED_INODE,
+	EXT4_FC_REASON_ENCRYPTED_FILENAME,
+	EXT4_FC_REASON_COMMIT_FAILED,
+	EXT4_FC_REASON_NEW_INODE,
+	EXT4_FC_REASON_INODE_EVICTED,
+	EXT4_FC_REASON_MAX
+};
+
+struct ext4_fc_stats {
+	unsigned int fc_ineligible_reason_count[EXT4_FC_REASON_MAX];
+	unsigned long fc_num_commits;		/* fast commits written */
+	unsigned long fc_ineligible_commits;	/* fallbacks, ineligible */
+	unsigned long fc_failed_commits;	/* fallbacks, write failed */
+	unsigned long fc_skipped_commits;	/* tid already committed */
+	unsigned long fc_full_commits;		/* full jbd2 commits */
+	unsigned long fc_numblks;		/* fast commit blocks written */
+	u64 fc_avg_commit_time;			/* in ns */
+	unsigned long fc_replayed_tags;		/* records applied at mount */
+};
+
+/* Directory entry update queued for the next fast commit */
+struct ext4_fc_dentry_update {
+	struct list_head fcd_list;
+	int fcd_op;			/* EXT4_FC_TAG_{LINK,UNLINK} */
+	tid_t fcd_tid;			/* Transaction of the update */
+	unsigned long fcd_parent;	/* Parent directory inode number */
+	unsigned long fcd_ino;		/* Inode number */
+	unsigned int fcd_name_len;
+	unsigned char fcd_name[0];	/* Entry name */
+};
+
+/* Fast commit area contents found by journal recovery */
+struct ext4_fc_replay_state {
+	u8 *fc_buf;			/* Copy of the fast commit area */
+	int fc_valid_len;		/* Bytes up to the last valid tail */
+	u32 fc_crc;			/* Running crc of the open fast commit */
+	bool fc_in_commit;		/* HEAD seen, TAIL not yet */
+};
+
+#endif /* __FAST_COMMIT_H__ */
@@ -903,6 +903,7 @@ struct inode *__ext4_new_inode(handle_t *handle, struct inode *dir,
 	goto out;
 
 got:
+	ext4_fc_mark_ineligible(sb, EXT4_FC_REASON_NEW_INODE, handle);
 	BUFFER_TRACE(inode_bitmap_bh, "call ext4_handle_dirty_metadata");
 	err = ext4_handle_dirty_metadata(handle, NULL, inode_bitmap_bh);
 	if (err) {
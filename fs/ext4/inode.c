@@ -191,6 +191,8 @@ void ext4_evict_inode(struct inode *inode)
 
 	trace_ext4_evict_inode(inode);
 
+	ext4_fc_del(inode);
+
 	if (inode->i_nlink) {
 		/*
 		 * When journalling data dirty buffers are tracked only in the
@@ -598,6 +600,11 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 	 */
 	map->m_flags &= ~EXT4_MAP_FLAGS;
 
+	/* Fast commits cannot express written extents turning unwritten */
+	if (flags & EXT4_GET_BLOCKS_CONVERT_UNWRITTEN)
+		ext4_fc_mark_ineligible(inode->i_sb,
+					EXT4_FC_REASON_FALLOC_RANGE, handle);
+
 	/*
 	 * New blocks allocate and/or writing to unwritten extent
 	 * will possibly result in updating i_data, so we take
@@ -696,6 +703,9 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 
 out_sem:
 	up_write((&EXT4_I(inode)->i_data_sem));
+	if (retval > 0)
+		ext4_fc_track_range(handle, inode, map->m_lblk,
+				    map->m_lblk + map->m_len - 1);
 	if (retval > 0 && map->m_flags & EXT4_MAP_MAPPED) {
 		ret = check_block_validity(inode, map);
 		if (ret != 0)
@@ -5529,6 +5539,8 @@ int ext4_mark_iloc_dirty(handle_t *handle,
 	if (IS_I_VERSION(inode))
 		inode_inc_iversion(inode);
 
+	ext4_fc_track_inode(handle, inode);
+
 	/* the do_update_inode consumes one bh->b_count */
 	get_bh(iloc->bh);
 
@@ -5815,6 +5827,8 @@ int ext4_change_inode_journal_flag(struct inode *inode, int val)
 	if (IS_ERR(handle))
 		return PTR_ERR(handle);
 
+	ext4_fc_mark_ineligible(inode->i_sb,
+				EXT4_FC_REASON_JOURNAL_FLAG_CHANGE, handle);
 	err = ext4_mark_inode_dirty(handle, inode);
 	ext4_handle_sync(handle);
 	ext4_journal_stop(handle);
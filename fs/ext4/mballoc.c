@@ -700,23 +700,103 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the matching s_mb_largest_free_orders list.
+ * Must be called under group lock.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
 	int i;
-	int bits;
-
-	grp->bb_largest_free_order = -1; /* uninit */
+	int new_order = -1; /* uninit */
 
-	bits = sb->s_blocksize_bits + 1;
-	for (i = bits; i >= 0; i--) {
+	for (i = MB_NUM_ORDERS(sb) - 1; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
-			grp->bb_largest_free_order = i;
+			new_order = i;
 			break;
 		}
 	}
+
+	if (new_order == grp->bb_largest_free_order &&
+	    (new_order < 0 || !list_empty(&grp->bb_largest_free_order_node)))
+		return;
+
+	if (!list_empty(&grp->bb_largest_free_order_node)) {
+		i = grp->bb_largest_free_order;
+		write_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+	grp->bb_largest_free_order = new_order;
+	if (new_order >= 0) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[new_order]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[new_order]);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[new_order]);
+	}
+}
+
+static inline ext4_grpblk_t
+mb_avg_fragment_size(struct ext4_group_info *grp)
+{
+	return grp->bb_fragments ? grp->bb_free / grp->bb_fragments : 0;
+}
+
+/*
+ * Groups in s_mb_avg_fragment_size_root are ordered by the average size of
+ * their free fragments, ties broken by group number. The key is cached in
+ * bb_avg_fragment_size so that it stays stable while the group's counters
+ * change under the group lock only.
+ */
+static int mb_avg_fragment_size_cmp(struct ext4_group_info *a,
+				    struct ext4_group_info *b)
+{
+	if (a->bb_avg_fragment_size != b->bb_avg_fragment_size)
+		return a->bb_avg_fragment_size < b->bb_avg_fragment_size ?
+			-1 : 1;
+	if (a->bb_group != b->bb_group)
+		return a->bb_group < b->bb_group ? -1 : 1;
+	return 0;
+}
+
+/* Reposition the group in the average fragment size tree, under group lock */
+static void
+mb_update_avg_fragment_size(struct super_block *sb, struct ext4_group_info *grp)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct rb_node **link, *parent = NULL;
+	struct ext4_group_info *cur;
+	ext4_grpblk_t avg = mb_avg_fragment_size(grp);
+	bool linked = !RB_EMPTY_NODE(&grp->bb_avg_fragment_size_rb);
+
+	if (linked ? avg == grp->bb_avg_fragment_size : avg == 0)
+		return;
+
+	write_lock(&sbi->s_mb_rb_lock);
+	if (linked) {
+		rb_erase(&grp->bb_avg_fragment_size_rb,
+			 &sbi->s_mb_avg_fragment_size_root);
+		RB_CLEAR_NODE(&grp->bb_avg_fragment_size_rb);
+	}
+	grp->bb_avg_fragment_size = avg;
+	if (avg == 0)
+		goto out;
+
+	link = &sbi->s_mb_avg_fragment_size_root.rb_node;
+	while (*link) {
+		parent = *link;
+		cur = rb_entry(parent, struct ext4_group_info,
+			       bb_avg_fragment_size_rb);
+		if (mb_avg_fragment_size_cmp(grp, cur) < 0)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&grp->bb_avg_fragment_size_rb, parent, link);
+	rb_insert_color(&grp->bb_avg_fragment_size_rb,
+			&sbi->s_mb_avg_fragment_size_root);
+out:
+	write_unlock(&sbi->s_mb_rb_lock);
 }
 
 static noinline_for_stack
@@ -768,8 +848,10 @@ void ext4_mb_generate_buddy(struct super_block *sb,
 		set_bit(EXT4_GROUP_INFO_BBITMAP_CORRUPT_BIT, &grp->bb_state);
 	}
 	mb_set_largest_free_order(sb, grp);
+	mb_update_avg_fragment_size(sb, grp);
 
-	clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state));
+	if (test_and_clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state)))
+		atomic_dec(&sbi->s_mb_groups_need_init);
 
 	period = get_cycles() - period;
 	spin_lock(&EXT4_SB(sb)->s_bal_lock);
@@ -1505,6 +1587,7 @@ static void mb_free_blocks(struct inode *inode, struct ext4_buddy *e4b,
 
 done:
 	mb_set_largest_free_order(sb, e4b->bd_info);
+	mb_update_avg_fragment_size(sb, e4b->bd_info);
 	mb_check_buddy(e4b);
 }
 
@@ -1629,6 +1712,7 @@ static int mb_mark_used(struct ext4_buddy *e4b, struct ext4_free_extent *ex)
 		e4b->bd_info->bb_counters[ord]++;
 	}
 	mb_set_largest_free_order(e4b->bd_sb, e4b->bd_info);
+	mb_update_avg_fragment_size(e4b->bd_sb, e4b->bd_info);
 
 	ext4_set_bits(e4b->bd_bitmap, ex->fe_start, len0);
 	mb_check_buddy(e4b);
@@ -2101,6 +2185,182 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Try to allocate from @group with criterion @cr. Unsuitable groups are
+ * skipped, remembering the first error of the suitability check in
+ * @first_err; only failing to load the buddy is returned as an error.
+ */
+static int ext4_mb_scan_group(struct ext4_allocation_context *ac,
+			      ext4_group_t group, int cr, int *first_err)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_buddy e4b;
+	int ret, err;
+
+	ac->ac_groups_considered++;
+
+	/* This now checks without needing the buddy page */
+	ret = ext4_mb_good_group(ac, group, cr);
+	if (ret <= 0) {
+		if (!*first_err)
+			*first_err = ret;
+		return 0;
+	}
+
+	err = ext4_mb_load_buddy(sb, group, &e4b);
+	if (err)
+		return err;
+
+	ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	ret = ext4_mb_good_group(ac, group, cr);
+	if (ret <= 0) {
+		ext4_unlock_group(sb, group);
+		ext4_mb_unload_buddy(&e4b);
+		if (!*first_err)
+			*first_err = ret;
+		return 0;
+	}
+
+	ac->ac_groups_scanned++;
+	if (cr == 0)
+		ext4_mb_simple_scan_group(ac, &e4b);
+	else if (cr == 1 && sbi->s_stripe &&
+			!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+		ext4_mb_scan_aligned(ac, &e4b);
+	else
+		ext4_mb_complex_scan_group(ac, &e4b);
+
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(&e4b);
+	return 0;
+}
+
+/*
+ * Criteria 0 and 1 can take their groups from the largest free order
+ * lists and the average fragment size tree. Groups only enter those once
+ * their buddy has been loaded; the ones that never were are handled by
+ * ext4_mb_scan_uninit_groups().
+ */
+static bool ext4_mb_should_optimize_scan(struct ext4_allocation_context *ac,
+					 int cr)
+{
+	return cr < 2 && EXT4_SB(ac->ac_sb)->s_mb_optimize_scan;
+}
+
+/*
+ * Linear scan of the groups whose buddy has never been loaded, so that
+ * they are not left out by the indexes. Full groups, and at criteria 0
+ * and 1 groups with too few free clusters, are skipped by
+ * ext4_mb_good_group() without being initialized, so on full or
+ * fragmented file systems some groups may stay out of the indexes for
+ * good; checking them costs a bit test each.
+ */
+static int ext4_mb_scan_uninit_groups(struct ext4_allocation_context *ac,
+				      ext4_group_t ngroups, int cr,
+				      int *first_err)
+{
+	struct super_block *sb = ac->ac_sb;
+	ext4_group_t group = ac->ac_g_ex.fe_group;
+	ext4_group_t i;
+	int err;
+
+	for (i = 0; i < ngroups; group++, i++) {
+		if (!atomic_read(&EXT4_SB(sb)->s_mb_groups_need_init))
+			break;
+		if (group >= ngroups)
+			group = 0;
+		if (!EXT4_MB_GRP_NEED_INIT(ext4_get_group_info(sb, group)))
+			continue;
+
+		cond_resched();
+		err = ext4_mb_scan_group(ac, group, cr, first_err);
+		if (err)
+			return err;
+		if (ac->ac_status != AC_STATUS_CONTINUE)
+			break;
+	}
+	return 0;
+}
+
+/*
+ * Collect groups whose largest free extent is at least 2^ac_2order,
+ * preferring the smallest sufficient order to keep large extents for
+ * large requests. Indexed groups are initialized, so checking them
+ * cannot sleep.
+ */
+static int ext4_mb_find_groups_cr0(struct ext4_allocation_context *ac,
+				   ext4_group_t ngroups, ext4_group_t *groups)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_group_info *grp;
+	int i, nr = 0;
+
+	for (i = ac->ac_2order; i < MB_NUM_ORDERS(sb); i++) {
+		if (list_empty(&sbi->s_mb_largest_free_orders[i]))
+			continue;
+		read_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_for_each_entry(grp, &sbi->s_mb_largest_free_orders[i],
+				    bb_largest_free_order_node) {
+			ac->ac_groups_considered++;
+			if (grp->bb_group >= ngroups ||
+			    ext4_mb_good_group(ac, grp->bb_group, 0) <= 0)
+				continue;
+			groups[nr++] = grp->bb_group;
+			if (nr == MB_OPTIMIZE_SCAN_BATCH)
+				break;
+		}
+		read_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+		if (nr == MB_OPTIMIZE_SCAN_BATCH)
+			break;
+	}
+	return nr;
+}
+
+/*
+ * Collect groups whose average free fragment is at least the goal length,
+ * smallest average first.
+ */
+static int ext4_mb_find_groups_cr1(struct ext4_allocation_context *ac,
+				   ext4_group_t ngroups, ext4_group_t *groups)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+	struct rb_node *node, *found = NULL;
+	struct ext4_group_info *grp;
+	int nr = 0;
+
+	read_lock(&sbi->s_mb_rb_lock);
+	node = sbi->s_mb_avg_fragment_size_root.rb_node;
+	while (node) {
+		grp = rb_entry(node, struct ext4_group_info,
+			       bb_avg_fragment_size_rb);
+		if (grp->bb_avg_fragment_size >= ac->ac_g_ex.fe_len) {
+			found = node;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+	for (node = found; node && nr < MB_OPTIMIZE_SCAN_BATCH;
+	     node = rb_next(node)) {
+		grp = rb_entry(node, struct ext4_group_info,
+			       bb_avg_fragment_size_rb);
+		ac->ac_groups_considered++;
+		if (grp->bb_group >= ngroups ||
+		    ext4_mb_good_group(ac, grp->bb_group, 1) <= 0)
+			continue;
+		groups[nr++] = grp->bb_group;
+	}
+	read_unlock(&sbi->s_mb_rb_lock);
+	return nr;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
@@ -2169,6 +2429,36 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 repeat:
 	for (; cr < 4 && ac->ac_status == AC_STATUS_CONTINUE; cr++) {
 		ac->ac_criteria = cr;
+
+		if (ext4_mb_should_optimize_scan(ac, cr)) {
+			ext4_group_t groups[MB_OPTIMIZE_SCAN_BATCH];
+			int nr;
+
+			if (cr == 0)
+				nr = ext4_mb_find_groups_cr0(ac, ngroups, groups);
+			else
+				nr = ext4_mb_find_groups_cr1(ac, ngroups, groups);
+			if (sbi->s_mb_stats)
+				atomic_add(nr, &sbi->s_bal_optimized);
+
+			for (i = 0; i < nr; i++) {
+				cond_resched();
+				err = ext4_mb_scan_group(ac, groups[i], cr,
+							 &first_err);
+				if (err)
+					goto out;
+				if (ac->ac_status != AC_STATUS_CONTINUE)
+					break;
+			}
+			if (ac->ac_status == AC_STATUS_CONTINUE) {
+				err = ext4_mb_scan_uninit_groups(ac, ngroups,
+								 cr, &first_err);
+				if (err)
+					goto out;
+			}
+			continue;
+		}
+
 		/*
 		 * searching for the right group start
 		 * from the goal value specified
@@ -2176,7 +2466,6 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 		group = ac->ac_g_ex.fe_group;
 
 		for (i = 0; i < ngroups; group++, i++) {
-			int ret = 0;
 			cond_resched();
 			/*
 			 * Artificially restricted ngroups for non-extent
@@ -2185,45 +2474,9 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 			if (group >= ngroups)
 				group = 0;
 
-			/* This now checks without needing the buddy page */
-			ret = ext4_mb_good_group(ac, group, cr);
-			if (ret <= 0) {
-				if (!first_err)
-					first_err = ret;
-				continue;
-			}
-
-			err = ext4_mb_load_buddy(sb, group, &e4b);
+			err = ext4_mb_scan_group(ac, group, cr, &first_err);
 			if (err)
 				goto out;
-
-			ext4_lock_group(sb, group);
-
-			/*
-			 * We need to check again after locking the
-			 * block group
-			 */
-			ret = ext4_mb_good_group(ac, group, cr);
-			if (ret <= 0) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				if (!first_err)
-					first_err = ret;
-				continue;
-			}
-
-			ac->ac_groups_scanned++;
-			if (cr == 0)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
-
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
@@ -2362,6 +2615,45 @@ const struct file_operations ext4_seq_mb_groups_fops = {
 	.release	= seq_release,
 };
 
+int ext4_seq_mb_stats_show(struct seq_file *seq, void *v)
+{
+	struct super_block *sb = seq->private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	unsigned int reqs = atomic_read(&sbi->s_bal_reqs);
+
+	seq_puts(seq, "mballoc:\n");
+	if (!sbi->s_mb_stats) {
+		seq_puts(seq, "\tmb stats collection turned off.\n");
+		seq_puts(seq, "\tTo enable, please write \"1\" to sysfs file mb_stats.\n");
+		return 0;
+	}
+	seq_printf(seq, "\treqs: %u\n", reqs);
+	seq_printf(seq, "\tsuccess: %u\n", atomic_read(&sbi->s_bal_success));
+	seq_printf(seq, "\tblocks: %u\n", atomic_read(&sbi->s_bal_allocated));
+	seq_printf(seq, "\textents_scanned: %u\n",
+		   atomic_read(&sbi->s_bal_ex_scanned));
+	seq_printf(seq, "\tgoal_hits: %u\n", atomic_read(&sbi->s_bal_goals));
+	seq_printf(seq, "\t2^n_hits: %u\n", atomic_read(&sbi->s_bal_2orders));
+	seq_printf(seq, "\tbreaks: %u\n", atomic_read(&sbi->s_bal_breaks));
+	seq_printf(seq, "\tlost: %u\n", atomic_read(&sbi->s_mb_lost_chunks));
+	seq_printf(seq, "\tgroups_considered: %u\n",
+		   atomic_read(&sbi->s_bal_groups_considered));
+	seq_printf(seq, "\tgroups_scanned: %u\n",
+		   atomic_read(&sbi->s_bal_groups_scanned));
+	seq_printf(seq, "\tgroups_scanned_per_req: %u\n",
+		   reqs ? atomic_read(&sbi->s_bal_groups_scanned) / reqs : 0);
+	seq_printf(seq, "\tgroups_from_indexes: %u\n",
+		   atomic_read(&sbi->s_bal_optimized));
+	seq_printf(seq, "\tgroups_need_init: %d\n",
+		   atomic_read(&sbi->s_mb_groups_need_init));
+	seq_printf(seq, "\tbuddies_generated: %lu\n",
+		   sbi->s_mb_buddies_generated);
+	seq_printf(seq, "\tpreallocated: %u\n",
+		   atomic_read(&sbi->s_mb_preallocated));
+	seq_printf(seq, "\tdiscarded: %u\n", atomic_read(&sbi->s_mb_discarded));
+	return 0;
+}
+
 static struct kmem_cache *get_groupinfo_cache(int blocksize_bits)
 {
 	int cache_index = blocksize_bits - EXT4_MIN_BLOCK_LOG_SIZE;
@@ -2447,6 +2739,7 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	}
 	set_bit(EXT4_GROUP_INFO_NEED_INIT_BIT,
 		&(meta_group_info[i]->bb_state));
+	atomic_inc(&sbi->s_mb_groups_need_init);
 
 	/*
 	 * initialize bb_free to be able to skip
@@ -2465,6 +2758,9 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
+	RB_CLEAR_NODE(&meta_group_info[i]->bb_avg_fragment_size_rb);
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2625,6 +2921,27 @@ int ext4_mb_init(struct super_block *sb)
 		goto out;
 	}
 
+	i = MB_NUM_ORDERS(sb) * sizeof(*sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = kmalloc(i, GFP_KERNEL);
+	if (sbi->s_mb_largest_free_orders == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	i = MB_NUM_ORDERS(sb) * sizeof(*sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = kmalloc(i, GFP_KERNEL);
+	if (sbi->s_mb_largest_free_orders_locks == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+	sbi->s_mb_avg_fragment_size_root = RB_ROOT;
+	rwlock_init(&sbi->s_mb_rb_lock);
+	atomic_set(&sbi->s_mb_groups_need_init, 0);
+
 	ret = ext4_groupinfo_create_slab(sb->s_blocksize);
 	if (ret < 0)
 		goto out;
@@ -2655,6 +2972,7 @@ int ext4_mb_init(struct super_block *sb)
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2707,6 +3025,10 @@ int ext4_mb_init(struct super_block *sb)
 	free_percpu(sbi->s_locality_groups);
 	sbi->s_locality_groups = NULL;
 out:
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
 	kfree(sbi->s_mb_offsets);
 	sbi->s_mb_offsets = NULL;
 	kfree(sbi->s_mb_maxs);
@@ -2762,6 +3084,8 @@ int ext4_mb_release(struct super_block *sb)
 		kvfree(group_info);
 		rcu_read_unlock();
 	}
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
 	iput(sbi->s_buddy_cache);
@@ -2779,6 +3103,12 @@ int ext4_mb_release(struct super_block *sb)
 				atomic_read(&sbi->s_bal_2orders),
 				atomic_read(&sbi->s_bal_breaks),
 				atomic_read(&sbi->s_mb_lost_chunks));
+		ext4_msg(sb, KERN_INFO,
+		      "mballoc: %u groups considered, %u scanned, "
+				"%u picked from indexes",
+				atomic_read(&sbi->s_bal_groups_considered),
+				atomic_read(&sbi->s_bal_groups_scanned),
+				atomic_read(&sbi->s_bal_optimized));
 		ext4_msg(sb, KERN_INFO,
 		       "mballoc: %lu generated and it took %Lu",
 				sbi->s_mb_buddies_generated,
@@ -3271,6 +3601,9 @@ static void ext4_mb_collect_stats(struct ext4_allocation_context *ac)
 		if (ac->ac_b_ex.fe_len >= ac->ac_o_ex.fe_len)
 			atomic_inc(&sbi->s_bal_success);
 		atomic_add(ac->ac_found, &sbi->s_bal_ex_scanned);
+		atomic_add(ac->ac_groups_considered,
+			   &sbi->s_bal_groups_considered);
+		atomic_add(ac->ac_groups_scanned, &sbi->s_bal_groups_scanned);
 		if (ac->ac_g_ex.fe_start == ac->ac_b_ex.fe_start &&
 				ac->ac_g_ex.fe_group == ac->ac_b_ex.fe_group)
 			atomic_inc(&sbi->s_bal_goals);
@@ -5089,6 +5422,137 @@ int ext4_group_add_blocks(handle_t *handle, struct super_block *sb,
 	return err;
 }
 
+/**
+ * ext4_mb_mark_bb() -- Mark given blocks of a group as in use
+ * @handle:			handle to this transaction
+ * @sb:				super block
+ * @block:			start physical block to mark
+ * @count:			number of blocks to mark
+ *
+ * This marks the blocks as used in the bitmap and buddy, leaving the ones
+ * that are in use already alone. Fast commit replay uses it to claim the
+ * blocks of logged extents before any extent tree is touched.
+ */
+int ext4_mb_mark_bb(handle_t *handle, struct super_block *sb,
+		    ext4_fsblk_t block, unsigned long count)
+{
+	struct buffer_head *bitmap_bh = NULL;
+	struct buffer_head *gd_bh;
+	ext4_group_t block_group;
+	ext4_grpblk_t bit, i, next;
+	struct ext4_group_desc *desc;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_free_extent ex;
+	struct ext4_buddy e4b;
+	int err = 0, ret, blk_free_count;
+	ext4_grpblk_t blocks_used;
+
+	ext4_debug("Marking block(s) %llu-%llu\n", block, block + count - 1);
+
+	if (count == 0)
+		return 0;
+
+	ext4_get_group_no_and_offset(sb, block, &block_group, &bit);
+	if (bit + count > EXT4_BLOCKS_PER_GROUP(sb)) {
+		ext4_warning(sb, "too many blocks marked in group %u",
+			     block_group);
+		err = -EINVAL;
+		goto error_return;
+	}
+
+	bitmap_bh = ext4_read_block_bitmap(sb, block_group);
+	if (IS_ERR(bitmap_bh)) {
+		err = PTR_ERR(bitmap_bh);
+		bitmap_bh = NULL;
+		goto error_return;
+	}
+
+	desc = ext4_get_group_desc(sb, block_group, &gd_bh);
+	if (!desc) {
+		err = -EIO;
+		goto error_return;
+	}
+
+	if (in_range(ext4_block_bitmap(sb, desc), block, count) ||
+	    in_range(ext4_inode_bitmap(sb, desc), block, count) ||
+	    in_range(block, ext4_inode_table(sb, desc), sbi->s_itb_per_group) ||
+	    in_range(block + count - 1, ext4_inode_table(sb, desc),
+		     sbi->s_itb_per_group)) {
+		ext4_error(sb, "Marking blocks in system zones - "
+			   "Block = %llu, count = %lu",
+			   block, count);
+		err = -EINVAL;
+		goto error_return;
+	}
+
+	BUFFER_TRACE(bitmap_bh, "getting write access");
+	err = ext4_journal_get_write_access(handle, bitmap_bh);
+	if (err)
+		goto error_return;
+
+	BUFFER_TRACE(gd_bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, gd_bh);
+	if (err)
+		goto error_return;
+
+	err = ext4_mb_load_buddy(sb, block_group, &e4b);
+	if (err)
+		goto error_return;
+
+	ext4_lock_group(sb, block_group);
+	if (ext4_has_group_desc_csum(sb) &&
+	    (desc->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT))) {
+		desc->bg_flags &= cpu_to_le16(~EXT4_BG_BLOCK_UNINIT);
+		ext4_free_group_clusters_set(sb, desc,
+			ext4_free_clusters_after_init(sb, block_group, desc));
+	}
+	/* Claim each run of free blocks in the range */
+	for (i = bit, blocks_used = 0; i < bit + count; i = next) {
+		i = mb_find_next_zero_bit(bitmap_bh->b_data, bit + count, i);
+		if (i >= bit + count)
+			break;
+		next = mb_find_next_bit(bitmap_bh->b_data, bit + count, i);
+		ex.fe_logical = 0;
+		ex.fe_group = block_group;
+		ex.fe_start = i;
+		ex.fe_len = next - i;
+		ext4_set_bits(bitmap_bh->b_data, i, next - i);
+		mb_mark_used(&e4b, &ex);
+		blocks_used += next - i;
+	}
+	blk_free_count = ext4_free_group_clusters(sb, desc) - blocks_used;
+	ext4_free_group_clusters_set(sb, desc, blk_free_count);
+	ext4_block_bitmap_csum_set(sb, block_group, desc, bitmap_bh);
+	ext4_group_desc_csum_set(sb, block_group, desc);
+	ext4_unlock_group(sb, block_group);
+	percpu_counter_sub(&sbi->s_freeclusters_counter,
+			   EXT4_NUM_B2C(sbi, blocks_used));
+
+	if (sbi->s_log_groups_per_flex) {
+		ext4_group_t flex_group = ext4_flex_group(sbi, block_group);
+		atomic64_sub(EXT4_NUM_B2C(sbi, blocks_used),
+			     &sbi_array_rcu_deref(sbi, s_flex_groups,
+						  flex_group)->free_clusters);
+	}
+
+	ext4_mb_unload_buddy(&e4b);
+
+	/* We dirtied the bitmap block */
+	BUFFER_TRACE(bitmap_bh, "dirtied bitmap block");
+	err = ext4_handle_dirty_metadata(handle, NULL, bitmap_bh);
+
+	/* And the group descriptor block */
+	BUFFER_TRACE(gd_bh, "dirtied group descriptor block");
+	ret = ext4_handle_dirty_metadata(handle, NULL, gd_bh);
+	if (!err)
+		err = ret;
+
+error_return:
+	brelse(bitmap_bh);
+	ext4_std_error(sb, err);
+	return err;
+}
+
 /**
  * ext4_trim_extent -- function to TRIM one single free extent in the group
  * @sb:		super block for the file system
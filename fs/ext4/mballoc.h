@@ -76,6 +76,21 @@ do {									\
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * Pick groups for criteria 0 and 1 from the per-order lists and the
+ * average fragment size tree instead of scanning all groups.
+ * Tunable via /sys/fs/ext4/<partition>/mb_optimize_scan
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/*
+ * Number of groups taken from the indexes per criterion before falling
+ * back to the next criterion
+ */
+#define MB_OPTIMIZE_SCAN_BATCH		8
+
+/* Number of buddy orders, from single blocks up to a whole bitmap block */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
 
 struct ext4_free_data {
 	/* MUST be the first member */
@@ -162,6 +177,7 @@ struct ext4_allocation_context {
 	/* copy of the best found extent taken before preallocation efforts */
 	struct ext4_free_extent ac_f_ex;
 
+	__u32 ac_groups_considered;
 	__u16 ac_groups_scanned;
 	__u16 ac_found;
 	__u16 ac_tail;
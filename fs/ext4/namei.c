@@ -2096,7 +2096,7 @@ static int make_indexed_dir(handle_t *handle, struct ext4_filename *fname,
 }
 
 /*
- *	ext4_add_entry()
+ *	__ext4_add_entry()
  *
  * adds a file entry to the specified directory, using the same
  * semantics as ext4_find_entry(). It returns NULL if it failed.
@@ -2105,10 +2105,9 @@ static int make_indexed_dir(handle_t *handle, struct ext4_filename *fname,
  * may not sleep between calling this and putting something into
  * the entry, as someone else might have used it while you slept.
  */
-static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
-			  struct inode *inode)
+static int __ext4_add_entry(handle_t *handle, struct inode *dir,
+			    const struct qstr *d_name, struct inode *inode)
 {
-	struct inode *dir = d_inode(dentry->d_parent);
 	struct buffer_head *bh = NULL;
 	struct ext4_dir_entry_2 *de;
 	struct ext4_dir_entry_tail *t;
@@ -2125,10 +2124,10 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 
 	sb = dir->i_sb;
 	blocksize = sb->s_blocksize;
-	if (!dentry->d_name.len)
+	if (!d_name->len)
 		return -EINVAL;
 
-	retval = ext4_fname_setup_filename(dir, &dentry->d_name, 0, &fname);
+	retval = ext4_fname_setup_filename(dir, d_name, 0, &fname);
 	if (retval)
 		return retval;
 
@@ -2209,6 +2208,13 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	return retval;
 }
 
+static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
+			  struct inode *inode)
+{
+	return __ext4_add_entry(handle, d_inode(dentry->d_parent),
+				&dentry->d_name, inode);
+}
+
 /*
  * Returns 0 for success, or a negative error value
  */
@@ -3017,6 +3023,7 @@ static int ext4_rmdir(struct inode *dir, struct dentry *dentry)
 	retval = ext4_delete_entry(handle, dir, de, bh);
 	if (retval)
 		goto end_rmdir;
+	ext4_fc_mark_ineligible(dir->i_sb, EXT4_FC_REASON_DIR_OP, handle);
 	if (!EXT4_DIR_LINK_EMPTY(inode))
 		ext4_warning_inode(inode,
 			     "empty directory '%.*s' has too many links (%u)",
@@ -3042,68 +3049,78 @@ static int ext4_rmdir(struct inode *dir, struct dentry *dentry)
 	return retval;
 }
 
-static int ext4_unlink(struct inode *dir, struct dentry *dentry)
+/*
+ * Remove the entry @d_name of @inode from @dir. Shared between unlink and
+ * fast commit replay; returns -ENOENT if there is no such entry.
+ */
+int __ext4_unlink(handle_t *handle, struct inode *dir,
+		  const struct qstr *d_name, struct inode *inode)
 {
 	int retval;
-	struct inode *inode;
 	struct buffer_head *bh;
 	struct ext4_dir_entry_2 *de;
-	handle_t *handle = NULL;
 
-	trace_ext4_unlink_enter(dir, dentry);
-	/* Initialize quotas before so that eventual writes go
-	 * in separate transaction */
-	retval = dquot_initialize(dir);
-	if (retval)
-		return retval;
-	retval = dquot_initialize(d_inode(dentry));
-	if (retval)
-		return retval;
-
-	retval = -ENOENT;
-	bh = ext4_find_entry(dir, &dentry->d_name, &de, NULL);
+	bh = ext4_find_entry(dir, d_name, &de, NULL);
 	if (IS_ERR(bh))
 		return PTR_ERR(bh);
 	if (!bh)
-		goto end_unlink;
-
-	inode = d_inode(dentry);
+		return -ENOENT;
 
 	retval = -EFSCORRUPTED;
 	if (le32_to_cpu(de->inode) != inode->i_ino)
-		goto end_unlink;
-
-	handle = ext4_journal_start(dir, EXT4_HT_DIR,
-				    EXT4_DATA_TRANS_BLOCKS(dir->i_sb));
-	if (IS_ERR(handle)) {
-		retval = PTR_ERR(handle);
-		handle = NULL;
-		goto end_unlink;
-	}
-
-	if (IS_DIRSYNC(dir))
-		ext4_handle_sync(handle);
+		goto out;
 
 	retval = ext4_delete_entry(handle, dir, de, bh);
 	if (retval)
-		goto end_unlink;
+		goto out;
 	dir->i_ctime = dir->i_mtime = ext4_current_time(dir);
 	ext4_update_dx_flag(dir);
 	ext4_mark_inode_dirty(handle, dir);
 	if (inode->i_nlink == 0)
 		ext4_warning_inode(inode, "Deleting file '%.*s' with no links",
-				   dentry->d_name.len, dentry->d_name.name);
+				   d_name->len, d_name->name);
 	else
 		drop_nlink(inode);
 	if (!inode->i_nlink)
 		ext4_orphan_add(handle, inode);
 	inode->i_ctime = ext4_current_time(inode);
 	ext4_mark_inode_dirty(handle, inode);
-
-end_unlink:
+out:
 	brelse(bh);
-	if (handle)
-		ext4_journal_stop(handle);
+	return retval;
+}
+
+static int ext4_unlink(struct inode *dir, struct dentry *dentry)
+{
+	int retval;
+	struct inode *inode = d_inode(dentry);
+	handle_t *handle;
+
+	trace_ext4_unlink_enter(dir, dentry);
+	/* Initialize quotas before so that eventual writes go
+	 * in separate transaction */
+	retval = dquot_initialize(dir);
+	if (retval)
+		return retval;
+	retval = dquot_initialize(inode);
+	if (retval)
+		return retval;
+
+	handle = ext4_journal_start(dir, EXT4_HT_DIR,
+				    EXT4_DATA_TRANS_BLOCKS(dir->i_sb));
+	if (IS_ERR(handle)) {
+		retval = PTR_ERR(handle);
+		goto out;
+	}
+
+	if (IS_DIRSYNC(dir))
+		ext4_handle_sync(handle);
+
+	retval = __ext4_unlink(handle, dir, &dentry->d_name, inode);
+	if (!retval)
+		ext4_fc_track_unlink(handle, dir, inode, &dentry->d_name);
+	ext4_journal_stop(handle);
+out:
 	trace_ext4_unlink_exit(dentry, retval);
 	return retval;
 }
@@ -3235,6 +3252,37 @@ static int ext4_symlink(struct inode *dir,
 	return err;
 }
 
+/*
+ * Add a link @d_name in @dir to the existing @inode, for fast commit replay.
+ * Returns 0 if the link is already there and -EEXIST if the name is taken
+ * by another inode.
+ */
+int __ext4_link(handle_t *handle, struct inode *dir,
+		const struct qstr *d_name, struct inode *inode)
+{
+	struct buffer_head *bh;
+	struct ext4_dir_entry_2 *de;
+	int err;
+
+	bh = ext4_find_entry(dir, d_name, &de, NULL);
+	if (IS_ERR(bh))
+		return PTR_ERR(bh);
+	if (bh) {
+		err = le32_to_cpu(de->inode) == inode->i_ino ? 0 : -EEXIST;
+		brelse(bh);
+		return err;
+	}
+
+	inode->i_ctime = ext4_current_time(inode);
+	ext4_inc_count(handle, inode);
+	err = __ext4_add_entry(handle, dir, d_name, inode);
+	if (err) {
+		drop_nlink(inode);
+		return err;
+	}
+	return ext4_mark_inode_dirty(handle, inode);
+}
+
 static int ext4_link(struct dentry *old_dentry,
 		     struct inode *dir, struct dentry *dentry)
 {
@@ -3278,8 +3326,15 @@ static int ext4_link(struct dentry *old_dentry,
 		/* this can happen only for tmpfile being
 		 * linked the first time
 		 */
-		if (inode->i_nlink == 1)
+		if (inode->i_nlink == 1) {
 			ext4_orphan_del(handle, inode);
+			ext4_fc_mark_ineligible(dir->i_sb,
+						EXT4_FC_REASON_NEW_INODE,
+						handle);
+		} else {
+			ext4_fc_track_link(handle, dir, inode,
+					   &dentry->d_name);
+		}
 		d_instantiate(dentry, inode);
 	} else {
 		drop_nlink(inode);
@@ -3658,6 +3713,7 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	old_file_type = old.de->file_type;
 	if (IS_DIRSYNC(old.dir) || IS_DIRSYNC(new.dir))
 		ext4_handle_sync(handle);
+	ext4_fc_mark_ineligible(old.dir->i_sb, EXT4_FC_REASON_RENAME, handle);
 
 	if (S_ISDIR(old.inode->i_mode)) {
 		if (new.inode) {
@@ -3846,6 +3902,7 @@ static int ext4_cross_rename(struct inode *old_dir, struct dentry *old_dentry,
 
 	if (IS_DIRSYNC(old.dir) || IS_DIRSYNC(new.dir))
 		ext4_handle_sync(handle);
+	ext4_fc_mark_ineligible(old.dir->i_sb, EXT4_FC_REASON_RENAME, handle);
 
 	if (S_ISDIR(old.inode->i_mode)) {
 		old.is_dir = true;
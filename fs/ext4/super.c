@@ -846,6 +846,7 @@ static void ext4_put_super(struct super_block *sb)
 		if ((err < 0) && !aborted)
 			ext4_abort(sb, "Couldn't clean up the journal");
 	}
+	ext4_fc_destroy(sb);
 
 	ext4_unregister_sysfs(sb);
 	ext4_es_unregister_shrinker(sbi);
@@ -961,6 +962,10 @@ static struct inode *ext4_alloc_inode(struct super_block *sb)
 	spin_lock_init(&ei->i_completed_io_lock);
 	ei->i_sync_tid = 0;
 	ei->i_datasync_tid = 0;
+	INIT_LIST_HEAD(&ei->i_fc_list);
+	ei->i_fc_lblk_start = 0;
+	ei->i_fc_lblk_len = 0;
+	ei->i_fc_tid = 0;
 	atomic_set(&ei->i_unwritten, 0);
 	INIT_WORK(&ei->i_rsv_conversion_work, ext4_end_io_rsv_work);
 	return &ei->vfs_inode;
@@ -4159,6 +4164,8 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 	sbi->s_journal->j_commit_callback = ext4_journal_commit_callback;
 
 no_journal:
+	ext4_fc_init(sb, sbi->s_journal);
+
 	sbi->s_mb_cache = ext4_xattr_create_cache();
 	if (!sbi->s_mb_cache) {
 		ext4_msg(sb, KERN_ERR, "Failed to create an mb_cache");
@@ -4309,6 +4316,9 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 	}
 #endif  /* CONFIG_QUOTA */
 
+	/* Replay fast commits before orphans are looked at: unlinks add some */
+	ext4_fc_replay(sb);
+
 	EXT4_SB(sb)->s_mount_state |= EXT4_ORPHAN_FS;
 	ext4_orphan_cleanup(sb, es);
 	EXT4_SB(sb)->s_mount_state &= ~EXT4_ORPHAN_FS;
@@ -4399,6 +4409,7 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 		sbi->s_journal = NULL;
 	}
 failed_mount3a:
+	ext4_fc_destroy(sb);
 	ext4_es_unregister_shrinker(sbi);
 failed_mount3:
 	del_timer_sync(&sbi->s_err_report);
@@ -4452,6 +4463,7 @@ static void ext4_init_journal_params(struct super_block *sb, journal_t *journal)
 	else
 		journal->j_flags &= ~JBD2_ABORT_ON_SYNCDATA_ERR;
 	write_unlock(&journal->j_state_lock);
+	journal->j_fc_replay_callback = ext4_fc_replay_scan;
 }
 
 static struct inode *ext4_get_journal_inode(struct super_block *sb,
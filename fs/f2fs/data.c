@@ -27,9 +27,12 @@
 #include <trace/events/android_fs.h>
 
 #define NUM_PREALLOC_POST_READ_CTXS	128
+#define NUM_PREALLOC_IOSTAT_CTXS	128
 
 static struct kmem_cache *bio_post_read_ctx_cache;
 static mempool_t *bio_post_read_ctx_pool;
+static struct kmem_cache *bio_iostat_ctx_cache;
+static mempool_t *bio_iostat_ctx_pool;
 
 static bool __is_cp_guaranteed(struct page *page)
 {
@@ -245,6 +248,83 @@ static void f2fs_write_end_io(struct bio *bio)
 	bio_put(bio);
 }
 
+/*
+ * While iostat is enabled, every submitted bio carries a bio_iostat_ctx
+ * which records its class and submission time, and is replaced with the
+ * original bi_private/bi_end_io on completion.
+ */
+struct bio_iostat_ctx {
+	struct f2fs_sb_info *sbi;
+	u64 submit_ns;
+	unsigned int size;
+	unsigned char lat_type;		/* enum iostat_lat_type */
+	unsigned char type;		/* DATA/NODE/META */
+	unsigned char temp;		/* HOT/WARM/COLD/IO_LAT_NO_TEMP */
+	unsigned char src;		/* enum iostat_lat_src */
+	bio_end_io_t *orig_end_io;
+	void *orig_private;
+};
+
+static void f2fs_iostat_end_io(struct bio *bio)
+{
+	struct bio_iostat_ctx *ctx = bio->bi_private;
+	struct f2fs_sb_info *sbi = ctx->sbi;
+	u64 lat_ns = ktime_get_ns() - ctx->submit_ns;
+	unsigned long lat_us = (unsigned long)div_u64(lat_ns, NSEC_PER_USEC);
+	int bucket;
+
+	bucket = min_t(int, fls_long(lat_us >> IO_LAT_BUCKET_SHIFT),
+						NR_IO_LAT_BUCKET - 1);
+	this_cpu_inc(sbi->iostat_lat->hist[ctx->lat_type][ctx->type]
+					[ctx->temp][ctx->src][bucket]);
+
+	trace_f2fs_bio_latency(sbi->sb, ctx->lat_type, ctx->type, ctx->temp,
+					ctx->src, ctx->size, lat_ns);
+
+	bio->bi_private = ctx->orig_private;
+	bio->bi_end_io = ctx->orig_end_io;
+	mempool_free(ctx, bio_iostat_ctx_pool);
+	bio_endio(bio);
+}
+
+static void f2fs_iostat_bind_bio(struct f2fs_sb_info *sbi, struct bio *bio,
+			enum page_type type, const struct f2fs_io_info *fio)
+{
+	struct bio_iostat_ctx *ctx;
+
+	ctx = mempool_alloc(bio_iostat_ctx_pool, GFP_NOIO);
+	if (!ctx)
+		return;
+
+	ctx->sbi = sbi;
+	ctx->size = bio->bi_iter.bi_size;
+	ctx->type = PAGE_TYPE_OF_BIO(type);
+	ctx->temp = IO_LAT_NO_TEMP;
+	ctx->src = IO_LAT_SRC_FS;
+
+	if (is_read_io(bio_op(bio))) {
+		ctx->lat_type = READ_IO_LAT;
+	} else {
+		ctx->lat_type = (bio->bi_opf & REQ_SYNC) ?
+				WRITE_SYNC_IO_LAT : WRITE_ASYNC_IO_LAT;
+		if (fio)
+			ctx->temp = fio->temp;
+	}
+
+	if (READ_ONCE(sbi->gc_task) == current)
+		ctx->src = sbi->gc_task_background ?
+				IO_LAT_SRC_BG_GC : IO_LAT_SRC_FG_GC;
+	else if (fio && (fio->io_type == FS_GC_DATA_IO ||
+					fio->io_type == FS_GC_NODE_IO))
+		ctx->src = IO_LAT_SRC_FG_GC;
+
+	ctx->orig_end_io = bio->bi_end_io;
+	ctx->orig_private = bio->bi_private;
+	bio->bi_end_io = f2fs_iostat_end_io;
+	bio->bi_private = ctx;
+	ctx->submit_ns = ktime_get_ns();
+}
+
 /*
  * Return true, if pre_bio's bdev is same as its target device.
  */
@@ -349,7 +429,8 @@ static bool f2fs_crypt_mergeable_bio(struct bio *bio, const struct inode *inode,
 }
 
 static inline void __submit_bio(struct f2fs_sb_info *sbi,
-				struct bio *bio, enum page_type type)
+				struct bio *bio, enum page_type type,
+				const struct f2fs_io_info *fio)
 {
 	if (!is_read_io(bio_op(bio))) {
 		unsigned int start;
@@ -392,6 +473,8 @@ static inline void __submit_bio(struct f2fs_sb_info *sbi,
 		trace_f2fs_submit_read_bio(sbi->sb, type, bio);
 	else
 		trace_f2fs_submit_write_bio(sbi->sb, type, bio);
+	if (sbi->iostat_enable)
+		f2fs_iostat_bind_bio(sbi, bio, type, fio);
 	submit_bio(bio);
 }
 
@@ -418,7 +501,7 @@ static void __f2fs_submit_read_bio(struct f2fs_sb_info *sbi,
 				current->comm);
 		}
 	}
-	__submit_bio(sbi, bio, type);
+	__submit_bio(sbi, bio, type, NULL);
 }
 
 static void __submit_merged_bio(struct f2fs_bio_info *io)
@@ -435,7 +518,7 @@ static void __submit_merged_bio(struct f2fs_bio_info *io)
 	else
 		trace_f2fs_prepare_write_bio(io->sbi->sb, fio->type, io->bio);
 
-	__submit_bio(io->sbi, io->bio, fio->type);
+	__submit_bio(io->sbi, io->bio, fio->type, fio);
 	io->bio = NULL;
 }
 
@@ -575,7 +658,7 @@ int f2fs_submit_page_bio(struct f2fs_io_info *fio)
 	if (is_read_io(fio->op))
 		__f2fs_submit_read_bio(fio->sbi, bio, fio->type);
 	else
-		__submit_bio(fio->sbi, bio, fio->type);
+		__submit_bio(fio->sbi, bio, fio->type, fio);
 	return 0;
 }
 
@@ -594,14 +677,14 @@ int f2fs_merge_page_bio(struct f2fs_io_info *fio)
 
 	if (bio && (*fio->last_block + 1 != fio->new_blkaddr ||
 			!__same_bdev(fio->sbi, fio->new_blkaddr, bio))) {
-		__submit_bio(fio->sbi, bio, fio->type);
+		__submit_bio(fio->sbi, bio, fio->type, fio);
 		bio = NULL;
 	}
 
 	/* ICE support */
 	if (bio && !f2fs_crypt_mergeable_bio(bio, fio->page->mapping->host,
 					     fio->page->index, fio)) {
-		__submit_bio(fio->sbi, bio, fio->type);
+		__submit_bio(fio->sbi, bio, fio->type, fio);
 		bio = NULL;
 	}
 
@@ -616,7 +699,7 @@ int f2fs_merge_page_bio(struct f2fs_io_info *fio)
 	}
 
 	if (bio_add_page(bio, page, PAGE_SIZE, 0) < PAGE_SIZE) {
-		__submit_bio(fio->sbi, bio, fio->type);
+		__submit_bio(fio->sbi, bio, fio->type, fio);
 		bio = NULL;
 		goto alloc_new;
 	}
@@ -641,7 +724,7 @@ static void f2fs_submit_ipu_bio(struct f2fs_sb_info *sbi, struct bio **bio,
 	if (!__has_merged_page(*bio, NULL, page, 0))
 		return;
 
-	__submit_bio(sbi, *bio, DATA);
+	__submit_bio(sbi, *bio, DATA, NULL);
 	*bio = NULL;
 }
 
@@ -2475,7 +2558,7 @@ static int f2fs_write_cache_pages(struct address_space *mapping,
 								NULL, 0, DATA);
 	/* submit cached bio of IPU write */
 	if (bio)
-		__submit_bio(sbi, bio, DATA);
+		__submit_bio(sbi, bio, DATA, NULL);
 
 	return ret;
 }
@@ -3312,8 +3395,32 @@ int __init f2fs_init_post_read_processing(void)
 	return -ENOMEM;
 }
 
-void __exit f2fs_destroy_post_read_processing(void)
+void f2fs_destroy_post_read_processing(void)
 {
 	mempool_destroy(bio_post_read_ctx_pool);
 	kmem_cache_destroy(bio_post_read_ctx_cache);
 }
+
+int __init f2fs_init_iostat_processing(void)
+{
+	bio_iostat_ctx_cache = KMEM_CACHE(bio_iostat_ctx, 0);
+	if (!bio_iostat_ctx_cache)
+		goto fail;
+	bio_iostat_ctx_pool =
+		mempool_create_slab_pool(NUM_PREALLOC_IOSTAT_CTXS,
+					 bio_iostat_ctx_cache);
+	if (!bio_iostat_ctx_pool)
+		goto fail_free_cache;
+	return 0;
+
+fail_free_cache:
+	kmem_cache_destroy(bio_iostat_ctx_cache);
+fail:
+	return -ENOMEM;
+}
+
+void __exit f2fs_destroy_iostat_processing(void)
+{
+	mempool_destroy(bio_iostat_ctx_pool);
+	kmem_cache_destroy(bio_iostat_ctx_cache);
+}
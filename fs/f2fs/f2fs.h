@@ -1057,6 +1057,37 @@ enum iostat_type {
 	NR_IO_TYPE,
 };
 
+/* bio completion latency is accounted per below types */
+enum iostat_lat_type {
+	READ_IO_LAT,			/* read bios */
+	WRITE_SYNC_IO_LAT,		/* write bios with REQ_SYNC */
+	WRITE_ASYNC_IO_LAT,		/* other write bios */
+	NR_IO_LAT_TYPE,
+};
+
+enum iostat_lat_src {
+	IO_LAT_SRC_FS,			/* IOs not issued by gc */
+	IO_LAT_SRC_FG_GC,		/* IOs from foreground gc */
+	IO_LAT_SRC_BG_GC,		/* IOs from gc thread */
+	NR_IO_LAT_SRC,
+};
+
+/* reads and bios submitted without f2fs_io_info have no temperature */
+#define IO_LAT_NO_TEMP		NR_TEMP_TYPE
+#define NR_IO_LAT_TEMP		(NR_TEMP_TYPE + 1)
+
+/*
+ * bucket 0 counts bios completed within 64us, bucket n within
+ * [64us << (n - 1), 64us << n), the last bucket has no upper limit.
+ */
+#define IO_LAT_BUCKET_SHIFT	6
+#define NR_IO_LAT_BUCKET	12
+
+struct f2fs_iostat_lat {
+	unsigned int hist[NR_IO_LAT_TYPE][NR_PAGE_TYPE][NR_IO_LAT_TEMP]
+					[NR_IO_LAT_SRC][NR_IO_LAT_BUCKET];
+};
+
 struct f2fs_io_info {
 	struct f2fs_sb_info *sbi;	/* f2fs_sb_info pointer */
 	nid_t ino;		/* inode number */
@@ -1298,6 +1329,8 @@ struct f2fs_sb_info {
 						 * race between GC and GC or CP
 						 */
 	struct f2fs_gc_kthread	*gc_thread;	/* GC thread */
+	struct task_struct *gc_task;		/* task running GC, for iostat */
+	bool gc_task_background;		/* gc_task runs background GC */
 	unsigned int cur_victim_sec;		/* current victim section num */
 	unsigned int gc_mode;			/* current GC state */
 	unsigned int next_victim_seg[2];	/* next segment in victim section */
@@ -1348,6 +1381,7 @@ struct f2fs_sb_info {
 	bool iostat_enable;
 	unsigned long iostat_next_period;
 	unsigned int iostat_period_ms;
+	struct f2fs_iostat_lat __percpu *iostat_lat;	/* bio latency */
 
 	/* For sysfs suppport */
 	struct kobject s_kobj;
@@ -2873,6 +2907,10 @@ static inline void f2fs_reset_iostat(struct f2fs_sb_info *sbi)
 		sbi->prev_rw_iostat[i] = 0;
 	}
 	spin_unlock(&sbi->iostat_lock);
+
+	for_each_possible_cpu(i)
+		memset(per_cpu_ptr(sbi->iostat_lat, i), 0,
+					sizeof(struct f2fs_iostat_lat));
 }
 
 extern void f2fs_record_iostat(struct f2fs_sb_info *sbi);
@@ -3217,6 +3255,8 @@ void f2fs_destroy_checkpoint_caches(void);
 #define F2FS_GETPAGE_SKIP_VERITY	0x02
 int f2fs_init_post_read_processing(void);
 void f2fs_destroy_post_read_processing(void);
+int f2fs_init_iostat_processing(void);
+void f2fs_destroy_iostat_processing(void);
 void f2fs_submit_merged_write(struct f2fs_sb_info *sbi, enum page_type type);
 void f2fs_submit_merged_write_cond(struct f2fs_sb_info *sbi,
 				struct inode *inode, struct page *page,
@@ -1261,6 +1261,10 @@ int f2fs_gc(struct f2fs_sb_info *sbi, bool sync,
 				reserved_segments(sbi),
 				prefree_segments(sbi));
 
+	/* IOs issued from here on are accounted to GC by iostat */
+	sbi->gc_task = current;
+	sbi->gc_task_background = background;
+
 	cpc.reason = __get_cp_reason(sbi);
 	sbi->skipped_gc_rwsem = 0;
 	first_skipped = last_skipped;
@@ -1349,6 +1353,7 @@ int f2fs_gc(struct f2fs_sb_info *sbi, bool sync,
 				reserved_segments(sbi),
 				prefree_segments(sbi));
 
+	sbi->gc_task = NULL;
 	up_write(&sbi->gc_lock);
 
 	put_gc_inode(&gc_list);
@@ -1009,6 +1009,7 @@ static void destroy_percpu_info(struct f2fs_sb_info *sbi)
 {
 	percpu_counter_destroy(&sbi->alloc_valid_block_count);
 	percpu_counter_destroy(&sbi->total_valid_inode_count);
+	free_percpu(sbi->iostat_lat);
 }
 
 static void destroy_device_list(struct f2fs_sb_info *sbi)
@@ -2872,8 +2873,19 @@ static int init_percpu_info(struct f2fs_sb_info *sbi)
 	err = percpu_counter_init(&sbi->total_valid_inode_count, 0,
 								GFP_KERNEL);
 	if (err)
-		percpu_counter_destroy(&sbi->alloc_valid_block_count);
+		goto free_valid_block_count;
 
+	sbi->iostat_lat = alloc_percpu(struct f2fs_iostat_lat);
+	if (!sbi->iostat_lat) {
+		err = -ENOMEM;
+		goto free_valid_inode_count;
+	}
+	return 0;
+
+free_valid_inode_count:
+	percpu_counter_destroy(&sbi->total_valid_inode_count);
+free_valid_block_count:
+	percpu_counter_destroy(&sbi->alloc_valid_block_count);
 	return err;
 }
 
@@ -3716,8 +3728,13 @@ static int __init init_f2fs_fs(void)
 	err = f2fs_init_post_read_processing();
 	if (err)
 		goto free_root_stats;
+	err = f2fs_init_iostat_processing();
+	if (err)
+		goto free_post_read;
 	return 0;
 
+free_post_read:
+	f2fs_destroy_post_read_processing();
 free_root_stats:
 	f2fs_destroy_root_stats();
 	unregister_filesystem(&f2fs_fs_type);
@@ -3741,6 +3758,7 @@ static int __init init_f2fs_fs(void)
 
 static void __exit exit_f2fs_fs(void)
 {
+	f2fs_destroy_iostat_processing();
 	f2fs_destroy_post_read_processing();
 	f2fs_destroy_root_stats();
 	unregister_filesystem(&f2fs_fs_type);
@@ -727,6 +727,83 @@ static int __maybe_unused iostat_info_seq_show(struct seq_file *seq,
 	return 0;
 }
 
+static const char *iostat_lat_type_name[NR_IO_LAT_TYPE] = {
+	[READ_IO_LAT]		= "read",
+	[WRITE_SYNC_IO_LAT]	= "sync",
+	[WRITE_ASYNC_IO_LAT]	= "async",
+};
+
+static const char *iostat_lat_page_name[NR_PAGE_TYPE] = {
+	[DATA]	= "data",
+	[NODE]	= "node",
+	[META]	= "meta",
+};
+
+static const char *iostat_lat_temp_name[NR_IO_LAT_TEMP] = {
+	[HOT]			= "hot",
+	[WARM]			= "warm",
+	[COLD]			= "cold",
+	[IO_LAT_NO_TEMP]	= "-",
+};
+
+static const char *iostat_lat_src_name[NR_IO_LAT_SRC] = {
+	[IO_LAT_SRC_FS]		= "fs",
+	[IO_LAT_SRC_FG_GC]	= "fg_gc",
+	[IO_LAT_SRC_BG_GC]	= "bg_gc",
+};
+
+static void iostat_latency_show_row(struct seq_file *seq,
+				struct f2fs_sb_info *sbi, int lat_type,
+				int type, int temp, int src)
+{
+	unsigned long long hist[NR_IO_LAT_BUCKET];
+	unsigned long long total = 0;
+	int i, cpu;
+
+	for (i = 0; i < NR_IO_LAT_BUCKET; i++) {
+		hist[i] = 0;
+		for_each_possible_cpu(cpu)
+			hist[i] += per_cpu_ptr(sbi->iostat_lat, cpu)->
+					hist[lat_type][type][temp][src][i];
+		total += hist[i];
+	}
+	if (!total)
+		return;
+
+	seq_printf(seq, "%-5s %-4s %-4s %-5s:",
+			iostat_lat_type_name[lat_type],
+			iostat_lat_page_name[type],
+			iostat_lat_temp_name[temp],
+			iostat_lat_src_name[src]);
+	for (i = 0; i < NR_IO_LAT_BUCKET; i++)
+		seq_printf(seq, " %llu", hist[i]);
+	seq_putc(seq, '\n');
+}
+
+static int __maybe_unused iostat_latency_info_seq_show(struct seq_file *seq,
+						       void *offset)
+{
+	struct super_block *sb = seq->private;
+	struct f2fs_sb_info *sbi = F2FS_SB(sb);
+	time64_t now = ktime_get_real_seconds();
+	int lat_type, type, temp, src;
+
+	if (!sbi->iostat_enable)
+		return 0;
+
+	seq_printf(seq, "time:		%-16llu\n", now);
+	seq_puts(seq, "format: io type temp source: bios completed in "
+			"<64us <128us ... <65536us >=65536us\n");
+
+	for (lat_type = 0; lat_type < NR_IO_LAT_TYPE; lat_type++)
+		for (type = 0; type < NR_PAGE_TYPE; type++)
+			for (temp = 0; temp < NR_IO_LAT_TEMP; temp++)
+				for (src = 0; src < NR_IO_LAT_SRC; src++)
+					iostat_latency_show_row(seq, sbi,
+						lat_type, type, temp, src);
+	return 0;
+}
+
 static int __maybe_unused victim_bits_seq_show(struct seq_file *seq,
 						void *offset)
 {
@@ -765,6 +842,7 @@ static const struct file_operations f2fs_seq_##_name##_fops = {		\
 F2FS_PROC_FILE_DEF(segment_info);
 F2FS_PROC_FILE_DEF(segment_bits);
 F2FS_PROC_FILE_DEF(iostat_info);
+F2FS_PROC_FILE_DEF(iostat_latency_info);
 F2FS_PROC_FILE_DEF(victim_bits);
 
 int __init f2fs_init_sysfs(void)
@@ -816,6 +894,8 @@ int f2fs_register_sysfs(struct f2fs_sb_info *sbi)
 				 &f2fs_seq_segment_bits_fops, sb);
 		proc_create_data("iostat_info", S_IRUGO, sbi->s_proc,
 				&f2fs_seq_iostat_info_fops, sb);
+		proc_create_data("iostat_latency_info", S_IRUGO, sbi->s_proc,
+				&f2fs_seq_iostat_latency_info_fops, sb);
 		proc_create_data("victim_bits", S_IRUGO, sbi->s_proc,
 				&f2fs_seq_victim_bits_fops, sb);
 	}
@@ -826,6 +906,7 @@ void f2fs_unregister_sysfs(struct f2fs_sb_info *sbi)
 {
 	if (sbi->s_proc) {
 		remove_proc_entry("iostat_info", sbi->s_proc);
+		remove_proc_entry("iostat_latency_info", sbi->s_proc);
 		remove_proc_entry("segment_info", sbi->s_proc);
 		remove_proc_entry("segment_bits", sbi->s_proc);
 		remove_proc_entry("victim_bits", sbi->s_proc);
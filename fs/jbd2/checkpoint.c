@@ -179,14 +179,14 @@ void __jbd2_log_wait_for_space(journal_t *journal)
 }
 
 static void
-__flush_batch(journal_t *journal, int *batch_count)
+__flush_batch(journal_t *journal, int *batch_count, int op_flags)
 {
 	int i;
 	struct blk_plug plug;
 
 	blk_start_plug(&plug);
 	for (i = 0; i < *batch_count; i++)
-		write_dirty_buffer(journal->j_chkpt_bhs[i], WRITE_SYNC);
+		write_dirty_buffer(journal->j_chkpt_bhs[i], op_flags);
 	blk_finish_plug(&plug);
 
 	for (i = 0; i < *batch_count; i++) {
@@ -317,7 +317,8 @@ int jbd2_log_do_checkpoint(journal_t *journal)
 			spin_unlock(&journal->j_list_lock);
 		retry:
 			if (batch_count)
-				__flush_batch(journal, &batch_count);
+				__flush_batch(journal, &batch_count,
+					      WRITE_SYNC);
 			spin_lock(&journal->j_list_lock);
 			goto restart;
 	}
@@ -366,6 +367,119 @@ int jbd2_log_do_checkpoint(journal_t *journal)
 	return (result < 0) ? result : 0;
 }
 
+/*
+ * Background checkpointing
+ *
+ * Waiting for log space in start_this_handle() stalls every new handle
+ * behind synchronous checkpoint I/O. Once the log fills past
+ * j_checkpoint_threshold percent, the commit code queues
+ * j_checkpoint_work, which writes back checkpoint buffers of the oldest
+ * transactions in large asynchronous batches and then retires them,
+ * until usage is below half of the threshold.
+ */
+
+/* Whether more than @percent of the log is in use; racy by design */
+static bool jbd2_log_used_over(journal_t *journal, unsigned int percent)
+{
+	unsigned long size = journal->j_last - journal->j_first;
+	unsigned long used = size - READ_ONCE(journal->j_free);
+
+	return used * 100 > size * percent;
+}
+
+/*
+ * Queue background checkpointing if the log is filling up. Called by the
+ * commit code once a transaction has been committed. j_state_lock orders
+ * this against jbd2_journal_destroy() setting JBD2_CHECKPOINT_STOP.
+ */
+void jbd2_log_queue_checkpoint(journal_t *journal)
+{
+	unsigned int threshold = READ_ONCE(journal->j_checkpoint_threshold);
+
+	read_lock(&journal->j_state_lock);
+	if (threshold && !is_journal_aborted(journal) &&
+	    !(journal->j_flags & JBD2_CHECKPOINT_STOP) &&
+	    journal->j_checkpoint_transactions &&
+	    jbd2_log_used_over(journal, threshold))
+		queue_work(system_unbound_wq, &journal->j_checkpoint_work);
+	read_unlock(&journal->j_state_lock);
+}
+
+/*
+ * Start writeback of up to JBD2_CHECKPOINT_IO_BATCH dirty checkpoint
+ * buffers, oldest transactions first, without waiting for it. Buffers
+ * that are busy are left to jbd2_log_do_checkpoint().
+ *
+ * Called with j_checkpoint_mutex held.
+ */
+static void jbd2_log_submit_checkpoint_io(journal_t *journal)
+{
+	struct journal_head	*jh, *next_jh, *last_jh;
+	transaction_t		*transaction;
+	struct buffer_head	*bh;
+	int			batch_count = 0, submitted = 0;
+
+	spin_lock(&journal->j_list_lock);
+restart:
+	transaction = journal->j_checkpoint_transactions;
+	while (transaction) {
+		next_jh = transaction->t_checkpoint_list;
+		last_jh = next_jh ? next_jh->b_cpprev : NULL;
+		while (next_jh) {
+			jh = next_jh;
+			next_jh = jh == last_jh ? NULL : jh->b_cpnext;
+			bh = jh2bh(jh);
+			if (jh->b_transaction || buffer_locked(bh) ||
+			    !buffer_dirty(bh))
+				continue;
+
+			BUFFER_TRACE(bh, "queue");
+			get_bh(bh);
+			J_ASSERT_BH(bh, !buffer_jwrite(bh));
+			journal->j_chkpt_bhs[batch_count++] = bh;
+			__buffer_relink_io(jh);
+			transaction->t_chp_stats.cs_written++;
+			submitted++;
+			if (batch_count == JBD2_NR_BATCH) {
+				spin_unlock(&journal->j_list_lock);
+				__flush_batch(journal, &batch_count, 0);
+				if (submitted >= JBD2_CHECKPOINT_IO_BATCH)
+					return;
+				cond_resched();
+				spin_lock(&journal->j_list_lock);
+				/* The lists may have changed meanwhile */
+				goto restart;
+			}
+		}
+		transaction = transaction->t_cpnext;
+		if (transaction == journal->j_checkpoint_transactions)
+			break;
+	}
+	spin_unlock(&journal->j_list_lock);
+	if (batch_count)
+		__flush_batch(journal, &batch_count, 0);
+}
+
+void jbd2_checkpoint_work(struct work_struct *work)
+{
+	journal_t *journal = container_of(work, journal_t, j_checkpoint_work);
+	unsigned int threshold;
+
+	mutex_lock(&journal->j_checkpoint_mutex);
+	while (!is_journal_aborted(journal) &&
+	       journal->j_checkpoint_transactions) {
+		threshold = READ_ONCE(journal->j_checkpoint_threshold);
+		if (!threshold || !jbd2_log_used_over(journal, threshold / 2))
+			break;
+		jbd2_log_submit_checkpoint_io(journal);
+		/* Mostly waits for the I/O submitted above */
+		if (jbd2_log_do_checkpoint(journal))
+			break;
+		cond_resched();
+	}
+	mutex_unlock(&journal->j_checkpoint_mutex);
+}
+
 /*
  * Check the list of checkpoint transactions for the journal to see if
  * we have already got rid of any since the last update of the log tail
@@ -100,9 +100,15 @@ EXPORT_SYMBOL(jbd2_journal_init_jbd_inode);
 EXPORT_SYMBOL(jbd2_journal_release_jbd_inode);
 EXPORT_SYMBOL(jbd2_journal_begin_ordered_truncate);
 EXPORT_SYMBOL(jbd2_inode_cache);
+EXPORT_SYMBOL(jbd2_fc_begin_commit);
+EXPORT_SYMBOL(jbd2_fc_end_commit);
+EXPORT_SYMBOL(jbd2_fc_get_buf);
+EXPORT_SYMBOL(jbd2_fc_wait_bufs);
+EXPORT_SYMBOL(jbd2_fc_replay_done);
 
 static void __journal_abort_soft (journal_t *journal, int errno);
 static int jbd2_journal_create_slab(size_t slab_size);
+static int jbd2_write_superblock(journal_t *journal, int write_flags);
 
 #ifdef CONFIG_JBD2_DEBUG
 void __jbd2_debug(int level, const char *file, const char *func,
@@ -760,6 +766,160 @@ int jbd2_complete_transaction(journal_t *journal, tid_t tid)
 }
 EXPORT_SYMBOL(jbd2_complete_transaction);
 
+/**
+ * jbd2_fc_begin_commit() - Start a fast commit of a running transaction.
+ * @journal: Journal to act on.
+ * @tid: Transaction the fast commit is written for.
+ *
+ * Returns -EALREADY if @tid has already been committed by a full commit,
+ * in which case the caller has nothing left to do. Waits for any ongoing
+ * full or fast commit to finish before claiming the fast commit area.
+ */
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid)
+{
+	if (unlikely(is_journal_aborted(journal)))
+		return -EIO;
+
+	if (!jbd2_has_feature_fast_commit(journal))
+		return -EOPNOTSUPP;
+
+	write_lock(&journal->j_state_lock);
+	while (1) {
+		DEFINE_WAIT(wait);
+
+		if (tid_geq(journal->j_commit_sequence, tid)) {
+			write_unlock(&journal->j_state_lock);
+			return -EALREADY;
+		}
+		if (journal->j_fc_replay_pending) {
+			write_unlock(&journal->j_state_lock);
+			return -EAGAIN;
+		}
+		if (!(journal->j_flags & (JBD2_FULL_COMMIT_ONGOING |
+					  JBD2_FAST_COMMIT_ONGOING)))
+			break;
+
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		finish_wait(&journal->j_fc_wait, &wait);
+		write_lock(&journal->j_state_lock);
+	}
+	journal->j_flags |= JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+
+	return 0;
+}
+
+/**
+ * jbd2_fc_end_commit() - Finish a fast commit.
+ * @journal: Journal to act on.
+ *
+ * Releases the fast commit area claimed by jbd2_fc_begin_commit() and lets
+ * waiting full and fast commits proceed.
+ */
+int jbd2_fc_end_commit(journal_t *journal)
+{
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
+
+	return 0;
+}
+
+/**
+ * jbd2_fc_get_buf() - Get the next free fast commit block.
+ * @journal: Journal to act on.
+ * @bh_out: Where to store the buffer head of the block.
+ *
+ * The buffer is owned by the journal until jbd2_fc_wait_bufs() drops it,
+ * so every block handed out must be submitted and waited for. Returns
+ * -ENOSPC once the fast commit area is full; the caller then has to fall
+ * back to a full commit.
+ */
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out)
+{
+	unsigned long long pblock;
+	unsigned long blocknr;
+	struct buffer_head *bh;
+	int ret;
+
+	*bh_out = NULL;
+
+	if (journal->j_fc_first + journal->j_fc_off >= journal->j_fc_last)
+		return -ENOSPC;
+
+	blocknr = journal->j_fc_first + journal->j_fc_off;
+	ret = jbd2_journal_bmap(journal, blocknr, &pblock);
+	if (ret)
+		return ret;
+
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -ENOMEM;
+
+	journal->j_fc_wbuf[journal->j_fc_off++] = bh;
+	*bh_out = bh;
+
+	return 0;
+}
+
+/**
+ * jbd2_fc_wait_bufs() - Wait for the last @num_blks fast commit blocks.
+ * @journal: Journal to act on.
+ * @num_blks: Number of blocks submitted by the current fast commit.
+ */
+int jbd2_fc_wait_bufs(journal_t *journal, int num_blks)
+{
+	struct buffer_head *bh;
+	int i, ret = 0;
+
+	/*
+	 * Wait in reverse order so that we are woken up as few times as
+	 * possible before all the I/O has completed.
+	 */
+	for (i = journal->j_fc_off - 1;
+	     i >= (int)journal->j_fc_off - num_blks; i--) {
+		bh = journal->j_fc_wbuf[i];
+		if (!bh)
+			continue;
+		wait_on_buffer(bh);
+		if (unlikely(!buffer_uptodate(bh)))
+			ret = -EIO;
+		put_bh(bh);
+		journal->j_fc_wbuf[i] = NULL;
+	}
+
+	return ret;
+}
+
+/**
+ * jbd2_fc_replay_done() - Tell the journal that fast commits were replayed.
+ * @journal: Journal to act on.
+ *
+ * Must only be called once the effects of the replay are safely committed:
+ * clearing the pending state in the superblock makes the fast commit area
+ * reusable.
+ */
+int jbd2_fc_replay_done(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+
+	write_lock(&journal->j_state_lock);
+	if (!journal->j_fc_replay_pending) {
+		write_unlock(&journal->j_state_lock);
+		return 0;
+	}
+	journal->j_fc_replay_pending = false;
+	sb->s_fc_replay_pending = 0;
+	sb->s_fc_replay_tid = 0;
+	write_unlock(&journal->j_state_lock);
+
+	return jbd2_write_superblock(journal, WRITE_FUA);
+}
+
 /*
  * Log buffer allocation routines:
  */
@@ -966,6 +1126,7 @@ void jbd2_update_log_tail(journal_t *journal, tid_t tid, unsigned long block)
 struct jbd2_stats_proc_session {
 	journal_t *journal;
 	struct transaction_stats_s *stats;
+	unsigned long handle_wait_hist[JBD2_LAT_HIST_BUCKETS];
 	int start;
 	int max;
 };
@@ -980,6 +1141,26 @@ static void *jbd2_seq_info_next(struct seq_file *seq, void *v, loff_t *pos)
 	return NULL;
 }
 
+static void jbd2_seq_print_hist(struct seq_file *seq, const char *name,
+				unsigned long *hist)
+{
+	int i;
+
+	seq_printf(seq, "%s latency histogram:\n", name);
+	for (i = 0; i < JBD2_LAT_HIST_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		if (i == 0)
+			seq_printf(seq, "  %10s us: %lu\n", "<1", hist[i]);
+		else if (i == JBD2_LAT_HIST_BUCKETS - 1)
+			seq_printf(seq, "  >=%8lu us: %lu\n",
+				   1UL << (i - 1), hist[i]);
+		else
+			seq_printf(seq, "  %10lu us: %lu\n",
+				   1UL << (i - 1), hist[i]);
+	}
+}
+
 static int jbd2_seq_info_show(struct seq_file *seq, void *v)
 {
 	struct jbd2_stats_proc_session *s = seq->private;
@@ -1014,6 +1195,9 @@ static int jbd2_seq_info_show(struct seq_file *seq, void *v)
 	    s->stats->run.rs_blocks / s->stats->ts_tid);
 	seq_printf(seq, "  %lu logged blocks per transaction\n",
 	    s->stats->run.rs_blocks_logged / s->stats->ts_tid);
+	jbd2_seq_print_hist(seq, "transaction commit",
+			    s->stats->ts_commit_hist);
+	jbd2_seq_print_hist(seq, "handle start wait", s->handle_wait_hist);
 	return 0;
 }
 
@@ -1032,7 +1216,7 @@ static int jbd2_seq_info_open(struct inode *inode, struct file *file)
 {
 	journal_t *journal = PDE_DATA(inode);
 	struct jbd2_stats_proc_session *s;
-	int rc, size;
+	int rc, size, cpu, i;
 
 	s = kmalloc(sizeof(*s), GFP_KERNEL);
 	if (s == NULL)
@@ -1048,6 +1232,15 @@ static int jbd2_seq_info_open(struct inode *inode, struct file *file)
 	s->journal = journal;
 	spin_unlock(&journal->j_history_lock);
 
+	memset(s->handle_wait_hist, 0, sizeof(s->handle_wait_hist));
+	for_each_possible_cpu(cpu) {
+		unsigned long *hist = per_cpu_ptr(journal->j_handle_wait_hist,
+						  cpu);
+
+		for (i = 0; i < JBD2_LAT_HIST_BUCKETS; i++)
+			s->handle_wait_hist[i] += hist[i];
+	}
+
 	rc = seq_open(file, &jbd2_seq_info_ops);
 	if (rc == 0) {
 		struct seq_file *m = file->private_data;
@@ -1077,6 +1270,47 @@ static const struct file_operations jbd2_seq_info_fops = {
 	.release        = jbd2_seq_info_release,
 };
 
+static int jbd2_seq_checkpoint_threshold_show(struct seq_file *seq, void *v)
+{
+	journal_t *journal = seq->private;
+
+	seq_printf(seq, "%u\n", READ_ONCE(journal->j_checkpoint_threshold));
+	return 0;
+}
+
+static int jbd2_seq_checkpoint_threshold_open(struct inode *inode,
+					      struct file *file)
+{
+	return single_open(file, jbd2_seq_checkpoint_threshold_show,
+			   PDE_DATA(inode));
+}
+
+static ssize_t jbd2_checkpoint_threshold_write(struct file *file,
+					       const char __user *buf,
+					       size_t count, loff_t *ppos)
+{
+	journal_t *journal = PDE_DATA(file_inode(file));
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint_from_user(buf, count, 0, &val);
+	if (ret)
+		return ret;
+	if (val > 100)
+		return -EINVAL;
+	WRITE_ONCE(journal->j_checkpoint_threshold, val);
+	return count;
+}
+
+static const struct file_operations jbd2_checkpoint_threshold_fops = {
+	.owner		= THIS_MODULE,
+	.open		= jbd2_seq_checkpoint_threshold_open,
+	.read		= seq_read,
+	.write		= jbd2_checkpoint_threshold_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static struct proc_dir_entry *proc_jbd2_stats;
 
 static void jbd2_stats_proc_init(journal_t *journal)
@@ -1085,11 +1319,15 @@ static void jbd2_stats_proc_init(journal_t *journal)
 	if (journal->j_proc_entry) {
 		proc_create_data("info", S_IRUGO, journal->j_proc_entry,
 				 &jbd2_seq_info_fops, journal);
+		proc_create_data("checkpoint_threshold", S_IRUGO | S_IWUSR,
+				 journal->j_proc_entry,
+				 &jbd2_checkpoint_threshold_fops, journal);
 	}
 }
 
 static void jbd2_stats_proc_exit(journal_t *journal)
 {
+	remove_proc_entry("checkpoint_threshold", journal->j_proc_entry);
 	remove_proc_entry("info", journal->j_proc_entry);
 	remove_proc_entry(journal->j_devname, proc_jbd2_stats);
 }
@@ -1122,8 +1360,10 @@ static journal_t *journal_init_common(struct block_device *bdev,
 	init_waitqueue_head(&journal->j_wait_commit);
 	init_waitqueue_head(&journal->j_wait_updates);
 	init_waitqueue_head(&journal->j_wait_reserved);
+	init_waitqueue_head(&journal->j_fc_wait);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
+	INIT_WORK(&journal->j_checkpoint_work, jbd2_checkpoint_work);
 	spin_lock_init(&journal->j_revoke_lock);
 	spin_lock_init(&journal->j_list_lock);
 	rwlock_init(&journal->j_state_lock);
@@ -1131,6 +1371,7 @@ static journal_t *journal_init_common(struct block_device *bdev,
 	journal->j_commit_interval = (HZ * JBD2_DEFAULT_MAX_COMMIT_AGE);
 	journal->j_min_batch_time = 0;
 	journal->j_max_batch_time = 15000; /* 15ms */
+	journal->j_checkpoint_threshold = JBD2_DEFAULT_CHECKPOINT_THRESHOLD;
 	atomic_set(&journal->j_reserved_credits, 0);
 
 	/* The journal is marked for error until we succeed with recovery! */
@@ -1142,6 +1383,11 @@ static journal_t *journal_init_common(struct block_device *bdev,
 		goto err_cleanup;
 
 	spin_lock_init(&journal->j_history_lock);
+	journal->j_handle_wait_hist = __alloc_percpu(JBD2_LAT_HIST_BUCKETS *
+						     sizeof(unsigned long),
+						     sizeof(unsigned long));
+	if (!journal->j_handle_wait_hist)
+		goto err_cleanup;
 
 	lockdep_init_map(&journal->j_trans_commit_map, "jbd2_handle",
 			 &jbd2_trans_commit_key, 0);
@@ -1172,6 +1418,7 @@ static journal_t *journal_init_common(struct block_device *bdev,
 
 err_cleanup:
 	kfree(journal->j_wbuf);
+	free_percpu(journal->j_handle_wait_hist);
 	jbd2_journal_destroy_revoke(journal);
 	kfree(journal);
 	return NULL;
@@ -1269,6 +1516,41 @@ static void journal_fail_superblock (journal_t *journal)
 	journal->j_sb_buffer = NULL;
 }
 
+/*
+ * Carve the fast commit area out of the end of the log. j_last must hold
+ * the end of the whole journal on entry.
+ */
+static int journal_setup_fc_area(journal_t *journal)
+{
+	unsigned long num_fc_blks;
+
+	if (!jbd2_has_feature_fast_commit(journal))
+		return 0;
+
+	num_fc_blks = jbd2_journal_get_num_fc_blks(journal->j_superblock);
+	if (journal->j_first + JBD2_MIN_JOURNAL_BLOCKS + num_fc_blks >
+	    journal->j_last + 1) {
+		printk(KERN_ERR "JBD2: Journal too short for %lu fast commit "
+		       "blocks on %s.\n", num_fc_blks, journal->j_devname);
+		return -EINVAL;
+	}
+
+	if (!journal->j_fc_wbuf) {
+		journal->j_fc_wbuf = kcalloc(num_fc_blks,
+					     sizeof(struct buffer_head *),
+					     GFP_KERNEL);
+		if (!journal->j_fc_wbuf)
+			return -ENOMEM;
+	}
+
+	journal->j_fc_last = journal->j_last;
+	journal->j_last = journal->j_fc_first =
+		journal->j_fc_last - num_fc_blks;
+	journal->j_fc_off = 0;
+
+	return 0;
+}
+
 /*
  * Given a journal_t structure, initialise the various fields for
  * startup of a new journaling session.  We use this both when creating
@@ -1292,11 +1574,21 @@ static int journal_reset(journal_t *journal)
 
 	journal->j_first = first;
 	journal->j_last = last;
+	if (journal_setup_fc_area(journal)) {
+		journal_fail_superblock(journal);
+		return -EINVAL;
+	}
+	last = journal->j_last;
 
 	journal->j_head = first;
 	journal->j_tail = first;
 	journal->j_free = last - first;
 
+	if (jbd2_has_feature_fast_commit(journal)) {
+		sb->s_fc_replay_pending = journal->j_fc_replay_pending;
+		sb->s_fc_replay_tid = cpu_to_be32(journal->j_fc_replay_tid);
+	}
+
 	journal->j_tail_sequence = journal->j_transaction_sequence;
 	journal->j_commit_sequence = journal->j_transaction_sequence - 1;
 	journal->j_commit_request = journal->j_commit_sequence;
@@ -1616,7 +1908,12 @@ static int load_superblock(journal_t *journal)
 	journal->j_last = be32_to_cpu(sb->s_maxlen);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
-	return 0;
+	if (jbd2_has_feature_fast_commit(journal)) {
+		journal->j_fc_replay_pending = sb->s_fc_replay_pending;
+		journal->j_fc_replay_tid = be32_to_cpu(sb->s_fc_replay_tid);
+	}
+
+	return journal_setup_fc_area(journal);
 }
 
 
@@ -1702,6 +1999,15 @@ int jbd2_journal_destroy(journal_t *journal)
 {
 	int err = 0;
 
+	/*
+	 * Background checkpointing may wait for a commit, so it has to be
+	 * stopped while the commit thread is still around.
+	 */
+	write_lock(&journal->j_state_lock);
+	journal->j_flags |= JBD2_CHECKPOINT_STOP;
+	write_unlock(&journal->j_state_lock);
+	cancel_work_sync(&journal->j_checkpoint_work);
+
 	/* Wait for the commit thread to wake up and die. */
 	journal_kill_thread(journal);
 
@@ -1758,7 +2064,9 @@ int jbd2_journal_destroy(journal_t *journal)
 		jbd2_journal_destroy_revoke(journal);
 	if (journal->j_chksum_driver)
 		crypto_free_shash(journal->j_chksum_driver);
+	kfree(journal->j_fc_wbuf);
 	kfree(journal->j_wbuf);
+	free_percpu(journal->j_handle_wait_hist);
 	kfree(journal);
 
 	return err;
@@ -1852,6 +2160,7 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 #define COMPAT_FEATURE_ON(f) \
 		((compat & (f)) && !(sb->s_feature_compat & cpu_to_be32(f)))
 	journal_superblock_t *sb;
+	bool fc_on = false;
 
 	if (jbd2_journal_check_used_features(journal, compat, ro, incompat))
 		return 1;
@@ -1905,10 +2214,62 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 			~cpu_to_be32(JBD2_FEATURE_INCOMPAT_CSUM_V2 |
 				     JBD2_FEATURE_INCOMPAT_CSUM_V3);
 
+	/*
+	 * The fast commit area is carved out of the end of the log, which is
+	 * only safe while nothing has been logged since the journal was
+	 * loaded.
+	 */
+	if (INCOMPAT_FEATURE_ON(JBD2_FEATURE_INCOMPAT_FAST_COMMIT)) {
+		int err;
+
+		if (!journal->j_fc_wbuf) {
+			journal->j_fc_wbuf = kcalloc(
+				jbd2_journal_get_num_fc_blks(sb),
+				sizeof(struct buffer_head *), GFP_KERNEL);
+			if (!journal->j_fc_wbuf)
+				return 0;
+		}
+
+		/* Serialises the superblock update with the log tail ones */
+		mutex_lock(&journal->j_checkpoint_mutex);
+		fc_on = true;
+		write_lock(&journal->j_state_lock);
+		if (journal->j_running_transaction ||
+		    journal->j_committing_transaction ||
+		    journal->j_head != journal->j_tail) {
+			write_unlock(&journal->j_state_lock);
+			mutex_unlock(&journal->j_checkpoint_mutex);
+			return 0;
+		}
+		sb->s_feature_incompat |=
+			cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+		if (!sb->s_num_fc_blks)
+			sb->s_num_fc_blks =
+				cpu_to_be32(JBD2_DEFAULT_FAST_COMMIT_BLOCKS);
+		journal->j_last = be32_to_cpu(sb->s_maxlen);
+		err = journal_setup_fc_area(journal);
+		if (err) {
+			journal->j_last = be32_to_cpu(sb->s_maxlen);
+			sb->s_feature_incompat &=
+				~cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+			write_unlock(&journal->j_state_lock);
+			mutex_unlock(&journal->j_checkpoint_mutex);
+			return 0;
+		}
+		journal->j_head = journal->j_tail = journal->j_first;
+		journal->j_free = journal->j_last - journal->j_first;
+		write_unlock(&journal->j_state_lock);
+	}
+
 	sb->s_feature_compat    |= cpu_to_be32(compat);
 	sb->s_feature_ro_compat |= cpu_to_be32(ro);
 	sb->s_feature_incompat  |= cpu_to_be32(incompat);
 
+	if (fc_on) {
+		jbd2_write_superblock(journal, WRITE_FUA);
+		mutex_unlock(&journal->j_checkpoint_mutex);
+	}
+
 	return 1;
 #undef COMPAT_FEATURE_ON
 #undef INCOMPAT_FEATURE_ON
@@ -244,6 +244,53 @@ do {									\
  * blocks.  In the third and final pass, we replay any un-revoked blocks
  * in the log.
  */
+/*
+ * Hand the fast commit area to the filesystem. Fast commits are only valid
+ * for the transaction that was running when they were written, which is
+ * the one right after the last transaction found in the log - unless an
+ * earlier mount already found fast commits and crashed before it finished
+ * replaying them.
+ */
+static int fc_do_one_pass(journal_t *journal, tid_t expected_tid)
+{
+	unsigned long next_fc_block;
+	struct buffer_head *bh;
+	int err = 0;
+
+	if (!jbd2_has_feature_fast_commit(journal))
+		return 0;
+
+	if (journal->j_fc_replay_pending)
+		expected_tid = journal->j_fc_replay_tid;
+	journal->j_fc_replay_pending = false;
+	journal->j_fc_replay_tid = expected_tid;
+
+	if (!journal->j_fc_replay_callback)
+		return 0;
+
+	jbd_debug(1, "Scanning fast commits for transaction %u\n",
+		  expected_tid);
+	for (next_fc_block = journal->j_fc_first;
+	     next_fc_block < journal->j_fc_last; next_fc_block++) {
+		err = jread(&bh, journal, next_fc_block);
+		if (err)
+			break;
+		err = journal->j_fc_replay_callback(journal, bh,
+				next_fc_block - journal->j_fc_first,
+				expected_tid);
+		brelse(bh);
+		if (err <= 0)
+			break;
+	}
+
+	if (err < 0) {
+		printk(KERN_ERR "JBD2: fast commit scan failed on %s: %d\n",
+		       journal->j_devname, err);
+		return err;
+	}
+	return 0;
+}
+
 int jbd2_journal_recover(journal_t *journal)
 {
 	int			err, err2;
@@ -264,7 +311,7 @@ int jbd2_journal_recover(journal_t *journal)
 		jbd_debug(1, "No recovery required, last transaction %d\n",
 			  be32_to_cpu(sb->s_sequence));
 		journal->j_transaction_sequence = be32_to_cpu(sb->s_sequence) + 1;
-		return 0;
+		return fc_do_one_pass(journal, be32_to_cpu(sb->s_sequence));
 	}
 
 	err = do_one_pass(journal, &info, PASS_SCAN);
@@ -272,6 +319,8 @@ int jbd2_journal_recover(journal_t *journal)
 		err = do_one_pass(journal, &info, PASS_REVOKE);
 	if (!err)
 		err = do_one_pass(journal, &info, PASS_REPLAY);
+	if (!err)
+		err = fc_do_one_pass(journal, info.end_transaction);
 
 	jbd_debug(1, "JBD2: recovery, exit status %d, "
 		  "recovered transactions %u to %u\n",
@@ -333,6 +382,8 @@ int jbd2_journal_skip_recovery(journal_t *journal)
 		journal->j_transaction_sequence = ++info.end_transaction;
 	}
 
+	/* Fast commits depend on the log we are throwing away */
+	journal->j_fc_replay_pending = false;
 	journal->j_tail = 0;
 	return err;
 }
@@ -279,6 +279,8 @@ static int start_this_handle(journal_t *journal, handle_t *handle,
 	int		blocks = handle->h_buffer_credits;
 	int		rsv_blocks = 0;
 	unsigned long ts = jiffies;
+	u64		start_ns = ktime_get_ns();
+	bool		waited = false;
 
 	if (handle->h_rsv_handle)
 		rsv_blocks = handle->h_rsv_handle->h_buffer_credits;
@@ -337,6 +339,7 @@ static int start_this_handle(journal_t *journal, handle_t *handle,
 		read_unlock(&journal->j_state_lock);
 		wait_event(journal->j_wait_transaction_locked,
 				journal->j_barrier_count == 0);
+		waited = true;
 		goto repeat;
 	}
 
@@ -358,8 +361,10 @@ static int start_this_handle(journal_t *journal, handle_t *handle,
 
 	if (!handle->h_reserved) {
 		/* We may have dropped j_state_lock - restart in that case */
-		if (add_transaction_credits(journal, blocks, rsv_blocks))
+		if (add_transaction_credits(journal, blocks, rsv_blocks)) {
+			waited = true;
 			goto repeat;
+		}
 	} else {
 		/*
 		 * We have handle reserved so we are allowed to join T_LOCKED
@@ -386,6 +391,9 @@ static int start_this_handle(journal_t *journal, handle_t *handle,
 	read_unlock(&journal->j_state_lock);
 	current->journal_info = handle;
 
+	this_cpu_inc(journal->j_handle_wait_hist[waited ?
+		jbd2_lat_hist_bucket(ktime_get_ns() - start_ns) : 0]);
+
 	rwsem_acquire_read(&journal->j_trans_commit_map, 0, 0, _THIS_IP_);
 	jbd2_journal_free_transaction(new_transaction);
 	return 0;
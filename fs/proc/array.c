@@ -86,6 +86,7 @@
 #include <linux/string_helpers.h>
 #include <linux/user_namespace.h>
 #include <linux/fs_struct.h>
+#include <linux/proc_task_stats.h>
 
 #include <asm/pgtable.h>
 #include <asm/processor.h>
@@ -768,3 +769,232 @@ const struct file_operations proc_tid_children_operations = {
 	.release = children_seq_release,
 };
 #endif /* CONFIG_PROC_CHILDREN */
+
+/*
+ * /proc/task_stats: see include/uapi/linux/proc_task_stats.h for the format.
+ * The tasks are walked in pid order with find_ge_pid(), so the seq_file
+ * position is the next pid to look at; position 0 is the header.
+ */
+struct task_stats_iter {
+	struct pid_namespace *ns;
+	u64 fields;
+	u64 flags;
+};
+
+static struct task_struct *task_stats_find(struct task_stats_iter *iter,
+					   loff_t *pos)
+{
+	struct task_struct *task = NULL;
+	struct pid *pid;
+	pid_t nr = *pos;
+
+	rcu_read_lock();
+	for (;; nr++) {
+		pid = find_ge_pid(nr, iter->ns);
+		if (!pid)
+			break;
+		nr = pid_nr_ns(pid, iter->ns);
+		task = pid_task(pid, PIDTYPE_PID);
+		/* As for the per-task files: hidden from hidepid=1 on */
+		if (task &&
+		    ((iter->flags & PROC_TS_THREADS) ||
+		     thread_group_leader(task)) &&
+		    has_pid_permissions(iter->ns, task, 1)) {
+			get_task_struct(task);
+			break;
+		}
+		task = NULL;
+	}
+	rcu_read_unlock();
+
+	*pos = nr;
+	return task;
+}
+
+static void *task_stats_start(struct seq_file *m, loff_t *pos)
+{
+	if (!*pos)
+		return SEQ_START_TOKEN;
+	return task_stats_find(m->private, pos);
+}
+
+static void *task_stats_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	if (v != SEQ_START_TOKEN)
+		put_task_struct(v);
+	++*pos;
+	return task_stats_find(m->private, pos);
+}
+
+static void task_stats_stop(struct seq_file *m, void *v)
+{
+	if (v && v != SEQ_START_TOKEN)
+		put_task_struct(v);
+}
+
+static void task_stats_fill_cpu(struct task_struct *task, bool whole,
+				struct proc_task_stats *st)
+{
+	cputime_t utime, stime;
+	unsigned long flags;
+
+	if (!whole) {
+		task_cputime_adjusted(task, &utime, &stime);
+		st->min_flt = task->min_flt;
+		st->maj_flt = task->maj_flt;
+		st->nvcsw = task->nvcsw;
+		st->nivcsw = task->nivcsw;
+	} else if (lock_task_sighand(task, &flags)) {
+		struct signal_struct *sig = task->signal;
+		struct task_struct *t = task;
+
+		st->min_flt = sig->min_flt;
+		st->maj_flt = sig->maj_flt;
+		st->nvcsw = sig->nvcsw;
+		st->nivcsw = sig->nivcsw;
+		do {
+			st->min_flt += t->min_flt;
+			st->maj_flt += t->maj_flt;
+			st->nvcsw += t->nvcsw;
+			st->nivcsw += t->nivcsw;
+		} while_each_thread(task, t);
+		thread_group_cputime_adjusted(task, &utime, &stime);
+		unlock_task_sighand(task, &flags);
+	} else {
+		return;
+	}
+
+	st->utime = cputime_to_nsecs(utime);
+	st->stime = cputime_to_nsecs(stime);
+}
+
+static void task_stats_fill_mem(struct task_struct *task,
+				struct proc_task_stats *st)
+{
+	struct mm_struct *mm = get_task_mm(task);
+
+	if (!mm)
+		return;
+
+	st->vsize = task_vsize(mm);
+	st->rss_anon = get_mm_counter(mm, MM_ANONPAGES) << PAGE_SHIFT;
+	st->rss_file = get_mm_counter(mm, MM_FILEPAGES) << PAGE_SHIFT;
+	st->rss_shmem = get_mm_counter(mm, MM_SHMEMPAGES) << PAGE_SHIFT;
+	st->swap = get_mm_counter(mm, MM_SWAPENTS) << PAGE_SHIFT;
+	st->hiwater_rss = max(mm->hiwater_rss, get_mm_rss(mm)) << PAGE_SHIFT;
+	mmput(mm);
+}
+
+static int task_stats_show(struct seq_file *m, void *v)
+{
+	struct task_stats_iter *iter = m->private;
+	struct task_struct *task = v;
+	struct proc_task_stats st;
+	bool whole = !(iter->flags & PROC_TS_THREADS);
+
+	if (v == SEQ_START_TOKEN) {
+		struct proc_task_stats_header hdr = {
+			.fields = iter->fields | PROC_TS_ID,
+			.flags = iter->flags,
+			.record_size = sizeof(st),
+		};
+
+		seq_write(m, &hdr, sizeof(hdr));
+		return 0;
+	}
+
+	memset(&st, 0, sizeof(st));
+
+	rcu_read_lock();
+	st.pid = task_pid_nr_ns(task, iter->ns);
+	st.tgid = task_tgid_nr_ns(task, iter->ns);
+	if (pid_alive(task))
+		st.ppid = task_tgid_nr_ns(rcu_dereference(task->real_parent),
+					  iter->ns);
+	st.uid = from_kuid_munged(seq_user_ns(m), task_uid(task));
+	rcu_read_unlock();
+	get_task_comm(st.comm, task);
+
+	if (iter->fields & PROC_TS_SCHED) {
+		st.flags = task->flags;
+		st.start_time = task->real_start_time;
+		st.state = *get_task_state(task);
+		st.nice = task_nice(task);
+		st.prio = task_prio(task);
+		st.policy = task->policy;
+		st.rt_priority = task->rt_priority;
+		st.cpu = task_cpu(task);
+		st.num_threads = get_nr_threads(task);
+	}
+
+	if (iter->fields & PROC_TS_CPU)
+		task_stats_fill_cpu(task, whole, &st);
+
+	if (iter->fields & PROC_TS_MEM)
+		task_stats_fill_mem(task, &st);
+
+	if (iter->fields & PROC_TS_OOM)
+		st.oom_score_adj = task->signal->oom_score_adj;
+
+	seq_write(m, &st, sizeof(st));
+	return 0;
+}
+
+static const struct seq_operations task_stats_seq_ops = {
+	.start	= task_stats_start,
+	.next	= task_stats_next,
+	.stop	= task_stats_stop,
+	.show	= task_stats_show,
+};
+
+static int task_stats_open(struct inode *inode, struct file *file)
+{
+	struct task_stats_iter *iter;
+
+	iter = __seq_open_private(file, &task_stats_seq_ops, sizeof(*iter));
+	if (!iter)
+		return -ENOMEM;
+
+	iter->ns = inode->i_sb->s_fs_info;
+	iter->fields = PROC_TS_ID | PROC_TS_SCHED;
+	return 0;
+}
+
+static ssize_t task_stats_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct task_stats_iter *iter = m->private;
+	struct proc_task_stats_request req;
+
+	if (count != sizeof(req))
+		return -EINVAL;
+	if (copy_from_user(&req, buf, sizeof(req)))
+		return -EFAULT;
+	if ((req.fields & ~PROC_TS_ALL_FIELDS) ||
+	    (req.flags & ~PROC_TS_ALL_FLAGS))
+		return -EINVAL;
+
+	mutex_lock(&m->lock);
+	iter->fields = req.fields | PROC_TS_ID;
+	iter->flags = req.flags;
+	mutex_unlock(&m->lock);
+
+	return count;
+}
+
+static const struct file_operations proc_task_stats_operations = {
+	.open		= task_stats_open,
+	.read		= seq_read,
+	.write		= task_stats_write,
+	.llseek		= seq_lseek,
+	.release	= seq_release_private,
+};
+
+static int __init proc_task_stats_init(void)
+{
+	proc_create("task_stats", S_IRUGO | S_IWUGO, NULL,
+		    &proc_task_stats_operations);
+	return 0;
+}
+fs_initcall(proc_task_stats_init);
@@ -88,6 +88,7 @@
 #include <linux/flex_array.h>
 #include <linux/posix-timers.h>
 #include <linux/cpufreq_times.h>
+#include <linux/dma-buf.h>
 #ifdef CONFIG_HARDWALL
 #include <asm/hardwall.h>
 #endif
@@ -667,6 +668,28 @@ static int proc_pid_limits(struct seq_file *m, struct pid_namespace *ns,
 	return 0;
 }
 
+#ifdef CONFIG_DMA_SHARED_BUFFER
+/* dma-bufs the process holds file descriptors to */
+static int proc_tgid_dmabuf(struct seq_file *m, struct pid_namespace *ns,
+			    struct pid *pid, struct task_struct *task)
+{
+	struct dma_buf_task_stats stats;
+	int ret;
+
+	/* Tells about the file table, just as fd/ and fdinfo/ do */
+	if (!ptrace_may_access(task, PTRACE_MODE_READ_FSCREDS))
+		return -EACCES;
+
+	ret = dma_buf_task_stats(task, &stats);
+	if (ret)
+		return ret;
+
+	seq_printf(m, "Fds:\t%u\nBuffers:\t%u\nSize:\t%zu kB\n",
+		   stats.fds, stats.buffers, stats.size >> 10);
+	return 0;
+}
+#endif
+
 #ifdef CONFIG_HAVE_ARCH_TRACEHOOK
 static int proc_pid_syscall(struct seq_file *m, struct pid_namespace *ns,
 			    struct pid *pid, struct task_struct *task)
@@ -737,9 +760,9 @@ int proc_setattr(struct dentry *dentry, struct iattr *attr)
  * May current process learn task's sched/cmdline info (for hide_pid_min=1)
  * or euid/egid (for hide_pid_min=2)?
  */
-static bool has_pid_permissions(struct pid_namespace *pid,
-				 struct task_struct *task,
-				 int hide_pid_min)
+bool has_pid_permissions(struct pid_namespace *pid,
+			 struct task_struct *task,
+			 int hide_pid_min)
 {
 	if (pid->hide_pid < hide_pid_min)
 		return true;
@@ -3284,6 +3307,9 @@ static const struct pid_entry tgid_base_stuff[] = {
 	ONE("concurrent_active_time", 0444, proc_concurrent_active_time_show),
 	ONE("concurrent_policy_time", 0444, proc_concurrent_policy_time_show),
 #endif
+#ifdef CONFIG_DMA_SHARED_BUFFER
+	ONE("dmabuf",     S_IRUGO, proc_tgid_dmabuf),
+#endif
 };
 
 static int proc_tgid_base_readdir(struct file *file, struct dir_context *ctx)
@@ -169,6 +169,8 @@ extern int pid_delete_dentry(const struct dentry *);
 extern int proc_pid_readdir(struct file *, struct dir_context *);
 extern struct dentry *proc_pid_lookup(struct inode *, struct dentry *, unsigned int);
 extern loff_t mem_lseek(struct file *, loff_t, int);
+extern bool has_pid_permissions(struct pid_namespace *, struct task_struct *,
+				int);
 
 /* Lookups */
 typedef int instantiate_t(struct inode *, struct dentry *,
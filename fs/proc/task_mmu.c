@@ -16,6 +16,7 @@
 #include <linux/page_idle.h>
 #include <linux/shmem_fs.h>
 #include <linux/mm_inline.h>
+#include <linux/sysctl.h>
 
 #include <asm/elf.h>
 #include <asm/uaccess.h>
@@ -513,6 +514,11 @@ struct mem_size_stats {
 	u64 pss_locked;
 	u64 swap_pss;
 	bool check_shmem_swap;
+#ifdef CONFIG_PROC_SMAPS_ROLLUP_CACHE
+	/* rollup only: the cache of the mm and its fault count, see below */
+	struct smaps_cache *cache;
+	unsigned long fault_key;
+#endif
 };
 
 static void smaps_account(struct mem_size_stats *mss, struct page *page,
@@ -786,16 +792,480 @@ static int smaps_hugetlb_range(pte_t *pte, unsigned long hmask,
 }
 #endif /* HUGETLB_PAGE */
 
+static void smaps_rollup_add(struct mem_size_stats *mss,
+			     const struct mem_size_stats *vma_mss)
+{
+	mss->resident += vma_mss->resident;
+	mss->shared_clean += vma_mss->shared_clean;
+	mss->shared_dirty += vma_mss->shared_dirty;
+	mss->private_clean += vma_mss->private_clean;
+	mss->private_dirty += vma_mss->private_dirty;
+	mss->referenced += vma_mss->referenced;
+	mss->anonymous += vma_mss->anonymous;
+	mss->anonymous_thp += vma_mss->anonymous_thp;
+	mss->shmem_thp += vma_mss->shmem_thp;
+	mss->swap += vma_mss->swap;
+	mss->shared_hugetlb += vma_mss->shared_hugetlb;
+	mss->private_hugetlb += vma_mss->private_hugetlb;
+	mss->pss += vma_mss->pss;
+	mss->pss_locked += vma_mss->pss_locked;
+	mss->swap_pss += vma_mss->swap_pss;
+}
+
+#ifdef CONFIG_PROC_SMAPS_ROLLUP_CACHE
+/*
+ * smaps_rollup keeps the walk result of each vma in a cache per mm, which
+ * is registered as an mmu notifier of the mm. Unmapping, reclaim,
+ * migration and protection changes all go through the notifier, which
+ * drops the entries of the vmas in the range they touch. Faults do not,
+ * so they are caught for the mm as a whole: each entry records the fault
+ * count of the mm's threads it was walked at. Neither sees accessed and
+ * dirty bits set by the hardware, nor the Pss of shared pages changing as
+ * other mms map and unmap them, nor pages populated from outside the mm's
+ * threads: get_user_pages() on a remote mm charges the fault to the
+ * caller, and UFFDIO_COPY installs ptes without faulting at all. Entries
+ * therefore also expire after smaps_rollup_cache_ms, which is kept short.
+ *
+ * Vmas whose ptes drivers install without faulting are never cached.
+ */
+struct smaps_cache {
+	struct mmu_notifier mn;
+	spinlock_t lock;
+	struct rb_root root;		/* entries, by address */
+	unsigned long seq;		/* bumped by every invalidation */
+	unsigned long nr_entries;
+	struct list_head list;		/* in smaps_caches, by last use */
+	struct rcu_head rcu;
+};
+
+struct smaps_cache_entry {
+	struct rb_node node;
+	unsigned long start;
+	unsigned long end;
+	unsigned long vm_flags;
+	unsigned long vm_pgoff;
+	struct file *vm_file;
+	struct anon_vma *anon_vma;
+	unsigned long fault_key;
+	unsigned long expires;
+	struct mem_size_stats mss;
+};
+
+#define SMAPS_CACHE_NOCACHE	(VM_PFNMAP | VM_MIXEDMAP | VM_IO)
+
+static int smaps_rollup_cache_ms = 1000;
+static struct kmem_cache *smaps_cache_entry_cachep;
+static LIST_HEAD(smaps_caches);
+static DEFINE_SPINLOCK(smaps_caches_lock);
+
+static atomic_long_t smaps_cache_entries;
+static atomic_long_t smaps_cache_hits;
+static atomic_long_t smaps_cache_misses;
+static atomic_long_t smaps_cache_invalidations;
+
+/* Entries never overlap, so they are sorted by their end as well. */
+static struct smaps_cache_entry *smaps_cache_first(struct smaps_cache *cache,
+						   unsigned long addr)
+{
+	struct rb_node *node = cache->root.rb_node;
+	struct smaps_cache_entry *e, *found = NULL;
+
+	while (node) {
+		e = rb_entry(node, struct smaps_cache_entry, node);
+		if (e->end > addr) {
+			found = e;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+	return found;
+}
+
+static void smaps_cache_erase(struct smaps_cache *cache,
+			      struct smaps_cache_entry *e)
+{
+	rb_erase(&e->node, &cache->root);
+	cache->nr_entries--;
+	atomic_long_dec(&smaps_cache_entries);
+	kmem_cache_free(smaps_cache_entry_cachep, e);
+}
+
+static unsigned long smaps_cache_clear(struct smaps_cache *cache)
+{
+	unsigned long nr = cache->nr_entries;
+	struct smaps_cache_entry *e, *n;
+
+	rbtree_postorder_for_each_entry_safe(e, n, &cache->root, node)
+		kmem_cache_free(smaps_cache_entry_cachep, e);
+	cache->root = RB_ROOT;
+	cache->nr_entries = 0;
+	cache->seq++;
+	atomic_long_sub(nr, &smaps_cache_entries);
+	return nr;
+}
+
+static void smaps_cache_invalidate(struct mmu_notifier *mn,
+				   unsigned long start, unsigned long end)
+{
+	struct smaps_cache *cache = container_of(mn, struct smaps_cache, mn);
+	struct smaps_cache_entry *e;
+	struct rb_node *next;
+
+	spin_lock(&cache->lock);
+	cache->seq++;
+	e = smaps_cache_first(cache, start);
+	while (e && e->start < end) {
+		next = rb_next(&e->node);
+		smaps_cache_erase(cache, e);
+		atomic_long_inc(&smaps_cache_invalidations);
+		e = next ? rb_entry(next, struct smaps_cache_entry, node) : NULL;
+	}
+	spin_unlock(&cache->lock);
+}
+
+static void smaps_cache_invalidate_page(struct mmu_notifier *mn,
+					struct mm_struct *mm,
+					unsigned long address)
+{
+	smaps_cache_invalidate(mn, address, address + PAGE_SIZE);
+}
+
+static void smaps_cache_change_pte(struct mmu_notifier *mn,
+				   struct mm_struct *mm,
+				   unsigned long address, pte_t pte)
+{
+	smaps_cache_invalidate(mn, address, address + PAGE_SIZE);
+}
+
+/*
+ * Used for both the start and the end of a range invalidation, so that a
+ * walk overlapping the change can neither leave nor insert a stale entry.
+ */
+static void smaps_cache_invalidate_range(struct mmu_notifier *mn,
+					 struct mm_struct *mm,
+					 unsigned long start, unsigned long end)
+{
+	smaps_cache_invalidate(mn, start, end);
+}
+
+static void smaps_cache_free_rcu(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct smaps_cache, rcu));
+}
+
+static void smaps_cache_release(struct mmu_notifier *mn, struct mm_struct *mm)
+{
+	struct smaps_cache *cache = container_of(mn, struct smaps_cache, mn);
+
+	spin_lock(&smaps_caches_lock);
+	list_del(&cache->list);
+	spin_unlock(&smaps_caches_lock);
+
+	spin_lock(&cache->lock);
+	smaps_cache_clear(cache);
+	spin_unlock(&cache->lock);
+
+	mmu_notifier_call_srcu(&cache->rcu, smaps_cache_free_rcu);
+}
+
+static const struct mmu_notifier_ops smaps_cache_ops = {
+	.release		= smaps_cache_release,
+	.change_pte		= smaps_cache_change_pte,
+	.invalidate_page	= smaps_cache_invalidate_page,
+	.invalidate_range_start	= smaps_cache_invalidate_range,
+	.invalidate_range_end	= smaps_cache_invalidate_range,
+};
+
+static struct smaps_cache *smaps_cache_find(struct mm_struct *mm)
+{
+	struct smaps_cache *cache = NULL;
+	struct mmu_notifier *mn;
+
+	if (!mm_has_notifiers(mm))
+		return NULL;
+
+	spin_lock(&mm->mmu_notifier_mm->lock);
+	hlist_for_each_entry(mn, &mm->mmu_notifier_mm->list, hlist) {
+		if (mn->ops == &smaps_cache_ops) {
+			cache = container_of(mn, struct smaps_cache, mn);
+			break;
+		}
+	}
+	spin_unlock(&mm->mmu_notifier_mm->lock);
+	return cache;
+}
+
+/* Called on open, as registering the notifier needs mmap_sem for writing. */
+static void smaps_cache_attach(struct mm_struct *mm)
+{
+	struct smaps_cache *cache;
+
+	if (!READ_ONCE(smaps_rollup_cache_ms) ||
+	    !mm || !atomic_inc_not_zero(&mm->mm_users))
+		return;
+
+	if (smaps_cache_find(mm))
+		goto out;
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache)
+		goto out;
+	cache->mn.ops = &smaps_cache_ops;
+	spin_lock_init(&cache->lock);
+	cache->root = RB_ROOT;
+
+	down_write(&mm->mmap_sem);
+	if (smaps_cache_find(mm) || __mmu_notifier_register(&cache->mn, mm)) {
+		up_write(&mm->mmap_sem);
+		kfree(cache);
+		goto out;
+	}
+	spin_lock(&smaps_caches_lock);
+	list_add_tail(&cache->list, &smaps_caches);
+	spin_unlock(&smaps_caches_lock);
+	up_write(&mm->mmap_sem);
+out:
+	mmput(mm);
+}
+
+/* Called with mmap_sem held at the start of each rollup. */
+static void smaps_cache_begin(struct proc_maps_private *priv,
+			      struct mem_size_stats *mss)
+{
+	struct smaps_cache *cache;
+	struct task_struct *t;
+	unsigned long flags;
+
+	mss->cache = NULL;
+	if (!READ_ONCE(smaps_rollup_cache_ms))
+		return;
+
+	cache = smaps_cache_find(priv->mm);
+	if (!cache || !lock_task_sighand(priv->task, &flags))
+		return;
+
+	mss->fault_key = priv->task->signal->min_flt +
+			 priv->task->signal->maj_flt;
+	for_each_thread(priv->task, t)
+		mss->fault_key += t->min_flt + t->maj_flt;
+	unlock_task_sighand(priv->task, &flags);
+
+	mss->cache = cache;
+	spin_lock(&smaps_caches_lock);
+	list_move_tail(&cache->list, &smaps_caches);
+	spin_unlock(&smaps_caches_lock);
+}
+
+static bool smaps_cache_lookup(struct mem_size_stats *mss,
+			       struct vm_area_struct *vma)
+{
+	struct smaps_cache *cache = mss->cache;
+	struct smaps_cache_entry *e;
+	bool hit = false;
+
+	if (!cache || (vma->vm_flags & SMAPS_CACHE_NOCACHE))
+		return false;
+
+	spin_lock(&cache->lock);
+	e = smaps_cache_first(cache, vma->vm_start);
+	if (e && e->start == vma->vm_start) {
+		if (e->end == vma->vm_end && e->vm_flags == vma->vm_flags &&
+		    e->vm_pgoff == vma->vm_pgoff &&
+		    e->vm_file == vma->vm_file &&
+		    e->anon_vma == vma->anon_vma &&
+		    e->fault_key == mss->fault_key &&
+		    time_before(jiffies, e->expires)) {
+			smaps_rollup_add(mss, &e->mss);
+			hit = true;
+		} else {
+			smaps_cache_erase(cache, e);
+		}
+	}
+	spin_unlock(&cache->lock);
+
+	atomic_long_inc(hit ? &smaps_cache_hits : &smaps_cache_misses);
+	return hit;
+}
+
+static unsigned long smaps_cache_seq(struct mem_size_stats *mss)
+{
+	unsigned long seq = 0;
+
+	if (mss->cache) {
+		spin_lock(&mss->cache->lock);
+		seq = mss->cache->seq;
+		spin_unlock(&mss->cache->lock);
+	}
+	return seq;
+}
+
+static void smaps_cache_insert(struct mem_size_stats *mss,
+			       struct vm_area_struct *vma, unsigned long seq,
+			       const struct mem_size_stats *vma_mss)
+{
+	struct smaps_cache *cache = mss->cache;
+	struct rb_node **link, *parent = NULL;
+	struct smaps_cache_entry *e, *old;
+
+	if (!cache || (vma->vm_flags & SMAPS_CACHE_NOCACHE))
+		return;
+
+	e = kmem_cache_alloc(smaps_cache_entry_cachep, GFP_KERNEL);
+	if (!e)
+		return;
+	e->start = vma->vm_start;
+	e->end = vma->vm_end;
+	e->vm_flags = vma->vm_flags;
+	e->vm_pgoff = vma->vm_pgoff;
+	e->vm_file = vma->vm_file;
+	e->anon_vma = vma->anon_vma;
+	e->fault_key = mss->fault_key;
+	e->expires = jiffies +
+		     msecs_to_jiffies(READ_ONCE(smaps_rollup_cache_ms));
+	e->mss = *vma_mss;
+
+	spin_lock(&cache->lock);
+	/* Invalidated while it was walked, or emptied by the shrinker. */
+	if (cache->seq != seq) {
+		spin_unlock(&cache->lock);
+		kmem_cache_free(smaps_cache_entry_cachep, e);
+		return;
+	}
+	/* Drop what is left of vmas this one was split from or merged with. */
+	while ((old = smaps_cache_first(cache, e->start)) &&
+	       old->start < e->end)
+		smaps_cache_erase(cache, old);
+
+	link = &cache->root.rb_node;
+	while (*link) {
+		parent = *link;
+		old = rb_entry(parent, struct smaps_cache_entry, node);
+		if (e->start < old->start)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&e->node, parent, link);
+	rb_insert_color(&e->node, &cache->root);
+	cache->nr_entries++;
+	atomic_long_inc(&smaps_cache_entries);
+	spin_unlock(&cache->lock);
+}
+
+static unsigned long smaps_cache_shrink_count(struct shrinker *shrinker,
+					      struct shrink_control *sc)
+{
+	return atomic_long_read(&smaps_cache_entries);
+}
+
+/* Empties whole caches, least recently read first. */
+static unsigned long smaps_cache_shrink_scan(struct shrinker *shrinker,
+					     struct shrink_control *sc)
+{
+	struct smaps_cache *cache;
+	unsigned long freed = 0;
+
+	spin_lock(&smaps_caches_lock);
+	list_for_each_entry(cache, &smaps_caches, list) {
+		spin_lock(&cache->lock);
+		freed += smaps_cache_clear(cache);
+		spin_unlock(&cache->lock);
+		if (freed >= sc->nr_to_scan)
+			break;
+	}
+	spin_unlock(&smaps_caches_lock);
+
+	return freed;
+}
+
+static struct shrinker smaps_cache_shrinker = {
+	.count_objects = smaps_cache_shrink_count,
+	.scan_objects = smaps_cache_shrink_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+
+/* entries, hits, misses, invalidations */
+static int smaps_cache_stats_handler(struct ctl_table *table, int write,
+				     void __user *buffer, size_t *lenp,
+				     loff_t *ppos)
+{
+	unsigned long stats[] = {
+		atomic_long_read(&smaps_cache_entries),
+		atomic_long_read(&smaps_cache_hits),
+		atomic_long_read(&smaps_cache_misses),
+		atomic_long_read(&smaps_cache_invalidations),
+	};
+	struct ctl_table t = *table;
+
+	t.data = stats;
+	t.maxlen = sizeof(stats);
+	return proc_doulongvec_minmax(&t, write, buffer, lenp, ppos);
+}
+
+static int zero;
+
+static struct ctl_table smaps_cache_table[] = {
+	{
+		.procname	= "smaps_rollup_cache_ms",
+		.data		= &smaps_rollup_cache_ms,
+		.maxlen		= sizeof(smaps_rollup_cache_ms),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+	},
+	{
+		.procname	= "smaps_rollup_cache_stats",
+		.mode		= 0444,
+		.proc_handler	= smaps_cache_stats_handler,
+	},
+	{ }
+};
+
+static int __init smaps_cache_init(void)
+{
+	smaps_cache_entry_cachep = KMEM_CACHE(smaps_cache_entry, SLAB_PANIC);
+	register_sysctl("vm", smaps_cache_table);
+	register_shrinker(&smaps_cache_shrinker);
+	return 0;
+}
+fs_initcall(smaps_cache_init);
+#else
+static inline void smaps_cache_attach(struct mm_struct *mm)
+{
+}
+
+static inline void smaps_cache_begin(struct proc_maps_private *priv,
+				     struct mem_size_stats *mss)
+{
+}
+
+static inline bool smaps_cache_lookup(struct mem_size_stats *mss,
+				      struct vm_area_struct *vma)
+{
+	return false;
+}
+
+static inline unsigned long smaps_cache_seq(struct mem_size_stats *mss)
+{
+	return 0;
+}
+
+static inline void smaps_cache_insert(struct mem_size_stats *mss,
+				      struct vm_area_struct *vma,
+				      unsigned long seq,
+				      const struct mem_size_stats *vma_mss)
+{
+}
+#endif /* CONFIG_PROC_SMAPS_ROLLUP_CACHE */
+
 void __weak arch_show_smap(struct seq_file *m, struct vm_area_struct *vma)
 {
 }
 
-static int show_smap(struct seq_file *m, void *v, int is_pid)
+static void smap_gather_stats(struct vm_area_struct *vma,
+			      struct mem_size_stats *mss)
 {
-	struct proc_maps_private *priv = m->private;
-	struct vm_area_struct *vma = v;
-	struct mem_size_stats mss_stack;
-	struct mem_size_stats *mss;
 	struct mm_walk smaps_walk = {
 		.pmd_entry = smaps_pte_range,
 #ifdef CONFIG_HUGETLB_PAGE
@@ -803,29 +1273,10 @@ static int show_smap(struct seq_file *m, void *v, int is_pid)
 #endif
 		.mm = vma->vm_mm,
 	};
-	int ret = 0;
-	bool rollup_mode;
-	bool last_vma;
-
-	if (priv->rollup) {
-		rollup_mode = true;
-		mss = priv->rollup;
-		if (mss->first) {
-			mss->first_vma_start = vma->vm_start;
-			mss->first = false;
-		}
-		last_vma = !m_next_vma(priv, vma);
-	} else {
-		rollup_mode = false;
-		memset(&mss_stack, 0, sizeof(mss_stack));
-		mss = &mss_stack;
-	}
 
 	smaps_walk.private = mss;
 
 #ifdef CONFIG_SHMEM
-	/* In case of smaps_rollup, reset the value from previous vma */
-	mss->check_shmem_swap = false;
 	if (vma->vm_file && shmem_mapping(vma->vm_file->f_mapping)) {
 		/*
 		 * For shared or readonly shmem mappings we know that all
@@ -850,6 +1301,51 @@ static int show_smap(struct seq_file *m, void *v, int is_pid)
 #endif
 	/* mmap_sem is held in m_start */
 	walk_page_vma(vma, &smaps_walk);
+}
+
+/* Adds the stats of @vma to the rollup, walking it only if not cached. */
+static void smaps_rollup_gather(struct mem_size_stats *mss,
+				struct vm_area_struct *vma)
+{
+	struct mem_size_stats vma_mss;
+	unsigned long seq;
+
+	if (smaps_cache_lookup(mss, vma))
+		return;
+
+	seq = smaps_cache_seq(mss);
+	memset(&vma_mss, 0, sizeof(vma_mss));
+	smap_gather_stats(vma, &vma_mss);
+	smaps_rollup_add(mss, &vma_mss);
+	smaps_cache_insert(mss, vma, seq, &vma_mss);
+}
+
+static int show_smap(struct seq_file *m, void *v, int is_pid)
+{
+	struct proc_maps_private *priv = m->private;
+	struct vm_area_struct *vma = v;
+	struct mem_size_stats mss_stack;
+	struct mem_size_stats *mss;
+	int ret = 0;
+	bool rollup_mode;
+	bool last_vma;
+
+	if (priv->rollup) {
+		rollup_mode = true;
+		mss = priv->rollup;
+		if (mss->first) {
+			mss->first_vma_start = vma->vm_start;
+			mss->first = false;
+			smaps_cache_begin(priv, mss);
+		}
+		last_vma = !m_next_vma(priv, vma);
+		smaps_rollup_gather(mss, vma);
+	} else {
+		rollup_mode = false;
+		memset(&mss_stack, 0, sizeof(mss_stack));
+		mss = &mss_stack;
+		smap_gather_stats(vma, mss);
+	}
 
 	if (!rollup_mode) {
 		show_map_vma(m, vma, is_pid);
@@ -937,6 +1433,25 @@ static const struct seq_operations proc_pid_smaps_op = {
 	.show	= show_pid_smap
 };
 
+/* A read from the start is a new rollup, not more of the last one. */
+static void *smaps_rollup_start(struct seq_file *m, loff_t *ppos)
+{
+	struct proc_maps_private *priv = m->private;
+
+	if (!*ppos) {
+		memset(priv->rollup, 0, sizeof(*priv->rollup));
+		priv->rollup->first = true;
+	}
+	return m_start(m, ppos);
+}
+
+static const struct seq_operations proc_pid_smaps_rollup_op = {
+	.start	= smaps_rollup_start,
+	.next	= m_next,
+	.stop	= m_stop,
+	.show	= show_pid_smap
+};
+
 static const struct seq_operations proc_tid_smaps_op = {
 	.start	= m_start,
 	.next	= m_next,
@@ -953,7 +1468,7 @@ static int pid_smaps_rollup_open(struct inode *inode, struct file *file)
 {
 	struct seq_file *seq;
 	struct proc_maps_private *priv;
-	int ret = do_maps_open(inode, file, &proc_pid_smaps_op);
+	int ret = do_maps_open(inode, file, &proc_pid_smaps_rollup_op);
 
 	if (ret < 0)
 		return ret;
@@ -965,6 +1480,7 @@ static int pid_smaps_rollup_open(struct inode *inode, struct file *file)
 		return -ENOMEM;
 	}
 	priv->rollup->first = true;
+	smaps_cache_attach(priv->mm);
 	return 0;
 }
 
@@ -1618,11 +2134,518 @@ static int pagemap_release(struct inode *inode, struct file *file)
 	return 0;
 }
 
+/*
+ * PAGEMAP_SCAN: the same walk as pagemap_read(), but pages are filtered by
+ * category and the matching ones are returned as runs of virtually
+ * contiguous pages in the same category, so that scanning a sparse address
+ * space costs in proportion to what is found rather than to its size.
+ */
+#define PM_SCAN_END		1	/* vec or max_pages used up */
+
+struct pagemap_scan_private {
+	struct pm_scan_arg arg;
+	struct pagemapread pm;		/* for pte_to_pagemap_entry() */
+	struct page_region __user *vec;
+	struct page_region *buffer;	/* runs finished in this chunk */
+	unsigned long nr_buffer;
+	struct page_region cur;		/* run being extended */
+	unsigned long found;		/* entries copied to vec */
+	unsigned long found_pages;
+	unsigned long walk_end;
+	bool clear;
+	/* vma whose VM_SOFTDIRTY was cleared and is still to be reported */
+	unsigned long sd_start, sd_end;
+};
+
+static u64 pme_to_categories(u64 pme)
+{
+	u64 categories = 0;
+
+	if (pme & PM_PRESENT)
+		categories |= PAGE_IS_PRESENT;
+	if (pme & PM_SWAP)
+		categories |= PAGE_IS_SWAPPED;
+	if (pme & PM_FILE)
+		categories |= PAGE_IS_FILE;
+	if (pme & PM_MMAP_EXCLUSIVE)
+		categories |= PAGE_IS_EXCLUSIVE;
+	if (pme & PM_SOFT_DIRTY)
+		categories |= PAGE_IS_SOFT_DIRTY;
+
+	return categories;
+}
+
+/* Pages of a soft-dirty vma are all soft-dirty, see pagemap_scan_clear_vma() */
+static bool pagemap_scan_vma_soft_dirty(struct pagemap_scan_private *p,
+					struct vm_area_struct *vma,
+					unsigned long addr)
+{
+	return (vma->vm_flags & VM_SOFTDIRTY) ||
+		(addr >= p->sd_start && addr < p->sd_end);
+}
+
+static bool pagemap_scan_match(struct pagemap_scan_private *p, u64 categories)
+{
+	categories ^= p->arg.category_inverted;
+	if ((categories & p->arg.category_mask) != p->arg.category_mask)
+		return false;
+	if (p->arg.category_anyof_mask &&
+	    !(categories & p->arg.category_anyof_mask))
+		return false;
+	return true;
+}
+
+/*
+ * Report the pages in [addr, *end) if they match, extending the current
+ * run when they continue it. When vec or max_pages runs out, *end is moved
+ * back to the first page not reported and PM_SCAN_END is returned.
+ */
+static int pagemap_scan_output(struct pagemap_scan_private *p,
+			       u64 categories, unsigned long addr,
+			       unsigned long *end)
+{
+	unsigned long nr_pages = (*end - addr) >> PAGE_SHIFT;
+	unsigned long used;
+	int ret = 0;
+
+	if (!p->arg.vec_len || !pagemap_scan_match(p, categories))
+		return 0;
+
+	if (p->arg.max_pages &&
+	    p->found_pages + nr_pages >= p->arg.max_pages) {
+		nr_pages = p->arg.max_pages - p->found_pages;
+		*end = addr + (nr_pages << PAGE_SHIFT);
+		ret = PM_SCAN_END;
+		if (!nr_pages)
+			return ret;
+	}
+
+	categories &= p->arg.return_mask;
+	if (p->cur.end == addr && p->cur.categories == categories) {
+		p->cur.end = *end;
+	} else {
+		used = p->found + p->nr_buffer + (p->cur.start != p->cur.end);
+		if (used >= p->arg.vec_len) {
+			*end = addr;
+			return PM_SCAN_END;
+		}
+		if (p->cur.start != p->cur.end)
+			p->buffer[p->nr_buffer++] = p->cur;
+		p->cur.start = addr;
+		p->cur.end = *end;
+		p->cur.categories = categories;
+	}
+	p->found_pages += nr_pages;
+
+	return ret;
+}
+
+static int pagemap_scan_flush(struct pagemap_scan_private *p)
+{
+	if (!p->nr_buffer)
+		return 0;
+	if (copy_to_user(p->vec + p->found, p->buffer,
+			 p->nr_buffer * sizeof(*p->buffer)))
+		return -EFAULT;
+	p->found += p->nr_buffer;
+	p->nr_buffer = 0;
+	return 0;
+}
+
+static int pagemap_scan_test_walk(unsigned long start, unsigned long end,
+				  struct mm_walk *walk)
+{
+	if (walk->vma->vm_flags & VM_PFNMAP)
+		return 1;
+	return 0;
+}
+
+static int pagemap_scan_pte_hole(unsigned long addr, unsigned long end,
+				 struct mm_walk *walk)
+{
+	struct pagemap_scan_private *p = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	u64 categories = 0;
+	int ret;
+
+	/* Unmapped address space is never reported. */
+	if (!vma)
+		return 0;
+
+	if (pagemap_scan_vma_soft_dirty(p, vma, addr))
+		categories |= PAGE_IS_SOFT_DIRTY;
+
+	ret = pagemap_scan_output(p, categories, addr, &end);
+	if (ret)
+		p->walk_end = end;
+	return ret;
+}
+
+static int pagemap_scan_pmd_range(pmd_t *pmdp, unsigned long addr,
+				  unsigned long end, struct mm_walk *walk)
+{
+	struct pagemap_scan_private *p = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	unsigned long next;
+	spinlock_t *ptl;
+	pte_t *pte, *orig_pte;
+	int ret = 0;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	ptl = pmd_trans_huge_lock(pmdp, vma);
+	if (ptl) {
+		bool whole = !(addr & ~PMD_MASK) && end - addr == PMD_SIZE;
+		pmd_t pmd = *pmdp;
+		u64 categories = 0;
+
+		/*
+		 * Clearing soft-dirty write-protects the whole pmd, so a
+		 * huge page only partly in the range is split first.
+		 */
+		if (p->clear && !whole) {
+			spin_unlock(ptl);
+			split_huge_pmd(vma, pmdp, addr);
+			goto pte_range;
+		}
+
+		if (pagemap_scan_vma_soft_dirty(p, vma, addr) ||
+		    pmd_soft_dirty(pmd))
+			categories |= PAGE_IS_SOFT_DIRTY;
+		if (pmd_present(pmd)) {
+			struct page *page = pmd_page(pmd);
+
+			if (page_mapcount(page) == 1)
+				categories |= PAGE_IS_EXCLUSIVE;
+			if (!PageAnon(page))
+				categories |= PAGE_IS_FILE;
+			categories |= PAGE_IS_PRESENT;
+		}
+
+		next = end;
+		ret = pagemap_scan_output(p, categories, addr, &next);
+		/* A partly reported huge page is left to report it again. */
+		if (p->clear && next == end)
+			clear_soft_dirty_pmd(vma, addr, pmdp);
+		if (ret)
+			p->walk_end = next;
+		spin_unlock(ptl);
+		return ret;
+	}
+
+pte_range:
+	if (pmd_trans_unstable(pmdp))
+		return 0;
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+	orig_pte = pte = pte_offset_map_lock(walk->mm, pmdp, addr, &ptl);
+	for (; addr < end; pte++, addr += PAGE_SIZE) {
+		pagemap_entry_t pme;
+		u64 categories;
+
+		pme = pte_to_pagemap_entry(&p->pm, vma, addr, *pte);
+		categories = pme_to_categories(pme.pme);
+		if (pagemap_scan_vma_soft_dirty(p, vma, addr))
+			categories |= PAGE_IS_SOFT_DIRTY;
+		next = addr + PAGE_SIZE;
+		ret = pagemap_scan_output(p, categories, addr, &next);
+		if (p->clear && next != addr)
+			clear_soft_dirty(vma, addr, pte);
+		if (ret) {
+			p->walk_end = next;
+			break;
+		}
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+
+	cond_resched();
+
+	return ret;
+}
+
+#ifdef CONFIG_HUGETLB_PAGE
+static int pagemap_scan_hugetlb_range(pte_t *ptep, unsigned long hmask,
+				      unsigned long addr, unsigned long end,
+				      struct mm_walk *walk)
+{
+	struct pagemap_scan_private *p = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	u64 categories = 0;
+	pte_t pte;
+	int ret;
+
+	if (pagemap_scan_vma_soft_dirty(p, vma, addr))
+		categories |= PAGE_IS_SOFT_DIRTY;
+
+	pte = huge_ptep_get(ptep);
+	if (pte_present(pte)) {
+		struct page *page = pte_page(pte);
+
+		if (!PageAnon(page))
+			categories |= PAGE_IS_FILE;
+		if (page_mapcount(page) == 1)
+			categories |= PAGE_IS_EXCLUSIVE;
+		categories |= PAGE_IS_PRESENT;
+	}
+
+	ret = pagemap_scan_output(p, categories, addr, &end);
+	if (ret)
+		p->walk_end = end;
+
+	cond_resched();
+
+	return ret;
+}
+#endif /* HUGETLB_PAGE */
+
+/*
+ * The soft-dirty flag of a vma marks all its pages and can only be cleared
+ * for the vma as a whole, splitting off what sticks out of the scanned
+ * [start, end). It is cleared before the walk gets to the vma, under the
+ * same mmap_sem, so that nothing mapped in between can lose it unreported;
+ * the walk then reports [sd_start, sd_end) as soft-dirty itself.
+ *
+ * Called with mmap_sem held for reading and returns with it held for
+ * reading, unless an error is returned.
+ */
+static int pagemap_scan_clear_vma(struct mm_struct *mm,
+				  struct pagemap_scan_private *p,
+				  unsigned long addr, unsigned long start,
+				  unsigned long end)
+{
+	struct vm_area_struct *vma;
+
+	up_read(&mm->mmap_sem);
+	if (down_write_killable(&mm->mmap_sem))
+		return -EINTR;
+	/* See clear_refs_write(). */
+	if (!mmget_still_valid(mm)) {
+		up_write(&mm->mmap_sem);
+		return -ESRCH;
+	}
+
+	vma = find_vma(mm, addr);
+	/* If splitting fails the pages stay soft-dirty, which is safe. */
+	if (vma && vma->vm_start <= addr && (vma->vm_flags & VM_SOFTDIRTY) &&
+	    !(vma->vm_start < start && split_vma(mm, vma, start, 1)) &&
+	    !(vma->vm_end > end && split_vma(mm, vma, end, 0))) {
+		vma->vm_flags &= ~VM_SOFTDIRTY;
+		vma_set_page_prot(vma);
+		p->sd_start = vma->vm_start;
+		p->sd_end = vma->vm_end;
+	}
+
+	downgrade_write(&mm->mmap_sem);
+	return 0;
+}
+
+/*
+ * Before walking [addr, *next) with PM_SCAN_CLEAR_SOFT_DIRTY, clear the
+ * soft-dirty vma at @addr, and end the chunk at the next soft-dirty vma
+ * so that it gets the same treatment. Called with mmap_sem held for
+ * reading.
+ */
+static int pagemap_scan_prepare_clear(struct mm_struct *mm,
+				      struct pagemap_scan_private *p,
+				      unsigned long addr, unsigned long *next,
+				      unsigned long start, unsigned long end)
+{
+	struct vm_area_struct *vma;
+	int ret;
+
+	vma = find_vma(mm, addr);
+	if (vma && vma->vm_start <= addr && (vma->vm_flags & VM_SOFTDIRTY)) {
+		ret = pagemap_scan_clear_vma(mm, p, addr, start, end);
+		if (ret)
+			return ret;
+		vma = find_vma(mm, addr);
+	}
+
+	for (; vma && vma->vm_start < *next; vma = vma->vm_next) {
+		if (vma->vm_start > addr && (vma->vm_flags & VM_SOFTDIRTY)) {
+			*next = vma->vm_start;
+			break;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The walk stopped inside a vma whose soft-dirty flag was cleared: mark
+ * the part not reported soft-dirty again. Whatever is mapped there now is
+ * at most reported once more than needed.
+ */
+static void pagemap_scan_restore_vmas(struct mm_struct *mm,
+				      unsigned long start, unsigned long end)
+{
+	struct vm_area_struct *vma;
+
+	for (vma = find_vma(mm, start); vma && vma->vm_start < end;
+	     vma = vma->vm_next) {
+		if (vma->vm_flags & VM_SOFTDIRTY)
+			continue;
+		vma->vm_flags |= VM_SOFTDIRTY;
+		vma_set_page_prot(vma);
+	}
+}
+
+static long pagemap_scan(struct file *file, struct pm_scan_arg __user *uarg)
+{
+	struct mm_struct *mm = file->private_data;
+	struct pagemap_scan_private p = {};
+	struct mm_walk scan_walk = {};
+	unsigned long start, end, next, scan_start;
+	int ret;
+
+	if (copy_from_user(&p.arg, uarg, sizeof(p.arg)))
+		return -EFAULT;
+	if (p.arg.size != sizeof(p.arg))
+		return -EINVAL;
+	if ((p.arg.flags & ~PM_SCAN_FLAGS) ||
+	    ((p.arg.category_inverted | p.arg.category_mask |
+	      p.arg.category_anyof_mask | p.arg.return_mask) &
+	     ~PM_SCAN_CATEGORIES))
+		return -EINVAL;
+	if (!IS_ALIGNED(p.arg.start, PAGE_SIZE) || p.arg.end < p.arg.start)
+		return -EINVAL;
+
+	p.clear = p.arg.flags & PM_SCAN_CLEAR_SOFT_DIRTY;
+	if (p.clear && !IS_ENABLED(CONFIG_MEM_SOFT_DIRTY))
+		return -EOPNOTSUPP;
+	if (p.clear) {
+		struct task_struct *task = get_proc_task(file_inode(file));
+		bool allowed;
+
+		if (!task)
+			return -ESRCH;
+		/* Clearing changes what the task's next scan sees. */
+		allowed = ptrace_may_access(task, PTRACE_MODE_ATTACH_FSCREDS);
+		put_task_struct(task);
+		if (!allowed)
+			return -EPERM;
+	}
+	if (!p.arg.vec_len && !p.clear)
+		return -EINVAL;
+
+	p.vec = u64_to_user_ptr(p.arg.vec);
+	if (p.arg.vec_len > ULONG_MAX / sizeof(*p.vec) ||
+	    !access_ok(VERIFY_WRITE, p.vec, p.arg.vec_len * sizeof(*p.vec)))
+		return -EFAULT;
+
+	if (!mm || !atomic_inc_not_zero(&mm->mm_users))
+		return 0;
+
+	end = min_t(u64, PAGE_ALIGN(p.arg.end), mm->task_size);
+	start = scan_start = min_t(u64, p.arg.start, end);
+	p.walk_end = end;
+
+	/* A chunk has no more runs than pages, see pagemap_scan_output(). */
+	ret = -ENOMEM;
+	p.buffer = kmalloc_array(PAGEMAP_WALK_SIZE >> PAGE_SHIFT,
+				 sizeof(*p.buffer), GFP_TEMPORARY);
+	if (!p.buffer)
+		goto out_mm;
+
+	scan_walk.pmd_entry = pagemap_scan_pmd_range;
+	scan_walk.pte_hole = pagemap_scan_pte_hole;
+	scan_walk.test_walk = pagemap_scan_test_walk;
+#ifdef CONFIG_HUGETLB_PAGE
+	scan_walk.hugetlb_entry = pagemap_scan_hugetlb_range;
+#endif
+	scan_walk.mm = mm;
+	scan_walk.private = &p;
+
+	/*
+	 * Walk a chunk at a time and copy the runs out with mmap_sem dropped,
+	 * as vec may well be in the address space being scanned.
+	 */
+	ret = 0;
+	for (; start < end; start = next) {
+		next = (start + PAGEMAP_WALK_SIZE) & PAGEMAP_WALK_MASK;
+		/* overflow ? */
+		if (next < start || next > end)
+			next = end;
+
+		down_read(&mm->mmap_sem);
+		if (p.clear) {
+			ret = pagemap_scan_prepare_clear(mm, &p, start, &next,
+							 scan_start, end);
+			if (ret) {
+				p.walk_end = start;
+				goto out_flush;
+			}
+			mmu_notifier_invalidate_range_start(mm, start, next);
+		}
+		ret = walk_page_range(start, next, &scan_walk);
+		if (p.clear) {
+			mmu_notifier_invalidate_range_end(mm, start, next);
+			/* Nothing may write through a stale tlb entry */
+			flush_tlb_mm(mm);
+		}
+		up_read(&mm->mmap_sem);
+
+		if (pagemap_scan_flush(&p)) {
+			p.walk_end = start;
+			ret = -EFAULT;
+			goto out_flush;
+		}
+		if (ret)
+			break;
+		if (fatal_signal_pending(current)) {
+			p.walk_end = next;
+			break;
+		}
+	}
+
+out_flush:
+	if (p.clear && p.walk_end < p.sd_end) {
+		down_write(&mm->mmap_sem);
+		if (mmget_still_valid(mm))
+			pagemap_scan_restore_vmas(mm,
+						  max(p.walk_end, p.sd_start),
+						  p.sd_end);
+		up_write(&mm->mmap_sem);
+	}
+	if (ret < 0)
+		goto out_free;
+
+	if (p.cur.start != p.cur.end) {
+		p.buffer[p.nr_buffer++] = p.cur;
+		if (pagemap_scan_flush(&p)) {
+			ret = -EFAULT;
+			goto out_free;
+		}
+	}
+
+	ret = -EFAULT;
+	if (put_user(p.walk_end, &uarg->walk_end))
+		goto out_free;
+	ret = p.found;
+
+out_free:
+	kfree(p.buffer);
+out_mm:
+	mmput(mm);
+	return ret;
+}
+
+static long pagemap_ioctl(struct file *file, unsigned int cmd,
+			  unsigned long arg)
+{
+	switch (cmd) {
+	case PAGEMAP_SCAN:
+		return pagemap_scan(file, (struct pm_scan_arg __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
 const struct file_operations proc_pagemap_operations = {
 	.llseek		= mem_lseek, /* borrow this */
 	.read		= pagemap_read,
 	.open		= pagemap_open,
 	.release	= pagemap_release,
+	.unlocked_ioctl	= pagemap_ioctl,
+	.compat_ioctl	= pagemap_ioctl,
 };
 #endif /* CONFIG_PROC_PAGE_MONITOR */
 
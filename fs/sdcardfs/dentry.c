@@ -114,6 +114,8 @@ static int sdcardfs_d_revalidate(struct dentry *dentry, unsigned int flags)
 			data_put(data);
 		iput(inode);
 	}
+	if (err)
+		fixup_perms_lazy(dentry);
 
 out:
 	dput(parent_dentry);
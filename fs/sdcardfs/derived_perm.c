@@ -46,6 +46,7 @@ void setup_derived_state(struct inode *inode, perm_t perm, userid_t userid,
 	info->data->under_android = false;
 	info->data->under_cache = false;
 	info->data->under_obb = false;
+	info->data->pkg_gen = atomic_read(&sdcardfs_pkg_gen);
 }
 
 /* While renaming, there is a point where we want the path from dentry,
@@ -75,6 +76,8 @@ void get_derived_permission_new(struct inode *parent, struct inode *inode,
 	 * of using the inode permissions.
 	 */
 
+	info->data->pkg_gen = atomic_read(&sdcardfs_pkg_gen);
+	smp_rmb();
 	inherit_derived_state(parent, inode);
 
 	/* Files don't get special labels */
@@ -266,69 +269,55 @@ void fixup_lower_ownership(struct dentry *dentry, const char *name)
 	sdcardfs_put_lower_path(dentry, &path);
 }
 
-static int descendant_may_need_fixup(struct sdcardfs_inode_data *data,
-		struct limit_search *limit)
-{
-	if (data->perm == PERM_ROOT)
-		return (limit->flags & BY_USERID) ?
-				data->userid == limit->userid : 1;
-	if (data->perm == PERM_PRE_ROOT || data->perm == PERM_ANDROID)
-		return 1;
-	return 0;
-}
-
-static int needs_fixup(perm_t perm)
+/*
+ * Package list changes only bump sdcardfs_pkg_gen. The ownership of a package
+ * directory, which everything below it takes from its top data, is derived
+ * again here once it is found to predate the last change. This is called on
+ * lookup, revalidation and getattr of @dentry, so it only ever walks up from
+ * the dentry being accessed to its package directory.
+ */
+void fixup_perms_lazy(struct dentry *dentry)
 {
-	if (perm == PERM_ANDROID_DATA || perm == PERM_ANDROID_OBB
-			|| perm == PERM_ANDROID_MEDIA)
-		return 1;
-	return 0;
-}
+	struct sdcardfs_inode_data *top;
+	struct dentry *pkg, *parent;
+	int gen = atomic_read(&sdcardfs_pkg_gen);
 
-static void __fixup_perms_recursive(struct dentry *dentry, struct limit_search *limit, int depth)
-{
-	struct dentry *child;
-	struct sdcardfs_inode_info *info;
+	if (!d_inode(dentry))
+		return;
 
-	/*
-	 * All paths will terminate their recursion on hitting PERM_ANDROID_OBB,
-	 * PERM_ANDROID_MEDIA, or PERM_ANDROID_DATA. This happens at a depth of
-	 * at most 3.
-	 */
-	WARN(depth > 3, "%s: Max expected depth exceeded!\n", __func__);
-	spin_lock_nested(&dentry->d_lock, depth);
-	if (!d_inode(dentry)) {
-		spin_unlock(&dentry->d_lock);
+	top = top_data_get(SDCARDFS_I(d_inode(dentry)));
+	if (!top)
+		return;
+	if (top->perm != PERM_ANDROID_PACKAGE ||
+			READ_ONCE(top->pkg_gen) == gen) {
+		data_put(top);
 		return;
 	}
-	info = SDCARDFS_I(d_inode(dentry));
 
-	if (needs_fixup(info->data->perm)) {
-		list_for_each_entry(child, &dentry->d_subdirs, d_child) {
-			spin_lock_nested(&child->d_lock, depth + 1);
-			if (!(limit->flags & BY_NAME) ||
-				qstr_case_eq(&child->d_name, &limit->name)) {
-				if (d_inode(child)) {
-					get_derived_permission(d_inode(dentry),
-									child);
-					fixup_tmp_permissions(d_inode(child));
-					spin_unlock(&child->d_lock);
-					break;
-				}
-			}
-			spin_unlock(&child->d_lock);
-		}
-	} else if (descendant_may_need_fixup(info->data, limit)) {
-		list_for_each_entry(child, &dentry->d_subdirs, d_child) {
-			__fixup_perms_recursive(child, limit, depth + 1);
+	pkg = dget(dentry);
+	while (!d_inode(pkg) || SDCARDFS_I(d_inode(pkg))->data != top) {
+		if (IS_ROOT(pkg)) {
+			/* top data no longer reachable, d_revalidate drops it */
+			dput(pkg);
+			data_put(top);
+			return;
 		}
+		parent = dget_parent(pkg);
+		dput(pkg);
+		pkg = parent;
 	}
-	spin_unlock(&dentry->d_lock);
-}
 
-void fixup_perms_recursive(struct dentry *dentry, struct limit_search *limit)
-{
-	__fixup_perms_recursive(dentry, limit, 0);
+	parent = dget_parent(pkg);
+	spin_lock(&pkg->d_lock);
+	if (d_inode(pkg) && READ_ONCE(top->pkg_gen) != gen) {
+		get_derived_permission(d_inode(parent), pkg);
+		fixup_tmp_permissions(d_inode(pkg));
+		atomic_long_inc(&sdcardfs_lazy_fixups);
+	}
+	spin_unlock(&pkg->d_lock);
+	dput(parent);
+	dput(pkg);
+	data_put(top);
 }
 
 /* main function for updating derived permission */
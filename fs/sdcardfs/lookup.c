@@ -472,6 +472,7 @@ struct dentry *sdcardfs_lookup(struct inode *dir, struct dentry *dentry,
 		/* get derived permission */
 		get_derived_permission(dir, dentry);
 		fixup_tmp_permissions(d_inode(dentry));
+		fixup_perms_lazy(dentry);
 		fixup_lower_ownership(dentry, dentry->d_name.name);
 	}
 	/* update parent directory's atime */
@@ -168,6 +168,8 @@ struct sdcardfs_inode_data {
 	bool under_android;
 	bool under_cache;
 	bool under_obb;
+	/* package list generation this was derived under */
+	int pkg_gen;
 };
 
 /* sdcardfs inode data in memory */
@@ -489,6 +491,8 @@ extern struct mutex sdcardfs_super_list_lock;
 extern struct list_head sdcardfs_super_list;
 
 /* for packagelist.c */
+extern atomic_t sdcardfs_pkg_gen;
+extern atomic_long_t sdcardfs_lazy_fixups;
 extern appid_t get_appid(const char *app_name);
 extern appid_t get_ext_gid(const char *app_name);
 extern appid_t is_excluded(const char *app_name, userid_t userid);
@@ -497,20 +501,12 @@ extern int packagelist_init(void);
 extern void packagelist_exit(void);
 
 /* for derived_perm.c */
-#define BY_NAME		(1 << 0)
-#define BY_USERID	(1 << 1)
-struct limit_search {
-	unsigned int flags;
-	struct qstr name;
-	userid_t userid;
-};
-
 extern void setup_derived_state(struct inode *inode, perm_t perm,
 			userid_t userid, uid_t uid);
 extern void get_derived_permission(struct inode *parent, struct dentry *dentry);
 extern void get_derived_permission_new(struct inode *parent,
 			struct inode *inode, const struct qstr *name);
-extern void fixup_perms_recursive(struct dentry *dentry, struct limit_search *limit);
+extern void fixup_perms_lazy(struct dentry *dentry);
 
 extern void update_derived_permission_lock(struct inode *dir,
 			struct inode *inode, struct dentry *dentry);
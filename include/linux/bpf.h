@@ -15,6 +15,7 @@
 
 struct perf_event;
 struct bpf_map;
+struct pt_regs;
 
 /* map is generic key/value storage optionally accesible by eBPF programs */
 struct bpf_map_ops {
@@ -335,6 +336,8 @@ int bpf_percpu_array_update(struct bpf_map *map, void *key, void *value,
 			    u64 flags);
 
 int bpf_stackmap_copy(struct bpf_map *map, void *key, void *value);
+long bpf_stackmap_get_id(struct bpf_map *map, struct pt_regs *regs,
+			 u64 flags);
 
 int bpf_fd_array_map_update_elem(struct bpf_map *map, struct file *map_file,
 				 void *key, void *value, u64 map_flags);
@@ -36,6 +36,7 @@
 struct device;
 struct dma_buf;
 struct dma_buf_attachment;
+struct task_struct;
 
 /**
  * struct dma_buf_ops - operations possible on struct dma_buf
@@ -126,6 +127,7 @@ struct dma_buf_ops {
  * @poll: for userspace poll support
  * @cb_excl: for userspace poll support
  * @cb_shared: for userspace poll support
+ * @rcu: for freeing the buffer after an RCU grace period
  */
 struct dma_buf {
 	size_t size;
@@ -151,6 +153,8 @@ struct dma_buf {
 
 		unsigned long active;
 	} cb_excl, cb_shared;
+
+	struct rcu_head rcu;
 };
 
 /**
@@ -245,4 +249,20 @@ int dma_buf_mmap(struct dma_buf *, struct vm_area_struct *,
 		 unsigned long);
 void *dma_buf_vmap(struct dma_buf *);
 void dma_buf_vunmap(struct dma_buf *, void *vaddr);
+
+/**
+ * struct dma_buf_task_stats - dma-bufs referenced by a task's file table
+ * @fds:	number of file descriptors referring to dma-bufs
+ * @buffers:	number of distinct dma-bufs among them
+ * @size:	total size of the distinct dma-bufs in bytes
+ */
+struct dma_buf_task_stats {
+	unsigned int fds;
+	unsigned int buffers;
+	size_t size;
+};
+
+int is_dma_buf_file(struct file *file);
+int dma_buf_task_stats(struct task_struct *task,
+		       struct dma_buf_task_stats *stats);
 #endif /* __DMA_BUF_H__ */
@@ -169,6 +169,10 @@ enum  hrtimer_base_type {
  * @nr_retries:		Total number of hrtimer interrupt retries
  * @nr_hangs:		Total number of hrtimer interrupt hangs
  * @max_hang_time:	Maximum time spent in hrtimer_interrupt
+ * @nr_coalesced:	Timers expired ahead of their hard expiry in an
+ *			interrupt armed for another timer
+ * @nr_coalesce_moves:	Timers with slack moved to a CPU which wakes up
+ *			inside their slack window
  * @clock_base:		array of clock bases for this cpu
  *
  * Note: next_timer is just an optimization for __remove_hrtimer().
@@ -194,6 +198,10 @@ struct hrtimer_cpu_base {
 	unsigned int			nr_retries;
 	unsigned int			nr_hangs;
 	unsigned int			max_hang_time;
+#ifdef CONFIG_HRTIMER_COALESCE
+	unsigned int			nr_coalesced;
+	unsigned int			nr_coalesce_moves;
+#endif
 #endif
 	struct hrtimer_clock_base	clock_base[HRTIMER_MAX_CLOCK_BASES];
 } ____cacheline_aligned;
@@ -28,6 +28,7 @@
 #include <linux/stddef.h>
 #include <linux/mutex.h>
 #include <linux/timer.h>
+#include <linux/workqueue.h>
 #include <linux/slab.h>
 #include <linux/bit_spinlock.h>
 #include <crypto/hash.h>
@@ -70,6 +71,7 @@ extern void *jbd2_alloc(size_t size, gfp_t flags);
 extern void jbd2_free(void *ptr, size_t size);
 
 #define JBD2_MIN_JOURNAL_BLOCKS 1024
+#define JBD2_DEFAULT_FAST_COMMIT_BLOCKS 256
 
 #ifdef __KERNEL__
 
@@ -265,7 +267,19 @@ typedef struct journal_superblock_s
 /* 0x0050 */
 	__u8	s_checksum_type;	/* checksum type */
 	__u8	s_padding2[3];
-	__u32	s_padding[42];
+/* 0x0054 */
+	__u32	s_padding[39];
+/* 0x00F0 */
+	/*
+	 * Fast commit area, only valid with JBD2_FEATURE_INCOMPAT_FAST_COMMIT.
+	 * This is not the upstream fast commit format and deliberately kept
+	 * away from where upstream places its fields.
+	 */
+	__be32	s_num_fc_blks;		/* Number of fast commit blocks */
+	__be32	s_fc_replay_tid;	/* tid owning the pending fast commits */
+	__u8	s_fc_replay_pending;	/* fast commit area awaits replay */
+	__u8	s_padding3[3];
+/* 0x00FC */
 	__be32	s_checksum;		/* crc32c(superblock) */
 
 /* 0x0100 */
@@ -291,6 +305,11 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
 #define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x00000008
 #define JBD2_FEATURE_INCOMPAT_CSUM_V3		0x00000010
+/*
+ * Private bit: the fast commit area layout here is incompatible with the
+ * upstream feature 0x00000020, so other kernels and tools must refuse it.
+ */
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x80000000
 
 /* See "journal feature predicate functions" below */
 
@@ -301,7 +320,8 @@ typedef struct journal_superblock_s
 					JBD2_FEATURE_INCOMPAT_64BIT | \
 					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
 					JBD2_FEATURE_INCOMPAT_CSUM_V2 | \
-					JBD2_FEATURE_INCOMPAT_CSUM_V3)
+					JBD2_FEATURE_INCOMPAT_CSUM_V3 | \
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT)
 
 #ifdef __KERNEL__
 
@@ -721,12 +741,22 @@ struct transaction_run_stats_s {
 	__u32			rs_blocks_logged;
 };
 
+/* Latency histograms: bucket n counts [2^(n-1), 2^n) microseconds */
+#define JBD2_LAT_HIST_BUCKETS	24
+
 struct transaction_stats_s {
 	unsigned long		ts_tid;
 	unsigned long		ts_requested;
 	struct transaction_run_stats_s run;
+	unsigned long		ts_commit_hist[JBD2_LAT_HIST_BUCKETS];
 };
 
+static inline int jbd2_lat_hist_bucket(u64 ns)
+{
+	return min_t(int, fls64(div_u64(ns, NSEC_PER_USEC)),
+		     JBD2_LAT_HIST_BUCKETS - 1);
+}
+
 static inline unsigned long
 jbd2_time_diff(unsigned long start, unsigned long end)
 {
@@ -738,6 +768,15 @@ jbd2_time_diff(unsigned long start, unsigned long end)
 
 #define JBD2_NR_BATCH	64
 
+/*
+ * Background checkpointing starts once this percentage of the log is in
+ * use, and goes on until usage is back below half of it.
+ */
+#define JBD2_DEFAULT_CHECKPOINT_THRESHOLD	50
+
+/* Buffers submitted per round of background checkpointing */
+#define JBD2_CHECKPOINT_IO_BATCH	(4 * JBD2_NR_BATCH)
+
 /**
  * struct journal_s - The journal_s type is the concrete type associated with
  *     journal_t.
@@ -860,6 +899,22 @@ struct journal_s
 	 */
 	struct buffer_head	*j_chkpt_bhs[JBD2_NR_BATCH];
 
+	/**
+	 * @j_checkpoint_work:
+	 *
+	 * Background checkpointing, queued by the commit code once the log
+	 * fills past @j_checkpoint_threshold.
+	 */
+	struct work_struct	j_checkpoint_work;
+
+	/**
+	 * @j_checkpoint_threshold:
+	 *
+	 * Percentage of the log in use at which background checkpointing
+	 * starts, 0 to disable it.
+	 */
+	unsigned int		j_checkpoint_threshold;
+
 	/**
 	 * @j_head:
 	 *
@@ -900,6 +955,30 @@ struct journal_s
 	 */
 	unsigned long		j_last;
 
+	/**
+	 * @j_fc_first:
+	 *
+	 * The block number of the first fast commit block in the journal
+	 * [j_state_lock].
+	 */
+	unsigned long		j_fc_first;
+
+	/**
+	 * @j_fc_off:
+	 *
+	 * Number of fast commit blocks currently allocated. Accessed only
+	 * by the task holding %JBD2_FAST_COMMIT_ONGOING.
+	 */
+	unsigned long		j_fc_off;
+
+	/**
+	 * @j_fc_last:
+	 *
+	 * The block number one beyond the last fast commit block in the
+	 * journal [j_state_lock].
+	 */
+	unsigned long		j_fc_last;
+
 	/**
 	 * @j_dev: Device where we store the journal.
 	 */
@@ -1050,6 +1129,32 @@ struct journal_s
 	 */
 	int			j_wbufsize;
 
+	/**
+	 * @j_fc_wbuf: Array of fast commit bhs for fast commit. Accessed only
+	 * by the task holding %JBD2_FAST_COMMIT_ONGOING.
+	 */
+	struct buffer_head	**j_fc_wbuf;
+
+	/**
+	 * @j_fc_wait:
+	 *
+	 * Wait queue for waiting for a fast or a full commit to finish.
+	 */
+	wait_queue_head_t	j_fc_wait;
+
+	/**
+	 * @j_fc_replay_pending:
+	 *
+	 * Set by recovery when the fast commit area holds blocks of
+	 * transaction @j_fc_replay_tid that the filesystem must replay.
+	 */
+	bool			j_fc_replay_pending;
+
+	/**
+	 * @j_fc_replay_tid: Transaction owning the pending fast commits.
+	 */
+	tid_t			j_fc_replay_tid;
+
 	/**
 	 * @j_last_sync_writer:
 	 *
@@ -1090,6 +1195,30 @@ struct journal_s
 	void			(*j_commit_callback)(journal_t *,
 						     transaction_t *);
 
+	/**
+	 * @j_fc_cleanup_callback:
+	 *
+	 * Clean-up after a full commit of transaction @tid. Fast commits
+	 * written against that transaction are obsolete from now on.
+	 */
+	void			(*j_fc_cleanup_callback)(journal_t *journal,
+							 tid_t tid);
+
+	/**
+	 * @j_fc_replay_callback:
+	 *
+	 * File-system specific function that is handed each block of the
+	 * fast commit area during recovery, in log order. @off is the block
+	 * index inside the area and @expected_tid the transaction that the
+	 * fast commits must belong to. Returns 1 to keep scanning, 0 once
+	 * the last valid block has been seen and a negative error code on
+	 * failure.
+	 */
+	int			(*j_fc_replay_callback)(journal_t *journal,
+							struct buffer_head *bh,
+							int off,
+							tid_t expected_tid);
+
 	/*
 	 * Journal statistics
 	 */
@@ -1109,6 +1238,14 @@ struct journal_s
 	 */
 	struct transaction_stats_s j_stats;
 
+	/**
+	 * @j_handle_wait_hist:
+	 *
+	 * Per-cpu histogram of the time handles had to wait in
+	 * start_this_handle() before joining a transaction.
+	 */
+	unsigned long __percpu	*j_handle_wait_hist;
+
 	/**
 	 * @j_failed_commit: Failed journal commit ID.
 	 */
@@ -1219,6 +1356,7 @@ JBD2_FEATURE_INCOMPAT_FUNCS(64bit,		64BIT)
 JBD2_FEATURE_INCOMPAT_FUNCS(async_commit,	ASYNC_COMMIT)
 JBD2_FEATURE_INCOMPAT_FUNCS(csum2,		CSUM_V2)
 JBD2_FEATURE_INCOMPAT_FUNCS(csum3,		CSUM_V3)
+JBD2_FEATURE_INCOMPAT_FUNCS(fast_commit,	FAST_COMMIT)
 
 /*
  * Journal flag definitions
@@ -1233,6 +1371,9 @@ JBD2_FEATURE_INCOMPAT_FUNCS(csum3,		CSUM_V3)
 						 * data write error in ordered
 						 * mode */
 #define JBD2_REC_ERR	0x080	/* The errno in the sb has been recorded */
+#define JBD2_FAST_COMMIT_ONGOING	0x100	/* Fast commit is ongoing */
+#define JBD2_FULL_COMMIT_ONGOING	0x200	/* Full commit is ongoing */
+#define JBD2_CHECKPOINT_STOP	0x400	/* No more background checkpointing */
 
 /*
  * Function declarations for the journaling transaction and buffer
@@ -1402,6 +1543,20 @@ extern int	   jbd2_journal_begin_ordered_truncate(journal_t *journal,
 extern void	   jbd2_journal_init_jbd_inode(struct jbd2_inode *jinode, struct inode *inode);
 extern void	   jbd2_journal_release_jbd_inode(journal_t *journal, struct jbd2_inode *jinode);
 
+/* Fast commit related APIs */
+extern int	   jbd2_fc_begin_commit(journal_t *journal, tid_t tid);
+extern int	   jbd2_fc_end_commit(journal_t *journal);
+extern int	   jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out);
+extern int	   jbd2_fc_wait_bufs(journal_t *journal, int num_blks);
+extern int	   jbd2_fc_replay_done(journal_t *journal);
+
+static inline int jbd2_journal_get_num_fc_blks(journal_superblock_t *jsb)
+{
+	int num_fc_blocks = be32_to_cpu(jsb->s_num_fc_blks);
+
+	return num_fc_blocks ? num_fc_blocks : JBD2_DEFAULT_FAST_COMMIT_BLOCKS;
+}
+
 /*
  * journal_head management
  */
@@ -1472,6 +1627,8 @@ int jbd2_journal_start_commit(journal_t *journal, tid_t *tid);
 int jbd2_log_wait_commit(journal_t *journal, tid_t tid);
 int jbd2_complete_transaction(journal_t *journal, tid_t tid);
 int jbd2_log_do_checkpoint(journal_t *journal);
+void jbd2_log_queue_checkpoint(journal_t *journal);
+void jbd2_checkpoint_work(struct work_struct *work);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
 void __jbd2_log_wait_for_space(journal_t *journal);
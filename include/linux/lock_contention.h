@@ -0,0 +1,68 @@
+#ifndef _LINUX_LOCK_CONTENTION_H
+#define _LINUX_LOCK_CONTENTION_H
+
+/*
+ * Lock contention profiler hooks.
+ *
+ * The sleeping and spinning lock slowpaths bracket the time spent waiting
+ * for a contended lock with lock_contention_begin()/lock_contention_end().
+ * While profiling is off this is a patched out branch; see
+ * kernel/trace/trace_lock_contention.c for where the samples go.
+ */
+
+#include <linux/types.h>
+#include <linux/compiler.h>
+
+enum lock_contention_type {
+	LOCK_CONTENTION_MUTEX,
+	LOCK_CONTENTION_RWSEM_READ,
+	LOCK_CONTENTION_RWSEM_WRITE,
+	LOCK_CONTENTION_SPIN,
+	LOCK_CONTENTION_RTMUTEX,
+	LOCK_CONTENTION_NR_TYPES,
+};
+
+#ifdef CONFIG_LOCK_CONTENTION_PROFILER
+
+#include <linux/jump_label.h>
+#include <linux/sched.h>
+
+DECLARE_STATIC_KEY_FALSE(lock_contention_key);
+
+extern void __lock_contention_record(int type, u64 start);
+
+/*
+ * Returns the start time of the wait, or 0 when profiling is disabled.
+ */
+static __always_inline u64 lock_contention_begin(void)
+{
+	if (static_branch_unlikely(&lock_contention_key))
+		return local_clock() ? : 1;
+	return 0;
+}
+
+/*
+ * Account the wait that started at @start to the caller of the lock
+ * function. Must be called directly from the slowpath that called
+ * lock_contention_begin(), once the lock has been acquired.
+ */
+static __always_inline void lock_contention_end(int type, u64 start)
+{
+	if (unlikely(start))
+		__lock_contention_record(type, start);
+}
+
+#else /* !CONFIG_LOCK_CONTENTION_PROFILER */
+
+static inline u64 lock_contention_begin(void)
+{
+	return 0;
+}
+
+static inline void lock_contention_end(int type, u64 start)
+{
+}
+
+#endif /* CONFIG_LOCK_CONTENTION_PROFILER */
+
+#endif /* _LINUX_LOCK_CONTENTION_H */
@@ -11,6 +11,7 @@ struct msg_msg {
 	size_t m_ts;		/* message text size */
 	struct msg_msgseg *next;
 	void *security;
+	bool m_cached;		/* from the per-cpu small message cache */
 	/* the actual message follows immediately */
 };
 
@@ -708,6 +708,10 @@ struct perf_event {
 #ifdef CONFIG_BPF_SYSCALL
 	perf_overflow_handler_t		orig_overflow_handler;
 	struct bpf_prog			*prog;
+	/* PERF_EVENT_IOC_SET_STACK_AGGR */
+	struct bpf_map			*stack_aggr_map;
+	struct bpf_map			*stack_aggr_counts;
+	u64				stack_aggr_flags;
 #endif
 
 #ifdef CONFIG_EVENT_TRACING
@@ -8,6 +8,7 @@
 
 struct ring_buffer;
 struct ring_buffer_iter;
+struct trace_buffer_meta;
 
 /*
  * Don't refer to this struct directly, use functions below.
@@ -190,6 +191,15 @@ void ring_buffer_free_read_page(struct ring_buffer *buffer, void *data);
 int ring_buffer_read_page(struct ring_buffer *buffer, void **data_page,
 			  size_t len, int cpu, int full);
 
+int ring_buffer_map(struct ring_buffer *buffer, int cpu,
+		    struct vm_area_struct *vma);
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu);
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu);
+struct trace_buffer_meta *
+ring_buffer_map_meta_page(struct ring_buffer *buffer, int cpu);
+void *ring_buffer_map_subbuf(struct ring_buffer *buffer, int cpu,
+			     unsigned int id);
+
 struct trace_seq;
 
 int ring_buffer_print_entry_header(struct trace_seq *s);
@@ -45,6 +45,12 @@ TRACE_DEFINE_ENUM(CP_SYNC);
 TRACE_DEFINE_ENUM(CP_RECOVERY);
 TRACE_DEFINE_ENUM(CP_DISCARD);
 TRACE_DEFINE_ENUM(CP_TRIMMED);
+TRACE_DEFINE_ENUM(READ_IO_LAT);
+TRACE_DEFINE_ENUM(WRITE_SYNC_IO_LAT);
+TRACE_DEFINE_ENUM(WRITE_ASYNC_IO_LAT);
+TRACE_DEFINE_ENUM(IO_LAT_SRC_FS);
+TRACE_DEFINE_ENUM(IO_LAT_SRC_FG_GC);
+TRACE_DEFINE_ENUM(IO_LAT_SRC_BG_GC);
 
 #define show_block_type(type)						\
 	__print_symbolic(type,						\
@@ -89,6 +95,25 @@ TRACE_DEFINE_ENUM(CP_TRIMMED);
 		{ WARM,		"WARM" },				\
 		{ COLD,		"COLD" })
 
+#define show_lat_temp(temp)						\
+	__print_symbolic(temp,						\
+		{ HOT,		"HOT" },				\
+		{ WARM,		"WARM" },				\
+		{ COLD,		"COLD" },				\
+		{ IO_LAT_NO_TEMP,	"-" })
+
+#define show_lat_type(type)						\
+	__print_symbolic(type,						\
+		{ READ_IO_LAT,		"READ" },			\
+		{ WRITE_SYNC_IO_LAT,	"WRITE_SYNC" },			\
+		{ WRITE_ASYNC_IO_LAT,	"WRITE_ASYNC" })
+
+#define show_lat_src(src)						\
+	__print_symbolic(src,						\
+		{ IO_LAT_SRC_FS,	"fs" },				\
+		{ IO_LAT_SRC_FG_GC,	"fg_gc" },			\
+		{ IO_LAT_SRC_BG_GC,	"bg_gc" })
+
 #define show_data_type(type)						\
 	__print_symbolic(type,						\
 		{ CURSEG_HOT_DATA, 	"Hot DATA" },			\
@@ -1712,6 +1737,44 @@ TRACE_EVENT(f2fs_shutdown,
 		__entry->ret)
 );
 
+TRACE_EVENT(f2fs_bio_latency,
+
+	TP_PROTO(struct super_block *sb, int lat_type, int type, int temp,
+			int src, unsigned int size, u64 lat_ns),
+
+	TP_ARGS(sb, lat_type, type, temp, src, size, lat_ns),
+
+	TP_STRUCT__entry(
+		__field(dev_t,	dev)
+		__field(int,	lat_type)
+		__field(int,	type)
+		__field(int,	temp)
+		__field(int,	src)
+		__field(unsigned int,	size)
+		__field(u64,	lat_ns)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= sb->s_dev;
+		__entry->lat_type	= lat_type;
+		__entry->type		= type;
+		__entry->temp		= temp;
+		__entry->src		= src;
+		__entry->size		= size;
+		__entry->lat_ns		= lat_ns;
+	),
+
+	TP_printk("dev = (%d,%d), %s, type = %s_%s, src = %s, "
+		"size = %u, latency = %llu ns",
+		show_dev(__entry->dev),
+		show_lat_type(__entry->lat_type),
+		show_lat_temp(__entry->temp),
+		show_block_type(__entry->type),
+		show_lat_src(__entry->src),
+		__entry->size,
+		(unsigned long long)__entry->lat_ns)
+);
+
 TRACE_EVENT(f2fs_iostat,
 
 	TP_PROTO(struct f2fs_sb_info *sbi, unsigned long long *iostat),
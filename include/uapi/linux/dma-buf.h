@@ -36,6 +36,25 @@ struct dma_buf_sync {
 
 #define DMA_BUF_NAME_LEN	32
 
+/*
+ * Binary layout of /proc/dma_buf_info: one header, then header.record_size
+ * bytes for every exported buffer, of which the first are a struct
+ * dma_buf_info.
+ */
+struct dma_buf_info_header {
+	__u64 total_size;
+	__u32 nr_buffers;
+	__u32 record_size;
+};
+
+struct dma_buf_info {
+	__u64 inode;
+	__u64 size;
+	__u32 file_count;
+	__u32 reserved;
+	char exp_name[DMA_BUF_NAME_LEN];
+};
+
 #define DMA_BUF_BASE		'b'
 #define DMA_BUF_IOCTL_SYNC	_IOW(DMA_BUF_BASE, 0, struct dma_buf_sync)
 #define DMA_BUF_SET_NAME	_IOW(DMA_BUF_BASE, 5, const char *)
@@ -374,6 +374,80 @@ struct fsverity_measurement {
 #define FS_FL_USER_VISIBLE		0x0003DFFF /* User visible flags */
 #define FS_FL_USER_MODIFIABLE		0x000380FF /* User modifiable flags */
 
+/*
+ * PAGEMAP_SCAN, an ioctl on /proc/<pid>/pagemap: walk [start, end) of the
+ * address space and return the runs of pages that match the category
+ * masks, rather than one entry per page.
+ */
+#define PAGEMAP_SCAN	_IOWR('f', 16, struct pm_scan_arg)
+
+/*
+ * Page categories, used in the masks and reported in page_region. The
+ * numbering is that of the upstream interface; of its categories only
+ * those below are supported, the others are refused with -EINVAL.
+ * PAGE_IS_EXCLUSIVE is an extension, kept clear of the upstream bits.
+ */
+#define PAGE_IS_FILE		(1 << 2)
+#define PAGE_IS_PRESENT		(1 << 3)
+#define PAGE_IS_SWAPPED		(1 << 4)
+#define PAGE_IS_SOFT_DIRTY	(1 << 7)
+#define PAGE_IS_EXCLUSIVE	(1ULL << 32)	/* mapped only here */
+
+#define PM_SCAN_CATEGORIES	(PAGE_IS_PRESENT | PAGE_IS_SWAPPED | \
+				 PAGE_IS_FILE | PAGE_IS_EXCLUSIVE | \
+				 PAGE_IS_SOFT_DIRTY)
+
+/*
+ * Flags. The upstream PM_SCAN_WP_MATCHING and PM_SCAN_CHECK_WPASYNC
+ * (bits 0 and 1) need userfaultfd write protection and are refused.
+ * PM_SCAN_CLEAR_SOFT_DIRTY is an extension: clear the soft-dirty state
+ * of every page walked, i.e. [start, walk_end).
+ */
+#define PM_SCAN_CLEAR_SOFT_DIRTY	(1ULL << 32)
+#define PM_SCAN_FLAGS			(PM_SCAN_CLEAR_SOFT_DIRTY)
+
+/*
+ * A run of virtually contiguous pages in [start, end) that all have the
+ * same categories, masked by return_mask.
+ */
+struct page_region {
+	__u64 start;
+	__u64 end;
+	__u64 categories;
+};
+
+/*
+ * @size:		sizeof(struct pm_scan_arg)
+ * @flags:		PM_SCAN_* flags
+ * @start:		start of the range to walk, page aligned
+ * @end:		end of the range to walk
+ * @walk_end:		out: where the walk stopped, end if it completed
+ * @vec:		user address of a page_region array
+ * @vec_len:		number of entries in @vec; may be 0 when only
+ *			clearing soft-dirty
+ * @max_pages:		stop after reporting this many pages, 0 for no limit
+ * @category_inverted:	categories to invert before testing the masks
+ * @category_mask:	a page matches if it has all of these categories...
+ * @category_anyof_mask: ...and at least one of these, if any are given
+ * @return_mask:	categories to report in page_region.categories
+ *
+ * The ioctl returns the number of page_region entries filled in.
+ */
+struct pm_scan_arg {
+	__u64 size;
+	__u64 flags;
+	__u64 start;
+	__u64 end;
+	__u64 walk_end;
+	__u64 vec;
+	__u64 vec_len;
+	__u64 max_pages;
+	__u64 category_inverted;
+	__u64 category_mask;
+	__u64 category_anyof_mask;
+	__u64 return_mask;
+};
+
 
 #define SYNC_FILE_RANGE_WAIT_BEFORE	1
 #define SYNC_FILE_RANGE_WRITE		2
@@ -394,6 +394,23 @@ struct perf_event_attr {
 
 #define perf_flags(attr)	(*(&(attr)->read_format + 1))
 
+/*
+ * Argument of PERF_EVENT_IOC_SET_STACK_AGGR: count the samples of the
+ * event per callchain instead of writing sample records.
+ *
+ * Each sample stores its callchain in the BPF_MAP_TYPE_STACK_TRACE map
+ * @stack_map_fd, as bpf_get_stackid() would with @flags, and increments
+ * the __u64 at the returned stack id in the BPF_MAP_TYPE_PERCPU_ARRAY
+ * map @count_map_fd. Samples whose callchain could not be stored count
+ * at the index following the last stack id, so the count map needs
+ * roundup_pow_of_two(max_entries of the stack map) + 1 entries.
+ */
+struct perf_event_stack_aggr {
+	__u32	stack_map_fd;
+	__u32	count_map_fd;
+	__u64	flags;
+};
+
 /*
  * Ioctls that can be done on a perf event fd:
  */
@@ -407,6 +424,7 @@ struct perf_event_attr {
 #define PERF_EVENT_IOC_ID		_IOR('$', 7, __u64 *)
 #define PERF_EVENT_IOC_SET_BPF		_IOW('$', 8, __u32)
 #define PERF_EVENT_IOC_PAUSE_OUTPUT	_IOW('$', 9, __u32)
+#define PERF_EVENT_IOC_SET_STACK_AGGR	_IOW('$', 10, struct perf_event_stack_aggr)
 
 enum perf_event_ioc_flags {
 	PERF_IOC_FLAG_GROUP		= 1U << 0,
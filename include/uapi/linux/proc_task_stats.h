@@ -0,0 +1,88 @@
+#ifndef _UAPI_LINUX_PROC_TASK_STATS_H
+#define _UAPI_LINUX_PROC_TASK_STATS_H
+
+#include <linux/types.h>
+
+/*
+ * /proc/task_stats returns the statistics of many tasks in one read, as
+ * fixed size binary records in native byte order: a struct
+ * proc_task_stats_header, then header.record_size bytes per task, of which
+ * the first are a struct proc_task_stats.
+ *
+ * Writing a struct proc_task_stats_request to the file selects the fields
+ * to fill in and which tasks to report on, for the reads from offset 0
+ * that follow. Fields not asked for are zero and not computed, so callers
+ * that do not need memory statistics, say, never pay for taking the mm.
+ */
+
+/* pid, tgid, ppid, uid, comm: always filled */
+#define PROC_TS_ID		(1ULL << 0)
+/* state, flags, priorities, policy, cpu, num_threads, start_time */
+#define PROC_TS_SCHED		(1ULL << 1)
+/* cpu times, page faults and context switches */
+#define PROC_TS_CPU		(1ULL << 2)
+/* address space and rss, takes a reference to the mm */
+#define PROC_TS_MEM		(1ULL << 3)
+/* oom_score_adj */
+#define PROC_TS_OOM		(1ULL << 4)
+#define PROC_TS_ALL_FIELDS	(PROC_TS_ID | PROC_TS_SCHED | PROC_TS_CPU | \
+				 PROC_TS_MEM | PROC_TS_OOM)
+
+/* report every thread rather than one record per thread group */
+#define PROC_TS_THREADS		(1ULL << 0)
+#define PROC_TS_ALL_FLAGS	(PROC_TS_THREADS)
+
+struct proc_task_stats_request {
+	__u64 fields;
+	__u64 flags;
+};
+
+struct proc_task_stats_header {
+	__u64 fields;
+	__u64 flags;
+	__u32 record_size;
+	__u32 reserved;
+};
+
+struct proc_task_stats {
+	/* PROC_TS_ID */
+	__u32 pid;
+	__u32 tgid;
+	__u32 ppid;
+	__u32 uid;
+	char comm[16];
+
+	/* PROC_TS_SCHED */
+	__u64 flags;
+	__u64 start_time;	/* ns since boot */
+	__u32 state;		/* letter as in /proc/<pid>/stat */
+	__s32 nice;
+	__s32 prio;
+	__u32 policy;
+	__u32 rt_priority;
+	__u32 cpu;
+	__u32 num_threads;
+	__u32 reserved;
+
+	/* PROC_TS_CPU, summed over the thread group for group records */
+	__u64 utime;		/* ns */
+	__u64 stime;		/* ns */
+	__u64 min_flt;
+	__u64 maj_flt;
+	__u64 nvcsw;
+	__u64 nivcsw;
+
+	/* PROC_TS_MEM, in bytes */
+	__u64 vsize;
+	__u64 rss_anon;
+	__u64 rss_file;
+	__u64 rss_shmem;
+	__u64 swap;
+	__u64 hiwater_rss;
+
+	/* PROC_TS_OOM */
+	__s32 oom_score_adj;
+	__u32 reserved2;
+};
+
+#endif /* _UAPI_LINUX_PROC_TASK_STATS_H */
@@ -0,0 +1,56 @@
+#ifndef _UAPI_TRACE_MMAP_H_
+#define _UAPI_TRACE_MMAP_H_
+
+#include <linux/types.h>
+
+/**
+ * struct trace_buffer_meta - Ring-buffer Meta-page description
+ * @meta_page_size:	Size of this meta-page.
+ * @meta_struct_len:	Size of this structure.
+ * @subbuf_size:	Size of each sub-buffer.
+ * @nr_subbufs:		Number of sub-buffers, including the reader one.
+ * @reader.lost_events:	Number of events lost before the reader sub-buffer.
+ * @reader.id:		ID of the reader sub-buffer, in [0, @nr_subbufs - 1].
+ * @reader.read:	Offset of the first event not seen by a previous
+ *			TRACE_MMAP_IOCTL_GET_READER on the reader sub-buffer.
+ * @flags:		Flags for the meta-page, reserved.
+ * @entries:		Number of entries in the ring-buffer.
+ * @overrun:		Number of entries lost in the ring-buffer.
+ * @read:		Number of entries that have been read.
+ *
+ * The file is mapped read-only: the meta-page comes first, followed by the
+ * sub-buffers in ID order. Each sub-buffer starts with the same header as
+ * the pages read from trace_pipe_raw.
+ */
+struct trace_buffer_meta {
+	__u32		meta_page_size;
+	__u32		meta_struct_len;
+
+	__u32		subbuf_size;
+	__u32		nr_subbufs;
+
+	struct {
+		__u64	lost_events;
+		__u32	id;
+		__u32	read;
+	} reader;
+
+	__u64	flags;
+
+	__u64	entries;
+	__u64	overrun;
+	__u64	read;
+
+	__u64	Reserved1;
+	__u64	Reserved2;
+};
+
+/*
+ * Hand the reader sub-buffer to user-space: everything on the reader
+ * sub-buffer is considered read and, once it is exhausted, the next
+ * sub-buffer is swapped in. The meta-page is updated accordingly. Blocks
+ * until there is data to read unless the file is O_NONBLOCK.
+ */
+#define TRACE_MMAP_IOCTL_GET_READER		_IO('T', 0x1)
+
+#endif /* _UAPI_TRACE_MMAP_H_ */
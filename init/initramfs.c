@@ -20,6 +20,11 @@
 #include <linux/utime.h>
 #include <linux/initramfs.h>
 #include <linux/file.h>
+#include <linux/async.h>
+#include <linux/completion.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/wait.h>
 
 static ssize_t __init xwrite(int fd, const char *p, size_t count)
 {
@@ -448,6 +453,163 @@ static unsigned long my_inptr; /* index of next byte to be processed in inbuf */
 
 #include <linux/decompress/generic.h>
 
+/*
+ * With more than one cpu, the decompressor runs in a thread of its own
+ * and hands its output over in chunks, so that decompressing the
+ * archive overlaps with parsing it and creating the files.
+ */
+#define UNPACK_CHUNK_SIZE	(64 * 1024)
+#define UNPACK_NR_CHUNKS	16
+
+struct unpack_chunk {
+	struct list_head list;
+	unsigned long len;
+	char data[];
+};
+
+#define UNPACK_CHUNK_DATA	(UNPACK_CHUNK_SIZE - sizeof(struct unpack_chunk))
+
+static __initdata struct {
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	struct list_head free;		/* chunks for the decompressor */
+	struct list_head full;		/* chunks for the cpio parser */
+	struct unpack_chunk *cur;	/* being filled by the decompressor */
+	bool done;
+	struct completion exited;
+	decompress_fn decompress;
+	char *buf;
+	unsigned long len;
+	int res;
+} unpack_pipe;
+
+static void __init unpack_pipe_put(struct unpack_chunk *chunk,
+				   struct list_head *list)
+{
+	spin_lock(&unpack_pipe.lock);
+	list_add_tail(&chunk->list, list);
+	spin_unlock(&unpack_pipe.lock);
+	wake_up(&unpack_pipe.wait);
+}
+
+static struct unpack_chunk * __init unpack_pipe_get(struct list_head *list)
+{
+	struct unpack_chunk *chunk;
+
+	spin_lock(&unpack_pipe.lock);
+	chunk = list_first_entry_or_null(list, struct unpack_chunk, list);
+	if (chunk)
+		list_del(&chunk->list);
+	spin_unlock(&unpack_pipe.lock);
+	return chunk;
+}
+
+/* The flush callback of the decompressor, in its thread. */
+static long __init unpack_pipe_flush(void *bufv, unsigned long len)
+{
+	char *buf = bufv;
+	long orig_len = len;
+	unsigned long n;
+
+	while (len) {
+		/* The parser drains the pipe even after an error. */
+		if (READ_ONCE(message))
+			return -1;
+		if (!unpack_pipe.cur) {
+			wait_event(unpack_pipe.wait,
+				   (unpack_pipe.cur =
+					unpack_pipe_get(&unpack_pipe.free)));
+			unpack_pipe.cur->len = 0;
+		}
+		n = min(len, UNPACK_CHUNK_DATA - unpack_pipe.cur->len);
+		memcpy(unpack_pipe.cur->data + unpack_pipe.cur->len, buf, n);
+		unpack_pipe.cur->len += n;
+		buf += n;
+		len -= n;
+		if (unpack_pipe.cur->len == UNPACK_CHUNK_DATA) {
+			unpack_pipe_put(unpack_pipe.cur, &unpack_pipe.full);
+			unpack_pipe.cur = NULL;
+		}
+	}
+	return orig_len;
+}
+
+static int __init unpack_pipe_decompress(void *unused)
+{
+	unpack_pipe.res = unpack_pipe.decompress(unpack_pipe.buf,
+						 unpack_pipe.len, NULL,
+						 unpack_pipe_flush, NULL,
+						 &my_inptr, error);
+	if (unpack_pipe.cur) {
+		unpack_pipe_put(unpack_pipe.cur, &unpack_pipe.full);
+		unpack_pipe.cur = NULL;
+	}
+
+	spin_lock(&unpack_pipe.lock);
+	unpack_pipe.done = true;
+	spin_unlock(&unpack_pipe.lock);
+	wake_up(&unpack_pipe.wait);
+
+	/* Don't return into init text that may be freed by then. */
+	complete_and_exit(&unpack_pipe.exited, 0);
+}
+
+static int __init unpack_decompress(decompress_fn decompress, char *buf,
+				    unsigned long len)
+{
+	struct unpack_chunk *chunk;
+	struct task_struct *tsk;
+	int i;
+
+	if (num_online_cpus() == 1)
+		goto direct;
+
+	spin_lock_init(&unpack_pipe.lock);
+	init_waitqueue_head(&unpack_pipe.wait);
+	INIT_LIST_HEAD(&unpack_pipe.free);
+	INIT_LIST_HEAD(&unpack_pipe.full);
+	init_completion(&unpack_pipe.exited);
+	for (i = 0; i < UNPACK_NR_CHUNKS; i++) {
+		chunk = kmalloc(UNPACK_CHUNK_SIZE, GFP_KERNEL);
+		if (!chunk)
+			break;
+		list_add(&chunk->list, &unpack_pipe.free);
+	}
+	if (i < 2)
+		goto free;
+
+	unpack_pipe.cur = NULL;
+	unpack_pipe.done = false;
+	unpack_pipe.decompress = decompress;
+	unpack_pipe.buf = buf;
+	unpack_pipe.len = len;
+	tsk = kthread_run(unpack_pipe_decompress, NULL, "initramfs_unpack");
+	if (IS_ERR(tsk))
+		goto free;
+
+	for (;;) {
+		wait_event(unpack_pipe.wait,
+			   !list_empty_careful(&unpack_pipe.full) ||
+			   READ_ONCE(unpack_pipe.done));
+		chunk = unpack_pipe_get(&unpack_pipe.full);
+		if (!chunk)
+			break;
+		flush_buffer(chunk->data, chunk->len);
+		unpack_pipe_put(chunk, &unpack_pipe.free);
+	}
+	wait_for_completion(&unpack_pipe.exited);
+
+	while ((chunk = unpack_pipe_get(&unpack_pipe.free)))
+		kfree(chunk);
+	return unpack_pipe.res;
+
+free:
+	while ((chunk = unpack_pipe_get(&unpack_pipe.free)))
+		kfree(chunk);
+direct:
+	return decompress(buf, len, NULL, flush_buffer, NULL, &my_inptr, error);
+}
+
 static char * __init unpack_to_rootfs(char *buf, unsigned long len)
 {
 	long written;
@@ -484,8 +646,8 @@ static char * __init unpack_to_rootfs(char *buf, unsigned long len)
 		decompress = decompress_method(buf, len, &compress_name);
 		pr_debug("Detected %s compressed data\n", compress_name);
 		if (decompress) {
-			int res = decompress(buf, len, NULL, flush_buffer, NULL,
-				   &my_inptr, error);
+			int res = unpack_decompress(decompress, buf, len);
+
 			if (res)
 				error("decompressor failed");
 		} else if (compress_name) {
@@ -628,14 +790,30 @@ static int __init skip_initramfs_param(char *str)
 }
 __setup("skip_initramfs", skip_initramfs_param);
 
-static int __init populate_rootfs(void)
+/*
+ * Off by default: usermode helpers are enabled before the initcalls run
+ * and do not wait for the unpacking, so modprobe and hotplug calls from
+ * device_initcalls would race with it.
+ */
+static bool initramfs_async __ro_after_init;
+
+static int __init initramfs_async_setup(char *str)
+{
+	strtobool(str, &initramfs_async);
+	return 1;
+}
+__setup("initramfs_async=", initramfs_async_setup);
+
+static void __init do_populate_rootfs(void *unused, async_cookie_t cookie)
 {
+	ktime_t start = ktime_get();
 	char *err;
 
 	if (!skip_override && do_skip_initramfs) {
 		if (initrd_start)
 			free_initrd();
-		return default_rootfs();
+		default_rootfs();
+		return;
 	}
 
 	err = unpack_to_rootfs(__initramfs_start, __initramfs_size);
@@ -681,10 +859,52 @@ static int __init populate_rootfs(void)
 		flush_delayed_fput();
 		/*
 		 * Try loading default modules from initramfs.  This gives
-		 * us a chance to load before device_initcalls.
+		 * us a chance to load before device_initcalls.  Not from
+		 * an async worker though: kernel_init_freeable() loads them
+		 * once it has waited for the unpacking.
 		 */
-		load_default_modules();
+		if (!initramfs_async)
+			load_default_modules();
+	}
+
+	if (initcall_debug)
+		pr_info("initramfs unpacked in %lld usecs\n",
+			ktime_us_delta(ktime_get(), start));
+}
+
+static ASYNC_DOMAIN_EXCLUSIVE(initramfs_domain);
+static async_cookie_t initramfs_cookie;
+
+/*
+ * The initramfs is unpacked asynchronously, overlapping the initcalls
+ * that come after rootfs_initcall. Anything that needs files from it
+ * before kernel_init_freeable() has to wait for it here.
+ */
+void wait_for_initramfs(void)
+{
+	if (!initramfs_async)
+		return;
+	if (!initramfs_cookie) {
+		/*
+		 * Something before rootfs_initcall wants the initramfs,
+		 * which has never worked. Don't deadlock, let the access
+		 * fail as it used to.
+		 */
+		pr_warn_once("wait_for_initramfs() called before rootfs_initcall\n");
+		return;
+	}
+	async_synchronize_cookie_domain(initramfs_cookie + 1, &initramfs_domain);
+}
+EXPORT_SYMBOL_GPL(wait_for_initramfs);
+
+static int __init populate_rootfs(void)
+{
+	if (!initramfs_async) {
+		do_populate_rootfs(NULL, 0);
+		return 0;
 	}
+	initramfs_cookie = async_schedule_domain(do_populate_rootfs, NULL,
+						 &initramfs_domain);
 	return 0;
 }
 rootfs_initcall(populate_rootfs);
@@ -19,6 +19,9 @@
 #include <linux/proc_ns.h>
 #include <linux/uaccess.h>
 #include <linux/sched.h>
+#include <linux/percpu.h>
+#include <linux/memcontrol.h>
+#include <linux/mm.h>
 
 #include "util.h"
 
@@ -46,18 +49,98 @@ struct msg_msgseg {
 #define DATALEN_MSG	((size_t)PAGE_SIZE-sizeof(struct msg_msg))
 #define DATALEN_SEG	((size_t)PAGE_SIZE-sizeof(struct msg_msgseg))
 
+/*
+ * Messages that would land in kmalloc-512 anyway are allocated with that
+ * size, and a few freed ones are kept per cpu for the next msgsnd(), which
+ * saves the slab round trip for daemons exchanging many small messages.
+ * Smaller ones keep going to their own kmalloc cache rather than being
+ * rounded up. The cache is bypassed when kernel memory is accounted to
+ * memory cgroups, as a cached message would stay charged to the cgroup
+ * that allocated it first.
+ */
+#define MSG_CACHE_SIZE	512
+#define MSG_CACHE_MIN	(MSG_CACHE_SIZE / 2 + 1)
+#define MSG_CACHE_NR	16
+
+struct msg_cache {
+	unsigned int nr;
+	void *objs[MSG_CACHE_NR];
+};
+
+static DEFINE_PER_CPU(struct msg_cache, msg_cache);
+
+static void *msg_cache_alloc(void)
+{
+	struct msg_cache *mc;
+	void *obj = NULL;
+
+	if (!memcg_kmem_enabled()) {
+		mc = get_cpu_ptr(&msg_cache);
+		if (mc->nr)
+			obj = mc->objs[--mc->nr];
+		put_cpu_ptr(&msg_cache);
+	}
+
+	if (!obj)
+		obj = kmalloc(MSG_CACHE_SIZE, GFP_KERNEL_ACCOUNT);
+	return obj;
+}
+
+static void msg_cache_free(void *obj)
+{
+	struct msg_cache *mc;
+
+	if (!memcg_kmem_enabled()) {
+		mc = get_cpu_ptr(&msg_cache);
+		if (mc->nr < MSG_CACHE_NR) {
+			mc->objs[mc->nr++] = obj;
+			obj = NULL;
+		}
+		put_cpu_ptr(&msg_cache);
+	}
+
+	kfree(obj);
+}
+
+/*
+ * Segments that fill a page are taken from the page allocator rather than
+ * from kmalloc, so that large messages do not go through the high order
+ * slabs of the page sized kmalloc cache. The last, partial, segment
+ * still comes from kmalloc.
+ */
+static struct msg_msgseg *alloc_msg_seg(size_t alen)
+{
+	if (alen == DATALEN_SEG)
+		return (void *)__get_free_page(GFP_KERNEL_ACCOUNT);
+	return kmalloc(sizeof(struct msg_msgseg) + alen, GFP_KERNEL_ACCOUNT);
+}
+
+static void free_msg_seg(struct msg_msgseg *seg)
+{
+	if (PageSlab(virt_to_page(seg)))
+		kfree(seg);
+	else
+		free_page((unsigned long)seg);
+}
 
 static struct msg_msg *alloc_msg(size_t len)
 {
 	struct msg_msg *msg;
 	struct msg_msgseg **pseg;
 	size_t alen;
+	bool cached;
 
 	alen = min(len, DATALEN_MSG);
-	msg = kmalloc(sizeof(*msg) + alen, GFP_KERNEL_ACCOUNT);
+	cached = sizeof(*msg) + alen >= MSG_CACHE_MIN &&
+		 sizeof(*msg) + alen <= MSG_CACHE_SIZE;
+	if (cached)
+		msg = msg_cache_alloc();
+	else
+		msg = kmalloc(sizeof(*msg) + alen, GFP_KERNEL_ACCOUNT);
 	if (msg == NULL)
 		return NULL;
 
+	msg->m_cached = cached;
 	msg->next = NULL;
 	msg->security = NULL;
 
@@ -69,7 +152,7 @@ static struct msg_msg *alloc_msg(size_t len)
 		cond_resched();
 
 		alen = min(len, DATALEN_SEG);
-		seg = kmalloc(sizeof(*seg) + alen, GFP_KERNEL_ACCOUNT);
+		seg = alloc_msg_seg(alen);
 		if (seg == NULL)
 			goto out_err;
 		*pseg = seg;
@@ -177,12 +260,15 @@ void free_msg(struct msg_msg *msg)
 	security_msg_msg_free(msg);
 
 	seg = msg->next;
-	kfree(msg);
+	if (msg->m_cached)
+		msg_cache_free(msg);
+	else
+		kfree(msg);
 	while (seg != NULL) {
 		struct msg_msgseg *tmp = seg->next;
 
 		cond_resched();
-		kfree(seg);
+		free_msg_seg(seg);
 		seg = tmp;
 	}
 }
@@ -1813,6 +1813,50 @@ static int get_queue_result(struct sem_queue *q)
 	return error;
 }
 
+/**
+ * perform_simple_semop - Perform an uncontended single semaphore operation
+ * @sma: semaphore array
+ * @sop: the operation, without SEM_UNDO
+ * @pid: pid to record as the last one that operated on the semaphore
+ *
+ * The common case of semop() is a single operation on a semaphore that
+ * nobody waits for. Then no sleeper can be affected by the operation:
+ * there is no undo structure to update and no queue to scan, so the
+ * operation only needs to be applied.
+ *
+ * Must be called with the per-semaphore lock held, i.e. when sem_lock()
+ * did not return SEM_GLOBAL_LOCK. In that case no complex operation is
+ * pending either, so the global queues are empty.
+ *
+ * Returns 0 if the operation was performed.
+ * Returns 1 if the caller must use perform_atomic_semop(): there are
+ * waiters, the operation would block or is out of range.
+ */
+static int perform_simple_semop(struct sem_array *sma, struct sembuf *sop,
+				int pid)
+{
+	struct sem *curr = sma->sem_base + sop->sem_num;
+	int result;
+
+	if (!list_empty(&curr->pending_alter) ||
+	    !list_empty(&curr->pending_const))
+		return 1;
+
+	result = curr->semval;
+	if (!sop->sem_op && result)
+		return 1;
+
+	result += sop->sem_op;
+	if (result < 0 || result > SEMVMX)
+		return 1;
+
+	curr->semval = result;
+	curr->sempid = pid;
+	curr->sem_otime = get_seconds();
+
+	return 0;
+}
+
 SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 		unsigned, nsops, const struct timespec __user *, timeout)
 {
@@ -1920,6 +1964,12 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	if (un && un->semid == -1)
 		goto out_unlock_free;
 
+	if (nsops == 1 && !undos && locknum != SEM_GLOBAL_LOCK) {
+		error = perform_simple_semop(sma, sops, task_tgid_vnr(current));
+		if (error == 0)
+			goto out_unlock_free;
+	}
+
 	queue.sops = sops;
 	queue.nsops = nsops;
 	queue.undo = un;
@@ -4844,6 +4844,8 @@ static int perf_event_set_output(struct perf_event *event,
 				 struct perf_event *output_event);
 static int perf_event_set_filter(struct perf_event *event, void __user *arg);
 static int perf_event_set_bpf_prog(struct perf_event *event, u32 prog_fd);
+static int perf_event_set_stack_aggr(struct perf_event *event,
+				     void __user *arg);
 
 static long _perf_ioctl(struct perf_event *event, unsigned int cmd, unsigned long arg)
 {
@@ -4913,6 +4915,10 @@ static long _perf_ioctl(struct perf_event *event, unsigned int cmd, unsigned lon
 		rcu_read_unlock();
 		return 0;
 	}
+
+	case PERF_EVENT_IOC_SET_STACK_AGGR:
+		return perf_event_set_stack_aggr(event, (void __user *)arg);
+
 	default:
 		return -ENOTTY;
 	}
@@ -8075,7 +8081,7 @@ static int perf_event_set_bpf_handler(struct perf_event *event, u32 prog_fd)
 		/* hw breakpoint or kernel counter */
 		return -EINVAL;
 
-	if (event->prog)
+	if (event->prog || event->stack_aggr_map)
 		return -EEXIST;
 
 	prog = bpf_prog_get_type(prog_fd, BPF_PROG_TYPE_PERF_EVENT);
@@ -8099,6 +8105,119 @@ static void perf_event_free_bpf_handler(struct perf_event *event)
 	event->prog = NULL;
 	bpf_prog_put(prog);
 }
+
+/*
+ * Count the sample against its callchain instead of writing a record,
+ * see PERF_EVENT_IOC_SET_STACK_AGGR. User space only reads the maps.
+ */
+static void perf_stack_aggr_handler(struct perf_event *event,
+				    struct perf_sample_data *data,
+				    struct pt_regs *regs)
+{
+	struct bpf_map *counts = event->stack_aggr_counts;
+	u64 *count;
+	long id;
+	u32 key;
+
+	id = bpf_stackmap_get_id(event->stack_aggr_map, regs,
+				 event->stack_aggr_flags);
+	if (id < 0)
+		/* the slot after the last stack id counts the failures */
+		key = roundup_pow_of_two(event->stack_aggr_map->max_entries);
+	else
+		key = id;
+
+	/*
+	 * The count is this cpu's, but the handler may run from an NMI that
+	 * interrupted another overflow of the same map on this cpu.
+	 */
+	count = counts->ops->map_lookup_elem(counts, &key);
+	if (count)
+		local64_inc((local64_t *)count);
+}
+
+static struct bpf_map *perf_stack_aggr_map_get(u32 ufd)
+{
+	struct fd f = fdget(ufd);
+	struct bpf_map *map;
+
+	map = __bpf_map_get(f);
+	if (IS_ERR(map))
+		return map;
+
+	map = bpf_map_inc(map, false);
+	fdput(f);
+
+	return map;
+}
+
+static int perf_event_set_stack_aggr(struct perf_event *event,
+				     void __user *uarg)
+{
+	struct perf_event_stack_aggr arg;
+	struct bpf_map *map, *counts;
+	int err;
+
+	if (event->attr.type != PERF_TYPE_HARDWARE &&
+	    event->attr.type != PERF_TYPE_SOFTWARE)
+		return -EINVAL;
+
+	if (!is_sampling_event(event) || event->overflow_handler_context)
+		return -EINVAL;
+
+	if (event->prog || event->stack_aggr_map)
+		return -EEXIST;
+
+	if (copy_from_user(&arg, uarg, sizeof(arg)))
+		return -EFAULT;
+
+	/* a reused stack id would mix the counts of two callchains */
+	if (arg.flags & ~(BPF_F_SKIP_FIELD_MASK | BPF_F_USER_STACK |
+			  BPF_F_FAST_STACK_CMP))
+		return -EINVAL;
+
+	map = perf_stack_aggr_map_get(arg.stack_map_fd);
+	if (IS_ERR(map))
+		return PTR_ERR(map);
+
+	counts = perf_stack_aggr_map_get(arg.count_map_fd);
+	if (IS_ERR(counts)) {
+		err = PTR_ERR(counts);
+		goto put_map;
+	}
+
+	err = -EINVAL;
+	if (map->map_type != BPF_MAP_TYPE_STACK_TRACE ||
+	    counts->map_type != BPF_MAP_TYPE_PERCPU_ARRAY ||
+	    counts->value_size != sizeof(u64) ||
+	    counts->max_entries <= roundup_pow_of_two(map->max_entries))
+		goto put_counts;
+
+	event->stack_aggr_map = map;
+	event->stack_aggr_counts = counts;
+	event->stack_aggr_flags = arg.flags;
+	event->orig_overflow_handler = READ_ONCE(event->overflow_handler);
+	WRITE_ONCE(event->overflow_handler, perf_stack_aggr_handler);
+	return 0;
+
+put_counts:
+	bpf_map_put(counts);
+put_map:
+	bpf_map_put(map);
+	return err;
+}
+
+static void perf_event_free_stack_aggr(struct perf_event *event)
+{
+	if (!event->stack_aggr_map)
+		return;
+
+	WRITE_ONCE(event->overflow_handler, event->orig_overflow_handler);
+	bpf_map_put(event->stack_aggr_counts);
+	bpf_map_put(event->stack_aggr_map);
+	event->stack_aggr_counts = NULL;
+	event->stack_aggr_map = NULL;
+}
 #else
 static int perf_event_set_bpf_handler(struct perf_event *event, u32 prog_fd)
 {
@@ -8107,6 +8226,14 @@ static int perf_event_set_bpf_handler(struct perf_event *event, u32 prog_fd)
 static void perf_event_free_bpf_handler(struct perf_event *event)
 {
 }
+static int perf_event_set_stack_aggr(struct perf_event *event,
+				     void __user *uarg)
+{
+	return -EOPNOTSUPP;
+}
+static void perf_event_free_stack_aggr(struct perf_event *event)
+{
+}
 #endif
 
 static int perf_event_set_bpf_prog(struct perf_event *event, u32 prog_fd)
@@ -8158,6 +8285,7 @@ static void perf_event_free_bpf_prog(struct perf_event *event)
 {
 	if (event->attr.type != PERF_TYPE_TRACEPOINT) {
 		perf_event_free_bpf_handler(event);
+		perf_event_free_stack_aggr(event);
 		return;
 	}
 	perf_event_detach_bpf_prog(event);
@@ -8178,6 +8306,12 @@ static int perf_event_set_bpf_prog(struct perf_event *event, u32 prog_fd)
 	return -ENOENT;
 }
 
+static int perf_event_set_stack_aggr(struct perf_event *event,
+				     void __user *uarg)
+{
+	return -ENOENT;
+}
+
 static void perf_event_free_bpf_prog(struct perf_event *event)
 {
 }
@@ -9617,6 +9751,27 @@ perf_event_alloc(struct perf_event_attr *attr, int cpu,
 			event->orig_overflow_handler =
 				parent_event->orig_overflow_handler;
 		}
+		if (overflow_handler == perf_stack_aggr_handler) {
+			struct bpf_map *map, *counts;
+
+			map = bpf_map_inc(parent_event->stack_aggr_map, false);
+			if (IS_ERR(map)) {
+				err = PTR_ERR(map);
+				goto err_ns;
+			}
+			counts = bpf_map_inc(parent_event->stack_aggr_counts,
+					     false);
+			if (IS_ERR(counts)) {
+				bpf_map_put(map);
+				err = PTR_ERR(counts);
+				goto err_ns;
+			}
+			event->stack_aggr_map = map;
+			event->stack_aggr_counts = counts;
+			event->stack_aggr_flags = parent_event->stack_aggr_flags;
+			event->orig_overflow_handler =
+				parent_event->orig_overflow_handler;
+		}
 #endif
 	}
 
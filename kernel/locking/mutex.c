@@ -26,6 +26,7 @@
 #include <linux/interrupt.h>
 #include <linux/debug_locks.h>
 #include <linux/osq_lock.h>
+#include <linux/lock_contention.h>
 #include <linux/delay.h>
 
 /*
@@ -521,6 +522,7 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 	struct task_struct *task = current;
 	struct mutex_waiter waiter;
 	unsigned long flags;
+	u64 wait_start;
 	int ret;
 
 	if (use_ww_ctx) {
@@ -529,12 +531,15 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 			return -EALREADY;
 	}
 
+	wait_start = lock_contention_begin();
+
 	preempt_disable();
 	mutex_acquire_nest(&lock->dep_map, subclass, 0, nest_lock, ip);
 
 	if (mutex_optimistic_spin(lock, ww_ctx, use_ww_ctx)) {
 		/* got the lock, yay! */
 		preempt_enable();
+		lock_contention_end(LOCK_CONTENTION_MUTEX, wait_start);
 		return 0;
 	}
 
@@ -614,6 +619,7 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 
 	spin_unlock_mutex(&lock->wait_lock, flags);
 	preempt_enable();
+	lock_contention_end(LOCK_CONTENTION_MUTEX, wait_start);
 	return 0;
 
 err:
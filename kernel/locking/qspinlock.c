@@ -28,6 +28,7 @@
 #include <linux/percpu.h>
 #include <linux/hardirq.h>
 #include <linux/mutex.h>
+#include <linux/lock_contention.h>
 #include <asm/byteorder.h>
 #include <asm/qspinlock.h>
 
@@ -418,6 +419,7 @@ EXPORT_SYMBOL(queued_spin_unlock_wait);
 void queued_spin_lock_slowpath(struct qspinlock *lock, u32 val)
 {
 	struct mcs_spinlock *prev, *next, *node;
+	u64 wait_start = lock_contention_begin();
 	u32 old, tail;
 	int idx;
 
@@ -484,6 +486,7 @@ void queued_spin_lock_slowpath(struct qspinlock *lock, u32 val)
 	 * 0,1,0 -> 0,0,1
 	 */
 	clear_pending_set_locked(lock);
+	lock_contention_end(LOCK_CONTENTION_SPIN, wait_start);
 	return;
 
 	/*
@@ -625,6 +628,7 @@ void queued_spin_lock_slowpath(struct qspinlock *lock, u32 val)
 	 * release the node
 	 */
 	__this_cpu_dec(mcs_nodes[0].count);
+	lock_contention_end(LOCK_CONTENTION_SPIN, wait_start);
 }
 EXPORT_SYMBOL(queued_spin_lock_slowpath);
 
@@ -16,6 +16,7 @@
 #include <linux/sched/rt.h>
 #include <linux/sched/deadline.h>
 #include <linux/timer.h>
+#include <linux/lock_contention.h>
 
 #include "rtmutex_common.h"
 
@@ -1263,6 +1264,7 @@ rt_mutex_slowlock(struct rt_mutex *lock, int state,
 		  enum rtmutex_chainwalk chwalk)
 {
 	struct rt_mutex_waiter waiter;
+	u64 wait_start = lock_contention_begin();
 	unsigned long flags;
 	int ret = 0;
 
@@ -1281,6 +1283,7 @@ rt_mutex_slowlock(struct rt_mutex *lock, int state,
 	/* Try to acquire the lock again: */
 	if (try_to_take_rt_mutex(lock, current, NULL)) {
 		raw_spin_unlock_irqrestore(&lock->wait_lock, flags);
+		lock_contention_end(LOCK_CONTENTION_RTMUTEX, wait_start);
 		return 0;
 	}
 
@@ -1317,6 +1320,9 @@ rt_mutex_slowlock(struct rt_mutex *lock, int state,
 
 	debug_rt_mutex_free_waiter(&waiter);
 
+	if (!ret)
+		lock_contention_end(LOCK_CONTENTION_RTMUTEX, wait_start);
+
 	return ret;
 }
 
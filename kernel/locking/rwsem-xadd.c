@@ -15,8 +15,10 @@
 #include <linux/export.h>
 #include <linux/sched/rt.h>
 #include <linux/osq_lock.h>
+#include <linux/lock_contention.h>
 
 #include "rwsem.h"
+#include "rwsem_stat.h"
 
 /*
  * Guide to the rw_semaphore's count field for common values.
@@ -100,8 +102,15 @@ struct rwsem_waiter {
 	struct list_head list;
 	struct task_struct *task;
 	enum rwsem_waiter_type type;
+	unsigned long timeout;
 };
 
+/*
+ * A writer at the head of the wait queue which hasn't got the lock within
+ * this many jiffies (about 4ms) asks for the lock to be handed off to it.
+ */
+#define RWSEM_WAIT_TIMEOUT	DIV_ROUND_UP(HZ, 250)
+
 enum rwsem_wake_type {
 	RWSEM_WAKE_ANY,		/* Wake whatever's at head of wait list */
 	RWSEM_WAKE_READERS,	/* Wake readers only */
@@ -248,15 +257,39 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 	long count, adjustment = -RWSEM_ACTIVE_READ_BIAS;
 	struct rwsem_waiter waiter;
 	struct task_struct *tsk = current;
+	u64 wait_start = lock_contention_begin();
+	bool first = false;
 	WAKE_Q(wake_q);
 
+	/*
+	 * Spin on a running writer rather than going to sleep behind it, but
+	 * only when nobody is queued yet so that waiters are not overtaken.
+	 * The read bias is dropped first since we are not actively locking
+	 * while spinning.
+	 */
+	if (rwsem_reader_can_spin(sem)) {
+		count = atomic_long_add_return(-RWSEM_ACTIVE_READ_BIAS,
+					       &sem->count);
+		adjustment = 0;
+		/* the waiters need a wakeup from us, see below */
+		if (count != RWSEM_WAITING_BIAS &&
+		    rwsem_optimistic_spin_read(sem)) {
+			lock_contention_end(LOCK_CONTENTION_RWSEM_READ,
+					    wait_start);
+			return sem;
+		}
+	}
+
 	waiter.task = tsk;
 	waiter.type = RWSEM_WAITING_FOR_READ;
 
 	raw_spin_lock_irq(&sem->wait_lock);
-	if (list_empty(&sem->wait_list))
+	if (list_empty(&sem->wait_list)) {
 		adjustment += RWSEM_WAITING_BIAS;
+		first = true;
+	}
 	list_add_tail(&waiter.list, &sem->wait_list);
+	rwstat_inc(rwstat_rlock_sleep);
 
 	/* we're now waiting on the lock, but no longer actively locking */
 	count = atomic_long_add_return(adjustment, &sem->count);
@@ -268,8 +301,7 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 	 * wake our own waiter to join the existing active readers !
 	 */
 	if (count == RWSEM_WAITING_BIAS ||
-	    (count > RWSEM_WAITING_BIAS &&
-	     adjustment != -RWSEM_ACTIVE_READ_BIAS))
+	    (count > RWSEM_WAITING_BIAS && first))
 		__rwsem_mark_wake(sem, RWSEM_WAKE_ANY, &wake_q);
 
 	raw_spin_unlock_irq(&sem->wait_lock);
@@ -284,6 +316,7 @@ struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
 	}
 
 	__set_task_state(tsk, TASK_RUNNING);
+	lock_contention_end(LOCK_CONTENTION_RWSEM_READ, wait_start);
 	return sem;
 }
 EXPORT_SYMBOL(rwsem_down_read_failed);
@@ -293,7 +326,8 @@ EXPORT_SYMBOL(rwsem_down_read_failed);
  * race conditions between checking the rwsem wait list and setting the
  * sem->count accordingly.
  */
-static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem)
+static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem,
+					bool first)
 {
 	/*
 	 * Avoid trying to acquire write lock if count isn't RWSEM_WAITING_BIAS.
@@ -301,6 +335,10 @@ static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem)
 	if (count != RWSEM_WAITING_BIAS)
 		return false;
 
+	/* the lock is being handed off to the head waiter */
+	if (!first && rwsem_handoff_pending(sem))
+		return false;
+
 	/*
 	 * Acquire the lock by trying to set it to ACTIVE_WRITE_BIAS. If there
 	 * are other tasks on the wait list, we need to add on WAITING_BIAS.
@@ -326,6 +364,9 @@ static inline bool rwsem_try_write_lock_unqueued(struct rw_semaphore *sem)
 {
 	long old, count = atomic_long_read(&sem->count);
 
+	if (rwsem_handoff_pending(sem))
+		return false;
+
 	while (true) {
 		if (!(count == 0 || count == RWSEM_WAITING_BIAS))
 			return false;
@@ -341,6 +382,30 @@ static inline bool rwsem_try_write_lock_unqueued(struct rw_semaphore *sem)
 	}
 }
 
+/*
+ * Try to acquire read lock before the reader has been put on wait queue.
+ * This only succeeds when there is no writer, active or waiting.
+ */
+static inline bool rwsem_try_read_lock_unqueued(struct rw_semaphore *sem)
+{
+	long old, count = atomic_long_read(&sem->count);
+
+	if (rwsem_handoff_pending(sem))
+		return false;
+
+	while (count >= 0) {
+		old = atomic_long_cmpxchg_acquire(&sem->count, count,
+				      count + RWSEM_ACTIVE_READ_BIAS);
+		if (old == count) {
+			rwsem_set_reader_owned(sem);
+			return true;
+		}
+
+		count = old;
+	}
+	return false;
+}
+
 static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
 {
 	struct task_struct *owner;
@@ -351,6 +416,12 @@ static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
 
 	rcu_read_lock();
 	owner = READ_ONCE(sem->owner);
+	/* Don't steal the lock from a waiter it is being handed off to */
+	if (rwsem_owner_flags(owner) & RWSEM_FLAG_HANDOFF) {
+		ret = false;
+		goto done;
+	}
+
 	if (!rwsem_owner_is_writer(owner)) {
 		/*
 		 * Don't spin if the rwsem is readers owned.
@@ -365,6 +436,11 @@ static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
 	return ret;
 }
 
+static inline bool rwsem_reader_can_spin(struct rw_semaphore *sem)
+{
+	return list_empty(&sem->wait_list) && rwsem_can_spin_on_owner(sem);
+}
+
 /*
  * Return true only if we can still spin on the owner field of the rwsem.
  */
@@ -372,7 +448,8 @@ static noinline bool rwsem_spin_on_owner(struct rw_semaphore *sem)
 {
 	struct task_struct *owner = READ_ONCE(sem->owner);
 
-	if (!rwsem_owner_is_writer(owner))
+	/* the flags would have to be masked before dereferencing owner */
+	if (!rwsem_owner_is_writer(owner) || rwsem_owner_flags(owner))
 		goto out;
 
 	rcu_read_lock();
@@ -395,11 +472,13 @@ static noinline bool rwsem_spin_on_owner(struct rw_semaphore *sem)
 	}
 	rcu_read_unlock();
 out:
+	owner = READ_ONCE(sem->owner);
 	/*
 	 * If there is a new owner or the owner is not set, we continue
-	 * spinning.
+	 * spinning, unless a handoff has been requested.
 	 */
-	return !rwsem_owner_is_reader(READ_ONCE(sem->owner));
+	return !rwsem_owner_is_reader(owner) &&
+	       !(rwsem_owner_flags(owner) & RWSEM_FLAG_HANDOFF);
 }
 
 static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
@@ -449,11 +528,81 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 		cpu_relax_lowlatency();
 	}
 	osq_unlock(&sem->osq);
+	rwstat_inc(taken ? rwstat_wlock_spin : rwstat_wlock_spin_fail);
+done:
+	preempt_enable();
+	return taken;
+}
+
+/*
+ * Readers spin on a running writer, the same way as writers do, and join
+ * once the lock is free or owned by readers again.
+ */
+static bool rwsem_optimistic_spin_read(struct rw_semaphore *sem)
+{
+	bool taken = false;
+
+	preempt_disable();
+
+	if (!rwsem_can_spin_on_owner(sem))
+		goto done;
+
+	if (!osq_lock(&sem->osq))
+		goto done;
+
+	while (rwsem_spin_on_owner(sem)) {
+		if (rwsem_try_read_lock_unqueued(sem)) {
+			taken = true;
+			break;
+		}
+
+		/* Someone went to sleep, queue up behind them */
+		if (!list_empty(&sem->wait_list))
+			break;
+
+		/* see rwsem_optimistic_spin() */
+		if (!sem->owner && (need_resched() || rt_task(current)))
+			break;
+
+		cpu_relax_lowlatency();
+	}
+
+	/* The lock may have become readers owned */
+	if (!taken)
+		taken = rwsem_try_read_lock_unqueued(sem);
+	osq_unlock(&sem->osq);
+	rwstat_inc(taken ? rwstat_rlock_spin : rwstat_rlock_spin_fail);
 done:
 	preempt_enable();
 	return taken;
 }
 
+static void rwsem_set_handoff(struct rw_semaphore *sem)
+{
+	struct task_struct *owner = READ_ONCE(sem->owner), *old;
+
+	while (!(rwsem_owner_flags(owner) & RWSEM_FLAG_HANDOFF)) {
+		old = cmpxchg(&sem->owner, owner, (struct task_struct *)
+			      ((unsigned long)owner | RWSEM_FLAG_HANDOFF));
+		if (old == owner)
+			break;
+		owner = old;
+	}
+}
+
+static void rwsem_clear_handoff(struct rw_semaphore *sem)
+{
+	struct task_struct *owner = READ_ONCE(sem->owner), *old;
+
+	while (rwsem_owner_flags(owner) & RWSEM_FLAG_HANDOFF) {
+		old = cmpxchg(&sem->owner, owner, (struct task_struct *)
+			      ((unsigned long)owner & ~RWSEM_FLAG_HANDOFF));
+		if (old == owner)
+			break;
+		owner = old;
+	}
+}
+
 /*
  * Return true if the rwsem has active spinner
  */
@@ -468,6 +617,24 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 	return false;
 }
 
+static inline bool rwsem_reader_can_spin(struct rw_semaphore *sem)
+{
+	return false;
+}
+
+static bool rwsem_optimistic_spin_read(struct rw_semaphore *sem)
+{
+	return false;
+}
+
+static inline void rwsem_set_handoff(struct rw_semaphore *sem)
+{
+}
+
+static inline void rwsem_clear_handoff(struct rw_semaphore *sem)
+{
+}
+
 static inline bool rwsem_has_spinner(struct rw_semaphore *sem)
 {
 	return false;
@@ -482,16 +649,20 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 {
 	long count;
 	bool waiting = true; /* any queued threads before us */
+	bool first, handoff = false;
 	struct rwsem_waiter waiter;
 	struct rw_semaphore *ret = sem;
+	u64 wait_start = lock_contention_begin();
 	WAKE_Q(wake_q);
 
 	/* undo write bias from down_write operation, stop active locking */
 	count = atomic_long_sub_return(RWSEM_ACTIVE_WRITE_BIAS, &sem->count);
 
 	/* do optimistic spinning and steal lock if possible */
-	if (rwsem_optimistic_spin(sem))
+	if (rwsem_optimistic_spin(sem)) {
+		lock_contention_end(LOCK_CONTENTION_RWSEM_WRITE, wait_start);
 		return sem;
+	}
 
 	/*
 	 * Optimistic spinning failed, proceed to the slowpath
@@ -499,6 +670,7 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 	 */
 	waiter.task = current;
 	waiter.type = RWSEM_WAITING_FOR_WRITE;
+	waiter.timeout = jiffies + RWSEM_WAIT_TIMEOUT;
 
 	raw_spin_lock_irq(&sem->wait_lock);
 
@@ -507,6 +679,7 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 		waiting = false;
 
 	list_add_tail(&waiter.list, &sem->wait_list);
+	rwstat_inc(rwstat_wlock_sleep);
 
 	/* we're now waiting on the lock, but no longer actively locking */
 	if (waiting) {
@@ -537,8 +710,34 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 	/* wait until we successfully acquire the lock */
 	set_current_state(state);
 	while (true) {
-		if (rwsem_try_write_lock(count, sem))
+		first = list_first_entry(&sem->wait_list, struct rwsem_waiter,
+					 list) == &waiter;
+		if (rwsem_try_write_lock(count, sem, first))
 			break;
+
+		if (first) {
+			/*
+			 * Waited for too long while others kept stealing the
+			 * lock, have it handed off to us. The flag may get lost
+			 * to a racing owner change, so set it every time.
+			 */
+			if (time_after(jiffies, waiter.timeout)) {
+				if (!handoff)
+					rwstat_inc(rwstat_wlock_handoff);
+				handoff = true;
+				rwsem_set_handoff(sem);
+			}
+		} else if (count == RWSEM_WAITING_BIAS) {
+			WAKE_Q(wake_q);
+
+			/*
+			 * The lock is free but not ours to take, make sure
+			 * the waiter it is handed off to is awake. As above,
+			 * the wakeup is done with the wait_lock held.
+			 */
+			__rwsem_mark_wake(sem, RWSEM_WAKE_ANY, &wake_q);
+			wake_up_q(&wake_q);
+		}
 		raw_spin_unlock_irq(&sem->wait_lock);
 
 		/* Block until there are no active lockers. */
@@ -555,12 +754,15 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 	__set_current_state(TASK_RUNNING);
 	list_del(&waiter.list);
 	raw_spin_unlock_irq(&sem->wait_lock);
+	lock_contention_end(LOCK_CONTENTION_RWSEM_WRITE, wait_start);
 
 	return ret;
 
 out_nolock:
 	__set_current_state(TASK_RUNNING);
 	raw_spin_lock_irq(&sem->wait_lock);
+	if (handoff)
+		rwsem_clear_handoff(sem);
 	list_del(&waiter.list);
 	if (list_empty(&sem->wait_list))
 		atomic_long_add(-RWSEM_WAITING_BIAS, &sem->count);
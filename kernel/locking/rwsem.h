@@ -1,19 +1,29 @@
 /*
- * The owner field of the rw_semaphore structure will be set to
- * RWSEM_READ_OWNED when a reader grabs the lock. A writer will clear
- * the owner field when it unlocks. A reader, on the other hand, will
- * not touch the owner field when it unlocks.
+ * The owner field of the rw_semaphore structure encodes both the owning
+ * task and the owner type in its low bits, as task_struct is always
+ * sufficiently aligned:
  *
- * In essence, the owner field now has the following 3 states:
  *  1) 0
  *     - lock is free or the owner hasn't set the field yet
- *  2) RWSEM_READER_OWNED
+ *  2) task | RWSEM_READER_OWNED
  *     - lock is currently or previously owned by readers (lock is free
- *       or not set by owner yet)
- *  3) Other non-zero value
+ *       or not set by owner yet); task is the reader which made the lock
+ *       reader-owned and is only useful for debugging
+ *  3) Other non-zero task value
  *     - a writer owns the lock
+ *
+ * A writer sets the owner field when it gets the lock and clears it when it
+ * unlocks. A reader, on the other hand, will not touch the owner field when
+ * it unlocks.
+ *
+ * RWSEM_FLAG_HANDOFF can be set in addition by the writer at the head of
+ * the wait queue when it has waited for too long. Optimistic spinners and
+ * other waiters stop stealing the lock while it is set, and the next writer
+ * to acquire the lock (normally the head waiter) clears it.
  */
-#define RWSEM_READER_OWNED	((struct task_struct *)1UL)
+#define RWSEM_READER_OWNED	(1UL << 0)
+#define RWSEM_FLAG_HANDOFF	(1UL << 1)
+#define RWSEM_OWNER_FLAGS_MASK	(RWSEM_READER_OWNED | RWSEM_FLAG_HANDOFF)
 
 #ifdef CONFIG_RWSEM_SPIN_ON_OWNER
 /*
@@ -23,6 +33,17 @@
  * may not need READ_ONCE() as long as the pointer value is only used
  * for comparison and isn't being dereferenced.
  */
+static inline unsigned long rwsem_owner_flags(struct task_struct *owner)
+{
+	return (unsigned long)owner & RWSEM_OWNER_FLAGS_MASK;
+}
+
+static inline struct task_struct *rwsem_owner_task(struct task_struct *owner)
+{
+	return (struct task_struct *)
+		((unsigned long)owner & ~RWSEM_OWNER_FLAGS_MASK);
+}
+
 static inline void rwsem_set_owner(struct rw_semaphore *sem)
 {
 	WRITE_ONCE(sem->owner, current);
@@ -30,28 +51,44 @@ static inline void rwsem_set_owner(struct rw_semaphore *sem)
 
 static inline void rwsem_clear_owner(struct rw_semaphore *sem)
 {
-	WRITE_ONCE(sem->owner, NULL);
+	/*
+	 * Keep a pending handoff visible to the spinners. This can race with
+	 * the waiter setting it, which then sets it again after its next
+	 * failed attempt.
+	 */
+	WRITE_ONCE(sem->owner, (struct task_struct *)
+		   ((unsigned long)READ_ONCE(sem->owner) & RWSEM_FLAG_HANDOFF));
 }
 
 static inline void rwsem_set_reader_owned(struct rw_semaphore *sem)
 {
+	unsigned long owner = (unsigned long)READ_ONCE(sem->owner);
+
 	/*
 	 * We check the owner value first to make sure that we will only
 	 * do a write to the rwsem cacheline when it is really necessary
 	 * to minimize cacheline contention.
 	 */
-	if (sem->owner != RWSEM_READER_OWNED)
-		WRITE_ONCE(sem->owner, RWSEM_READER_OWNED);
+	if (!(owner & RWSEM_READER_OWNED))
+		WRITE_ONCE(sem->owner, (struct task_struct *)
+			   ((unsigned long)current | RWSEM_READER_OWNED |
+			    (owner & RWSEM_FLAG_HANDOFF)));
 }
 
 static inline bool rwsem_owner_is_writer(struct task_struct *owner)
 {
-	return owner && owner != RWSEM_READER_OWNED;
+	return rwsem_owner_task(owner) &&
+	       !(rwsem_owner_flags(owner) & RWSEM_READER_OWNED);
 }
 
 static inline bool rwsem_owner_is_reader(struct task_struct *owner)
 {
-	return owner == RWSEM_READER_OWNED;
+	return rwsem_owner_flags(owner) & RWSEM_READER_OWNED;
+}
+
+static inline bool rwsem_handoff_pending(struct rw_semaphore *sem)
+{
+	return rwsem_owner_flags(READ_ONCE(sem->owner)) & RWSEM_FLAG_HANDOFF;
 }
 #else
 static inline void rwsem_set_owner(struct rw_semaphore *sem)
@@ -65,4 +102,9 @@ static inline void rwsem_clear_owner(struct rw_semaphore *sem)
 static inline void rwsem_set_reader_owned(struct rw_semaphore *sem)
 {
 }
+
+static inline bool rwsem_handoff_pending(struct rw_semaphore *sem)
+{
+	return false;
+}
 #endif
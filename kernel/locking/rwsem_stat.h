@@ -0,0 +1,148 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * When lock statistics are enabled, the following debugfs files will be
+ * created for reporting the rwsem slowpath counter values:
+ *
+ * <debugfs>/rwsemstat/
+ *   rlock_spin		- # of read locks acquired by optimistic spinning
+ *   rlock_spin_fail	- # of failed reader optimistic spinning attempts
+ *   rlock_sleep	- # of readers put on the wait queue
+ *   wlock_spin		- # of write locks acquired by optimistic spinning
+ *   wlock_spin_fail	- # of failed writer optimistic spinning attempts
+ *   wlock_sleep	- # of writers put on the wait queue
+ *   wlock_handoff	- # of times a waiting writer requested a handoff
+ *
+ * Writing to the "reset_counters" file will reset all the above counter
+ * values.
+ *
+ * As with qlockstat, the counters are per-cpu variables which are summed
+ * whenever the corresponding debugfs files are read.
+ */
+enum rwsem_stats {
+	rwstat_rlock_spin,
+	rwstat_rlock_spin_fail,
+	rwstat_rlock_sleep,
+	rwstat_wlock_spin,
+	rwstat_wlock_spin_fail,
+	rwstat_wlock_sleep,
+	rwstat_wlock_handoff,
+	rwstat_num,	/* Total number of statistical counters */
+	rwstat_reset_cnts = rwstat_num,
+};
+
+#ifdef CONFIG_LOCK_STAT
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+
+static const char * const rwstat_names[rwstat_num + 1] = {
+	[rwstat_rlock_spin]	 = "rlock_spin",
+	[rwstat_rlock_spin_fail] = "rlock_spin_fail",
+	[rwstat_rlock_sleep]	 = "rlock_sleep",
+	[rwstat_wlock_spin]	 = "wlock_spin",
+	[rwstat_wlock_spin_fail] = "wlock_spin_fail",
+	[rwstat_wlock_sleep]	 = "wlock_sleep",
+	[rwstat_wlock_handoff]	 = "wlock_handoff",
+	[rwstat_reset_cnts]	 = "reset_counters",
+};
+
+static DEFINE_PER_CPU(unsigned long, rwstats[rwstat_num]);
+
+static ssize_t rwstat_read(struct file *file, char __user *user_buf,
+			   size_t count, loff_t *ppos)
+{
+	char buf[64];
+	int cpu, counter, len;
+	u64 stat = 0;
+
+	if (!file->f_inode) {
+		WARN_ON_ONCE(1);
+		return -EBADF;
+	}
+	counter = (long)(file->f_inode->i_private);
+
+	if (counter >= rwstat_num)
+		return -EBADF;
+
+	for_each_possible_cpu(cpu)
+		stat += per_cpu(rwstats[counter], cpu);
+
+	len = snprintf(buf, sizeof(buf) - 1, "%llu\n", stat);
+	return simple_read_from_buffer(user_buf, count, ppos, buf, len);
+}
+
+static ssize_t rwstat_write(struct file *file, const char __user *user_buf,
+			    size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	if (!file->f_inode) {
+		WARN_ON_ONCE(1);
+		return -EBADF;
+	}
+	if ((long)(file->f_inode->i_private) != rwstat_reset_cnts)
+		return count;
+
+	for_each_possible_cpu(cpu) {
+		int i;
+		unsigned long *ptr = per_cpu_ptr(rwstats, cpu);
+
+		for (i = 0 ; i < rwstat_num; i++)
+			WRITE_ONCE(ptr[i], 0);
+	}
+	return count;
+}
+
+static const struct file_operations fops_rwstat = {
+	.read = rwstat_read,
+	.write = rwstat_write,
+	.llseek = default_llseek,
+};
+
+static int __init init_rwsem_stat(void)
+{
+	struct dentry *d_rwstat = debugfs_create_dir("rwsemstat", NULL);
+	int i;
+
+	if (!d_rwstat)
+		goto out;
+
+	for (i = 0; i < rwstat_num; i++)
+		if (!debugfs_create_file(rwstat_names[i], 0400, d_rwstat,
+					 (void *)(long)i, &fops_rwstat))
+			goto fail_undo;
+
+	if (!debugfs_create_file(rwstat_names[rwstat_reset_cnts], 0200,
+				 d_rwstat, (void *)(long)rwstat_reset_cnts,
+				 &fops_rwstat))
+		goto fail_undo;
+
+	return 0;
+fail_undo:
+	debugfs_remove_recursive(d_rwstat);
+out:
+	pr_warn("Could not create 'rwsemstat' debugfs entries\n");
+	return -ENOMEM;
+}
+fs_initcall(init_rwsem_stat);
+
+static inline void rwstat_inc(enum rwsem_stats stat)
+{
+	this_cpu_inc(rwstats[stat]);
+}
+
+#else /* CONFIG_LOCK_STAT */
+
+static inline void rwstat_inc(enum rwsem_stats stat)	{ }
+
+#endif /* CONFIG_LOCK_STAT */
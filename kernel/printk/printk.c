@@ -45,6 +45,9 @@
 #include <linux/utsname.h>
 #include <linux/ctype.h>
 #include <linux/uio.h>
+#include <linux/kthread.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 #include <asm/uaccess.h>
 #include <asm/sections.h>
@@ -384,6 +387,30 @@ static u32 console_idx;
 static u64 clear_seq;
 static u32 clear_idx;
 
+/*
+ * Consoles are written by printk_kthread once it is running, so that a
+ * noisy printk() caller does not end up flushing everybody's messages to
+ * slow consoles. printk.synchronous=1 restores the direct printing.
+ */
+static struct task_struct *printk_kthread;
+static bool __read_mostly printk_sync;
+module_param_named(synchronous, printk_sync, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(synchronous, "print to consoles from the printk() caller");
+
+/* time spent in console drivers, protected by console_sem */
+static u64 console_direct_ns, console_kthread_ns, console_max_ns;
+static unsigned long console_direct_lines, console_kthread_lines;
+
+static bool printk_offload(void)
+{
+	/* print directly on oops and panic, and when going down */
+	return printk_kthread && !printk_sync && !oops_in_progress &&
+	       system_state <= SYSTEM_RUNNING;
+}
+
+static void console_kick(void);
+static void defer_console_output(void);
+
 #define PREFIX_MAX		32
 #define LOG_LINE_MAX		(1024 - PREFIX_MAX)
 
@@ -1572,12 +1599,15 @@ static void call_console_drivers(int level,
 				 const char *text, size_t len)
 {
 	struct console *con;
+	u64 start, delta;
 
 	trace_console_rcuidle(text, len);
 
 	if (!console_drivers)
 		return;
 
+	start = local_clock();
+
 	for_each_console(con) {
 		if (exclusive_console && con != exclusive_console)
 			continue;
@@ -1593,6 +1623,17 @@ static void call_console_drivers(int level,
 		else
 			con->write(con, text, len);
 	}
+
+	delta = local_clock() - start;
+	if (current == printk_kthread) {
+		console_kthread_ns += delta;
+		console_kthread_lines++;
+	} else {
+		console_direct_ns += delta;
+		console_direct_lines++;
+	}
+	if (delta > console_max_ns)
+		console_max_ns = delta;
 }
 
 /*
@@ -1779,6 +1820,232 @@ static size_t log_output(int facility, int level, enum log_flags lflags, const c
 	return log_store(facility, level, lflags, 0, dict, dictlen, text, text_len);
 }
 
+/* strip the trailing newline and the syslog prefix, return the log flags */
+static enum log_flags parse_text(int facility, int *level,
+				 char **text, size_t *text_len)
+{
+	enum log_flags lflags = 0;
+
+	/* mark and strip a trailing newline */
+	if (*text_len && (*text)[*text_len - 1] == '\n') {
+		(*text_len)--;
+		lflags |= LOG_NEWLINE;
+	}
+
+	/* strip kernel syslog prefix and extract log level or control flags */
+	if (facility == 0) {
+		int kern_level;
+
+		while ((kern_level = printk_get_level(*text)) != 0) {
+			switch (kern_level) {
+			case '0' ... '7':
+				if (*level == LOGLEVEL_DEFAULT)
+					*level = kern_level - '0';
+				/* fallthrough */
+			case 'd':	/* KERN_DEFAULT */
+				lflags |= LOG_PREFIX;
+				break;
+			case 'c':	/* KERN_CONT */
+				lflags |= LOG_CONT;
+			}
+
+			*text_len -= 2;
+			*text += 2;
+		}
+	}
+	return lflags;
+}
+
+/*
+ * When logbuf_lock is contended, printk() does not spin on it. Instead the
+ * message is formatted into a lockless per-CPU staging buffer, the same way
+ * as printk_nmi does, and it gets merged into the main ring buffer by the
+ * next logbuf_lock holder or by IRQ work on the staging CPU. Staged records
+ * carry a global sequence number so that records from different CPUs are
+ * merged in the order they were issued.
+ *
+ * There is only one writer per CPU since interrupts are disabled, but the
+ * buffer can be drained from any CPU under logbuf_lock. As in nmi.c, @len
+ * is only ever advanced by the writer and reset by the reader with
+ * atomic_cmpxchg().
+ */
+#define PRINTK_STAGE_BUF_LEN	4096
+
+struct printk_stage_rec {
+	u64 seq;		/* global issue order */
+	u64 ts_nsec;
+	pid_t pid;
+	u16 len;		/* length of the entire record */
+	u16 raw_len;		/* length of the formatted text */
+	u16 text_off;		/* offset of the text after the prefixes */
+	u16 text_len;
+	u16 dict_len;		/* dictionary follows the formatted text */
+	u8 facility;
+	u8 level;
+	u8 flags;
+};
+
+struct printk_stage_buf {
+	atomic_t		len;	/* length of written data */
+	unsigned int		read;	/* merged so far, under logbuf_lock */
+	struct irq_work		work;	/* IRQ work that merges the buffer */
+	unsigned char		buffer[PRINTK_STAGE_BUF_LEN] __aligned(8);
+};
+
+static void printk_stage_work_func(struct irq_work *work);
+
+static DEFINE_PER_CPU(struct printk_stage_buf, printk_stage_bufs) = {
+	.work = { .func = printk_stage_work_func },
+};
+
+static atomic64_t printk_stage_seq;
+static atomic_t printk_stage_pending;
+static atomic_long_t printk_staged, printk_stage_full;
+
+/*
+ * Format a message into this CPU's staging buffer. Must be called with
+ * interrupts disabled. Returns the length of the staged text, or -ENOSPC
+ * if the buffer is full, in which case the caller has to go and take
+ * logbuf_lock.
+ */
+static int printk_stage(int facility, int level,
+			 const char *dict, size_t dictlen,
+			 const char *fmt, va_list args)
+{
+	struct printk_stage_buf *s = this_cpu_ptr(&printk_stage_bufs);
+	struct printk_stage_rec *rec;
+	size_t len, space, raw_len, text_len;
+	enum log_flags lflags;
+	char *raw, *text;
+	va_list ap;
+
+again:
+	len = atomic_read(&s->len);
+	space = sizeof(s->buffer) - len;
+	if (space < sizeof(*rec) + dictlen + PREFIX_MAX) {
+		atomic_long_inc(&printk_stage_full);
+		return -ENOSPC;
+	}
+
+	/*
+	 * Make sure that all old data have been read before the buffer was
+	 * reset. This is not needed when we just append data.
+	 */
+	if (!len)
+		smp_rmb();
+
+	rec = (struct printk_stage_rec *)(s->buffer + len);
+	raw = (char *)(rec + 1);
+
+	va_copy(ap, args);
+	raw_len = vscnprintf(raw, min_t(size_t, space - sizeof(*rec) - dictlen,
+					LOG_LINE_MAX), fmt, ap);
+	va_end(ap);
+
+	text = raw;
+	text_len = raw_len;
+	lflags = parse_text(facility, &level, &text, &text_len);
+	if (level == LOGLEVEL_DEFAULT)
+		level = default_message_loglevel;
+	if (dict) {
+		lflags |= LOG_PREFIX|LOG_NEWLINE;
+		memcpy(raw + raw_len, dict, dictlen);
+	}
+
+	rec->seq = atomic64_inc_return(&printk_stage_seq);
+	rec->ts_nsec = local_clock();
+	rec->pid = current->pid;
+	rec->len = ALIGN(sizeof(*rec) + raw_len + dictlen, 8);
+	rec->raw_len = raw_len;
+	rec->text_off = text - raw;
+	rec->text_len = text_len;
+	rec->dict_len = dictlen;
+	rec->facility = facility;
+	rec->level = level;
+	rec->flags = lflags;
+
+	/*
+	 * Do it once again if the buffer has been merged in the meantime.
+	 * Note that atomic_cmpxchg() is an implicit memory barrier that
+	 * makes sure that the record was written before updating s->len.
+	 */
+	if (atomic_cmpxchg(&s->len, len, len + rec->len) != len)
+		goto again;
+
+	atomic_inc(&printk_stage_pending);
+	atomic_long_inc(&printk_staged);
+	irq_work_queue(&s->work);
+	return text_len;
+}
+
+/*
+ * Move all staged records into the main ring buffer in issue order.
+ * Called with logbuf_lock held.
+ */
+static void printk_stage_merge(void)
+{
+	struct printk_stage_buf *s, *best_s;
+	struct printk_stage_rec *rec, *best;
+	int cpu, best_cpu;
+	char *raw;
+
+	if (!atomic_xchg(&printk_stage_pending, 0))
+		return;
+
+	/* staged lines are complete records, do not mix them into cont */
+	if (cont.len)
+		cont_flush();
+
+	for (;;) {
+		best = NULL;
+		best_s = NULL;
+		best_cpu = 0;
+		for_each_possible_cpu(cpu) {
+			s = per_cpu_ptr(&printk_stage_bufs, cpu);
+			if (s->read >= atomic_read(&s->len))
+				continue;
+			/* Make sure that data has been written up to @len */
+			smp_rmb();
+			rec = (struct printk_stage_rec *)(s->buffer + s->read);
+			if (!best || rec->seq < best->seq) {
+				best = rec;
+				best_s = s;
+				best_cpu = cpu;
+			}
+		}
+		if (!best)
+			break;
+
+		raw = (char *)(best + 1);
+		log_store(best->facility, best->level, best->flags,
+			  best->ts_nsec, raw + best->raw_len, best->dict_len,
+			  raw + best->text_off, best->text_len);
+		update_msg_ext(best_cpu, best->pid);
+		best_s->read += best->len;
+	}
+
+	/*
+	 * Release the buffers. If anything got appended in the meantime,
+	 * keep the read position, the writer bumped printk_stage_pending.
+	 */
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(&printk_stage_bufs, cpu);
+		if (s->read && atomic_cmpxchg(&s->len, s->read, 0) == s->read)
+			s->read = 0;
+	}
+}
+
+static void printk_stage_work_func(struct irq_work *work)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&logbuf_lock, flags);
+	printk_stage_merge();
+	raw_spin_unlock_irqrestore(&logbuf_lock, flags);
+
+	console_kick();
+}
+
 asmlinkage int vprintk_emit(int facility, int level,
 			    const char *dict, size_t dictlen,
 			    const char *fmt, va_list args)
@@ -1787,7 +2054,7 @@ asmlinkage int vprintk_emit(int facility, int level,
 	static char textbuf[LOG_LINE_MAX];
 	char *text = textbuf;
 	size_t text_len = 0;
-	enum log_flags lflags = 0;
+	enum log_flags lflags;
 	unsigned long flags;
 	int this_cpu;
 	int printed_len = 0;
@@ -1828,9 +2095,24 @@ asmlinkage int vprintk_emit(int facility, int level,
 
 	lockdep_off();
 	/* This stops the holder of console_sem just where we want him */
-	raw_spin_lock(&logbuf_lock);
+	if (!raw_spin_trylock(&logbuf_lock)) {
+		if (!oops_in_progress) {
+			printed_len = printk_stage(facility, level, dict,
+						   dictlen, fmt, args);
+			if (printed_len >= 0) {
+				lockdep_on();
+				local_irq_restore(flags);
+				return printed_len;
+			}
+			printed_len = 0;
+		}
+		raw_spin_lock(&logbuf_lock);
+	}
 	logbuf_cpu = this_cpu;
 
+	/* staged records were issued before this one */
+	printk_stage_merge();
+
 	if (unlikely(recursion_bug)) {
 		static const char recursion_msg[] =
 			"BUG: recent printk recursion!";
@@ -1858,34 +2140,7 @@ asmlinkage int vprintk_emit(int facility, int level,
 	 * prefix which might be passed-in as a parameter.
 	 */
 	text_len = vscnprintf(text, sizeof(textbuf), fmt, args);
-
-	/* mark and strip a trailing newline */
-	if (text_len && text[text_len-1] == '\n') {
-		text_len--;
-		lflags |= LOG_NEWLINE;
-	}
-
-	/* strip kernel syslog prefix and extract log level or control flags */
-	if (facility == 0) {
-		int kern_level;
-
-		while ((kern_level = printk_get_level(text)) != 0) {
-			switch (kern_level) {
-			case '0' ... '7':
-				if (level == LOGLEVEL_DEFAULT)
-					level = kern_level - '0';
-				/* fallthrough */
-			case 'd':	/* KERN_DEFAULT */
-				lflags |= LOG_PREFIX;
-				break;
-			case 'c':	/* KERN_CONT */
-				lflags |= LOG_CONT;
-			}
-
-			text_len -= 2;
-			text += 2;
-		}
-	}
+	lflags = parse_text(facility, &level, &text, &text_len);
 
 #ifdef CONFIG_EARLY_PRINTK_DIRECT
 	printascii(text);
@@ -1909,11 +2164,15 @@ asmlinkage int vprintk_emit(int facility, int level,
 	if (!in_sched) {
 		lockdep_off();
 		/*
-		 * Try to acquire and then immediately release the console
-		 * semaphore.  The release will print out buffers and wake up
-		 * /dev/kmsg and syslog() users.
+		 * Let printk_kthread do the printing; it is woken up via IRQ
+		 * work since printk() may be called with runqueue locks held.
+		 * Otherwise try to acquire and then immediately release the
+		 * console semaphore.  The release will print out buffers and
+		 * wake up /dev/kmsg and syslog() users.
 		 */
-		if (console_trylock())
+		if (printk_offload())
+			defer_console_output();
+		else if (console_trylock())
 			console_unlock();
 		lockdep_on();
 	}
@@ -2028,6 +2287,7 @@ static size_t msg_print_text(const struct printk_log *msg,
 			     bool syslog, char *buf, size_t size) { return 0; }
 static size_t cont_print_text(char *text, size_t size) { return 0; }
 static bool suppress_message_printing(int level) { return false; }
+static void printk_stage_merge(void) {}
 
 /* Still needs to be defined for users */
 DEFINE_PER_CPU(printk_func_t, printk_func);
@@ -2559,6 +2819,14 @@ void console_flush_on_panic(void)
 	 * context and we don't want to get preempted while flushing,
 	 * ensure may_schedule is cleared.
 	 */
+	unsigned long flags;
+
+	/* the staging buffers are not merged by IRQ work anymore */
+	if (raw_spin_trylock_irqsave(&logbuf_lock, flags)) {
+		printk_stage_merge();
+		raw_spin_unlock_irqrestore(&logbuf_lock, flags);
+	}
+
 	console_trylock();
 	console_may_schedule = 0;
 	console_unlock();
@@ -2891,15 +3159,25 @@ late_initcall(printk_late_init);
 
 static DEFINE_PER_CPU(int, printk_pending);
 
+/* print pending messages, must not be called with runqueue locks held */
+static void console_kick(void)
+{
+	if (printk_offload()) {
+		wake_up_process(printk_kthread);
+		return;
+	}
+
+	/* If trylock fails, someone else is doing the printing */
+	if (console_trylock())
+		console_unlock();
+}
+
 static void wake_up_klogd_work_func(struct irq_work *irq_work)
 {
 	int pending = __this_cpu_xchg(printk_pending, 0);
 
-	if (pending & PRINTK_PENDING_OUTPUT) {
-		/* If trylock fails, someone else is doing the printing */
-		if (console_trylock())
-			console_unlock();
-	}
+	if (pending & PRINTK_PENDING_OUTPUT)
+		console_kick();
 
 	if (pending & PRINTK_PENDING_WAKEUP)
 		wake_up_interruptible(&log_wait);
@@ -2920,6 +3198,14 @@ void wake_up_klogd(void)
 	preempt_enable();
 }
 
+static void defer_console_output(void)
+{
+	preempt_disable();
+	__this_cpu_or(printk_pending, PRINTK_PENDING_OUTPUT);
+	irq_work_queue(this_cpu_ptr(&wake_up_klogd_work));
+	preempt_enable();
+}
+
 int printk_deferred(const char *fmt, ...)
 {
 	va_list args;
@@ -2930,13 +3216,86 @@ int printk_deferred(const char *fmt, ...)
 	r = vprintk_emit(0, LOGLEVEL_SCHED, NULL, 0, fmt, args);
 	va_end(args);
 
-	__this_cpu_or(printk_pending, PRINTK_PENDING_OUTPUT);
-	irq_work_queue(this_cpu_ptr(&wake_up_klogd_work));
+	defer_console_output();
 	preempt_enable();
 
 	return r;
 }
 
+static bool printk_kthread_need_flush(void)
+{
+	unsigned long flags;
+	bool ret;
+
+	/* resume_console() flushes whatever got queued while suspended */
+	if (console_suspended)
+		return false;
+
+	raw_spin_lock_irqsave(&logbuf_lock, flags);
+	ret = console_seq != log_next_seq ||
+	      (cont.len && cont.cons != cont.len);
+	raw_spin_unlock_irqrestore(&logbuf_lock, flags);
+	return ret;
+}
+
+static int printk_kthread_func(void *data)
+{
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!printk_kthread_need_flush())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		/* console_lock() allows console_unlock() to reschedule */
+		console_lock();
+		console_unlock();
+	}
+	return 0;
+}
+
+static int printk_stats_show(struct seq_file *m, void *v)
+{
+	seq_printf(m, "console_direct_ns: %llu\n", console_direct_ns);
+	seq_printf(m, "console_direct_lines: %lu\n", console_direct_lines);
+	seq_printf(m, "console_kthread_ns: %llu\n", console_kthread_ns);
+	seq_printf(m, "console_kthread_lines: %lu\n", console_kthread_lines);
+	seq_printf(m, "console_max_ns: %llu\n", console_max_ns);
+	seq_printf(m, "staged: %ld\n", atomic_long_read(&printk_staged));
+	seq_printf(m, "stage_full: %ld\n",
+		   atomic_long_read(&printk_stage_full));
+	return 0;
+}
+
+static int printk_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, printk_stats_show, NULL);
+}
+
+static const struct file_operations printk_stats_fops = {
+	.open		= printk_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init printk_kthread_init(void)
+{
+	struct task_struct *tsk;
+
+	proc_create("printk_stats", S_IRUSR, NULL, &printk_stats_fops);
+
+	tsk = kthread_run(printk_kthread_func, NULL, "printk");
+	if (IS_ERR(tsk)) {
+		pr_err("printk: unable to create printing thread\n");
+		return PTR_ERR(tsk);
+	}
+	/* Make sure the thread is up before printk() starts waking it */
+	smp_wmb();
+	printk_kthread = tsk;
+	return 0;
+}
+late_initcall(printk_kthread_init);
+
 /*
  * printk rate limiting, lifted from the networking subsystem.
  *
@@ -3059,6 +3418,7 @@ void kmsg_dump(enum kmsg_dump_reason reason)
 		dumper->active = true;
 
 		raw_spin_lock_irqsave(&logbuf_lock, flags);
+		printk_stage_merge();
 		dumper->cur_seq = clear_seq;
 		dumper->cur_idx = clear_idx;
 		dumper->next_seq = log_next_seq;
@@ -2760,6 +2760,8 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 	unsigned long flags;
 	struct rcu_head *next, *list, **tail;
 	long bl, count, count_lazy;
+	bool offloaded;
+	u64 start;
 	int i;
 
 	/* If no callbacks are ready, just return. */
@@ -2788,8 +2790,14 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 			rdp->nxttail[i] = &rdp->nxtlist;
 	local_irq_restore(flags);
 
-	/* Invoke callbacks. */
+	/* Hand them to the cluster's kthread if there are too many. */
 	count = count_lazy = 0;
+	offloaded = rcu_offload_cbs(rdp, list, tail, &count, &count_lazy);
+	if (offloaded)
+		list = NULL;
+
+	/* Invoke callbacks. */
+	start = rcu_batch_start_time();
 	while (list) {
 		next = list->next;
 		prefetch(next);
@@ -2822,7 +2830,10 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 	smp_mb(); /* List handling before counting for rcu_barrier(). */
 	rdp->qlen_lazy -= count_lazy;
 	WRITE_ONCE(rdp->qlen, rdp->qlen - count);
-	rdp->n_cbs_invoked += count;
+	if (!offloaded) {
+		rdp->n_cbs_invoked += count;
+		rcu_batch_account(rdp, count, start);
+	}
 
 	/* Reinstate batch limit if we have worked down the excess. */
 	if (rdp->blimit == LONG_MAX && rdp->qlen <= qlowmark)
@@ -3603,11 +3614,8 @@ static void _rcu_barrier_trace(struct rcu_state *rsp, const char *s,
  * RCU callback function for _rcu_barrier().  If we are last, wake
  * up the task executing _rcu_barrier().
  */
-static void rcu_barrier_callback(struct rcu_head *rhp)
+static void __rcu_barrier_callback(struct rcu_state *rsp)
 {
-	struct rcu_data *rdp = container_of(rhp, struct rcu_data, barrier_head);
-	struct rcu_state *rsp = rdp->rsp;
-
 	if (atomic_dec_and_test(&rsp->barrier_cpu_count)) {
 		_rcu_barrier_trace(rsp, "LastCB", -1, rsp->barrier_sequence);
 		complete(&rsp->barrier_completion);
@@ -3616,6 +3624,13 @@ static void rcu_barrier_callback(struct rcu_head *rhp)
 	}
 }
 
+static void rcu_barrier_callback(struct rcu_head *rhp)
+{
+	struct rcu_data *rdp = container_of(rhp, struct rcu_data, barrier_head);
+
+	__rcu_barrier_callback(rdp->rsp);
+}
+
 /*
  * Called with preemption disabled, and from cross-cpu IRQ context.
  */
@@ -3698,6 +3713,9 @@ static void _rcu_barrier(struct rcu_state *rsp)
 	}
 	put_online_cpus();
 
+	/* And one behind the callbacks already offloaded to kthreads. */
+	rcu_offload_barrier(rsp);
+
 	/*
 	 * Now that we have an rcu_barrier_callback() callback on each
 	 * CPU, and thus each counted, remove the initial count.
@@ -3849,6 +3867,7 @@ int rcutree_online_cpu(unsigned int cpu)
 {
 	sync_sched_exp_online_cleanup(cpu);
 	rcutree_affinity_setting(cpu, -1);
+	rcu_offload_online_cpu(cpu);
 	return 0;
 }
 
@@ -4001,6 +4020,7 @@ static int __init rcu_spawn_gp_kthread(void)
 	}
 	rcu_spawn_nocb_kthreads();
 	rcu_spawn_boost_kthreads();
+	rcu_spawn_offload_kthreads();
 	return 0;
 }
 early_initcall(rcu_spawn_gp_kthread);
@@ -314,6 +314,37 @@ union rcu_noqs {
 #define RCU_NEXT_TAIL		3
 #define RCU_NEXT_SIZE		4
 
+#ifdef CONFIG_RCU_ADAPTIVE_OFFLOAD
+
+#define RCU_BATCH_HIST_BUCKETS	16
+
+/* log2 histograms of the length and invocation time of callback batches. */
+struct rcu_batch_hist {
+	unsigned long size[RCU_BATCH_HIST_BUCKETS];	/* 1, 2-3, 4-7, ... */
+	unsigned long usecs[RCU_BATCH_HIST_BUCKETS];	/* <1, 1, 2-3, ... */
+};
+
+/*
+ * Callbacks offloaded by the CPUs of a cluster to its kthread when their
+ * queues grow long, one per cluster and RCU flavor.  A cluster is the set
+ * of CPUs sharing a physical package, gathered as they come online.
+ */
+struct rcu_offload {
+	raw_spinlock_t lock;		/* Protects ->head and ->tail. */
+	struct rcu_head *head;		/* CBs waiting for the kthread. */
+	struct rcu_head **tail;
+	atomic_long_t qlen;		/* # CBs queued or being invoked. */
+	struct swait_queue_head wq;	/* For the kthread to sleep on. */
+	struct task_struct *kthread;
+	struct rcu_state *rsp;
+	int cpu;			/* First CPU of the cluster. */
+	cpumask_var_t cpus;		/* CPUs of the cluster. */
+	struct rcu_head barrier_head;	/* For _rcu_barrier(). */
+	struct rcu_batch_hist hist;	/* Batches invoked by the kthread. */
+};
+
+#endif /* #ifdef CONFIG_RCU_ADAPTIVE_OFFLOAD */
+
 /* Per-CPU data for read-copy update. */
 struct rcu_data {
 	/* 1) quiescent-state and grace-period handling : */
@@ -429,6 +460,11 @@ struct rcu_data {
 	struct rcu_data *nocb_leader ____cacheline_internodealigned_in_smp;
 					/* Leader CPU takes GP-end wakeups. */
 #endif /* #ifdef CONFIG_RCU_NOCB_CPU */
+#ifdef CONFIG_RCU_ADAPTIVE_OFFLOAD
+	struct rcu_offload *offload;	/* This CPU's cluster kthread. */
+	unsigned long n_cbs_offloaded;	/* count of RCU cbs offloaded. */
+	struct rcu_batch_hist batch_hist; /* Batches invoked from softirq. */
+#endif /* #ifdef CONFIG_RCU_ADAPTIVE_OFFLOAD */
 
 	/* 8) RCU CPU stall data. */
 	unsigned int softirq_snap;	/* Snapshot of softirq activity. */
@@ -652,6 +688,14 @@ static void do_nocb_deferred_wakeup(struct rcu_data *rdp);
 static void rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp);
 static void rcu_spawn_all_nocb_kthreads(int cpu);
 static void __init rcu_spawn_nocb_kthreads(void);
+static bool rcu_offload_cbs(struct rcu_data *rdp, struct rcu_head *list,
+			    struct rcu_head **tail, long *count,
+			    long *count_lazy);
+static u64 rcu_batch_start_time(void);
+static void rcu_batch_account(struct rcu_data *rdp, long count, u64 start);
+static void rcu_offload_barrier(struct rcu_state *rsp);
+static void rcu_offload_online_cpu(int cpu);
+static void __init rcu_spawn_offload_kthreads(void);
 #ifdef CONFIG_RCU_NOCB_CPU
 static void __init rcu_organize_nocb_kthreads(struct rcu_state *rsp);
 #endif /* #ifdef CONFIG_RCU_NOCB_CPU */
@@ -2485,6 +2485,311 @@ static bool init_nocb_callback_list(struct rcu_data *rdp)
 
 #endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
 
+#ifdef CONFIG_RCU_ADAPTIVE_OFFLOAD
+
+/*
+ * Adaptive callback offloading.  CPUs invoke their own callbacks from
+ * softirq, but once a CPU has more than offload_qlen callbacks queued,
+ * rcu_do_batch() hands its ready callbacks to a kthread shared by the
+ * CPUs of its cluster, which invokes them in preemptible context.
+ *
+ * As long as that kthread has callbacks queued or in flight, the ready
+ * callbacks of the cluster keep going to it whatever their number, so
+ * each CPU's callbacks are still invoked in order.  rcu_barrier()
+ * depends on that.
+ */
+static long offload_qlen = 1000; /* 0 to never offload. */
+module_param(offload_qlen, long, 0644);
+
+static unsigned int rcu_hist_bucket(u64 val)
+{
+	if (!val)
+		return 0;
+	return min_t(unsigned int, ilog2(val) + 1, RCU_BATCH_HIST_BUCKETS - 1);
+}
+
+static void rcu_batch_hist_add(struct rcu_batch_hist *hist, long count,
+			       u64 ns)
+{
+	if (!count)
+		return;
+	hist->size[rcu_hist_bucket(count) - 1]++;
+	hist->usecs[rcu_hist_bucket(div_u64(ns, NSEC_PER_USEC))]++;
+}
+
+static u64 rcu_batch_start_time(void)
+{
+	return local_clock();
+}
+
+/* Account a batch of callbacks invoked from softirq. */
+static void rcu_batch_account(struct rcu_data *rdp, long count, u64 start)
+{
+	rcu_batch_hist_add(&rdp->batch_hist, count, local_clock() - start);
+}
+
+/*
+ * Offload the ready callbacks [list, tail) of this CPU if it has too
+ * many queued or if its cluster's kthread is still busy.  Returns true
+ * with the number of callbacks moved in *count and *count_lazy if so,
+ * for rcu_do_batch() to remove them from ->qlen.
+ */
+static bool rcu_offload_cbs(struct rcu_data *rdp, struct rcu_head *list,
+			    struct rcu_head **tail, long *count,
+			    long *count_lazy)
+{
+	struct rcu_offload *rop = smp_load_acquire(&rdp->offload);
+	struct rcu_head *rhp;
+	unsigned long flags;
+	long thresh;
+	long c = 0;
+	long cl = 0;
+
+	if (!rop)
+		return false;
+
+	thresh = READ_ONCE(offload_qlen);
+	if ((!thresh || rdp->qlen <= thresh) &&
+	    !atomic_long_read(&rop->qlen)) {
+		smp_mb(); /* Kthread's CB invocations before ours. */
+		return false;
+	}
+
+	for (rhp = list; rhp; rhp = rhp->next) {
+		c++;
+		if (__is_kfree_rcu_offset((unsigned long)rhp->func))
+			cl++;
+	}
+
+	raw_spin_lock_irqsave(&rop->lock, flags);
+	*rop->tail = list;
+	rop->tail = tail;
+	atomic_long_add(c, &rop->qlen);
+	raw_spin_unlock_irqrestore(&rop->lock, flags);
+	swake_up(&rop->wq);
+
+	rdp->n_cbs_offloaded += c;
+	*count = c;
+	*count_lazy = cl;
+	return true;
+}
+
+/* Invoke the callbacks offloaded by the CPUs of a cluster. */
+static int rcu_offload_kthread(void *arg)
+{
+	struct rcu_offload *rop = arg;
+	struct rcu_head *list;
+	struct rcu_head *next;
+	unsigned long flags;
+	u64 start;
+	long c;
+
+	for (;;) {
+		swait_event_interruptible(rop->wq, READ_ONCE(rop->head));
+
+		raw_spin_lock_irqsave(&rop->lock, flags);
+		list = rop->head;
+		rop->head = NULL;
+		rop->tail = &rop->head;
+		raw_spin_unlock_irqrestore(&rop->lock, flags);
+		if (!list)
+			continue;
+
+		trace_rcu_batch_start(rop->rsp->name, 0,
+				      atomic_long_read(&rop->qlen), -1);
+		start = local_clock();
+		c = 0;
+		while (list) {
+			next = list->next;
+			debug_rcu_head_unqueue(list);
+			local_bh_disable();
+			__rcu_reclaim(rop->rsp->name, list);
+			local_bh_enable();
+			c++;
+			cond_resched_rcu_qs();
+			list = next;
+		}
+		trace_rcu_batch_end(rop->rsp->name, c, 0, 0, 0, 1);
+		rcu_batch_hist_add(&rop->hist, c, local_clock() - start);
+		smp_mb__before_atomic();  /* _sub after CB invocation. */
+		atomic_long_sub(c, &rop->qlen);
+	}
+	return 0;
+}
+
+static void rcu_offload_barrier_callback(struct rcu_head *rhp)
+{
+	struct rcu_offload *rop;
+
+	rop = container_of(rhp, struct rcu_offload, barrier_head);
+	__rcu_barrier_callback(rop->rsp);
+}
+
+/*
+ * Queue a barrier callback behind the callbacks that the CPUs already
+ * offloaded: they are no longer counted in ->qlen, so _rcu_barrier()
+ * would not wait for them otherwise.
+ */
+static void rcu_offload_barrier(struct rcu_state *rsp)
+{
+	struct rcu_offload *rop;
+	unsigned long flags;
+	bool queued;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		rop = per_cpu_ptr(rsp->rda, cpu)->offload;
+		if (!rop || rop->cpu != cpu)
+			continue;
+
+		queued = false;
+		raw_spin_lock_irqsave(&rop->lock, flags);
+		if (atomic_long_read(&rop->qlen)) {
+			atomic_inc(&rsp->barrier_cpu_count);
+			rop->barrier_head.next = NULL;
+			rop->barrier_head.func = rcu_offload_barrier_callback;
+			*rop->tail = &rop->barrier_head;
+			rop->tail = &rop->barrier_head.next;
+			atomic_long_inc(&rop->qlen);
+			queued = true;
+		}
+		raw_spin_unlock_irqrestore(&rop->lock, flags);
+
+		if (queued) {
+			_rcu_barrier_trace(rsp, "Offload", cpu,
+					   rsp->barrier_sequence);
+			swake_up(&rop->wq);
+		}
+	}
+}
+
+/*
+ * The cluster of the other online CPUs sharing @cpu's package, if any.
+ * The topology of a CPU is only known once it has come online, so the
+ * clusters are gathered as CPUs come online.
+ */
+static struct rcu_offload *rcu_offload_find(struct rcu_state *rsp, int cpu)
+{
+	int id = topology_physical_package_id(cpu);
+	struct rcu_offload *rop;
+	int i;
+
+	for_each_online_cpu(i) {
+		rop = per_cpu_ptr(rsp->rda, i)->offload;
+		if (i != cpu && rop && topology_physical_package_id(i) == id)
+			return rop;
+	}
+	return NULL;
+}
+
+static struct rcu_offload *
+rcu_spawn_one_offload_kthread(struct rcu_state *rsp, int cpu)
+{
+	struct rcu_offload *rop;
+	struct task_struct *t;
+
+	rop = kzalloc(sizeof(*rop), GFP_KERNEL);
+	if (!rop)
+		return NULL;
+	if (!zalloc_cpumask_var(&rop->cpus, GFP_KERNEL)) {
+		kfree(rop);
+		return NULL;
+	}
+
+	raw_spin_lock_init(&rop->lock);
+	rop->tail = &rop->head;
+	init_swait_queue_head(&rop->wq);
+	rop->rsp = rsp;
+	rop->cpu = cpu;
+
+	t = kthread_create(rcu_offload_kthread, rop, "rcuq%c/%d",
+			   rsp->abbr, topology_physical_package_id(cpu));
+	if (WARN_ON_ONCE(IS_ERR(t))) {
+		free_cpumask_var(rop->cpus);
+		kfree(rop);
+		return NULL;
+	}
+
+	rop->kthread = t;
+	wake_up_process(t);
+	return rop;
+}
+
+/*
+ * Point a CPU coming online at its cluster's kthread, spawning the
+ * kthread if the CPU is the first of its cluster.  A CPU coming back
+ * online keeps the cluster it had.  This assumes that the early_initcall()s
+ * happen before non-boot CPUs come online, as CPU hotplug serializes the
+ * rest.
+ */
+static void rcu_offload_online_cpu(int cpu)
+{
+	struct rcu_offload *rop;
+	struct rcu_state *rsp;
+	struct rcu_data *rdp;
+
+	if (!rcu_scheduler_fully_active)
+		return;
+
+	for_each_rcu_flavor(rsp) {
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		if (rdp->offload)
+			continue;
+
+		rop = rcu_offload_find(rsp, cpu);
+		if (!rop)
+			rop = rcu_spawn_one_offload_kthread(rsp, cpu);
+		if (!rop)
+			continue;
+
+		cpumask_set_cpu(cpu, rop->cpus);
+		set_cpus_allowed_ptr(rop->kthread, rop->cpus);
+		/* Pairs with smp_load_acquire() in rcu_offload_cbs(). */
+		smp_store_release(&rdp->offload, rop);
+	}
+}
+
+/* Spawn the kthreads of the CPUs already online. */
+static void __init rcu_spawn_offload_kthreads(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		rcu_offload_online_cpu(cpu);
+}
+
+#else /* #ifdef CONFIG_RCU_ADAPTIVE_OFFLOAD */
+
+static bool rcu_offload_cbs(struct rcu_data *rdp, struct rcu_head *list,
+			    struct rcu_head **tail, long *count,
+			    long *count_lazy)
+{
+	return false;
+}
+
+static u64 rcu_batch_start_time(void)
+{
+	return 0;
+}
+
+static void rcu_batch_account(struct rcu_data *rdp, long count, u64 start)
+{
+}
+
+static void rcu_offload_barrier(struct rcu_state *rsp)
+{
+}
+
+static void rcu_offload_online_cpu(int cpu)
+{
+}
+
+static void __init rcu_spawn_offload_kthreads(void)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_ADAPTIVE_OFFLOAD */
+
 /*
  * An adaptive-ticks CPU can potentially execute in kernel mode for an
  * arbitrarily long period of time with the scheduling-clock tick turned
@@ -99,6 +99,71 @@ static const struct file_operations rcubarrier_fops = {
 	.release = single_release,
 };
 
+#ifdef CONFIG_RCU_ADAPTIVE_OFFLOAD
+
+static void print_batch_hist(struct seq_file *m, const char *who,
+			     struct rcu_batch_hist *hist)
+{
+	int i;
+
+	seq_printf(m, "  %s cbs:", who);
+	for (i = 0; i < RCU_BATCH_HIST_BUCKETS; i++)
+		if (hist->size[i])
+			seq_printf(m, " %lu:%lu", 1UL << i, hist->size[i]);
+	seq_printf(m, "\n  %s usecs:", who);
+	for (i = 0; i < RCU_BATCH_HIST_BUCKETS; i++) {
+		if (!hist->usecs[i])
+			continue;
+		if (!i)
+			seq_printf(m, " <1:%lu", hist->usecs[i]);
+		else
+			seq_printf(m, " %lu:%lu", 1UL << (i - 1),
+				   hist->usecs[i]);
+	}
+	seq_putc(m, '\n');
+}
+
+static int show_rcuoffload(struct seq_file *m, void *v)
+{
+	struct rcu_state *rsp = (struct rcu_state *)m->private;
+	struct rcu_offload *rop;
+	struct rcu_data *rdp;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		if (!rdp->beenonline)
+			continue;
+		seq_printf(m, "%3d%c ci=%lu co=%lu\n",
+			   cpu, cpu_is_offline(cpu) ? '!' : ' ',
+			   rdp->n_cbs_invoked, rdp->n_cbs_offloaded);
+		print_batch_hist(m, "softirq", &rdp->batch_hist);
+
+		rop = rdp->offload;
+		if (!rop || rop->cpu != cpu)
+			continue;
+		seq_printf(m, "  kthread %s ql=%ld\n", rop->kthread->comm,
+			   atomic_long_read(&rop->qlen));
+		print_batch_hist(m, "kthread", &rop->hist);
+	}
+	return 0;
+}
+
+static int rcuoffload_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, show_rcuoffload, inode->i_private);
+}
+
+static const struct file_operations rcuoffload_fops = {
+	.owner = THIS_MODULE,
+	.open = rcuoffload_open,
+	.read = seq_read,
+	.llseek = no_llseek,
+	.release = single_release,
+};
+
+#endif /* #ifdef CONFIG_RCU_ADAPTIVE_OFFLOAD */
+
 #ifdef CONFIG_RCU_BOOST
 
 static char convert_kthread_status(unsigned int kthread_status)
@@ -463,6 +528,13 @@ static int __init rcutree_trace_init(void)
 		if (!retval)
 			goto free_out;
 
+#ifdef CONFIG_RCU_ADAPTIVE_OFFLOAD
+		retval = debugfs_create_file("rcuoffload", 0444,
+				rspdir, rsp, &rcuoffload_fops);
+		if (!retval)
+			goto free_out;
+#endif
+
 #ifdef CONFIG_RCU_BOOST
 		if (rsp == &rcu_preempt_state) {
 			retval = debugfs_create_file("rcuboost", 0444,
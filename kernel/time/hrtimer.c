@@ -50,6 +50,7 @@
 #include <linux/timer.h>
 #include <linux/freezer.h>
 #include <linux/delay.h>
+#include <linux/log2.h>
 
 #include <asm/uaccess.h>
 
@@ -104,6 +105,87 @@ static const int hrtimer_clock_to_base_table[MAX_CLOCKS] = {
 	[CLOCK_TAI]		= HRTIMER_BASE_TAI,
 };
 
+#ifdef CONFIG_HRTIMER_COALESCE
+/*
+ * Timer slack coalescing
+ *
+ * A timer with slack may expire anywhere between its soft and its hard
+ * expiry. Instead of arming the clock event device for the hard expiry
+ * of the first timer, arm it for the coarsest power of two boundary
+ * inside that timer's window. Timers with similar slack then land on
+ * the same boundaries, on this CPU and on the others, and all timers
+ * whose window has opened are expired in the same interrupt.
+ *
+ * The timers themselves are not modified, so hrtimer_forward() and the
+ * remaining time reported to user space are not affected.
+ */
+enum {
+	HRTIMER_COALESCE_OFF,
+	HRTIMER_COALESCE_ALIGN,
+	HRTIMER_COALESCE_MIGRATE,
+};
+
+static int hrtimer_coalesce_mode __read_mostly = HRTIMER_COALESCE_ALIGN;
+
+static int __init setup_hrtimer_coalesce(char *str)
+{
+	if (!strcmp(str, "off"))
+		hrtimer_coalesce_mode = HRTIMER_COALESCE_OFF;
+	else if (!strcmp(str, "on"))
+		hrtimer_coalesce_mode = HRTIMER_COALESCE_ALIGN;
+	else if (!strcmp(str, "migrate"))
+		hrtimer_coalesce_mode = HRTIMER_COALESCE_MIGRATE;
+	else
+		return 0;
+	return 1;
+}
+
+__setup("hrtimer_coalesce=", setup_hrtimer_coalesce);
+
+/*
+ * The expiry, in the timer's clock base, for which the clock event
+ * device is armed when @timer is the first timer.
+ */
+static ktime_t hrtimer_coalesce_expires(const struct hrtimer *timer)
+{
+	s64 soft = hrtimer_get_softexpires_tv64(timer);
+	s64 hard = hrtimer_get_expires_tv64(timer);
+	ktime_t expires;
+	u64 grain;
+
+	if (hrtimer_coalesce_mode == HRTIMER_COALESCE_OFF ||
+	    soft < 0 || hard <= soft)
+		return hrtimer_get_expires(timer);
+
+	grain = rounddown_pow_of_two(hard - soft);
+	expires.tv64 = hard & ~(s64)(grain - 1);
+	return expires;
+}
+
+/*
+ * Called for every expired timer. A timer which is expired before its
+ * hard expiry in an interrupt armed for another timer did not need a
+ * wakeup of its own.
+ */
+static inline void hrtimer_coalesce_account(struct hrtimer_cpu_base *cpu_base,
+					    struct hrtimer *timer,
+					    ktime_t basenow)
+{
+	if (timer != cpu_base->next_timer &&
+	    basenow.tv64 < hrtimer_get_expires_tv64(timer))
+		cpu_base->nr_coalesced++;
+}
+#else
+static inline ktime_t hrtimer_coalesce_expires(const struct hrtimer *timer)
+{
+	return hrtimer_get_expires(timer);
+}
+
+static inline void hrtimer_coalesce_account(struct hrtimer_cpu_base *cpu_base,
+					    struct hrtimer *timer,
+					    ktime_t basenow) { }
+#endif
+
 /*
  * Functions and macros which are different for UP/SMP systems are kept in a
  * single place
@@ -178,18 +260,74 @@ hrtimer_check_target(struct hrtimer *timer, struct hrtimer_clock_base *new_base)
 }
 
 #ifdef CONFIG_NO_HZ_COMMON
+#ifdef CONFIG_HRTIMER_COALESCE
+/*
+ * Find a CPU whose clock event device is armed inside the slack window
+ * of @timer, preferring @base's CPU. expires_next is read without the
+ * remote locks; a stale value only makes for a worse choice, because
+ * switch_hrtimer_base() rechecks the target under its lock.
+ */
+static struct hrtimer_cpu_base *
+hrtimer_coalesce_target(struct hrtimer_cpu_base *base, struct hrtimer *timer)
+{
+	ktime_t offset = timer->base->offset;
+	s64 soft = ktime_sub(hrtimer_get_softexpires(timer), offset).tv64;
+	s64 hard = ktime_sub(hrtimer_get_expires(timer), offset).tv64;
+	struct hrtimer_cpu_base *cpu_base;
+	s64 next;
+	int cpu;
+
+	if (hrtimer_coalesce_mode != HRTIMER_COALESCE_MIGRATE || hard <= soft)
+		return NULL;
+
+	next = base->expires_next.tv64;
+	if (next >= soft && next < hard)
+		return base;
+
+	for_each_online_cpu(cpu) {
+		if (!is_housekeeping_cpu(cpu))
+			continue;
+
+		cpu_base = &per_cpu(hrtimer_bases, cpu);
+		if (cpu_base == base || !cpu_base->hres_active)
+			continue;
+
+		next = READ_ONCE(cpu_base->expires_next.tv64);
+		if (next >= soft && next < hard) {
+			base->nr_coalesce_moves++;
+			return cpu_base;
+		}
+	}
+
+	return NULL;
+}
+#else
+static inline struct hrtimer_cpu_base *
+hrtimer_coalesce_target(struct hrtimer_cpu_base *base, struct hrtimer *timer)
+{
+	return NULL;
+}
+#endif
+
 static inline
 struct hrtimer_cpu_base *get_target_base(struct hrtimer_cpu_base *base,
-					 int pinned)
+					 struct hrtimer *timer, int pinned)
 {
+	struct hrtimer_cpu_base *target;
+
 	if (pinned || !base->migration_enabled)
 		return base;
+
+	target = hrtimer_coalesce_target(base, timer);
+	if (target)
+		return target;
+
 	return &per_cpu(hrtimer_bases, get_nohz_timer_target());
 }
 #else
 static inline
 struct hrtimer_cpu_base *get_target_base(struct hrtimer_cpu_base *base,
-					 int pinned)
+					 struct hrtimer *timer, int pinned)
 {
 	return base;
 }
@@ -216,7 +354,7 @@ switch_hrtimer_base(struct hrtimer *timer, struct hrtimer_clock_base *base,
 	int basenum = base->index;
 
 	this_cpu_base = this_cpu_ptr(&hrtimer_bases);
-	new_cpu_base = get_target_base(this_cpu_base, pinned);
+	new_cpu_base = get_target_base(this_cpu_base, timer, pinned);
 again:
 	new_base = &new_cpu_base->clock_base[basenum];
 
@@ -478,7 +616,7 @@ static ktime_t __hrtimer_get_next_event(struct hrtimer_cpu_base *cpu_base)
 
 		next = timerqueue_getnext(&base->active);
 		timer = container_of(next, struct hrtimer, node);
-		expires = ktime_sub(hrtimer_get_expires(timer), base->offset);
+		expires = ktime_sub(hrtimer_coalesce_expires(timer), base->offset);
 		if (expires.tv64 < expires_next.tv64) {
 			expires_next = expires;
 			hrtimer_update_next_timer(cpu_base, timer);
@@ -597,7 +735,7 @@ static void hrtimer_reprogram(struct hrtimer *timer,
 			      struct hrtimer_clock_base *base)
 {
 	struct hrtimer_cpu_base *cpu_base = this_cpu_ptr(&hrtimer_bases);
-	ktime_t expires = ktime_sub(hrtimer_get_expires(timer), base->offset);
+	ktime_t expires = ktime_sub(hrtimer_coalesce_expires(timer), base->offset);
 
 	WARN_ON_ONCE(hrtimer_get_expires_tv64(timer) < 0);
 
@@ -1294,6 +1432,7 @@ static void __hrtimer_run_queues(struct hrtimer_cpu_base *cpu_base, ktime_t now)
 			if (basenow.tv64 < hrtimer_get_softexpires_tv64(timer))
 				break;
 
+			hrtimer_coalesce_account(cpu_base, timer, basenow);
 			__run_hrtimer(cpu_base, base, timer, &basenow);
 		}
 	}
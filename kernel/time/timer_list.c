@@ -158,6 +158,10 @@ static void print_cpu(struct seq_file *m, int cpu, u64 now)
 	P(nr_retries);
 	P(nr_hangs);
 	P(max_hang_time);
+#ifdef CONFIG_HRTIMER_COALESCE
+	P(nr_coalesced);
+	P(nr_coalesce_moves);
+#endif
 #endif
 #undef P
 #undef P_ns
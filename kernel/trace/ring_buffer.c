@@ -22,6 +22,9 @@
 #include <linux/hash.h>
 #include <linux/list.h>
 #include <linux/cpu.h>
+#include <linux/mm.h>
+
+#include <uapi/linux/trace_mmap.h>
 
 #include <asm/local.h>
 
@@ -302,6 +305,7 @@ struct buffer_page {
 	unsigned	 read;		/* index for next read */
 	local_t		 entries;	/* entries on this page */
 	unsigned long	 real_end;	/* real end of data */
+	unsigned	 id;		/* ID for external mapping */
 	struct buffer_data_page *page;	/* Actual data page */
 };
 
@@ -470,6 +474,12 @@ struct ring_buffer_per_cpu {
 	struct completion		update_done;
 
 	struct rb_irq_work		irq_work;
+
+	/* user-space mapping of the pages, see ring_buffer_map() */
+	struct mutex			mapping_lock;
+	int				mapped;
+	unsigned long			*subbuf_ids;	/* ID to page address */
+	struct trace_buffer_meta	*meta_page;
 };
 
 struct ring_buffer {
@@ -1152,8 +1162,9 @@ static int __rb_allocate_pages(long nr_pages, struct list_head *pages, int cpu)
 
 		list_add(&bpage->list, pages);
 
+		/* zeroed, the page may be mapped to user space */
 		page = alloc_pages_node(cpu_to_node(cpu),
-					GFP_KERNEL, 0);
+					GFP_KERNEL | __GFP_ZERO, 0);
 		if (!page)
 			goto free_pages;
 		bpage->page = page_address(page);
@@ -1221,6 +1232,7 @@ rb_allocate_cpu_buffer(struct ring_buffer *buffer, long nr_pages, int cpu)
 	init_irq_work(&cpu_buffer->irq_work.work, rb_wake_up_waiters);
 	init_waitqueue_head(&cpu_buffer->irq_work.waiters);
 	init_waitqueue_head(&cpu_buffer->irq_work.full_waiters);
+	mutex_init(&cpu_buffer->mapping_lock);
 
 	bpage = kzalloc_node(ALIGN(sizeof(*bpage), cache_line_size()),
 			    GFP_KERNEL, cpu_to_node(cpu));
@@ -1230,7 +1242,7 @@ rb_allocate_cpu_buffer(struct ring_buffer *buffer, long nr_pages, int cpu)
 	rb_check_bpage(cpu_buffer, bpage);
 
 	cpu_buffer->reader_page = bpage;
-	page = alloc_pages_node(cpu_to_node(cpu), GFP_KERNEL, 0);
+	page = alloc_pages_node(cpu_to_node(cpu), GFP_KERNEL | __GFP_ZERO, 0);
 	if (!page)
 		goto fail_free_reader;
 	bpage->page = page_address(page);
@@ -1684,6 +1696,12 @@ int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size,
 	/* prevent another thread from changing buffer sizes */
 	mutex_lock(&buffer->mutex);
 
+	/* A mapping may have been set up while we were waiting */
+	if (atomic_read(&buffer->resize_disabled)) {
+		mutex_unlock(&buffer->mutex);
+		return -EBUSY;
+	}
+
 	if (cpu_id == RING_BUFFER_ALL_CPUS) {
 		/* calculate the pages to update */
 		for_each_buffer_cpu(buffer, cpu) {
@@ -4288,6 +4306,25 @@ unsigned long ring_buffer_size(struct ring_buffer *buffer, int cpu)
 }
 EXPORT_SYMBOL_GPL(ring_buffer_size);
 
+/*
+ * Refresh the meta page of a mapped cpu buffer, with the reader_lock held.
+ */
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+
+	if (!meta)
+		return;
+
+	meta->reader.id = cpu_buffer->reader_page->id;
+	meta->entries = local_read(&cpu_buffer->entries);
+	meta->overrun = local_read(&cpu_buffer->overrun);
+	meta->read = cpu_buffer->read;
+
+	/* Some archs do not have data cache coherency with user space */
+	flush_dcache_page(virt_to_page(meta));
+}
+
 static void
 rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 {
@@ -4327,6 +4364,11 @@ rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 	cpu_buffer->lost_events = 0;
 	cpu_buffer->last_overrun = 0;
 
+	if (cpu_buffer->meta_page) {
+		cpu_buffer->meta_page->reader.read = 0;
+		cpu_buffer->meta_page->reader.lost_events = 0;
+	}
+
 	rb_head_page_activate(cpu_buffer);
 }
 
@@ -4362,6 +4404,8 @@ void ring_buffer_reset_cpu(struct ring_buffer *buffer, int cpu)
 
 	arch_spin_unlock(&cpu_buffer->lock);
 
+	rb_update_meta_page(cpu_buffer);
+
  out:
 	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
 
@@ -4469,6 +4513,12 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	if (cpu_buffer_a->nr_pages != cpu_buffer_b->nr_pages)
 		goto out;
 
+	/* The pages of a mapped buffer must stay where they are */
+	ret = -EBUSY;
+	if (READ_ONCE(cpu_buffer_a->meta_page) ||
+	    READ_ONCE(cpu_buffer_b->meta_page))
+		goto out;
+
 	ret = -EAGAIN;
 
 	if (atomic_read(&buffer_a->record_disabled))
@@ -4593,6 +4643,7 @@ EXPORT_SYMBOL_GPL(ring_buffer_free_read_page);
  *
  * Returns:
  *  >=0 if data has been transferred, returns the offset of consumed data.
+ *  -EBUSY if the cpu buffer is mapped, see ring_buffer_map().
  *  <0 if no data has been transferred.
  */
 int ring_buffer_read_page(struct ring_buffer *buffer,
@@ -4630,6 +4681,12 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 
 	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
 
+	/* Swapping out pages would pull them from under the mapping */
+	if (cpu_buffer->meta_page) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
 	reader = rb_get_reader_page(cpu_buffer);
 	if (!reader)
 		goto out_unlock;
@@ -4767,6 +4824,341 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+/*
+ * Number the pages of a cpu buffer for user space: the reader page is
+ * ID 0 and the others follow in ring order. The set of pages can not
+ * change while the buffer is mapped, as resizing is disabled and
+ * ring_buffer_read_page() and ring_buffer_swap_cpu() refuse to run, so
+ * the IDs stay valid until it is unmapped.
+ */
+static void rb_setup_ids(struct ring_buffer_per_cpu *cpu_buffer,
+			 unsigned long *subbuf_ids)
+{
+	struct buffer_page *first, *bpage;
+	unsigned int id = 0;
+
+	bpage = cpu_buffer->reader_page;
+	subbuf_ids[id] = (unsigned long)bpage->page;
+	bpage->id = id++;
+
+	first = bpage = cpu_buffer->head_page;
+	do {
+		if (WARN_ON(id > cpu_buffer->nr_pages))
+			break;
+		subbuf_ids[id] = (unsigned long)bpage->page;
+		bpage->id = id++;
+		rb_inc_page(cpu_buffer, &bpage);
+	} while (bpage != first);
+
+	WARN_ON(id != cpu_buffer->nr_pages + 1);
+}
+
+static int rb_alloc_mapping(struct ring_buffer *buffer,
+			    struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta;
+	unsigned long *subbuf_ids;
+	unsigned long flags;
+
+	/* Stays disabled until unmapped, and wait for a resize in progress */
+	atomic_inc(&buffer->resize_disabled);
+	mutex_lock(&buffer->mutex);
+
+	subbuf_ids = kcalloc(cpu_buffer->nr_pages + 1, sizeof(*subbuf_ids),
+			     GFP_KERNEL);
+	meta = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!subbuf_ids || !meta) {
+		mutex_unlock(&buffer->mutex);
+		atomic_dec(&buffer->resize_disabled);
+		kfree(subbuf_ids);
+		free_page((unsigned long)meta);
+		return -ENOMEM;
+	}
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	rb_setup_ids(cpu_buffer, subbuf_ids);
+
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->subbuf_size = PAGE_SIZE;
+	meta->nr_subbufs = cpu_buffer->nr_pages + 1;
+	meta->reader.read = cpu_buffer->reader_page->read;
+
+	cpu_buffer->subbuf_ids = subbuf_ids;
+	cpu_buffer->meta_page = meta;
+	rb_update_meta_page(cpu_buffer);
+
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	mutex_unlock(&buffer->mutex);
+
+	return 0;
+}
+
+static void rb_free_mapping(struct ring_buffer *buffer,
+			    struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta;
+	unsigned long *subbuf_ids;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	meta = cpu_buffer->meta_page;
+	subbuf_ids = cpu_buffer->subbuf_ids;
+	cpu_buffer->meta_page = NULL;
+	cpu_buffer->subbuf_ids = NULL;
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	atomic_dec(&buffer->resize_disabled);
+
+	free_page((unsigned long)meta);
+	kfree(subbuf_ids);
+}
+
+static int rb_map_vma(struct ring_buffer_per_cpu *cpu_buffer,
+		      struct vm_area_struct *vma)
+{
+	unsigned long nr_subbufs = cpu_buffer->nr_pages + 1;
+	unsigned long nr_pages = vma_pages(vma);
+	unsigned long pgoff = vma->vm_pgoff;
+	unsigned long i;
+	struct page *page;
+	void *addr;
+	int err;
+
+	if (vma->vm_flags & (VM_WRITE | VM_EXEC))
+		return -EPERM;
+
+	/* The meta page comes first, followed by the sub-buffers */
+	if (!nr_pages || pgoff > nr_subbufs ||
+	    nr_pages > nr_subbufs + 1 - pgoff)
+		return -EINVAL;
+
+	vma->vm_flags &= ~(VM_MAYWRITE | VM_MAYEXEC);
+	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND | VM_DONTDUMP;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (pgoff + i)
+			addr = (void *)cpu_buffer->subbuf_ids[pgoff + i - 1];
+		else
+			addr = cpu_buffer->meta_page;
+		page = virt_to_page(addr);
+
+		err = vm_insert_page(vma, vma->vm_start + i * PAGE_SIZE, page);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * ring_buffer_map - map the pages of a cpu buffer to user space
+ * @buffer: The ring buffer
+ * @cpu: The cpu buffer to map
+ * @vma: The vma to map the pages into, or NULL
+ *
+ * The first mapping of a cpu buffer allocates a meta page describing
+ * it (struct trace_buffer_meta) and numbers its pages. @vma then gets
+ * the meta page followed by the pages in ID order, starting at its page
+ * offset. While mapped, the cpu buffer can not be resized or swapped,
+ * and it is consumed a page at a time with ring_buffer_map_get_reader().
+ *
+ * A NULL @vma only takes a reference on the mapping, for instance when
+ * a vma is split, or for kernel users of ring_buffer_map_meta_page().
+ *
+ * Every successful call must be paired with ring_buffer_unmap().
+ *
+ * Returns 0 on success, a negative error otherwise.
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu,
+		    struct vm_area_struct *vma)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&cpu_buffer->mapping_lock);
+
+	if (!cpu_buffer->mapped) {
+		err = rb_alloc_mapping(buffer, cpu_buffer);
+		if (err)
+			goto out;
+	}
+
+	if (vma) {
+		err = rb_map_vma(cpu_buffer, vma);
+		if (err) {
+			if (!cpu_buffer->mapped)
+				rb_free_mapping(buffer, cpu_buffer);
+			goto out;
+		}
+	}
+
+	cpu_buffer->mapped++;
+ out:
+	mutex_unlock(&cpu_buffer->mapping_lock);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_unmap - drop a mapping reference on a cpu buffer
+ * @buffer: The ring buffer
+ * @cpu: The cpu buffer
+ *
+ * The meta page is freed and the cpu buffer back to normal once the
+ * last reference taken by ring_buffer_map() is dropped.
+ *
+ * Returns 0 on success, -ENODEV if the cpu buffer is not mapped.
+ */
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	int err = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&cpu_buffer->mapping_lock);
+
+	if (!cpu_buffer->mapped)
+		err = -ENODEV;
+	else if (!--cpu_buffer->mapped)
+		rb_free_mapping(buffer, cpu_buffer);
+
+	mutex_unlock(&cpu_buffer->mapping_lock);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_map_get_reader - hand the reader page to a mapped reader
+ * @buffer: The ring buffer
+ * @cpu: The mapped cpu buffer
+ *
+ * Once the reader page has been fully read, swap in the next page from
+ * the ring. Everything that is on the reader page is then accounted as
+ * read, as the mapped reader is expected to consume it in place. The
+ * meta page tells which page that is, where its unread events start and
+ * how many events were lost before it.
+ *
+ * If the writer is still on the reader page, more events may show up
+ * after the ones accounted here; a later call returns the same page
+ * with the offset moved past the events already handed out.
+ *
+ * Returns 0 on success, -ENODEV if the cpu buffer is not mapped.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	struct buffer_page *reader;
+	unsigned long missed_events;
+	unsigned long flags;
+	unsigned int read, size;
+	int ret = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	raw_spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	meta = cpu_buffer->meta_page;
+	if (!meta) {
+		ret = -ENODEV;
+		goto out_unlock;
+	}
+
+	reader = rb_get_reader_page(cpu_buffer);
+	if (!reader) {
+		/* Nothing new, everything on the page was handed out */
+		meta->reader.read = cpu_buffer->reader_page->read;
+		meta->reader.lost_events = 0;
+		goto out;
+	}
+
+	missed_events = cpu_buffer->lost_events;
+	cpu_buffer->lost_events = 0;
+
+	read = reader->read;
+	size = rb_page_size(reader);
+
+	if (!read && reader != cpu_buffer->commit_page) {
+		/* A full page the writer is done with, as read_page() does */
+		cpu_buffer->read += rb_page_entries(reader);
+		cpu_buffer->read_bytes += BUF_PAGE_SIZE;
+		reader->read = size;
+	} else {
+		while (reader->read < size)
+			rb_advance_reader(cpu_buffer);
+	}
+
+	meta->reader.read = read;
+	meta->reader.lost_events = missed_events;
+ out:
+	rb_update_meta_page(cpu_buffer);
+	flush_dcache_page(virt_to_page(cpu_buffer->reader_page->page));
+ out_unlock:
+	raw_spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
+/**
+ * ring_buffer_map_meta_page - the meta page of a mapped cpu buffer
+ * @buffer: The ring buffer
+ * @cpu: The cpu buffer
+ *
+ * For kernel users that consume a cpu buffer the way a user space
+ * mapping does. The caller must hold a ring_buffer_map() reference.
+ */
+struct trace_buffer_meta *
+ring_buffer_map_meta_page(struct ring_buffer *buffer, int cpu)
+{
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return NULL;
+
+	return buffer->buffers[cpu]->meta_page;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_meta_page);
+
+/**
+ * ring_buffer_map_subbuf - address of a page of a mapped cpu buffer
+ * @buffer: The ring buffer
+ * @cpu: The cpu buffer
+ * @id: The page ID, as found in the meta page
+ *
+ * The caller must hold a ring_buffer_map() reference.
+ */
+void *ring_buffer_map_subbuf(struct ring_buffer *buffer, int cpu,
+			     unsigned int id)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return NULL;
+
+	cpu_buffer = buffer->buffers[cpu];
+	if (!cpu_buffer->subbuf_ids || id > cpu_buffer->nr_pages)
+		return NULL;
+
+	return (void *)cpu_buffer->subbuf_ids[id];
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_subbuf);
+
 #ifdef CONFIG_HOTPLUG_CPU
 static int rb_cpu_notify(struct notifier_block *self,
 			 unsigned long action, void *hcpu)
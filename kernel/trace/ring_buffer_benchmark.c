@@ -8,6 +8,8 @@
 #include <linux/kthread.h>
 #include <linux/module.h>
 #include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <uapi/linux/trace_mmap.h>
 #include <asm/local.h>
 
 struct rb_page {
@@ -58,7 +60,28 @@ MODULE_PARM_DESC(producer_fifo, "fifo prio for producer");
 module_param(consumer_fifo, int, 0644);
 MODULE_PARM_DESC(consumer_fifo, "fifo prio for consumer");
 
-static int read_events;
+enum read_mode {
+	READ_EVENTS,
+	READ_PAGES,
+	READ_MAPPED,
+	NR_READ_MODES,
+};
+
+static const char * const read_mode_names[NR_READ_MODES] = {
+	[READ_EVENTS]	= "events",
+	[READ_PAGES]	= "pages",
+	[READ_MAPPED]	= "mapped pages",
+};
+
+static int read_mode = NR_READ_MODES - 1;
+
+/* Where a mapped reader is in the page it was last handed */
+struct mapped_reader {
+	unsigned int	id;
+	unsigned long	pos;
+};
+
+static DEFINE_PER_CPU(struct mapped_reader, mapped_reader);
 
 static int test_error;
 
@@ -100,76 +123,84 @@ static enum event_status read_event(int cpu)
 	return EVENT_FOUND;
 }
 
-static enum event_status read_page(int cpu)
+/* Check and count the events of a page from offset @start to @commit */
+static void read_page_events(int cpu, struct rb_page *rpage,
+			     unsigned long start, unsigned long commit)
 {
 	struct ring_buffer_event *event;
-	struct rb_page *rpage;
-	unsigned long commit;
-	void *bpage;
 	int *entry;
-	int ret;
 	int inc;
 	int i;
 
-	bpage = ring_buffer_alloc_read_page(buffer, cpu);
-	if (!bpage)
-		return EVENT_DROPPED;
+	for (i = start; i < commit && !test_error ; i += inc) {
 
-	ret = ring_buffer_read_page(buffer, &bpage, PAGE_SIZE, cpu, 1);
-	if (ret >= 0) {
-		rpage = bpage;
-		/* The commit may have missed event flags set, clear them */
-		commit = local_read(&rpage->commit) & 0xfffff;
-		for (i = 0; i < commit && !test_error ; i += inc) {
+		if (i >= (PAGE_SIZE - offsetof(struct rb_page, data))) {
+			TEST_ERROR();
+			break;
+		}
 
-			if (i >= (PAGE_SIZE - offsetof(struct rb_page, data))) {
+		inc = -1;
+		event = (void *)&rpage->data[i];
+		switch (event->type_len) {
+		case RINGBUF_TYPE_PADDING:
+			/* failed writes may be discarded events */
+			if (!event->time_delta)
+				TEST_ERROR();
+			inc = event->array[0] + 4;
+			break;
+		case RINGBUF_TYPE_TIME_EXTEND:
+			inc = 8;
+			break;
+		case 0:
+			entry = ring_buffer_event_data(event);
+			if (*entry != cpu) {
 				TEST_ERROR();
 				break;
 			}
-
-			inc = -1;
-			event = (void *)&rpage->data[i];
-			switch (event->type_len) {
-			case RINGBUF_TYPE_PADDING:
-				/* failed writes may be discarded events */
-				if (!event->time_delta)
-					TEST_ERROR();
-				inc = event->array[0] + 4;
-				break;
-			case RINGBUF_TYPE_TIME_EXTEND:
-				inc = 8;
-				break;
-			case 0:
-				entry = ring_buffer_event_data(event);
-				if (*entry != cpu) {
-					TEST_ERROR();
-					break;
-				}
-				read++;
-				if (!event->array[0]) {
-					TEST_ERROR();
-					break;
-				}
-				inc = event->array[0] + 4;
+			read++;
+			if (!event->array[0]) {
+				TEST_ERROR();
 				break;
-			default:
-				entry = ring_buffer_event_data(event);
-				if (*entry != cpu) {
-					TEST_ERROR();
-					break;
-				}
-				read++;
-				inc = ((event->type_len + 1) * 4);
 			}
-			if (test_error)
-				break;
-
-			if (inc <= 0) {
+			inc = event->array[0] + 4;
+			break;
+		default:
+			entry = ring_buffer_event_data(event);
+			if (*entry != cpu) {
 				TEST_ERROR();
 				break;
 			}
+			read++;
+			inc = ((event->type_len + 1) * 4);
+		}
+		if (test_error)
+			break;
+
+		if (inc <= 0) {
+			TEST_ERROR();
+			break;
 		}
 	}
+}
+
+static enum event_status read_page(int cpu)
+{
+	struct rb_page *rpage;
+	unsigned long commit;
+	void *bpage;
+	int ret;
+
+	bpage = ring_buffer_alloc_read_page(buffer, cpu);
+	if (!bpage)
+		return EVENT_DROPPED;
+
+	ret = ring_buffer_read_page(buffer, &bpage, PAGE_SIZE, cpu, 1);
+	if (ret >= 0) {
+		rpage = bpage;
+		/* The commit may have missed event flags set, clear them */
+		commit = local_read(&rpage->commit) & 0xfffff;
+		read_page_events(cpu, rpage, 0, commit);
+	}
 	ring_buffer_free_read_page(buffer, bpage);
 
 	if (ret < 0)
@@ -177,10 +208,92 @@ static enum event_status read_page(int cpu)
 	return EVENT_FOUND;
 }
 
+/*
+ * Consume the buffer in place, the way a user space reader of the
+ * mmapped trace_pipe_raw does: ask for the reader page and walk the
+ * events the meta page points at, without copying the page.
+ */
+static enum event_status read_mapped(int cpu)
+{
+	struct mapped_reader *mr = per_cpu_ptr(&mapped_reader, cpu);
+	struct trace_buffer_meta *meta;
+	struct rb_page *rpage;
+	unsigned long start, commit;
+
+	meta = ring_buffer_map_meta_page(buffer, cpu);
+	if (!meta || ring_buffer_map_get_reader(buffer, cpu))
+		return EVENT_DROPPED;
+
+	rpage = ring_buffer_map_subbuf(buffer, cpu, meta->reader.id);
+	if (!rpage) {
+		TEST_ERROR();
+		return EVENT_DROPPED;
+	}
+
+	/*
+	 * The same page comes back while the writer is still on it. Events
+	 * that were committed after we last asked for it were already read.
+	 */
+	start = meta->reader.read;
+	if (meta->reader.id == mr->id && mr->pos > start)
+		start = mr->pos;
+
+	commit = local_read(&rpage->commit);
+	mr->id = meta->reader.id;
+	mr->pos = commit;
+
+	if (start >= commit)
+		return EVENT_DROPPED;
+
+	read_page_events(cpu, rpage, start, commit);
+	return EVENT_FOUND;
+}
+
+static void unmap_buffers(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		ring_buffer_unmap(buffer, cpu);
+}
+
+static int map_buffers(void)
+{
+	struct mapped_reader *mr;
+	int failed;
+	int cpu;
+	int ret;
+
+	for_each_online_cpu(cpu) {
+		ret = ring_buffer_map(buffer, cpu, NULL);
+		if (ret) {
+			failed = cpu;
+			goto out_unmap;
+		}
+		mr = per_cpu_ptr(&mapped_reader, cpu);
+		mr->id = UINT_MAX;
+		mr->pos = 0;
+	}
+
+	return 0;
+
+ out_unmap:
+	for_each_online_cpu(cpu) {
+		if (cpu == failed)
+			break;
+		ring_buffer_unmap(buffer, cpu);
+	}
+	return ret;
+}
+
 static void ring_buffer_consumer(void)
 {
-	/* toggle between reading pages and events */
-	read_events ^= 1;
+	/* cycle between reading events, pages and mapped pages */
+	read_mode = (read_mode + 1) % NR_READ_MODES;
+
+	/* fall back to reading pages if the buffer can not be mapped */
+	if (read_mode == READ_MAPPED && map_buffers())
+		read_mode = READ_PAGES;
 
 	read = 0;
 	/*
@@ -197,10 +310,16 @@ static void ring_buffer_consumer(void)
 			for_each_online_cpu(cpu) {
 				enum event_status stat;
 
-				if (read_events)
+				switch (read_mode) {
+				case READ_EVENTS:
 					stat = read_event(cpu);
-				else
+					break;
+				case READ_PAGES:
 					stat = read_page(cpu);
+					break;
+				default:
+					stat = read_mapped(cpu);
+				}
 
 				if (test_error)
 					break;
@@ -221,6 +340,8 @@ static void ring_buffer_consumer(void)
 		schedule();
 	}
 	__set_current_state(TASK_RUNNING);
+	if (read_mode == READ_MAPPED)
+		unmap_buffers();
 	reader_finish = 0;
 	complete(&read_done);
 }
@@ -326,7 +447,7 @@ static void ring_buffer_producer(void)
 		trace_printk("Read:     (reader disabled)\n");
 	else
 		trace_printk("Read:     %ld  (by %s)\n", read,
-			read_events ? "events" : "pages");
+			read_mode_names[read_mode]);
 	trace_printk("Entries:  %lld\n", entries);
 	trace_printk("Total:    %lld\n", entries + overruns + read);
 	trace_printk("Missed:   %ld\n", missed);
@@ -341,6 +462,9 @@ static void ring_buffer_producer(void)
 
 	trace_printk("Entries per millisec: %ld\n", hit);
 
+	if (!disable_reader && time)
+		trace_printk("Read per millisec:    %ld\n", read / (long)time);
+
 	if (hit) {
 		/* Calculate the average time in nanosecs */
 		avg = NSEC_PER_MSEC / hit;
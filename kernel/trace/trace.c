@@ -42,6 +42,7 @@
 #include <linux/fs.h>
 #include <linux/sched/rt.h>
 #include <linux/coresight-stm.h>
+#include <uapi/linux/trace_mmap.h>
 
 #include "trace.h"
 #include "trace_output.h"
@@ -917,17 +918,44 @@ static int resize_buffer_duplicate_size(struct trace_buffer *trace_buf,
 					struct trace_buffer *size_buf, int cpu_id);
 static void set_buffer_entries(struct trace_buffer *buf, unsigned long val);
 
+static int tracing_arm_snapshot(struct trace_array *tr)
+{
+	int ret = 0;
+
+	spin_lock(&tr->snapshot_trigger_lock);
+	if (tr->mapped)
+		ret = -EBUSY;
+	else
+		tr->snapshot_armed = true;
+	spin_unlock(&tr->snapshot_trigger_lock);
+
+	return ret;
+}
+
+static void tracing_disarm_snapshot(struct trace_array *tr)
+{
+	spin_lock(&tr->snapshot_trigger_lock);
+	tr->snapshot_armed = false;
+	spin_unlock(&tr->snapshot_trigger_lock);
+}
+
 static int alloc_snapshot(struct trace_array *tr)
 {
 	int ret;
 
 	if (!tr->allocated_snapshot) {
+		/* Mapped cpu buffers can not be swapped */
+		ret = tracing_arm_snapshot(tr);
+		if (ret < 0)
+			return ret;
 
 		/* allocate spare buffer */
 		ret = resize_buffer_duplicate_size(&tr->max_buffer,
 				   &tr->trace_buffer, RING_BUFFER_ALL_CPUS);
-		if (ret < 0)
+		if (ret < 0) {
+			tracing_disarm_snapshot(tr);
 			return ret;
+		}
 
 		tr->allocated_snapshot = true;
 	}
@@ -946,6 +974,7 @@ static void free_snapshot(struct trace_array *tr)
 	set_buffer_entries(&tr->max_buffer, 1);
 	tracing_reset_online_cpus(&tr->max_buffer);
 	tr->allocated_snapshot = false;
+	tracing_disarm_snapshot(tr);
 }
 
 /**
@@ -4291,7 +4320,7 @@ static const char readme_msg[] =
 	"\t    Format: hist:keys=<field1[,field2,...]>\n"
 	"\t            [:values=<field1[,field2,...]>]\n"
 	"\t            [:sort=<field1[,field2,...]>]\n"
-	"\t            [:size=#entries]\n"
+	"\t            [:size=#entries][:percpu]\n"
 	"\t            [:pause][:continue][:clear]\n"
 	"\t            [:name=histname1]\n"
 	"\t            [if <filter>]\n\n"
@@ -4307,6 +4336,10 @@ static const char readme_msg[] =
 	"\t    be modified by appending '.descending' or '.ascending' to a\n"
 	"\t    sort field.  The 'size' parameter can be used to specify more\n"
 	"\t    or fewer than the default 2048 entries for the hashtable size.\n"
+	"\t    With 'percpu', each cpu aggregates into a hashtable of that\n"
+	"\t    size of its own, which are merged when the hist is read.  This\n"
+	"\t    avoids sharing entries between cpus on frequent events, at\n"
+	"\t    the cost of memory.  Drops are then also reported per cpu.\n"
 	"\t    If a hist trigger is given a name using the 'name' parameter,\n"
 	"\t    its histogram data will be shared with other triggers of the\n"
 	"\t    same name, and trigger hits will update this common data.\n\n"
@@ -6260,6 +6293,10 @@ tracing_buffers_read(struct file *filp, char __user *ubuf,
 	trace_access_unlock(iter->cpu_file);
 
 	if (ret < 0) {
+		/* the buffer is mapped, consume it through the mapping */
+		if (ret == -EBUSY)
+			return ret;
+
 		if (trace_empty(iter)) {
 			if ((filp->f_flags & O_NONBLOCK))
 				return -EAGAIN;
@@ -6434,6 +6471,8 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 		if (r < 0) {
 			ring_buffer_free_read_page(ref->buffer, ref->page);
 			kfree(ref);
+			if (r == -EBUSY)
+				ret = r;
 			break;
 		}
 
@@ -6475,12 +6514,120 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 	return ret;
 }
 
+/*
+ * Hand the next page to a reader of the mapped buffer, waiting for one
+ * unless the file is non-blocking. The meta page tells which page it is.
+ */
+static long tracing_buffers_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = file->private_data;
+	struct trace_iterator *iter = &info->iter;
+	int ret;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	if (!(file->f_flags & O_NONBLOCK)) {
+		ret = wait_on_pipe(iter, false);
+		if (ret)
+			return ret;
+	}
+
+	trace_access_lock(iter->cpu_file);
+	ret = ring_buffer_map_get_reader(iter->trace_buffer->buffer,
+					 iter->cpu_file);
+	trace_access_unlock(iter->cpu_file);
+
+	return ret;
+}
+
+#ifdef CONFIG_TRACER_MAX_TRACE
+/* A mapped buffer can not be swapped with the snapshot one */
+static int get_snapshot_map(struct trace_array *tr)
+{
+	int ret = 0;
+
+	spin_lock(&tr->snapshot_trigger_lock);
+	if (tr->snapshot_armed || tr->mapped == UINT_MAX)
+		ret = -EBUSY;
+	else
+		tr->mapped++;
+	spin_unlock(&tr->snapshot_trigger_lock);
+
+	return ret;
+}
+
+static void put_snapshot_map(struct trace_array *tr)
+{
+	spin_lock(&tr->snapshot_trigger_lock);
+	if (!WARN_ON(!tr->mapped))
+		tr->mapped--;
+	spin_unlock(&tr->snapshot_trigger_lock);
+}
+#else
+static inline int get_snapshot_map(struct trace_array *tr) { return 0; }
+static inline void put_snapshot_map(struct trace_array *tr) { }
+#endif
+
+/* The vma holds a reference on the file, and so on the buffer info */
+static void tracing_buffers_mmap_open(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+	struct trace_iterator *iter = &info->iter;
+
+	/* The existing mapping keeps the snapshot disarmed */
+	WARN_ON(get_snapshot_map(iter->tr));
+	WARN_ON(ring_buffer_map(iter->trace_buffer->buffer, iter->cpu_file,
+				NULL));
+}
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+	struct trace_iterator *iter = &info->iter;
+
+	WARN_ON(ring_buffer_unmap(iter->trace_buffer->buffer, iter->cpu_file));
+	put_snapshot_map(iter->tr);
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.open		= tracing_buffers_mmap_open,
+	.close		= tracing_buffers_mmap_close,
+};
+
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	struct trace_iterator *iter = &info->iter;
+	int ret;
+
+	if (iter->cpu_file == RING_BUFFER_ALL_CPUS)
+		return -EINVAL;
+
+	ret = get_snapshot_map(iter->tr);
+	if (ret)
+		return ret;
+
+	ret = ring_buffer_map(iter->trace_buffer->buffer, iter->cpu_file, vma);
+	if (ret) {
+		put_snapshot_map(iter->tr);
+		return ret;
+	}
+
+	vma->vm_ops = &tracing_buffers_vmops;
+
+	return 0;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.poll		= tracing_buffers_poll,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
+	.mmap		= tracing_buffers_mmap,
 	.llseek		= no_llseek,
 };
 
@@ -7192,6 +7339,7 @@ static int allocate_trace_buffers(struct trace_array *tr, int size)
 		return -ENOMEM;
 	}
 	tr->allocated_snapshot = allocate_snapshot;
+	tr->snapshot_armed = allocate_snapshot;
 
 	/*
 	 * Only the top level trace array gets its snapshot allocated
@@ -7294,6 +7442,9 @@ static int instance_mkdir(const char *name)
 	raw_spin_lock_init(&tr->start_lock);
 
 	tr->max_lock = (arch_spinlock_t)__ARCH_SPIN_LOCK_UNLOCKED;
+#ifdef CONFIG_TRACER_MAX_TRACE
+	spin_lock_init(&tr->snapshot_trigger_lock);
+#endif
 
 	tr->current_trace = &nop_trace;
 
@@ -7912,6 +8063,9 @@ __init static int tracer_alloc_buffers(void)
 	global_trace.current_trace = &nop_trace;
 
 	global_trace.max_lock = (arch_spinlock_t)__ARCH_SPIN_LOCK_UNLOCKED;
+#ifdef CONFIG_TRACER_MAX_TRACE
+	spin_lock_init(&global_trace.snapshot_trigger_lock);
+#endif
 
 	ftrace_init_global_array_ops(&global_trace);
 
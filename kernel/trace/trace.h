@@ -214,6 +214,15 @@ struct trace_array {
 	 */
 	struct trace_buffer	max_buffer;
 	bool			allocated_snapshot;
+	/*
+	 * Swapping in the snapshot buffer would pull the buffer out from
+	 * under an mmapped cpu buffer: snapshot_armed is set while the
+	 * snapshot buffer is allocated, mapped counts the mappings, and
+	 * only one of them may be non-zero [snapshot_trigger_lock].
+	 */
+	spinlock_t		snapshot_trigger_lock;
+	bool			snapshot_armed;
+	unsigned int		mapped;
 #endif
 #if defined(CONFIG_TRACER_MAX_TRACE) || defined(CONFIG_HWLAT_TRACER)
 	unsigned long		max_latency;
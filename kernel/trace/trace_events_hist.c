@@ -129,6 +129,7 @@ struct hist_trigger_attrs {
 	bool		pause;
 	bool		cont;
 	bool		clear;
+	bool		percpu;
 	unsigned int	map_bits;
 };
 
@@ -246,6 +247,8 @@ static struct hist_trigger_attrs *parse_hist_trigger_attrs(char *trigger_str)
 			attrs->cont = true;
 		else if (strcmp(str, "clear") == 0)
 			attrs->clear = true;
+		else if (strcmp(str, "percpu") == 0)
+			attrs->percpu = true;
 		else if (strncmp(str, "size=", strlen("size=")) == 0) {
 			int map_bits = parse_map_size(str);
 
@@ -811,7 +814,7 @@ create_hist_data(unsigned int map_bits,
 		map_ops = &hist_trigger_elt_comm_ops;
 
 	hist_data->map = tracing_map_create(map_bits, hist_data->key_size,
-					    map_ops, hist_data);
+					    attrs->percpu, map_ops, hist_data);
 	if (IS_ERR(hist_data->map)) {
 		ret = PTR_ERR(hist_data->map);
 		hist_data->map = NULL;
@@ -1062,7 +1065,8 @@ static void hist_trigger_show(struct seq_file *m,
 			      struct event_trigger_data *data, int n)
 {
 	struct hist_trigger_data *hist_data;
-	int n_entries, ret = 0;
+	int cpu, n_entries, ret = 0;
+	u64 drops;
 
 	if (n > 0)
 		seq_puts(m, "\n\n");
@@ -1079,8 +1083,17 @@ static void hist_trigger_show(struct seq_file *m,
 	}
 
 	seq_printf(m, "\nTotals:\n    Hits: %llu\n    Entries: %u\n    Dropped: %llu\n",
-		   (u64)atomic64_read(&hist_data->map->hits),
-		   n_entries, (u64)atomic64_read(&hist_data->map->drops));
+		   tracing_map_read_hits(hist_data->map),
+		   n_entries, tracing_map_read_drops(hist_data->map));
+
+	if (!hist_data->map->percpu)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		drops = tracing_map_read_cpu_drops(hist_data->map, cpu);
+		if (drops)
+			seq_printf(m, "    Dropped on cpu%d: %llu\n", cpu, drops);
+	}
 }
 
 static int hist_show(struct seq_file *m, void *v)
@@ -1216,6 +1229,9 @@ static int event_hist_trigger_print(struct seq_file *m,
 
 	seq_printf(m, ":size=%u", (1 << hist_data->map->map_bits));
 
+	if (hist_data->map->percpu)
+		seq_puts(m, ":percpu");
+
 	if (data->filter_str)
 		seq_printf(m, " if %s", data->filter_str);
 
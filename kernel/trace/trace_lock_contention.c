@@ -0,0 +1,380 @@
+/*
+ * Lock contention profiler
+ *
+ * Records how long tasks wait in the mutex, rwsem, queued spinlock and
+ * rt_mutex slowpaths, aggregated per call site into per-cpu hash tables.
+ * The call site is the first few return addresses above the lock
+ * functions. Every site keeps a log2 histogram of its wait times in
+ * microseconds.
+ *
+ * Profiling is toggled with <tracefs>/lock_contention_profile_enabled;
+ * enabling it clears the previous samples. The sites, merged over all
+ * cpus and sorted by total wait time, are in
+ * <tracefs>/trace_stat/lock_contention.
+ *
+ * Recording is done with interrupts disabled on the local cpu's table
+ * only, so it takes no locks and is safe from any lock slowpath. A site
+ * that does not fit in its table is counted as dropped.
+ */
+
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/stacktrace.h>
+#include <linux/hardirq.h>
+#include <linux/tracefs.h>
+#include <linux/lock_contention.h>
+#include "trace_stat.h"
+#include "trace.h"
+
+#define LC_DEPTH		4	/* return addresses per call site */
+#define LC_STACK_ENTRIES	16	/* entries walked to find them */
+#define LC_HASH_BITS		8	/* sites per cpu */
+#define LC_SNAP_BITS		10	/* sites in a merged snapshot */
+#define LC_PROBES		8
+#define LC_HIST_BUCKETS		16	/* <1us, 1us, 2us, .., >=16ms */
+
+struct lc_site {
+	unsigned long	ips[LC_DEPTH];
+	unsigned int	type;
+	unsigned int	hist[LC_HIST_BUCKETS];
+	u64		count;
+	u64		total_ns;
+	u64		max_ns;
+};
+
+struct lc_cpu {
+	struct lc_site	*sites;
+	unsigned long	dropped;
+};
+
+DEFINE_STATIC_KEY_FALSE(lock_contention_key);
+
+static DEFINE_PER_CPU(struct lc_cpu, lc_cpu);
+static DEFINE_MUTEX(lc_lock);
+static bool lc_enabled;
+static struct lc_site *lc_snap;
+
+static const char * const lc_type_names[LOCK_CONTENTION_NR_TYPES] = {
+	[LOCK_CONTENTION_MUTEX]		= "mutex",
+	[LOCK_CONTENTION_RWSEM_READ]	= "rwsem_read",
+	[LOCK_CONTENTION_RWSEM_WRITE]	= "rwsem_write",
+	[LOCK_CONTENTION_SPIN]		= "spinlock",
+	[LOCK_CONTENTION_RTMUTEX]	= "rt_mutex",
+};
+
+/*
+ * Find the slot of a call site, claiming a free one if it is not there yet.
+ * A slot is in use once its count is non-zero; the count is only updated
+ * after the key, so readers on other cpus never see a half-written key.
+ */
+static struct lc_site *lc_lookup(struct lc_site *table, unsigned int bits,
+				 const unsigned long *ips, unsigned int type)
+{
+	unsigned int mask = (1U << bits) - 1;
+	struct lc_site *site;
+	u32 hash;
+	int i;
+
+	hash = jhash2((const u32 *)ips,
+		      LC_DEPTH * sizeof(unsigned long) / sizeof(u32), type);
+
+	for (i = 0; i < LC_PROBES; i++) {
+		site = &table[(hash + i) & mask];
+		if (!site->count) {
+			memcpy(site->ips, ips, sizeof(site->ips));
+			site->type = type;
+			return site;
+		}
+		if (site->type == type &&
+		    !memcmp(site->ips, ips, sizeof(site->ips)))
+			return site;
+	}
+
+	return NULL;
+}
+
+/*
+ * The walk starts inside the profiler. Skip up to the frame of the lock
+ * slowpath, which called us, and then past the lock functions themselves
+ * (__lockfunc and __sched text) to the code that asked for the lock.
+ */
+static void lc_call_site(unsigned long *entries, unsigned int nr,
+			 unsigned long slowpath, unsigned long *ips)
+{
+	unsigned int i, start = 0, n = 0;
+
+	for (i = 0; i < nr; i++) {
+		if (entries[i] == slowpath) {
+			start = i + 1;
+			break;
+		}
+	}
+
+	i = start;
+	while (i < nr && in_sched_functions(entries[i]))
+		i++;
+
+	while (i < nr && n < LC_DEPTH && entries[i] != ULONG_MAX)
+		ips[n++] = entries[i++];
+}
+
+static unsigned int lc_bucket(u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+
+	if (!us)
+		return 0;
+	return min_t(unsigned int, ilog2(us) + 1, LC_HIST_BUCKETS - 1);
+}
+
+void __lock_contention_record(int type, u64 start)
+{
+	unsigned long entries[LC_STACK_ENTRIES];
+	unsigned long ips[LC_DEPTH] = { 0 };
+	struct stack_trace trace = {
+		.max_entries	= LC_STACK_ENTRIES,
+		.entries	= entries,
+	};
+	unsigned long flags;
+	struct lc_site *site;
+	struct lc_cpu *lc;
+	s64 delta;
+
+	delta = local_clock() - start;
+	if (delta < 0)
+		delta = 0;
+
+	if (in_nmi())
+		return;
+
+	save_stack_trace(&trace);
+	lc_call_site(entries, trace.nr_entries, _RET_IP_, ips);
+
+	local_irq_save(flags);
+	/* checked with irqs off so that a reset can wait us out */
+	if (!static_branch_likely(&lock_contention_key))
+		goto out;
+
+	lc = this_cpu_ptr(&lc_cpu);
+	site = lc->sites ? lc_lookup(lc->sites, LC_HASH_BITS, ips, type) : NULL;
+	if (!site) {
+		lc->dropped++;
+		goto out;
+	}
+
+	site->hist[lc_bucket(delta)]++;
+	site->total_ns += delta;
+	if (delta > site->max_ns)
+		site->max_ns = delta;
+	smp_wmb();
+	WRITE_ONCE(site->count, site->count + 1);
+out:
+	local_irq_restore(flags);
+}
+
+static void *lc_stat_next(void *prev, int idx)
+{
+	struct lc_site *site = prev;
+
+	for (site++; site < lc_snap + (1 << LC_SNAP_BITS); site++) {
+		if (site->count)
+			return site;
+	}
+
+	return NULL;
+}
+
+/*
+ * Merge the per-cpu tables into a snapshot. The stat session holds its
+ * mutex across the whole read, and drops its references to the previous
+ * snapshot before calling us, so it can be freed here.
+ */
+static void *lc_stat_start(struct tracer_stat *trace)
+{
+	struct lc_site *src, *dst;
+	u64 count;
+	int cpu, i, b;
+
+	mutex_lock(&lc_lock);
+	vfree(lc_snap);
+	lc_snap = vzalloc(sizeof(*lc_snap) << LC_SNAP_BITS);
+	if (!lc_snap)
+		goto out;
+
+	for_each_possible_cpu(cpu) {
+		src = per_cpu(lc_cpu, cpu).sites;
+		if (!src)
+			continue;
+
+		for (i = 0; i < (1 << LC_HASH_BITS); i++, src++) {
+			count = READ_ONCE(src->count);
+			if (!count)
+				continue;
+			smp_rmb();
+
+			dst = lc_lookup(lc_snap, LC_SNAP_BITS, src->ips,
+					src->type);
+			if (!dst)
+				continue;
+
+			for (b = 0; b < LC_HIST_BUCKETS; b++)
+				dst->hist[b] += src->hist[b];
+			dst->total_ns += src->total_ns;
+			dst->max_ns = max(dst->max_ns, src->max_ns);
+			dst->count += count;
+		}
+	}
+out:
+	mutex_unlock(&lc_lock);
+
+	if (!lc_snap)
+		return NULL;
+	if (lc_snap->count)
+		return lc_snap;
+	return lc_stat_next(lc_snap, 0);
+}
+
+static int lc_stat_cmp(void *p1, void *p2)
+{
+	struct lc_site *a = p1, *b = p2;
+
+	if (a->total_ns > b->total_ns)
+		return 1;
+	if (a->total_ns < b->total_ns)
+		return -1;
+	return 0;
+}
+
+static int lc_stat_show(struct seq_file *s, void *p)
+{
+	struct lc_site *site = p;
+	u64 total_us = div_u64(site->total_ns, NSEC_PER_USEC);
+	int i;
+
+	seq_printf(s, "%-11s %10llu %12llu %8llu %8llu  ",
+		   lc_type_names[site->type], site->count, total_us,
+		   div64_u64(total_us, site->count),
+		   div_u64(site->max_ns, NSEC_PER_USEC));
+	for (i = 0; i < LC_DEPTH && site->ips[i]; i++)
+		seq_printf(s, "%s%pS", i ? " <- " : "", (void *)site->ips[i]);
+	seq_puts(s, "\n            wait_us:");
+	for (i = 0; i < LC_HIST_BUCKETS; i++) {
+		if (!site->hist[i])
+			continue;
+		if (!i)
+			seq_printf(s, " <1:%u", site->hist[i]);
+		else
+			seq_printf(s, " %lu:%u", 1UL << (i - 1), site->hist[i]);
+	}
+	seq_putc(s, '\n');
+
+	return 0;
+}
+
+static int lc_stat_headers(struct seq_file *s)
+{
+	unsigned long dropped = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		dropped += per_cpu(lc_cpu, cpu).dropped;
+
+	seq_printf(s, "# dropped: %lu\n", dropped);
+	seq_puts(s, "TYPE             COUNT     TOTAL_US   AVG_US   MAX_US  CALL SITE\n");
+	seq_puts(s, "  |                  |            |        |        |  |\n");
+	return 0;
+}
+
+static struct tracer_stat lc_stats __read_mostly = {
+	.name = "lock_contention",
+	.stat_start = lc_stat_start,
+	.stat_next = lc_stat_next,
+	.stat_cmp = lc_stat_cmp,
+	.stat_show = lc_stat_show,
+	.stat_headers = lc_stat_headers,
+};
+
+static void lc_free_tables(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		vfree(per_cpu(lc_cpu, cpu).sites);
+		per_cpu(lc_cpu, cpu).sites = NULL;
+	}
+}
+
+/* Called with the profiler disabled and in-flight recorders drained. */
+static int lc_reset_tables(void)
+{
+	size_t size = sizeof(struct lc_site) << LC_HASH_BITS;
+	struct lc_cpu *lc;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		lc = per_cpu_ptr(&lc_cpu, cpu);
+		lc->dropped = 0;
+		if (lc->sites) {
+			memset(lc->sites, 0, size);
+			continue;
+		}
+
+		lc->sites = vzalloc_node(size, cpu_to_node(cpu));
+		if (!lc->sites) {
+			lc_free_tables();
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static int lc_enable_set(void *data, u64 val)
+{
+	int ret = 0;
+
+	if (val > 1)
+		return -EINVAL;
+
+	mutex_lock(&lc_lock);
+	if (val && !lc_enabled) {
+		ret = lc_reset_tables();
+		if (!ret)
+			static_branch_enable(&lock_contention_key);
+	} else if (!val && lc_enabled) {
+		static_branch_disable(&lock_contention_key);
+		synchronize_sched();
+	}
+	if (!ret)
+		lc_enabled = val;
+	mutex_unlock(&lc_lock);
+
+	return ret;
+}
+
+static int lc_enable_get(void *data, u64 *val)
+{
+	mutex_lock(&lc_lock);
+	*val = lc_enabled;
+	mutex_unlock(&lc_lock);
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(lc_enable_fops, lc_enable_get, lc_enable_set,
+			"%llu\n");
+
+static int __init trace_lock_contention_init(void)
+{
+	struct dentry *d_tracer = tracing_init_dentry();
+
+	if (IS_ERR(d_tracer))
+		return 0;
+
+	tracefs_create_file("lock_contention_profile_enabled", 0644, d_tracer,
+			    NULL, &lc_enable_fops);
+
+	return register_stat_tracer(&lc_stats);
+}
+late_initcall(trace_lock_contention_init);
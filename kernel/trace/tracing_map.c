@@ -67,6 +67,58 @@ u64 tracing_map_read_sum(struct tracing_map_elt *elt, unsigned int i)
 	return (u64)atomic64_read(&elt->fields[i].sum);
 }
 
+/**
+ * tracing_map_read_hits - Return the number of hits of a tracing_map
+ * @map: The tracing_map
+ *
+ * Return: The number of successful inserts and lookups, summed over
+ * all cpus for a per-cpu map.
+ */
+u64 tracing_map_read_hits(struct tracing_map *map)
+{
+	u64 hits = 0;
+	unsigned int i;
+
+	for (i = 0; i < map->n_tables; i++)
+		hits += atomic64_read(&map->tables[i]->hits);
+
+	return hits;
+}
+
+/**
+ * tracing_map_read_drops - Return the number of drops of a tracing_map
+ * @map: The tracing_map
+ *
+ * Return: The number of failed inserts, summed over all cpus for a
+ * per-cpu map.
+ */
+u64 tracing_map_read_drops(struct tracing_map *map)
+{
+	u64 drops = 0;
+	unsigned int i;
+
+	for (i = 0; i < map->n_tables; i++)
+		drops += atomic64_read(&map->tables[i]->drops);
+
+	return drops;
+}
+
+/**
+ * tracing_map_read_cpu_drops - Return the drops of one cpu of a tracing_map
+ * @map: The tracing_map
+ * @cpu: The cpu
+ *
+ * Return: The number of failed inserts on @cpu for a per-cpu map, or 0
+ * for a map that is not per-cpu.
+ */
+u64 tracing_map_read_cpu_drops(struct tracing_map *map, int cpu)
+{
+	if (!map->percpu || cpu >= map->n_tables)
+		return 0;
+
+	return atomic64_read(&map->tables[cpu]->drops);
+}
+
 int tracing_map_cmp_string(void *val_a, void *val_b)
 {
 	char *a = val_a;
@@ -350,14 +402,15 @@ static struct tracing_map_elt *tracing_map_elt_alloc(struct tracing_map *map)
 	return ERR_PTR(err);
 }
 
-static struct tracing_map_elt *get_free_elt(struct tracing_map *map)
+static struct tracing_map_elt *get_free_elt(struct tracing_map *map,
+					    struct tracing_map_table *table)
 {
 	struct tracing_map_elt *elt = NULL;
 	int idx;
 
-	idx = atomic_inc_return(&map->next_elt);
+	idx = atomic_inc_return(&table->next_elt);
 	if (idx < map->max_elts) {
-		elt = *(TRACING_MAP_ELT(map->elts, idx));
+		elt = *(TRACING_MAP_ELT(table->elts, idx));
 		if (map->ops && map->ops->elt_init)
 			map->ops->elt_init(elt);
 	}
@@ -365,36 +418,38 @@ static struct tracing_map_elt *get_free_elt(struct tracing_map *map)
 	return elt;
 }
 
-static void tracing_map_free_elts(struct tracing_map *map)
+static void tracing_map_free_elts(struct tracing_map *map,
+				  struct tracing_map_table *table)
 {
 	unsigned int i;
 
-	if (!map->elts)
+	if (!table->elts)
 		return;
 
 	for (i = 0; i < map->max_elts; i++) {
-		tracing_map_elt_free(*(TRACING_MAP_ELT(map->elts, i)));
-		*(TRACING_MAP_ELT(map->elts, i)) = NULL;
+		tracing_map_elt_free(*(TRACING_MAP_ELT(table->elts, i)));
+		*(TRACING_MAP_ELT(table->elts, i)) = NULL;
 	}
 
-	tracing_map_array_free(map->elts);
-	map->elts = NULL;
+	tracing_map_array_free(table->elts);
+	table->elts = NULL;
 }
 
-static int tracing_map_alloc_elts(struct tracing_map *map)
+static int tracing_map_alloc_elts(struct tracing_map *map,
+				  struct tracing_map_table *table)
 {
 	unsigned int i;
 
-	map->elts = tracing_map_array_alloc(map->max_elts,
-					    sizeof(struct tracing_map_elt *));
-	if (!map->elts)
+	table->elts = tracing_map_array_alloc(map->max_elts,
+					      sizeof(struct tracing_map_elt *));
+	if (!table->elts)
 		return -ENOMEM;
 
 	for (i = 0; i < map->max_elts; i++) {
-		*(TRACING_MAP_ELT(map->elts, i)) = tracing_map_elt_alloc(map);
-		if (IS_ERR(*(TRACING_MAP_ELT(map->elts, i)))) {
-			*(TRACING_MAP_ELT(map->elts, i)) = NULL;
-			tracing_map_free_elts(map);
+		*(TRACING_MAP_ELT(table->elts, i)) = tracing_map_elt_alloc(map);
+		if (IS_ERR(*(TRACING_MAP_ELT(table->elts, i)))) {
+			*(TRACING_MAP_ELT(table->elts, i)) = NULL;
+			tracing_map_free_elts(map, table);
 
 			return -ENOMEM;
 		}
@@ -403,6 +458,74 @@ static int tracing_map_alloc_elts(struct tracing_map *map)
 	return 0;
 }
 
+static void tracing_map_free_tables(struct tracing_map *map)
+{
+	struct tracing_map_table *table;
+	unsigned int i;
+
+	if (!map->tables)
+		return;
+
+	for (i = 0; i < map->n_tables; i++) {
+		table = map->tables[i];
+		if (!table)
+			continue;
+		tracing_map_free_elts(map, table);
+		tracing_map_array_free(table->map);
+		kfree(table);
+	}
+
+	kfree(map->tables);
+	map->tables = NULL;
+}
+
+static int tracing_map_alloc_tables(struct tracing_map *map)
+{
+	struct tracing_map_table *table;
+	unsigned int i;
+
+	map->tables = kcalloc(map->n_tables, sizeof(*map->tables), GFP_KERNEL);
+	if (!map->tables)
+		return -ENOMEM;
+
+	for (i = 0; i < map->n_tables; i++) {
+		int node = NUMA_NO_NODE;
+
+		if (map->percpu) {
+			if (!cpu_possible(i))
+				continue;
+			node = cpu_to_node(i);
+		}
+
+		table = kzalloc_node(sizeof(*table), GFP_KERNEL, node);
+		if (!table)
+			return -ENOMEM;
+		map->tables[i] = table;
+
+		atomic_set(&table->next_elt, -1);
+		table->map = tracing_map_array_alloc(map->map_size,
+					sizeof(struct tracing_map_entry));
+		if (!table->map)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * A per-cpu map inserts into the table of the current cpu.  Hist
+ * triggers run with preemption disabled, but even if we get migrated
+ * the insertion below stays correct, only no longer cpu-local.
+ */
+static inline struct tracing_map_table *
+tracing_map_this_table(struct tracing_map *map)
+{
+	if (map->percpu)
+		return map->tables[raw_smp_processor_id()];
+
+	return map->tables[0];
+}
+
 static inline bool keys_match(void *key, void *test_key, unsigned key_size)
 {
 	bool match = true;
@@ -416,6 +539,7 @@ static inline bool keys_match(void *key, void *test_key, unsigned key_size)
 static inline struct tracing_map_elt *
 __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 {
+	struct tracing_map_table *table = tracing_map_this_table(map);
 	u32 idx, key_hash, test_key;
 	struct tracing_map_entry *entry;
 
@@ -426,12 +550,12 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 
 	while (1) {
 		idx &= (map->map_size - 1);
-		entry = TRACING_MAP_ENTRY(map->map, idx);
+		entry = TRACING_MAP_ENTRY(table->map, idx);
 		test_key = entry->key;
 
 		if (test_key && test_key == key_hash && entry->val &&
 		    keys_match(key, entry->val->key, map->key_size)) {
-			atomic64_inc(&map->hits);
+			atomic64_inc(&table->hits);
 			return entry->val;
 		}
 
@@ -442,16 +566,16 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 			if (!cmpxchg(&entry->key, 0, key_hash)) {
 				struct tracing_map_elt *elt;
 
-				elt = get_free_elt(map);
+				elt = get_free_elt(map, table);
 				if (!elt) {
-					atomic64_inc(&map->drops);
+					atomic64_inc(&table->drops);
 					entry->key = 0;
 					break;
 				}
 
 				memcpy(elt->key, key, map->key_size);
 				entry->val = elt;
-				atomic64_inc(&map->hits);
+				atomic64_inc(&table->hits);
 
 				return entry->val;
 			}
@@ -494,6 +618,9 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
  * run out of entries.  Readers can at any point in time traverse the
  * tracing map and safely access the key/val pairs.
  *
+ * For a per-cpu map, all of the above applies to the table of the
+ * current cpu, and 'hits' and 'drops' are counted per cpu.
+ *
  * Return: the tracing_map_elt pointer val associated with the key.
  * If this was a newly inserted key, the val will be a newly allocated
  * and associated tracing_map_elt pointer val.  If the key wasn't
@@ -519,6 +646,8 @@ struct tracing_map_elt *tracing_map_insert(struct tracing_map *map, void *key)
  * is successfully retrieved, the 'hits' value is incrememented.  The
  * 'drops' value is never updated by this function.
  *
+ * For a per-cpu map only the table of the current cpu is searched.
+ *
  * Return: the tracing_map_elt pointer val associated with the key.
  * If the key wasn't found, NULL is returned.
  */
@@ -542,9 +671,7 @@ void tracing_map_destroy(struct tracing_map *map)
 	if (!map)
 		return;
 
-	tracing_map_free_elts(map);
-
-	tracing_map_array_free(map->map);
+	tracing_map_free_tables(map);
 	kfree(map);
 }
 
@@ -561,16 +688,23 @@ void tracing_map_destroy(struct tracing_map *map)
  */
 void tracing_map_clear(struct tracing_map *map)
 {
-	unsigned int i;
+	struct tracing_map_table *table;
+	unsigned int i, t;
 
-	atomic_set(&map->next_elt, -1);
-	atomic64_set(&map->hits, 0);
-	atomic64_set(&map->drops, 0);
+	for (t = 0; t < map->n_tables; t++) {
+		table = map->tables[t];
+		if (!table)
+			continue;
+
+		atomic_set(&table->next_elt, -1);
+		atomic64_set(&table->hits, 0);
+		atomic64_set(&table->drops, 0);
 
-	tracing_map_array_clear(map->map);
+		tracing_map_array_clear(table->map);
 
-	for (i = 0; i < map->max_elts; i++)
-		tracing_map_elt_clear(*(TRACING_MAP_ELT(map->elts, i)));
+		for (i = 0; i < map->max_elts; i++)
+			tracing_map_elt_clear(*TRACING_MAP_ELT(table->elts, i));
+	}
 }
 
 static void set_sort_key(struct tracing_map *map,
@@ -583,6 +717,7 @@ static void set_sort_key(struct tracing_map *map,
  * tracing_map_create - Create a lock-free map and element pool
  * @map_bits: The size of the map (2 ** map_bits)
  * @key_size: The size of the key for the map in bytes
+ * @percpu: Give each cpu its own table of 2 ** map_bits elements
  * @ops: Optional client-defined tracing_map_ops instance
  * @private_data: Client data associated with the map
  *
@@ -625,12 +760,18 @@ static void set_sort_key(struct tracing_map *map,
  * tracing_map_sort_entries().  Sorting can be done on any field,
  * including keys.
  *
+ * If @percpu is set, every possible cpu gets a table and element pool
+ * of its own and inserts only touch the local one, at the cost of
+ * multiplying the memory used by the number of cpus.  The per-cpu
+ * tables are merged by tracing_map_sort_entries().
+ *
  * See tracing_map.h for a description of tracing_map_ops.
  *
  * Return: the tracing_map pointer if successful, ERR_PTR if not.
  */
 struct tracing_map *tracing_map_create(unsigned int map_bits,
 				       unsigned int key_size,
+				       bool percpu,
 				       const struct tracing_map_ops *ops,
 				       void *private_data)
 {
@@ -647,16 +788,15 @@ struct tracing_map *tracing_map_create(unsigned int map_bits,
 
 	map->map_bits = map_bits;
 	map->max_elts = (1 << map_bits);
-	atomic_set(&map->next_elt, -1);
 
 	map->map_size = (1 << (map_bits + 1));
 	map->ops = ops;
 
 	map->private_data = private_data;
 
-	map->map = tracing_map_array_alloc(map->map_size,
-					   sizeof(struct tracing_map_entry));
-	if (!map->map)
+	map->percpu = percpu;
+	map->n_tables = percpu ? nr_cpu_ids : 1;
+	if (tracing_map_alloc_tables(map))
 		goto free;
 
 	map->key_size = key_size;
@@ -692,14 +832,19 @@ struct tracing_map *tracing_map_create(unsigned int map_bits,
  */
 int tracing_map_init(struct tracing_map *map)
 {
+	unsigned int i;
 	int err;
 
 	if (map->n_fields < 2)
 		return -EINVAL; /* need at least 1 key and 1 val */
 
-	err = tracing_map_alloc_elts(map);
-	if (err)
-		return err;
+	for (i = 0; i < map->n_tables; i++) {
+		if (!map->tables[i])
+			continue;
+		err = tracing_map_alloc_elts(map, map->tables[i]);
+		if (err)
+			return err;
+	}
 
 	tracing_map_clear(map);
 
@@ -855,7 +1000,7 @@ static int merge_dup(struct tracing_map_sort_entry **sort_entries,
 		     unsigned int target, unsigned int dup)
 {
 	struct tracing_map_elt *target_elt, *elt;
-	bool first_dup = (target - dup) == 1;
+	bool first_dup = (dup - target) == 1;
 	int i;
 
 	if (first_dup) {
@@ -1010,25 +1155,34 @@ int tracing_map_sort_entries(struct tracing_map *map,
 {
 	int (*cmp_entries_fn)(const void *, const void *);
 	struct tracing_map_sort_entry *sort_entry, **entries;
+	struct tracing_map_table *table;
+	unsigned int t;
 	int i, n_entries, ret;
 
-	entries = vmalloc(map->max_elts * sizeof(sort_entry));
+	entries = vmalloc(map->n_tables * map->max_elts * sizeof(sort_entry));
 	if (!entries)
 		return -ENOMEM;
 
-	for (i = 0, n_entries = 0; i < map->map_size; i++) {
-		struct tracing_map_entry *entry;
+	n_entries = 0;
+	for (t = 0; t < map->n_tables; t++) {
+		table = map->tables[t];
+		if (!table)
+			continue;
 
-		entry = TRACING_MAP_ENTRY(map->map, i);
+		for (i = 0; i < map->map_size; i++) {
+			struct tracing_map_entry *entry;
 
-		if (!entry->key || !entry->val)
-			continue;
+			entry = TRACING_MAP_ENTRY(table->map, i);
 
-		entries[n_entries] = create_sort_entry(entry->val->key,
-						       entry->val);
-		if (!entries[n_entries++]) {
-			ret = -ENOMEM;
-			goto free;
+			if (!entry->key || !entry->val)
+				continue;
+
+			entries[n_entries] = create_sort_entry(entry->val->key,
+							       entry->val);
+			if (!entries[n_entries++]) {
+				ret = -ENOMEM;
+				goto free;
+			}
 		}
 	}
 
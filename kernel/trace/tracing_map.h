@@ -123,6 +123,16 @@ typedef int (*tracing_map_cmp_fn_t) (void *val_a, void *val_b);
  * user, tracing_map_sort_entry objects contain a number of additional
  * fields which are used for caching and internal purposes and can
  * safely be ignored.
+ *
+ * A map can also be created per-cpu.  Each possible cpu then gets its
+ * own tracing_map_table, i.e. its own tracing_map_entry array, pool of
+ * max_elts tracing_map_elts and hits/drops counters, and
+ * tracing_map_insert() only ever touches the table of the cpu it runs
+ * on.  Events hitting the same key on different cpus therefore no
+ * longer bounce the entry and the sums between cpus.  The same key
+ * will usually exist in several tables; tracing_map_sort_entries()
+ * already merges duplicate keys, so readers see a single combined
+ * entry for it.
 */
 
 struct tracing_map_field {
@@ -176,14 +186,22 @@ struct tracing_map_array {
 #define TRACING_MAP_ELT(array, idx)					\
 	((struct tracing_map_elt **)TRACING_MAP_ARRAY_ELT(array, idx))
 
+struct tracing_map_table {
+	atomic_t			next_elt;
+	struct tracing_map_array	*elts;
+	struct tracing_map_array	*map;
+	atomic64_t			hits;
+	atomic64_t			drops;
+} ____cacheline_aligned_in_smp;
+
 struct tracing_map {
 	unsigned int			key_size;
 	unsigned int			map_bits;
 	unsigned int			map_size;
 	unsigned int			max_elts;
-	atomic_t			next_elt;
-	struct tracing_map_array	*elts;
-	struct tracing_map_array	*map;
+	bool				percpu;
+	unsigned int			n_tables;
+	struct tracing_map_table	**tables;
 	const struct tracing_map_ops	*ops;
 	void				*private_data;
 	struct tracing_map_field	fields[TRACING_MAP_FIELDS_MAX];
@@ -191,8 +209,6 @@ struct tracing_map {
 	int				key_idx[TRACING_MAP_KEYS_MAX];
 	unsigned int			n_keys;
 	struct tracing_map_sort_key	sort_key;
-	atomic64_t			hits;
-	atomic64_t			drops;
 };
 
 /**
@@ -242,6 +258,7 @@ struct tracing_map_ops {
 extern struct tracing_map *
 tracing_map_create(unsigned int map_bits,
 		   unsigned int key_size,
+		   bool percpu,
 		   const struct tracing_map_ops *ops,
 		   void *private_data);
 extern int tracing_map_init(struct tracing_map *map);
@@ -267,6 +284,9 @@ extern int tracing_map_cmp_none(void *val_a, void *val_b);
 extern void tracing_map_update_sum(struct tracing_map_elt *elt,
 				   unsigned int i, u64 n);
 extern u64 tracing_map_read_sum(struct tracing_map_elt *elt, unsigned int i);
+extern u64 tracing_map_read_hits(struct tracing_map *map);
+extern u64 tracing_map_read_drops(struct tracing_map *map);
+extern u64 tracing_map_read_cpu_drops(struct tracing_map *map, int cpu);
 extern void tracing_map_set_field_descr(struct tracing_map *map,
 					unsigned int i,
 					unsigned int key_offset,
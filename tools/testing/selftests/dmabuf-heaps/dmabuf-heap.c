@@ -0,0 +1,261 @@
+/*
+ * Functional test and allocation latency benchmark of the dma-buf heaps
+ * in /dev/dma_heap. Every heap found is checked for valid and invalid
+ * allocations, for handing out zeroed memory also when it recycles freed
+ * buffers, and then timed allocating and freeing buffers of a few sizes.
+ *
+ * Usage: dmabuf-heap [iterations]
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <linux/dma-heap.h>
+
+#include "../kselftest.h"
+
+#define DEVPATH "/dev/dma_heap"
+
+#define ITERATIONS	1000
+
+static const size_t bench_sizes[] = {
+	4096, 64 * 1024, 1024 * 1024, 8 * 1024 * 1024,
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int dmabuf_heap_open(const char *name)
+{
+	char buf[256];
+	int fd;
+
+	snprintf(buf, sizeof(buf), "%s/%s", DEVPATH, name);
+	fd = open(buf, O_RDWR);
+	if (fd < 0)
+		printf("%s: open %s failed: %s\n", name, buf, strerror(errno));
+	return fd;
+}
+
+static int dmabuf_heap_alloc_fdflags(int fd, size_t len, unsigned int fd_flags,
+				     unsigned int heap_flags, int *dmabuf_fd)
+{
+	struct dma_heap_allocation_data data = {
+		.len = len,
+		.fd = 0,
+		.fd_flags = fd_flags,
+		.heap_flags = heap_flags,
+	};
+	int ret;
+
+	if (!dmabuf_fd)
+		return -EINVAL;
+
+	ret = ioctl(fd, DMA_HEAP_IOCTL_ALLOC, &data);
+	if (ret < 0)
+		return -errno;
+	*dmabuf_fd = (int)data.fd;
+	return ret;
+}
+
+static int dmabuf_heap_alloc(int fd, size_t len, int *dmabuf_fd)
+{
+	return dmabuf_heap_alloc_fdflags(fd, len, O_RDWR | O_CLOEXEC, 0,
+					 dmabuf_fd);
+}
+
+static int test_alloc(const char *name, int heap_fd)
+{
+	const size_t len = 16 * 4096 + 4096;
+	int dmabuf_fd = -1;
+	unsigned char *p;
+	int ret;
+
+	ret = dmabuf_heap_alloc(heap_fd, len, &dmabuf_fd);
+	if (ret) {
+		printf("%s: allocation failed: %s\n", name, strerror(-ret));
+		return -1;
+	}
+
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, dmabuf_fd, 0);
+	if (p == MAP_FAILED) {
+		printf("%s: mmap failed: %s\n", name, strerror(errno));
+		close(dmabuf_fd);
+		return -1;
+	}
+	memset(p, 0xaa, len);
+	munmap(p, len);
+	close(dmabuf_fd);
+
+	return 0;
+}
+
+static int test_alloc_zeroed(const char *name, int heap_fd)
+{
+	const size_t len = 1024 * 1024;
+	int fds[8], i, j, ret = 0;
+	unsigned char *p;
+
+	/* dirty a few buffers, so that the next ones come from the pool */
+	for (i = 0; i < 8; i++) {
+		if (dmabuf_heap_alloc(heap_fd, len, &fds[i])) {
+			printf("%s: allocation failed\n", name);
+			for (j = 0; j < i; j++)
+				close(fds[j]);
+			return -1;
+		}
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 fds[i], 0);
+		if (p != MAP_FAILED) {
+			memset(p, 0xff, len);
+			munmap(p, len);
+		}
+	}
+	for (i = 0; i < 8; i++)
+		close(fds[i]);
+
+	for (i = 0; i < 8 && !ret; i++) {
+		if (dmabuf_heap_alloc(heap_fd, len, &fds[0])) {
+			printf("%s: allocation failed\n", name);
+			return -1;
+		}
+		p = mmap(NULL, len, PROT_READ, MAP_SHARED, fds[0], 0);
+		if (p == MAP_FAILED) {
+			printf("%s: mmap failed: %s\n", name, strerror(errno));
+			close(fds[0]);
+			return -1;
+		}
+		for (j = 0; j < len; j++) {
+			if (p[j]) {
+				printf("%s: byte %d of reused buffer not zeroed\n",
+				       name, j);
+				ret = -1;
+				break;
+			}
+		}
+		munmap(p, len);
+		close(fds[0]);
+	}
+
+	return ret;
+}
+
+static int test_alloc_invalid(const char *name, int heap_fd)
+{
+	int dmabuf_fd = -1;
+	int ret = 0;
+
+	if (dmabuf_heap_alloc_fdflags(heap_fd, 4096, ~0U, 0,
+				      &dmabuf_fd) != -EINVAL) {
+		printf("%s: invalid fd flags accepted\n", name);
+		ret = -1;
+	}
+	if (dmabuf_heap_alloc_fdflags(heap_fd, 4096, O_RDWR | O_CLOEXEC, ~0U,
+				      &dmabuf_fd) != -EINVAL) {
+		printf("%s: invalid heap flags accepted\n", name);
+		ret = -1;
+	}
+	if (dmabuf_heap_alloc(heap_fd, 0, &dmabuf_fd) != -EINVAL) {
+		printf("%s: zero sized allocation accepted\n", name);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/*
+ * Average latency of allocating and freeing a buffer, with the heap's
+ * pools first being filled by the loop itself and then warm.
+ */
+static int bench_alloc(const char *name, int heap_fd, int iterations)
+{
+	double start, cold, warm;
+	int dmabuf_fd;
+	unsigned int s;
+	int i;
+
+	for (s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+		size_t len = bench_sizes[s];
+
+		start = now_us();
+		if (dmabuf_heap_alloc(heap_fd, len, &dmabuf_fd))
+			return -1;
+		close(dmabuf_fd);
+		cold = now_us() - start;
+
+		start = now_us();
+		for (i = 0; i < iterations; i++) {
+			if (dmabuf_heap_alloc(heap_fd, len, &dmabuf_fd)) {
+				printf("%s: allocation of %zu bytes failed\n",
+				       name, len);
+				return -1;
+			}
+			close(dmabuf_fd);
+		}
+		warm = (now_us() - start) / iterations;
+
+		printf("%-8s %8zu bytes: first %10.1f us, average %10.1f us\n",
+		       name, len, cold, warm);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = ITERATIONS;
+	struct dirent *dir;
+	int heap_fd, ret = 0;
+	DIR *d;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	if (iterations < 1)
+		iterations = 1;
+
+	d = opendir(DEVPATH);
+	if (!d) {
+		printf("No %s directory?\n", DEVPATH);
+		return ksft_exit_skip();
+	}
+
+	while ((dir = readdir(d)) != NULL) {
+		if (!strncmp(dir->d_name, ".", 2))
+			continue;
+		if (!strncmp(dir->d_name, "..", 3))
+			continue;
+
+		heap_fd = dmabuf_heap_open(dir->d_name);
+		if (heap_fd < 0) {
+			ret = -1;
+			continue;
+		}
+
+		if (test_alloc(dir->d_name, heap_fd) ||
+		    test_alloc_zeroed(dir->d_name, heap_fd) ||
+		    test_alloc_invalid(dir->d_name, heap_fd) ||
+		    bench_alloc(dir->d_name, heap_fd, iterations))
+			ret = -1;
+
+		close(heap_fd);
+	}
+	closedir(d);
+
+	if (ret)
+		return ksft_exit_fail();
+	return ksft_exit_pass();
+}
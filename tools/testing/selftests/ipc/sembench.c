@@ -0,0 +1,144 @@
+/*
+ * Microbenchmark of uncontended semop(): every worker process takes and
+ * releases its own semaphore of a shared set, once with plain operations,
+ * which the kernel performs without queue handling, and once with
+ * SEM_UNDO, which goes through the generic path.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+
+#include "../kselftest.h"
+
+#define RUN_SECS	1
+#define BATCH		1000
+
+union semun {
+	int val;
+	struct semid_ds *buf;
+	unsigned short *array;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns the number of take/release pairs done, or -1 on error */
+static long worker(int semid, int num, short flg)
+{
+	struct sembuf down = { .sem_num = num, .sem_op = -1, .sem_flg = flg };
+	struct sembuf up = { .sem_num = num, .sem_op = 1, .sem_flg = flg };
+	double end = now() + RUN_SECS;
+	long ops = 0;
+	int i;
+
+	do {
+		for (i = 0; i < BATCH; i++) {
+			if (semop(semid, &down, 1) || semop(semid, &up, 1))
+				return -1;
+		}
+		ops += BATCH;
+	} while (now() < end);
+
+	return ops;
+}
+
+static int run(int semid, int nr_workers, short flg, const char *name)
+{
+	int pipefd[2];
+	long ops, total = 0;
+	int i, status, ret = 0;
+
+	if (pipe(pipefd)) {
+		printf("pipe failed: %s\n", strerror(errno));
+		return -1;
+	}
+	/* do not let the workers inherit buffered output */
+	fflush(stdout);
+
+	for (i = 0; i < nr_workers; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			printf("fork failed: %s\n", strerror(errno));
+			ret = -1;
+			break;
+		}
+		if (!pid) {
+			close(pipefd[0]);
+			ops = worker(semid, i, flg);
+			if (write(pipefd[1], &ops, sizeof(ops)) != sizeof(ops))
+				exit(1);
+			exit(0);
+		}
+	}
+	close(pipefd[1]);
+
+	while (read(pipefd[0], &ops, sizeof(ops)) == sizeof(ops)) {
+		if (ops < 0)
+			ret = -1;
+		else
+			total += ops;
+	}
+	close(pipefd[0]);
+
+	while (wait(&status) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = -1;
+	}
+
+	if (!ret)
+		printf("%-8s %2d workers: %10ld semop/s\n", name, nr_workers,
+		       2 * total / RUN_SECS);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int nr_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	union semun arg;
+	int semid, i, ret = 0;
+
+	if (argc > 1)
+		nr_workers = atoi(argv[1]);
+	if (nr_workers < 1)
+		nr_workers = 1;
+
+	semid = semget(IPC_PRIVATE, nr_workers, 0600 | IPC_CREAT);
+	if (semid < 0) {
+		printf("semget failed: %s\n", strerror(errno));
+		return ksft_exit_fail();
+	}
+
+	arg.val = 1;
+	for (i = 0; i < nr_workers; i++) {
+		if (semctl(semid, i, SETVAL, arg)) {
+			printf("semctl failed: %s\n", strerror(errno));
+			ret = -1;
+			goto out;
+		}
+	}
+
+	if (run(semid, 1, 0, "plain") || run(semid, 1, SEM_UNDO, "undo") ||
+	    run(semid, nr_workers, 0, "plain") ||
+	    run(semid, nr_workers, SEM_UNDO, "undo"))
+		ret = -1;
+
+out:
+	semctl(semid, 0, IPC_RMID);
+
+	if (ret)
+		return ksft_exit_fail();
+	return ksft_exit_pass();
+}